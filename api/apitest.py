@@ -282,6 +282,286 @@ class ApiTester(unittest.TestCase):
     self.assertTrue(secondParent['url'].endswith(
                       '/commits/f3768a6714e667205d68475df37a889abb59d2d5'))
 
+  def test_commits(self):
+    """Tests listing the commits in a repository a page at a time."""
+    r = requests.get(self.baseUri + '/commits',
+                     params={'sha': 'fbc9629e2f0cd31ab08638ebbd8f98a323329a5b',
+                             'per_page': 2, 'first_parent': 'true'})
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.headers['content-type'], self.jsonContentType)
+
+    commits = r.json()
+    self.assertIsInstance(commits, list)
+    self.assertEqual(len(commits), 2)
+
+    # The first commit is the one it started from and the second is its first
+    # parent.
+    self.assertEqual(commits[0]['sha'],
+                     'fbc9629e2f0cd31ab08638ebbd8f98a323329a5b')
+    self.assertEqual(commits[1]['sha'],
+                     '35b6f72feb998add040d95a9c89ff7ecd4d74901')
+    self.assertIn('author', commits[0])
+    self.assertIn('parents', commits[0])
+
+    # The next page carries on from the last commit of this one.
+    self.assertIn('next', r.links)
+    r = requests.get(r.links['next']['url'])
+    self.assertEqual(r.status_code, 200)
+
+    nextCommits = r.json()
+    self.assertEqual(len(nextCommits), 2)
+    self.assertEqual(nextCommits[0]['sha'],
+                     commits[1]['parents'][0]['sha'])
+
+  def test_commits_bad_page_size(self):
+    """Tests that a page size that is out of range is rejected."""
+    r = requests.get(self.baseUri + '/commits', params={'per_page': 0})
+    self.assertEqual(r.status_code, 422)
+
+  def test_commit_not_modified(self):
+    """Tests that a commit the client already has is not sent again."""
+    uri = self.baseUri + '/commits/fbc9629e2f0cd31ab08638ebbd8f98a323329a5b'
+    r = requests.get(uri)
+    self.assertEqual(r.status_code, 200)
+    if 'etag' not in r.headers:
+      self.skipTest('the server does not give entity tags (see --listen)')
+
+    r = requests.get(uri, headers={'If-None-Match': r.headers['etag']})
+    self.assertEqual(r.status_code, 304)
+    self.assertEqual(r.content, b'')
+
+    r = requests.get(uri, headers={'If-None-Match': '"something-else"'})
+    self.assertEqual(r.status_code, 200)
+
+    # A wildcard only matches an object that exists.
+    r = requests.get(uri, headers={'If-None-Match': '*'})
+    self.assertEqual(r.status_code, 304)
+
+    missing = self.baseUri + '/commits/' + '0' * 40
+    r = requests.get(missing, headers={'If-None-Match': '*'})
+    self.assertEqual(r.status_code, 404)
+
+  def test_stats(self):
+    """Tests that the requests made are counted against their route."""
+    r = requests.get(self.baseUri + '/commits')
+    self.assertEqual(r.status_code, 200)
+    if 'server-timing' in r.headers:
+      self.assertIn('total;dur=', r.headers['server-timing'])
+
+    r = requests.get(self.baseUri.split('/repos/')[0] + '/stats')
+    self.assertEqual(r.status_code, 200)
+    routes = dict((route['route'], route) for route in r.json()['routes'])
+    if not routes:
+      self.skipTest('the server does not keep statistics (see --listen)')
+
+    route = routes['/api/repos/{repo}/commits']
+    self.assertGreaterEqual(route['count'], 1)
+    self.assertEqual(sum(bucket['count'] for bucket in route['histogram']),
+                     route['count'])
+
+  def test_batch(self):
+    """Tests running several requests in one, which are given in order."""
+    apiUri = self.baseUri.split('/repos/')[0]
+    commit = '/api/repos/git/commits/fbc9629e2f0cd31ab08638ebbd8f98a323329a5b'
+    missing = '/api/repos/git/commits/' + '0' * 40
+    r = requests.get(apiUri + '/batch',
+                     params={'path': [commit, missing,
+                                      '/api/batch?path=' + commit,
+                                      '/api/repos/git/file/HEAD:README']})
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.headers['content-type'], self.jsonContentType)
+
+    results = r.json()
+    self.assertEqual(len(results), 4)
+    self.assertEqual([result['path'] for result in results][:2],
+                     [commit, missing])
+
+    self.assertEqual(results[0]['status'], 200)
+    self.assertEqual(results[0]['body']['sha'],
+                     'fbc9629e2f0cd31ab08638ebbd8f98a323329a5b')
+    self.assertEqual(results[1]['status'], 404)
+    self.assertIn('message', results[1]['body'])
+
+    # Neither another batch nor a raw file can be included.
+    self.assertEqual(results[2]['status'], 422)
+    self.assertEqual(results[3]['status'], 422)
+
+    # Another batch is found by its route, not by how its path is written.
+    r = requests.get(apiUri + '/batch',
+                     params={'path': '//api//batch?path=' + commit})
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.json()[0]['status'], 422)
+
+    r = requests.get(apiUri + '/batch')
+    self.assertEqual(r.status_code, 422)
+
+  def test_blame(self):
+    """Tests the blame of a file, which is given in hunks that cover it."""
+    sha = 'fbc9629e2f0cd31ab08638ebbd8f98a323329a5b'
+    r = requests.get(self.baseUri + '/blame/' + sha + '/Documentation/git.txt')
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.headers['content-type'], self.jsonContentType)
+
+    blame = r.json()
+    self.assertEqual(blame['sha'], sha)
+    self.assertEqual(blame['path'], 'Documentation/git.txt')
+
+    # The hunks follow on from each other and cover every line of the file.
+    r = requests.get(self.baseUri + '/file/' + sha + ':Documentation/git.txt')
+    self.assertEqual(r.status_code, 200)
+    lineCount = r.content.count(b'\n')
+
+    line = 1
+    for hunk in blame['hunks']:
+      self.assertEqual(hunk['start_line'], line)
+      self.assertGreater(hunk['lines'], 0)
+      self.assertEqual(len(hunk['commit']['sha']), 40)
+      self.assertIn('author', hunk)
+      line += hunk['lines']
+    self.assertEqual(line - 1, lineCount)
+
+    # A revision that isn't a full SHA is resolved to the commit.
+    r = requests.get(self.baseUri + '/blame/' + sha + '~1/Documentation/' +
+                     'git.txt')
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.json()['sha'],
+                     '35b6f72feb998add040d95a9c89ff7ecd4d74901')
+    self.assertGreater(len(r.json()['hunks']), 0)
+
+    r = requests.get(self.baseUri + '/blame/' + sha + '/no-such-file')
+    self.assertEqual(r.status_code, 404)
+
+  def test_commit_files(self):
+    """Tests the files changed by a commit, which are only given on request."""
+    uri = self.baseUri + '/commits/fbc9629e2f0cd31ab08638ebbd8f98a323329a5b'
+    r = requests.get(uri)
+    self.assertEqual(r.status_code, 200)
+    self.assertNotIn('files', r.json())
+    self.assertNotIn('stats', r.json())
+
+    r = requests.get(uri, params={'files': 'true'})
+    self.assertEqual(r.status_code, 200)
+    commit = r.json()
+
+    # The files are those changed compared to the first parent, and the stats
+    # add up the lines changed in each.
+    files = commit['files']
+    self.assertGreater(len(files), 0)
+    stats = commit['stats']
+    self.assertEqual(stats['additions'],
+                     sum(file['additions'] for file in files))
+    self.assertEqual(stats['deletions'],
+                     sum(file['deletions'] for file in files))
+    self.assertEqual(stats['total'], stats['additions'] + stats['deletions'])
+
+    for file in files:
+      self.assertIn(file['status'], ('added', 'removed', 'modified',
+                                     'renamed', 'copied', 'changed'))
+      self.assertEqual(len(file['sha']), 40)
+      self.assertEqual(file['changes'], file['additions'] + file['deletions'])
+      if 'patch' in file:
+        self.assertTrue(file['patch'].startswith('@@ '))
+        self.assertEqual(file['patch'].count('\n+'), file['additions'])
+
+    # The diff is kept, so asking again gives the same files.
+    r = requests.get(uri, params={'files': 'true'})
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.json()['files'], files)
+
+  def test_compare(self):
+    """Tests comparing a commit against one of its ancestors both ways."""
+    base = '35b6f72feb998add040d95a9c89ff7ecd4d74901'
+    head = 'fbc9629e2f0cd31ab08638ebbd8f98a323329a5b'
+    r = requests.get(self.baseUri + '/compare/' + base + '...' + head)
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.headers['content-type'], self.jsonContentType)
+
+    comparison = r.json()
+    self.assertEqual(comparison['status'], 'ahead')
+    self.assertEqual(comparison['behind_by'], 0)
+    self.assertGreater(comparison['ahead_by'], 0)
+    self.assertEqual(comparison['total_commits'], comparison['ahead_by'])
+    self.assertEqual(comparison['base_commit']['sha'], base)
+    self.assertEqual(comparison['merge_base_commit']['sha'], base)
+
+    # The parents come before their children, so the head is last.
+    commits = comparison['commits']
+    self.assertEqual(len(commits), min(comparison['ahead_by'], 250))
+    self.assertEqual(commits[-1]['sha'], head)
+
+    # Only the stats of the files are given, not their patches.
+    self.assertGreater(len(comparison['files']), 0)
+    for file in comparison['files']:
+      self.assertNotIn('patch', file)
+
+    r = requests.get(self.baseUri + '/compare/' + head + '...' + base)
+    self.assertEqual(r.status_code, 200)
+    reverse = r.json()
+    self.assertEqual(reverse['status'], 'behind')
+    self.assertEqual(reverse['ahead_by'], 0)
+    self.assertEqual(reverse['behind_by'], comparison['ahead_by'])
+    self.assertEqual(reverse['files'], [])
+
+    r = requests.get(self.baseUri + '/compare/' + base + '...' + base)
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.json()['status'], 'identical')
+
+  def test_commits_path(self):
+    """Tests listing only the commits that changed a file or directory."""
+    start = 'fbc9629e2f0cd31ab08638ebbd8f98a323329a5b'
+
+    def changed(sha, path):
+      """Returns true if the commit changed the path from its first parent."""
+      r = requests.get(self.baseUri + '/commits/' + sha,
+                       params={'files': 'true'})
+      self.assertEqual(r.status_code, 200)
+      return any(file['filename'] == path or
+                 file['filename'].startswith(path + '/')
+                 for file in r.json()['files'])
+
+    for firstParent in ('false', 'true'):
+      for path in ('README', 'Documentation'):
+        r = requests.get(self.baseUri + '/commits',
+                         params={'sha': start, 'path': path, 'per_page': 3,
+                                 'first_parent': firstParent})
+        self.assertEqual(r.status_code, 200)
+
+        commits = r.json()
+        self.assertEqual(len(commits), 3)
+        for commit in commits:
+          self.assertTrue(changed(commit['sha'], path))
+
+        # The next page is of the same path.
+        self.assertIn('next', r.links)
+        self.assertIn('path=' + path, r.links['next']['url'])
+        r = requests.get(r.links['next']['url'])
+        self.assertEqual(r.status_code, 200)
+        nextCommits = r.json()
+        self.assertGreater(len(nextCommits), 0)
+        self.assertNotIn(nextCommits[0]['sha'],
+                         [commit['sha'] for commit in commits])
+
+    # The path is encoded in the next link, and the slash at the end of a
+    # directory makes no difference.
+    r = requests.get(self.baseUri + '/commits',
+                     params={'sha': start, 'path': 'Documentation/',
+                             'per_page': 3})
+    self.assertEqual(r.status_code, 200)
+    self.assertIn('path=Documentation%2F', r.links['next']['url'])
+    withSlash = r.json()
+    r = requests.get(self.baseUri + '/commits',
+                     params={'sha': start, 'path': 'Documentation',
+                             'per_page': 3})
+    self.assertEqual(r.json(), withSlash)
+
+    r = requests.get(self.baseUri + '/commits',
+                     params={'sha': start, 'path': 'no such&file'})
+    self.assertEqual(r.status_code, 200)
+    self.assertEqual(r.json(), [])
+
+    r = requests.get(self.baseUri + '/commits', params={'path': '/'})
+    self.assertEqual(r.status_code, 422)
+
 
 class ServiceWalker(unittest.TestCase):
   """
@@ -0,0 +1,318 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Base64
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "base64.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  const static char Base64Lookup[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  const char padCharacter('=');
+
+  // The number of input bytes that make up one line of 60 characters.
+  const std::size_t lineInput = 45;
+  const std::size_t lineOutput = 60;
+
+  // The data is encoded this many lines at a time.
+  const std::size_t chunkLines = 64;
+
+  // Encodes the groups of 3 bytes in [input, input + groups * 3) as 4
+  // characters each. This returns the number of groups it encoded, which may
+  // be less than all of them for the vectorised versions which leave the end
+  // for the scalar version.
+  typedef std::size_t (*EncodeFunction)(const unsigned char* input,
+                                        std::size_t groups,
+                                        char* output);
+
+  std::size_t encode_scalar(
+    const unsigned char* input, std::size_t groups, char* output)
+  {
+    for (std::size_t group = 0; group < groups; ++group)
+    {
+      const unsigned long temp =
+        (static_cast<unsigned long>(input[0]) << 16) |
+        (static_cast<unsigned long>(input[1]) << 8) |
+        (static_cast<unsigned long>(input[2]));
+      output[0] = Base64Lookup[(temp & 0x00FC0000) >> 18];
+      output[1] = Base64Lookup[(temp & 0x0003F000) >> 12];
+      output[2] = Base64Lookup[(temp & 0x00000FC0) >> 6 ];
+      output[3] = Base64Lookup[(temp & 0x0000003F)      ];
+      input += 3;
+      output += 4;
+    }
+    return groups;
+  }
+
+#ifdef SIMD_X86
+
+  // The vectorised versions are based on the approach described by Wojciech
+  // Muła in "Base64 encoding with SIMD instructions". The 3 bytes of each
+  // group are spread out over a 32-bit lane, the four 6-bit indices are
+  // shifted into their own bytes with multiplies and then the indices are
+  // turned into characters by adding an offset that depends on which range
+  // (A-Z, a-z, 0-9, + or /) the index is in.
+
+  SIMD_TARGET("ssse3")
+  inline __m128i encode_block(__m128i input)
+  {
+    input = _mm_shuffle_epi8(
+      input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    const __m128i t0 = _mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(input, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i isUpper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(isUpper, _mm_set1_epi8(13)));
+
+    const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+  }
+
+  SIMD_TARGET("ssse3")
+  std::size_t encode_ssse3(
+    const unsigned char* input, std::size_t groups, char* output)
+  {
+    // Each iteration encodes 4 groups (12 bytes) but loads 16 bytes so it
+    // must stop before it would read past the end.
+    std::size_t group = 0;
+    for (; group + 6 <= groups; group += 4)
+    {
+      const __m128i block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(input + group * 3));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + group * 4),
+                       encode_block(block));
+    }
+    return group;
+  }
+
+  SIMD_TARGET("avx2")
+  inline __m256i encode_block(__m256i input)
+  {
+    input = _mm256_shuffle_epi8(
+      input, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                             10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    const __m256i t0 = _mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i isUpper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range,
+                            _mm256_and_si256(isUpper, _mm256_set1_epi8(13)));
+
+    const __m256i offsets = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+  }
+
+  SIMD_TARGET("avx2")
+  std::size_t encode_avx2(
+    const unsigned char* input, std::size_t groups, char* output)
+  {
+    // Each iteration encodes 8 groups (24 bytes), as two halves of 12 bytes
+    // which are loaded 16 bytes at a time.
+    std::size_t group = 0;
+    for (; group + 10 <= groups; group += 8)
+    {
+      const unsigned char* const block = input + group * 3;
+      const __m256i halves = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(block))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 12)),
+        1);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + group * 4),
+                          encode_block(halves));
+    }
+    return group + encode_ssse3(input + group * 3, groups - group,
+                                output + group * 4);
+  }
+
+#endif
+
+  EncodeFunction choose_encoder()
+  {
+#ifdef SIMD_X86
+    if (simd::HasAvx2()) return encode_avx2;
+    if (simd::HasSsse3()) return encode_ssse3;
+#endif
+    return encode_scalar;
+  }
+
+  // Base64 encodes the data and calls write with the encoded text a chunk at
+  // a time.
+  template<typename Writer>
+  void encode(const void* content, std::size_t size, bool newLines,
+              Writer write)
+  {
+    static const EncodeFunction encodeGroups = choose_encoder();
+
+    char encoded[chunkLines * lineOutput];
+    char lines[chunkLines * (lineOutput + 2)];
+
+    const unsigned char* cursor = static_cast<const unsigned char*>(content);
+    while (size >= 3)
+    {
+      // Every chunk but the last is a whole number of lines, so the lines
+      // are not split across chunks.
+      const std::size_t chunkSize =
+        std::min(size - size % 3, chunkLines * lineInput);
+      const std::size_t groups = chunkSize / 3;
+
+      const std::size_t done = encodeGroups(cursor, groups, encoded);
+      encode_scalar(cursor + done * 3, groups - done, encoded + done * 4);
+
+      if (newLines)
+      {
+        char* line = lines;
+        for (std::size_t start = 0; start < groups * 4; start += lineOutput)
+        {
+          const std::size_t length = std::min(lineOutput, groups * 4 - start);
+          std::memcpy(line, encoded + start, length);
+          line += length;
+          if (length == lineOutput)
+          {
+            *line++ = '\\';
+            *line++ = 'n';
+          }
+        }
+        write(lines, static_cast<std::size_t>(line - lines));
+      }
+      else
+      {
+        write(encoded, groups * 4);
+      }
+
+      cursor += chunkSize;
+      size -= chunkSize;
+    }
+
+    char tail[4];
+    switch (size)
+    {
+    case 1:
+      tail[0] = Base64Lookup[cursor[0] >> 2];
+      tail[1] = Base64Lookup[(cursor[0] & 0x03) << 4];
+      tail[2] = padCharacter;
+      tail[3] = padCharacter;
+      write(tail, 4);
+      break;
+    case 2:
+      tail[0] = Base64Lookup[cursor[0] >> 2];
+      tail[1] = Base64Lookup[((cursor[0] & 0x03) << 4) | (cursor[1] >> 4)];
+      tail[2] = Base64Lookup[(cursor[1] & 0x0F) << 2];
+      tail[3] = padCharacter;
+      write(tail, 4);
+      break;
+    }
+  }
+}
+
+void util::Base64Encode(
+  const void * Content,
+  std::size_t Size,
+  bool NewLines,
+  OutputSink& Output)
+{
+  encode(Content, Size, NewLines,
+         [&Output](const char* text, std::size_t length)
+         {
+           Output.Write(text, length);
+         });
+}
+
+std::string util::Base64Encode(
+  const void * Content,
+  std::size_t Size,
+  bool NewLines)
+{
+  // Determine how big the output string will need to be.
+  std::size_t encodedSize = ((Size / 3) + (Size % 3 > 0)) * 4;
+  if (NewLines) encodedSize += encodedSize / 60 * 2;
+
+  std::string encodedString;
+  encodedString.reserve(encodedSize);
+  encode(Content, Size, NewLines,
+         [&encodedString](const char* text, std::size_t length)
+         {
+           encodedString.append(text, length);
+         });
+  return encodedString;
+}
+
+#ifdef BASE64_ENABLE_TESTING
+
+#include <cstdio>
+#include <cstdlib>
+
+// Compares the vectorised versions with the scalar one for every length up
+// to a few chunks.
+int main()
+{
+  std::string data;
+  std::srand(1);
+  for (int i = 0; i < 3 * 64 * 45 + 100; ++i)
+  {
+    data.push_back(static_cast<char>(std::rand() & 0xFF));
+  }
+
+  for (std::size_t size = 0; size <= data.size(); ++size)
+  {
+    const std::size_t groups = size / 3;
+    std::string expected(groups * 4, ' ');
+    encode_scalar(reinterpret_cast<const unsigned char*>(data.data()), groups,
+                  &expected[0]);
+
+    const EncodeFunction encoders[] = {
+#ifdef SIMD_X86
+      simd::HasSsse3() ? encode_ssse3 : encode_scalar,
+      simd::HasAvx2() ? encode_avx2 : encode_scalar,
+#endif
+      encode_scalar,
+    };
+    for (std::size_t i = 0; i < sizeof(encoders) / sizeof(*encoders); ++i)
+    {
+      std::string actual(groups * 4, ' ');
+      const std::size_t done = encoders[i](
+        reinterpret_cast<const unsigned char*>(data.data()), groups,
+        &actual[0]);
+      encode_scalar(
+        reinterpret_cast<const unsigned char*>(data.data()) + done * 3,
+        groups - done, &actual[done * 4]);
+      if (actual != expected)
+      {
+        printf("Encoder %d differs for %d bytes\n", static_cast<int>(i),
+               static_cast<int>(size));
+        return 1;
+      }
+    }
+  }
+
+  puts(util::Base64Encode("Man is distinguished", 20, true).c_str());
+  puts(util::Base64Encode(data.data(), 100, true).c_str());
+  return 0;
+}
+#endif
+
+//===--------------------------- End of the file --------------------------===//
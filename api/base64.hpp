@@ -0,0 +1,38 @@
+#ifndef BASE64_HPP_
+#define BASE64_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Base64
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Base64 encodes data for including it in a JSON string.
+//
+// The encoding is done in chunks using SSSE3 or AVX2 when the processor
+// supports it and the chunks are written out as they are encoded, so the
+// encoded form of a large blob is never held in memory.
+//
+//===----------------------------------------------------------------------===//
+
+#include "sink.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace util
+{
+  // Base64 encode the data from Content to Content + Size and write it to
+  // Output. If NewLines is true then an escaped new line ("\\n") is inserted
+  // every 60 characters, as the result is intended to be put in a JSON string.
+  void Base64Encode(const void * Content, std::size_t Size, bool NewLines,
+                    OutputSink& Output);
+
+  // Base64 encode the data from Content to Content + Size and insert new lines
+  // every 60 characters.
+  std::string
+  Base64Encode(const void * Content, std::size_t Size, bool NewLines);
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,515 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : bench
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Microbenchmarks for the paths taken by every response: writing JSON,
+// escaping strings, routing, Base64 encoding and the commit, tree and refs
+// handlers run against a synthetic repository which is the same every time.
+//
+// Each benchmark is reported as a line of JSON on standard output with the
+// time taken, the bytes allocated and the number of allocations for each
+// operation, so the results can be compared between builds:
+//   {"name": "router", "iterations": 4194304, "ns_per_op": 105.3,
+//    "bytes_per_op": 0.0, "allocs_per_op": 0.000}
+//
+// Before the handlers are measured, the comparisons of the commits are checked
+// to be the same with and without a commit-graph file, written into the
+// synthetic repository by git (check_commit_graph). The exit status is 1 if
+// they differ.
+//
+// Usage:
+//   make bench
+//   ./gitjson-bench [name]
+//
+// Only the benchmarks whose name contains the given name are run.
+//
+//===----------------------------------------------------------------------===//
+
+#include "base64.hpp"
+#include "jsonwriter.hpp"
+#include "repository.hpp"
+#include "request.hpp"
+#include "router.hpp"
+#include "sink.hpp"
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+// The handlers from gitjson.cpp, which is built without its main for this.
+void repository_information(const Router::Arguments& arguments);
+void repository_refs(const Router::Arguments& arguments);
+void repository_commit(const Router::Arguments& arguments);
+void repository_tree(const Router::Arguments& arguments);
+void repository_compare(const Router::Arguments& arguments);
+
+// The allocations made by every thread, which are counted by replacing the
+// global operator new.
+static std::atomic<std::uint64_t> allocationCount(0);
+static std::atomic<std::uint64_t> allocationBytes(0);
+
+void* operator new(std::size_t size)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocationBytes.fetch_add(size, std::memory_order_relaxed);
+  if (void* memory = std::malloc(size ? size : 1)) return memory;
+  throw std::bad_alloc();
+}
+
+// The deletes are kept out of line so the compiler doesn't see memory from
+// new being given to free().
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* memory) noexcept
+{
+  std::free(memory);
+}
+
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* memory, std::size_t) noexcept
+{
+  std::free(memory);
+}
+
+// How long each benchmark is run for, at least.
+static const std::chrono::milliseconds minimumDuration(500);
+
+// Runs the operation enough times to take at least the minimum duration and
+// reports the average cost of each run.
+static void measure(const char* name, const char* filter,
+                    const std::function<void()>& operation)
+{
+  if (filter && !std::strstr(name, filter)) return;
+
+  // Warms up the caches and anything set up on first use.
+  operation();
+
+  for (std::uint64_t iterations = 1;; iterations *= 2)
+  {
+    const std::uint64_t countBefore = allocationCount;
+    const std::uint64_t bytesBefore = allocationBytes;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t i = 0; i < iterations; ++i) operation();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if (elapsed < minimumDuration) continue;
+
+    const double count = static_cast<double>(iterations);
+    std::printf(
+      "{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, "
+      "\"bytes_per_op\": %.1f, \"allocs_per_op\": %.3f}\n",
+      name, static_cast<unsigned long long>(iterations),
+      std::chrono::duration<double, std::nano>(elapsed).count() / count,
+      (allocationBytes - bytesBefore) / count,
+      (allocationCount - countBefore) / count);
+    std::fflush(stdout);
+    return;
+  }
+}
+
+static void check(int error, const char* what)
+{
+  if (error == 0) return;
+
+  const git_error* lastError = giterr_last();
+  throw std::runtime_error(std::string(what) + ": " +
+                           (lastError && lastError->message ?
+                            lastError->message : "cause unknown."));
+}
+
+// Creates a repository with 256 commits, each changing one of the 128 files
+// spread over 8 directories, with a branch and an annotated tag for every
+// 16th commit. The times are fixed so the objects are the same every time.
+//
+// Returns the SHA of the last commit.
+static std::string create_repository(const std::string& path)
+{
+  const int directoryCount = 8;
+  const int fileCount = 16;
+  const int commitCount = 256;
+  const git_time_t firstTime = 1388534400; // 2014-01-01T00:00:00Z
+
+  git_repository* repository = nullptr;
+  check(git_repository_init(&repository, path.c_str(), 1), "init");
+  struct Close
+  {
+    git_repository* repository;
+    ~Close() { git_repository_free(repository); }
+  } closeOnScopeExit = { repository };
+  check(git_repository_set_head(repository, "refs/heads/master"), "head");
+
+  // Each file starts with the same content and has a line added each time it
+  // is changed.
+  std::vector<std::string> contents(directoryCount * fileCount);
+  std::vector<git_oid> blobs(contents.size());
+  for (std::size_t i = 0; i < contents.size(); ++i)
+  {
+    contents[i] = "Line 1 of file " + std::to_string(i) + "\n";
+    check(git_blob_create_frombuffer(&blobs[i], repository, contents[i].data(),
+                                     contents[i].size()), "blob");
+  }
+
+  git_oid parent;
+  for (int c = 0; c < commitCount; ++c)
+  {
+    const std::size_t changed = (c * 37) % contents.size();
+    contents[changed] += "Line changed by commit " + std::to_string(c) + "\n";
+    check(git_blob_create_frombuffer(&blobs[changed], repository,
+                                     contents[changed].data(),
+                                     contents[changed].size()), "blob");
+
+    git_treebuilder* root = nullptr;
+    check(git_treebuilder_new(&root, repository, nullptr), "tree");
+    for (int d = 0; d < directoryCount; ++d)
+    {
+      git_treebuilder* directory = nullptr;
+      check(git_treebuilder_new(&directory, repository, nullptr), "tree");
+      for (int f = 0; f < fileCount; ++f)
+      {
+        const std::string name = "file" + std::to_string(f) + ".txt";
+        check(git_treebuilder_insert(nullptr, directory, name.c_str(),
+                                     &blobs[d * fileCount + f],
+                                     GIT_FILEMODE_BLOB), "tree");
+      }
+      git_oid directoryId;
+      check(git_treebuilder_write(&directoryId, directory), "tree");
+      git_treebuilder_free(directory);
+
+      const std::string name = "directory" + std::to_string(d);
+      check(git_treebuilder_insert(nullptr, root, name.c_str(), &directoryId,
+                                   GIT_FILEMODE_TREE), "tree");
+    }
+    git_oid treeId;
+    check(git_treebuilder_write(&treeId, root), "tree");
+    git_treebuilder_free(root);
+
+    git_tree* tree = nullptr;
+    check(git_tree_lookup(&tree, repository, &treeId), "tree");
+    git_commit* parentCommit = nullptr;
+    if (c > 0) check(git_commit_lookup(&parentCommit, repository, &parent),
+                     "commit");
+
+    git_signature* signature = nullptr;
+    check(git_signature_new(&signature, "Bench Mark", "bench@example.com",
+                            firstTime + c * 3600, 0), "signature");
+
+    const std::string message = "Change file " + std::to_string(changed) +
+      "\n\nThis is commit " + std::to_string(c) + " of the benchmark.\n";
+    const git_commit* parents[] = { parentCommit };
+    const int error = git_commit_create(
+      &parent, repository, nullptr, signature, signature, nullptr,
+      message.c_str(), tree, c > 0 ? 1 : 0, parents);
+    git_commit_free(parentCommit);
+    git_tree_free(tree);
+    check(error, "commit");
+
+    // The references are replaced if they are already there, from an earlier
+    // run, as they will be given the same commits.
+    if (c % 16 == 15)
+    {
+      git_reference* branch = nullptr;
+      const std::string suffix = std::to_string(c / 16);
+      check(git_reference_create(&branch, repository,
+                                 ("refs/heads/branch" + suffix).c_str(),
+                                 &parent, 1, nullptr), "branch");
+      git_reference_free(branch);
+
+      git_object* target = nullptr;
+      check(git_object_lookup(&target, repository, &parent, GIT_OBJ_COMMIT),
+            "tag");
+      git_oid tag;
+      check(git_tag_create(&tag, repository, ("v1." + suffix).c_str(), target,
+                           signature, "Release\n", 1), "tag");
+      git_object_free(target);
+    }
+    git_signature_free(signature);
+  }
+
+  git_reference* master = nullptr;
+  check(git_reference_create(&master, repository, "refs/heads/master",
+                             &parent, 1, nullptr), "branch");
+  git_reference_free(master);
+
+  char sha[GIT_OID_HEXSZ + 1];
+  return git_oid_tostr(sha, sizeof(sha), &parent);
+}
+
+static void ignore() {}
+static void ignore_arguments(const Router::Arguments&) {}
+
+// Runs the handler for the path in the same way as for a request, writing
+// the response to the output.
+static void request(const Router& router, const std::string& path,
+                    BufferSink* output)
+{
+  output->Clear();
+  RequestContext context(path, output);
+  if (!router(context.Path(), '/') || context.Status() != 200)
+  {
+    throw std::runtime_error("Could not get " + path + ": " +
+                             context.ErrorMessage());
+  }
+}
+
+// Checks that comparing the commits gives the same response with and without
+// a commit-graph file, which is written into the repository by git. Without
+// the file the generations of the commits are worked out instead.
+//
+// Returns false if the responses differ.
+static bool check_commit_graph(const Router& router, const std::string& path)
+{
+  const char* comparisons[] = {
+    "branch1...master",
+    "master...branch3",
+    "branch4...branch12",
+    "v1.2...branch9",
+  };
+  const std::size_t count = sizeof(comparisons) / sizeof(comparisons[0]);
+
+  BufferSink output;
+  std::vector<std::string> withoutGraph;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    request(router, std::string("/api/repos/bench/compare/") + comparisons[i],
+            &output);
+    withoutGraph.push_back(output.Take());
+  }
+
+  const std::string command = "git --git-dir '" + path +
+    "' commit-graph write --reachable > /dev/null 2>&1";
+  if (std::system(command.c_str()) != 0)
+  {
+    std::fprintf(stderr, "Skipped the commit-graph comparison: git could not "
+                 "write the commit-graph file\n");
+    return true;
+  }
+
+  bool isSame = true;
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    request(router, std::string("/api/repos/bench/compare/") + comparisons[i],
+            &output);
+    if (output.Take() != withoutGraph[i])
+    {
+      std::fprintf(stderr, "Error: the comparison %s differs with a "
+                   "commit-graph file\n", comparisons[i]);
+      isSame = false;
+    }
+  }
+  return isSame;
+}
+
+// Returns false if a check of the responses failed.
+static bool benchmark_handlers(const char* filter)
+{
+#ifndef _WIN32
+  // The synthetic repository is created in a directory of its own, which is
+  // removed after everything in it has been closed.
+  char directory[] = "/tmp/gitjson-bench.XXXXXX";
+  if (!mkdtemp(directory))
+  {
+    throw std::runtime_error("Could not create a directory for the benchmark");
+  }
+  struct Remove
+  {
+    const char* directory;
+    ~Remove() { std::filesystem::remove_all(directory); }
+  } removeOnScopeExit = { directory };
+  git::RepositoriesPath(directory);
+#endif
+
+  const std::string sha =
+    create_repository(git::RepositoriesPath() + "/bench");
+
+  git::Repository repository("bench");
+  git_commit* commit = nullptr;
+  git_oid id;
+  git_oid_fromstr(&id, sha.c_str());
+  check(git_commit_lookup(&commit, repository, &id), "commit");
+  char tree[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(tree, sizeof(tree), git_commit_tree_id(commit));
+  git_commit_free(commit);
+
+  // The placeholder for the repository needs a function of its own for the
+  // routes after it to be found.
+  Router router;
+  router["api"]["repos"][Router::placeholder] = repository_information;
+  router["api"]["repos"][Router::placeholder]["refs"] = repository_refs;
+  router["api"]["repos"][Router::placeholder]["commits"][Router::placeholder] =
+    repository_commit;
+  router["api"]["repos"][Router::placeholder]["trees"][Router::placeholder] =
+    repository_tree;
+  router["api"]["repos"][Router::placeholder]["compare"][
+    Router::placeholder_remaining] = repository_compare;
+  router.Compile();
+
+  // This is done before there is a cache, so each request works out the
+  // generations afresh rather than remembering them from the last.
+  const char* const checkName = "check_commit_graph";
+  const bool isCorrect = filter && !std::strstr(checkName, filter) ? true :
+    check_commit_graph(router, git::RepositoriesPath() + "/bench");
+
+  git::RepositoryCache cache(1);
+  BufferSink output;
+  const std::string commitPath = "/api/repos/bench/commits/" + sha;
+  const std::string treePath = "/api/repos/bench/trees/" + std::string(tree);
+  const std::string recursiveTreePath = treePath + "?recursive=1";
+  const std::string refsPath = "/api/repos/bench/refs";
+  const std::string comparePath = "/api/repos/bench/compare/branch1...master";
+
+  measure("handler_commit", filter,
+          [&] { request(router, commitPath, &output); });
+  measure("handler_tree", filter,
+          [&] { request(router, treePath, &output); });
+  measure("handler_tree_recursive", filter,
+          [&] { request(router, recursiveTreePath, &output); });
+  measure("handler_refs", filter,
+          [&] { request(router, refsPath, &output); });
+  measure("handler_compare", filter,
+          [&] { request(router, comparePath, &output); });
+  return isCorrect;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* filter = argc > 1 ? argv[1] : nullptr;
+
+  BufferSink output;
+
+  measure("json_object", filter, [&output] {
+    output.Clear();
+    JsonWriterObject object(&output);
+    object["sha"] = "7f4837766f5bf8bd1d008ac38470a53f34b4f910";
+    object["url"] = "/api/repos/gitweb/commits/"
+      "7f4837766f5bf8bd1d008ac38470a53f34b4f910";
+    {
+      auto author = object["author"].object();
+      author["name"] = "Sean Donnellan";
+      author["email"] = "darkdonno@gmail.com";
+      author["date"] = "2014-01-01T00:00:00Z";
+    }
+    object["message"] = "Add a benchmark.\n\nIt measures the \"hot\" paths.";
+    object["size"] = 1024u;
+    object["truncated"] = false;
+  });
+
+  measure("json_array", filter, [&output] {
+    output.Clear();
+    JsonWriterArray array(&output);
+    for (int i = 0; i < 100; ++i)
+    {
+      array << "refs/heads/master";
+    }
+  });
+
+  std::string text;
+  for (int i = 0; i < 32; ++i)
+  {
+    text += "A line of a commit message with a \"quote\", a\ttab and C:\\.\n";
+  }
+
+  measure("json_escape", filter, [&output, &text] {
+    output.Clear();
+    JsonWriter::escape(text.data(), text.size(), &output);
+  });
+
+  measure("json_escape_string", filter, [&text] {
+    JsonWriter::escape(text.c_str());
+  });
+
+  {
+    // The same routes as gitjson, going to functions which do nothing.
+    Router router;
+    router["api"] = ignore;
+    router["api"]["repos"] = ignore;
+    router["api"]["repos"][Router::placeholder] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["refs"] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["refs"][
+      Router::placeholder_remaining] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["branches"] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["branches"][
+      Router::placeholder] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["tags"] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["tags"][Router::placeholder] =
+      ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["commits"] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["commits"][
+      Router::placeholder] = ignore_arguments;
+    router["api"]["repos"][Router::placeholder]["trees"][Router::placeholder] =
+      ignore_arguments;
+    router.Compile();
+
+    const char* paths[] = {
+      "/api/repos",
+      "/api/repos/gitweb",
+      "/api/repos/gitweb/refs/heads/master",
+      "/api/repos/gitweb/branches/master",
+      "/api/repos/gitweb/commits",
+      "/api/repos/gitweb/commits/7f4837766f5bf8bd1d008ac38470a53f34b4f910",
+      "/api/repos/gitweb/trees/7f4837766f5bf8bd1d008ac38470a53f34b4f910",
+      "/api/repos/gitweb/unknown/path",
+    };
+    std::size_t next = 0;
+    measure("router", filter, [&router, &paths, &next] {
+      router(paths[next++ % (sizeof(paths) / sizeof(paths[0]))]);
+    });
+  }
+
+  std::vector<unsigned char> data(64 * 1024);
+  for (std::size_t i = 0; i < data.size(); ++i)
+  {
+    data[i] = static_cast<unsigned char>(i * 7919 >> 3);
+  }
+
+  measure("base64_64k", filter, [&output, &data] {
+    output.Clear();
+    util::Base64Encode(data.data(), data.size(), true, output);
+  });
+
+  measure("base64_1k", filter, [&output, &data] {
+    output.Clear();
+    util::Base64Encode(data.data(), 1024, true, output);
+  });
+
+  bool isCorrect = true;
+  git_libgit2_init();
+  {
+    ThreadPool threadPool;
+    try
+    {
+      isCorrect = benchmark_handlers(filter);
+    }
+    catch (const std::exception& error)
+    {
+      std::fprintf(stderr, "Skipped the handlers: %s\n", error.what());
+    }
+  }
+  git_libgit2_shutdown();
+
+  return isCorrect ? 0 : 1;
+}
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,333 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Blame
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "blame.hpp"
+
+#include "repository.hpp"
+#include "request.hpp"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+static git::BlameCache* currentCache = nullptr;
+
+// Returns the key of the blame of the file in the repository, which is the
+// blob at the path in the commit.
+static std::string key_of(const git::Repository& repository,
+                          const git_oid* commit, const git_oid* blob,
+                          const std::string& path)
+{
+  return repository.Name() + '\0' + git::HexOf(commit) + git::HexOf(blob) + path;
+}
+
+// Finds the blob at the path in the commit, returning false if there isn't
+// one.
+static bool find_blob(const git_commit* commit, const std::string& path,
+                      git_oid* id)
+{
+  git_tree* tree = nullptr;
+  if (git_commit_tree(&tree, commit) != 0) return false;
+
+  git_tree_entry* entry = nullptr;
+  const bool isFound =
+    git_tree_entry_bypath(&entry, tree, path.c_str()) == 0 &&
+    git_tree_entry_type(entry) == GIT_OBJ_BLOB;
+  if (isFound) git_oid_cpy(id, git_tree_entry_id(entry));
+
+  git_tree_entry_free(entry);
+  git_tree_free(tree);
+  return isFound;
+}
+
+// Works out the blame from the history with libgit2.
+static std::shared_ptr<const git::Blame> blame_history(
+  git::Repository& repository, const git_commit* commit,
+  const std::string& path)
+{
+  git_blame_options options;
+  git_blame_init_options(&options, GIT_BLAME_OPTIONS_VERSION);
+  git_oid_cpy(&options.newest_commit, git_commit_id(commit));
+
+  git_blame* blame = nullptr;
+  if (git_blame_file(&blame, repository, path.c_str(), &options) != 0)
+  {
+    const git_error* lastError = giterr_last();
+    throw git::Error(std::string("Could not blame the file: ") +
+                     (lastError && lastError->message ?
+                      lastError->message : "cause unknown."));
+  }
+
+  auto result = std::make_shared<git::Blame>();
+  const std::uint32_t count = git_blame_get_hunk_count(blame);
+  result->hunks.reserve(count);
+  for (std::uint32_t i = 0; i < count; ++i)
+  {
+    const git_blame_hunk* hunk = git_blame_get_hunk_byindex(blame, i);
+
+    git::Blame::Hunk added;
+    added.startLine = hunk->final_start_line_number;
+    added.lineCount = hunk->lines_in_hunk;
+    added.sha = git::HexOf(&hunk->final_commit_id);
+    added.authorTime = 0;
+    if (const git_signature* author = hunk->final_signature)
+    {
+      added.authorName = author->name;
+      added.authorEmail = author->email;
+      added.authorTime = author->when.time;
+    }
+    added.originalPath = hunk->orig_path ? hunk->orig_path : path;
+    added.originalStartLine = hunk->orig_start_line_number;
+    result->hunks.push_back(std::move(added));
+  }
+  git_blame_free(blame);
+  return result;
+}
+
+namespace
+{
+  // The lines of the blob at the commit that were changed from its parent,
+  // as given by the hunks of a diff without any context.
+  struct Change
+  {
+    std::size_t oldStart;
+    std::size_t oldLines;
+    std::size_t newStart;
+    std::size_t newLines;
+  };
+
+  int add_change(const git_diff_delta*, const git_diff_hunk* hunk,
+                 void* payload)
+  {
+    // A hunk which only adds or removes lines gives the line before them.
+    Change change;
+    change.oldStart = static_cast<std::size_t>(hunk->old_start);
+    change.oldLines = static_cast<std::size_t>(hunk->old_lines);
+    change.newStart = static_cast<std::size_t>(hunk->new_start);
+    change.newLines = static_cast<std::size_t>(hunk->new_lines);
+    if (change.oldLines == 0) ++change.oldStart;
+    if (change.newLines == 0) ++change.newStart;
+    static_cast<std::vector<Change>*>(payload)->push_back(change);
+    return 0;
+  }
+
+  std::size_t line_count(const git_blob* blob)
+  {
+    const char* const content =
+      static_cast<const char*>(git_blob_rawcontent(blob));
+    const std::size_t size = static_cast<std::size_t>(git_blob_rawsize(blob));
+    if (size == 0) return 0;
+    return std::count(content, content + size, '\n') +
+      (content[size - 1] == '\n' ? 0 : 1);
+  }
+}
+
+// Works out the blame at the commit from the blame of the parent, which had
+// the blob with the given id at the path.
+//
+// Returns null if it can't, such as when either blob is binary.
+static std::shared_ptr<const git::Blame> blame_from_parent(
+  git::Repository& repository, const git_commit* commit,
+  const git_oid* blobId, const git_oid* parentBlobId,
+  const git::Blame& parentBlame, const std::string& path)
+{
+  git_blob* blob = nullptr;
+  git_blob* parentBlob = nullptr;
+  std::vector<Change> changes;
+  bool isDiffed = false;
+  if (git_blob_lookup(&blob, repository, blobId) == 0 &&
+      git_blob_lookup(&parentBlob, repository, parentBlobId) == 0 &&
+      !git_blob_is_binary(blob) && !git_blob_is_binary(parentBlob))
+  {
+    git_diff_options options;
+    git_diff_init_options(&options, GIT_DIFF_OPTIONS_VERSION);
+    options.context_lines = 0;
+    options.interhunk_lines = 0;
+    isDiffed = git_diff_blobs(parentBlob, path.c_str(), blob, path.c_str(),
+                              &options, nullptr, nullptr, add_change,
+                              nullptr, &changes) == 0;
+  }
+  const std::size_t lineCount = isDiffed ? line_count(blob) : 0;
+  git_blob_free(parentBlob);
+  git_blob_free(blob);
+  if (!isDiffed) return nullptr;
+
+  // Where each line came from: the hunk of the parent's blame and the line
+  // within it, or no hunk if it was added by the commit.
+  struct Source
+  {
+    const git::Blame::Hunk* hunk;
+    std::size_t offset;
+  };
+  std::vector<Source> parentLines;
+  for (auto hunk = std::begin(parentBlame.hunks);
+       hunk != std::end(parentBlame.hunks); ++hunk)
+  {
+    for (std::size_t i = 0; i < hunk->lineCount; ++i)
+    {
+      parentLines.push_back(Source{ &*hunk, i });
+    }
+  }
+
+  std::vector<Source> lines;
+  lines.reserve(lineCount);
+  std::size_t oldLine = 1;
+  const auto keep = [&](std::size_t count)
+  {
+    for (; count != 0; --count, ++oldLine)
+    {
+      if (oldLine > parentLines.size()) return false;
+      lines.push_back(parentLines[oldLine - 1]);
+    }
+    return true;
+  };
+
+  for (auto change = std::begin(changes); change != std::end(changes);
+       ++change)
+  {
+    if (change->newStart < lines.size() + 1 ||
+        !keep(change->newStart - 1 - lines.size()))
+    {
+      return nullptr;
+    }
+    lines.insert(lines.end(), change->newLines, Source{ nullptr, 0 });
+    oldLine = change->oldStart + change->oldLines;
+  }
+  if (lineCount < lines.size() || !keep(lineCount - lines.size()))
+  {
+    return nullptr;
+  }
+
+  const git_signature* const author = git_commit_author(commit);
+  const std::string sha = git::HexOf(git_commit_id(commit));
+
+  // The lines are put back together into hunks of consecutive lines from the
+  // same hunk of the parent, or added by the commit.
+  auto result = std::make_shared<git::Blame>();
+  for (std::size_t i = 0; i < lines.size(); ++i)
+  {
+    const Source& line = lines[i];
+    if (!result->hunks.empty() && i > 0)
+    {
+      const Source& previous = lines[i - 1];
+      if (line.hunk == previous.hunk &&
+          (!line.hunk || line.offset == previous.offset + 1))
+      {
+        ++result->hunks.back().lineCount;
+        continue;
+      }
+    }
+
+    git::Blame::Hunk hunk;
+    hunk.startLine = i + 1;
+    hunk.lineCount = 1;
+    if (line.hunk)
+    {
+      hunk.sha = line.hunk->sha;
+      hunk.authorName = line.hunk->authorName;
+      hunk.authorEmail = line.hunk->authorEmail;
+      hunk.authorTime = line.hunk->authorTime;
+      hunk.originalPath = line.hunk->originalPath;
+      hunk.originalStartLine = line.hunk->originalStartLine + line.offset;
+    }
+    else
+    {
+      hunk.sha = sha;
+      hunk.authorName = author->name;
+      hunk.authorEmail = author->email;
+      hunk.authorTime = author->when.time;
+      hunk.originalPath = path;
+      hunk.originalStartLine = i + 1;
+    }
+    result->hunks.push_back(std::move(hunk));
+  }
+  return result;
+}
+
+std::shared_ptr<const git::Blame> git::BlameFile(Repository& repository,
+                                                 const git_commit* commit,
+                                                 const std::string& path)
+{
+  git_oid blobId;
+  if (!find_blob(commit, path, &blobId)) return nullptr;
+
+  BlameCache* const cache = currentCache;
+  const std::string key =
+    key_of(repository, git_commit_id(commit), &blobId, path);
+  if (cache)
+  {
+    if (auto blame = cache->Find(key)) return blame;
+  }
+
+  StageTimer timer("blame");
+  std::shared_ptr<const Blame> blame;
+
+  // When the parent's blame is known only the change to the file needs to be
+  // looked at. A merge has to be worked out from the history, as the lines
+  // may have come from any of the parents.
+  git_commit* parent = nullptr;
+  git_oid parentBlobId;
+  if (cache && git_commit_parentcount(commit) == 1 &&
+      git_commit_parent(&parent, commit, 0) == 0 &&
+      find_blob(parent, path, &parentBlobId))
+  {
+    const auto parentBlame = cache->Find(
+      key_of(repository, git_commit_id(parent), &parentBlobId, path));
+    if (parentBlame && git_oid_equal(&parentBlobId, &blobId))
+    {
+      blame = parentBlame;
+    }
+    else if (parentBlame)
+    {
+      blame = blame_from_parent(repository, commit, &blobId, &parentBlobId,
+                                *parentBlame, path);
+    }
+  }
+  git_commit_free(parent);
+
+  if (!blame) blame = blame_history(repository, commit, path);
+  if (cache) cache->Insert(key, blame);
+  return blame;
+}
+
+git::BlameCache::BlameCache(std::size_t capacity)
+: myBlames(capacity),
+  myPrevious(currentCache)
+{
+  currentCache = this;
+}
+
+git::BlameCache::~BlameCache()
+{
+  currentCache = myPrevious;
+}
+
+git::BlameCache* git::BlameCache::Current()
+{
+  return currentCache;
+}
+
+std::shared_ptr<const git::Blame> git::BlameCache::Find(
+  const std::string& key)
+{
+  return myBlames.Find(key);
+}
+
+void git::BlameCache::Insert(const std::string& key,
+                             std::shared_ptr<const Blame> blame)
+{
+  myBlames.Insert(key, std::move(blame), 1);
+}
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,105 @@
+#ifndef BLAME_HPP_
+#define BLAME_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Blame
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Works out which commit last changed each line of a file (git blame), and
+// keeps the results in a BlameCache.
+//
+// The blame of a file at a commit never changes, so it is kept by the commit,
+// the blob and the path. When the blame of the file in the parent of a commit
+// is in the cache, the blame at the commit is worked out from it by diffing
+// the two blobs: the lines that were added are the commit's and the others
+// keep what they had in the parent. Otherwise libgit2 works it out from the
+// history, which can take seconds for a large file.
+//
+// Usage:
+// {
+//   git::BlameCache cache(1024);
+//   ...
+//   git::Repository repository("gitweb");
+//   const auto blame = git::BlameFile(repository, commit, "README.md");
+//   for (auto hunk = blame->hunks.begin(); ...)
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "lrucache.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct git_commit;
+
+namespace git
+{
+  class Repository;
+
+  struct Blame
+  {
+    // Consecutive lines which were last changed by the same commit.
+    struct Hunk
+    {
+      // The first line of the hunk in the file, counting from 1.
+      std::size_t startLine;
+      std::size_t lineCount;
+
+      // The commit that last changed the lines, and its author.
+      std::string sha;
+      std::string authorName;
+      std::string authorEmail;
+      std::int64_t authorTime;
+
+      // Where the lines were in that commit.
+      std::string originalPath;
+      std::size_t originalStartLine;
+    };
+
+    std::vector<Hunk> hunks;
+  };
+
+  // Returns the blame of the file at the path in the commit, from the
+  // BlameCache if it is there, and adds it to the cache if there is one.
+  //
+  // Returns null if there is no file at the path, and throws git::Error if
+  // the blame can't be worked out.
+  std::shared_ptr<const Blame> BlameFile(Repository& repository,
+                                         const git_commit* commit,
+                                         const std::string& path);
+
+  // Keeps the blames that were most recently used.
+  class BlameCache
+  {
+  public:
+    // Makes this the current instance until it is destroyed.
+    BlameCache(std::size_t capacity);
+    ~BlameCache();
+
+    // Returns the instance in use or null if there is none.
+    static BlameCache* Current();
+
+    // Returns the blame with the given key or null if it isn't there.
+    std::shared_ptr<const Blame> Find(const std::string& key);
+
+    void Insert(const std::string& key, std::shared_ptr<const Blame> blame);
+
+  private:
+    BlameCache(const BlameCache&); /* = delete; */
+    BlameCache& operator =(const BlameCache&); /* = delete; */
+
+    LruCache<Blame> myBlames;
+
+    // The instance that was current when this one was created, if any.
+    BlameCache* myPrevious;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,156 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : BlobFiles
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "blobfiles.hpp"
+
+#include "repository.hpp"
+#include "request.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+static git::BlobFiles* currentFiles = nullptr;
+
+// The size of the pieces a blob is read in when it is streamed.
+static const std::size_t chunkSize = 64 * 1024;
+
+// Reads the blob, a chunk at a time, passing each one to write which returns
+// false to stop.
+//
+// Returns false if the blob could not be read.
+template<typename Writer>
+static bool read_blob(git::Repository& repository, const git_oid& id,
+                      Writer write)
+{
+  git_odb* objects = repository.Objects();
+  if (!objects) return false;
+
+  git_odb_stream* stream = nullptr;
+  if (git_odb_open_rstream(&stream, objects, &id) == 0)
+  {
+    std::vector<char> buffer(chunkSize);
+    bool isComplete = true;
+    for (;;)
+    {
+      const int length =
+        git_odb_stream_read(stream, buffer.data(), buffer.size());
+      if (length == 0) break;
+      if (length < 0 || !write(buffer.data(), std::size_t(length)))
+      {
+        isComplete = false;
+        break;
+      }
+    }
+    git_odb_stream_free(stream);
+    return isComplete;
+  }
+
+  // Only loose objects can be streamed, a blob in a pack has to be inflated
+  // into memory. For large blobs this happens once, when the copy is written.
+  git_odb_object* object = nullptr;
+  {
+    StageTimer timer("read");
+    if (git_odb_read(&object, objects, &id) != 0) return false;
+  }
+
+  const char* data = static_cast<const char*>(git_odb_object_data(object));
+  const std::size_t size = git_odb_object_size(object);
+  bool isComplete = true;
+  for (std::size_t offset = 0; offset < size && isComplete;
+       offset += chunkSize)
+  {
+    isComplete = write(data + offset, std::min(chunkSize, size - offset));
+  }
+  git_odb_object_free(object);
+  return isComplete;
+}
+
+git::BlobFiles::BlobFiles(const std::string& directory,
+                          std::uint64_t capacity)
+: myCopies(directory, capacity),
+  myPrevious(currentFiles)
+{
+  currentFiles = this;
+}
+
+git::BlobFiles::~BlobFiles()
+{
+  currentFiles = myPrevious;
+}
+
+git::BlobFiles* git::BlobFiles::Current()
+{
+  return currentFiles;
+}
+
+bool git::BlobFiles::Stream(Repository& repository, const git_oid& id,
+                            OutputSink* output)
+{
+  return read_blob(repository, id, [output](const char* data, std::size_t size)
+  {
+    output->Write(data, size);
+    return true;
+  });
+}
+
+bool git::BlobFiles::Write(Repository& repository, const git_oid& id,
+                           std::uint64_t size, OutputSink* output)
+{
+  char sha[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(sha, sizeof(sha), &id);
+
+  int descriptor = myCopies.Open(sha);
+#ifndef _WIN32
+  struct stat status;
+  if (descriptor != -1 &&
+      (fstat(descriptor, &status) != 0 ||
+       static_cast<std::uint64_t>(status.st_size) != size))
+  {
+    close(descriptor);
+    descriptor = -1;
+  }
+#endif
+
+  if (descriptor == -1)
+  {
+    FileCache::NewFile copy(myCopies, sha);
+    if (!copy.IsOpen()) return false;
+
+    const bool isWritten =
+      read_blob(repository, id, [&copy](const char* data, std::size_t length)
+      {
+        return copy.Write(data, length);
+      });
+    if (!isWritten) return false;
+
+    descriptor = copy.Commit();
+    if (descriptor == -1) return false;
+  }
+
+  output->WriteFile(descriptor, 0, size);
+#ifndef _WIN32
+  close(descriptor);
+#endif
+  return true;
+}
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,76 @@
+#ifndef BLOB_FILES_HPP_
+#define BLOB_FILES_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : BlobFiles
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Keeps inflated copies of large blobs in a FileCache, so they can be sent
+// straight from the file with sendfile() rather than each request inflating
+// the blob into memory.
+//
+// The copies are named after the blob's id, which identifies its content, so
+// they are shared by every repository and every gitjson process using the
+// same directory and never need to be invalidated.
+//
+// Usage:
+// {
+//   git::BlobFiles files("/var/cache/gitjson/blobs", 1 << 30);
+//   ...
+//   git::BlobFiles::Current()->Write(repository, id, size, &output);
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "filecache.hpp"
+#include "sink.hpp"
+
+#include <cstdint>
+#include <string>
+
+struct git_oid;
+
+namespace git
+{
+  class Repository;
+
+  class BlobFiles
+  {
+  public:
+    // Makes this the current instance until it is destroyed.
+    BlobFiles(const std::string& directory, std::uint64_t capacity);
+    ~BlobFiles();
+
+    // Returns the instance in use or null if there is none.
+    static BlobFiles* Current();
+
+    // Writes the content of the blob, which is size bytes, to the output from
+    // the copy of it, writing the copy first if there isn't one.
+    //
+    // Returns false if there is no copy and one could not be written, in which
+    // case nothing has been written to the output.
+    bool Write(Repository& repository, const git_oid& id, std::uint64_t size,
+               OutputSink* output);
+
+    // Writes the content of the blob to the output a chunk at a time, without
+    // keeping a copy.
+    //
+    // Returns false if the blob could not be read.
+    static bool Stream(Repository& repository, const git_oid& id,
+                       OutputSink* output);
+
+  private:
+    BlobFiles(const BlobFiles&); /* = delete; */
+    BlobFiles& operator =(const BlobFiles&); /* = delete; */
+
+    FileCache myCopies;
+
+    // The instance that was current when this one was created, if any.
+    BlobFiles* myPrevious;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
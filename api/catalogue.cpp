@@ -0,0 +1,471 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Catalogue
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "catalogue.hpp"
+
+#include "repository.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+static git::Catalogue* currentCatalogue = nullptr;
+
+#ifdef __linux__
+// The changes to a directory which may add or remove a repository or change
+// what its HEAD refers to. HEAD and the references are changed by renaming a
+// lock file over them.
+static const std::uint32_t watchedChanges =
+  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE |
+  IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+git::Catalogue::Catalogue()
+: myDirectory(RepositoriesPath()),
+  myNotifier(-1),
+  myDirectoryWatch(-1),
+  isScanNeeded(true),
+  myPrevious(currentCatalogue)
+{
+  currentCatalogue = this;
+}
+
+git::Catalogue::~Catalogue()
+{
+#ifndef _WIN32
+  if (myNotifier != -1) close(myNotifier);
+#endif
+  currentCatalogue = myPrevious;
+}
+
+git::Catalogue* git::Catalogue::Current()
+{
+  return currentCatalogue;
+}
+
+void git::Catalogue::Summarise(const std::string& gitDirectory,
+                               Summary* summary, std::string* reference)
+{
+  summary->defaultBranch.clear();
+  summary->sha.clear();
+  summary->time = 0;
+  reference->clear();
+
+  git_repository* repository = nullptr;
+  if (git_repository_open(&repository, gitDirectory.c_str()) != 0) return;
+
+  git_reference* head = nullptr;
+  if (git_reference_lookup(&head, repository, "HEAD") == 0)
+  {
+    if (git_reference_type(head) == GIT_REF_SYMBOLIC)
+    {
+      const std::string target = git_reference_symbolic_target(head);
+      const std::string prefix = "refs/heads/";
+      *reference = target;
+      summary->defaultBranch = target.compare(0, prefix.size(), prefix) == 0 ?
+        target.substr(prefix.size()) : target;
+    }
+
+    // There are no commits when HEAD refers to a branch which doesn't exist.
+    git_reference* resolved = nullptr;
+    git_commit* commit = nullptr;
+    if (git_reference_resolve(&resolved, head) == 0 &&
+        git_commit_lookup(&commit, repository,
+                          git_reference_target(resolved)) == 0)
+    {
+      char sha[GIT_OID_HEXSZ + 1];
+      summary->sha = git_oid_tostr(sha, sizeof(sha), git_commit_id(commit));
+      summary->time = git_commit_time(commit);
+    }
+    git_commit_free(commit);
+    git_reference_free(resolved);
+    git_reference_free(head);
+  }
+  git_repository_free(repository);
+}
+
+std::vector<git::Catalogue::Summary> git::Catalogue::List()
+{
+  struct Work
+  {
+    std::string name;
+    std::string gitDirectory;
+    Summary summary;
+    std::string reference;
+  };
+  std::vector<Work> work;
+
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+#ifdef __linux__
+    if (myNotifier == -1)
+    {
+      myNotifier = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (myNotifier != -1)
+      {
+        myDirectoryWatch = inotify_add_watch(myNotifier, myDirectory.c_str(),
+                                             watchedChanges);
+        if (myDirectoryWatch == -1)
+        {
+          close(myNotifier);
+          myNotifier = -1;
+        }
+      }
+      isScanNeeded = true;
+    }
+    else
+    {
+      ReadChanges();
+    }
+#endif
+
+    if (isScanNeeded || myNotifier == -1) Scan();
+
+    for (auto entry = std::begin(myEntries); entry != std::end(myEntries);
+         ++entry)
+    {
+      if (!entry->second.isRepository) continue;
+
+      // Without inotify it is up to the state of the references to say if
+      // the summary may have changed.
+      if (myNotifier == -1 || !entry->second.isWatched)
+      {
+        std::uint64_t state = 0;
+        if (!Repository::ReferencesState(entry->first, &state) ||
+            state != entry->second.state)
+        {
+          entry->second.isStale = true;
+        }
+        entry->second.state = state;
+      }
+
+      // Any changes from now on make the entry stale again.
+      if (entry->second.isStale)
+      {
+        entry->second.isStale = false;
+        Work item = { entry->first, entry->second.gitDirectory, Summary(),
+                      std::string() };
+        work.push_back(std::move(item));
+      }
+    }
+  }
+
+  // The lock isn't held while the repositories are read, as the calling
+  // thread may run another request, which also lists them, while it waits.
+  ThreadPool* pool = ThreadPool::Current();
+  if (pool && work.size() > 1)
+  {
+    std::atomic<std::size_t> remaining(work.size());
+    for (auto item = std::begin(work); item != std::end(work); ++item)
+    {
+      Work* task = &*item;
+      pool->Submit([task, &remaining]
+                   {
+                     Summarise(task->gitDirectory, &task->summary,
+                               &task->reference);
+                     --remaining;
+                   });
+    }
+    pool->RunUntil([&remaining] { return remaining == 0; });
+  }
+  else
+  {
+    for (auto item = std::begin(work); item != std::end(work); ++item)
+    {
+      Summarise(item->gitDirectory, &item->summary, &item->reference);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  for (auto item = std::begin(work); item != std::end(work); ++item)
+  {
+    const auto entry = myEntries.find(item->name);
+    if (entry == myEntries.end()) continue;
+
+    item->summary.name = item->name;
+    entry->second.summary = std::move(item->summary);
+    Watch(item->name, &entry->second, item->reference);
+  }
+
+  std::vector<Summary> summaries;
+  summaries.reserve(myEntries.size());
+  for (auto entry = std::begin(myEntries); entry != std::end(myEntries);
+       ++entry)
+  {
+    if (entry->second.isRepository) summaries.push_back(entry->second.summary);
+  }
+  return summaries;
+}
+
+#ifndef _WIN32
+
+static bool is_directory(const std::string& path)
+{
+  struct stat status;
+  return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+}
+
+void git::Catalogue::Scan()
+{
+  std::vector<std::string> names;
+  if (DIR* directory = opendir(myDirectory.c_str()))
+  {
+    while (const dirent* entry = readdir(directory))
+    {
+      if (entry->d_name[0] == '.') continue;
+      if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN &&
+          entry->d_type != DT_LNK)
+      {
+        continue;
+      }
+      names.push_back(entry->d_name);
+    }
+    closedir(directory);
+  }
+  std::sort(names.begin(), names.end());
+
+  // The entries are in the same order, so those which are gone are the ones
+  // passed over.
+  auto entry = std::begin(myEntries);
+  for (auto name = std::begin(names); name != std::end(names); ++name)
+  {
+    while (entry != std::end(myEntries) && entry->first < *name)
+    {
+      Unwatch(&entry->second);
+      entry = myEntries.erase(entry);
+    }
+
+    const std::string path = myDirectory + "/" + *name;
+    if (!is_directory(path)) continue;
+
+    // A repository with a working tree has its own directory within it.
+    std::string gitDirectory = path + "/.git";
+    if (!is_directory(gitDirectory)) gitDirectory = path;
+
+    struct stat status;
+    const bool isRepository =
+      stat((gitDirectory + "/HEAD").c_str(), &status) == 0 &&
+      S_ISREG(status.st_mode) && is_directory(gitDirectory + "/objects");
+
+    const bool isNew = entry == std::end(myEntries) || entry->first != *name;
+    if (isNew)
+    {
+      Entry added;
+      added.summary.time = 0;
+      added.isRepository = false;
+      added.state = 0;
+      added.isWatched = false;
+      entry = myEntries.emplace_hint(entry, *name, std::move(added));
+    }
+
+    if (isNew || entry->second.isRepository != isRepository ||
+        entry->second.gitDirectory != gitDirectory)
+    {
+      entry->second.gitDirectory = gitDirectory;
+      entry->second.isRepository = isRepository;
+      entry->second.summary = Summary();
+      entry->second.summary.name = *name;
+      entry->second.summary.time = 0;
+      entry->second.isStale = true;
+      Watch(*name, &entry->second, std::string());
+    }
+    ++entry;
+  }
+
+  while (entry != std::end(myEntries))
+  {
+    Unwatch(&entry->second);
+    entry = myEntries.erase(entry);
+  }
+
+  isScanNeeded = false;
+}
+
+#else
+
+void git::Catalogue::Scan()
+{
+  isScanNeeded = false;
+}
+
+#endif
+
+#ifdef __linux__
+
+void git::Catalogue::ReadChanges()
+{
+  alignas(inotify_event) char buffer[64 * 1024];
+  for (;;)
+  {
+    const ssize_t length = read(myNotifier, buffer, sizeof(buffer));
+    if (length <= 0) break;
+
+    for (const char* cursor = buffer; cursor < buffer + length;)
+    {
+      const inotify_event* event =
+        reinterpret_cast<const inotify_event*>(cursor);
+      cursor += sizeof(inotify_event) + event->len;
+
+      // Some of the changes were lost, so everything has to be looked at.
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        isScanNeeded = true;
+        for (auto entry = std::begin(myEntries);
+             entry != std::end(myEntries); ++entry)
+        {
+          entry->second.isStale = true;
+        }
+        continue;
+      }
+
+      if (event->wd == myDirectoryWatch)
+      {
+        isScanNeeded = true;
+
+        // The directory itself was removed or replaced, so it is watched
+        // again from scratch the next time.
+        if (event->mask & IN_IGNORED)
+        {
+          for (auto entry = std::begin(myEntries);
+               entry != std::end(myEntries); ++entry)
+          {
+            entry->second.watches.clear();
+            entry->second.isWatched = false;
+            entry->second.isStale = true;
+          }
+          myWatches.clear();
+          close(myNotifier);
+          myNotifier = -1;
+          myDirectoryWatch = -1;
+          return;
+        }
+        continue;
+      }
+
+      const auto watch = myWatches.find(event->wd);
+      if (watch == myWatches.end()) continue;
+
+      const auto entry = myEntries.find(watch->second);
+      if (entry != myEntries.end())
+      {
+        // Something which isn't a repository may have just become one.
+        entry->second.isStale = true;
+        if (!entry->second.isRepository) isScanNeeded = true;
+      }
+
+      // The directory is gone, so it is no longer watched.
+      if (event->mask & IN_IGNORED)
+      {
+        if (entry != myEntries.end())
+        {
+          std::vector<int>& watches = entry->second.watches;
+          watches.erase(std::remove(watches.begin(), watches.end(),
+                                    event->wd),
+                        watches.end());
+        }
+        myWatches.erase(watch);
+        isScanNeeded = true;
+      }
+    }
+  }
+}
+
+void git::Catalogue::Watch(const std::string& name, Entry* entry,
+                           const std::string& reference)
+{
+  Unwatch(entry);
+  if (myNotifier == -1) return;
+  entry->isWatched = true;
+
+  std::vector<std::string> directories(1, myDirectory + "/" + name);
+  if (entry->isRepository)
+  {
+    if (entry->gitDirectory != directories.front())
+    {
+      directories.push_back(entry->gitDirectory);
+    }
+
+    // The loose reference HEAD refers to is in the directory of its own,
+    // whether or not the file is there yet.
+    const std::size_t slash = reference.rfind('/');
+    if (slash != std::string::npos)
+    {
+      directories.push_back(entry->gitDirectory + "/" +
+                            reference.substr(0, slash));
+    }
+  }
+
+  for (auto directory = std::begin(directories);
+       directory != std::end(directories); ++directory)
+  {
+    const int watch =
+      inotify_add_watch(myNotifier, directory->c_str(), watchedChanges);
+    if (watch == -1)
+    {
+      fprintf(stderr, "Could not watch %s: %s\n", directory->c_str(),
+              strerror(errno));
+      entry->isWatched = false;
+      continue;
+    }
+
+    entry->watches.push_back(watch);
+    myWatches[watch] = name;
+  }
+}
+
+void git::Catalogue::Unwatch(Entry* entry)
+{
+  for (auto watch = std::begin(entry->watches);
+       watch != std::end(entry->watches); ++watch)
+  {
+    inotify_rm_watch(myNotifier, *watch);
+    myWatches.erase(*watch);
+  }
+  entry->watches.clear();
+  entry->isWatched = false;
+}
+
+#else
+
+void git::Catalogue::ReadChanges()
+{
+}
+
+void git::Catalogue::Watch(const std::string&, Entry*, const std::string&)
+{
+}
+
+void git::Catalogue::Unwatch(Entry*)
+{
+}
+
+#endif
+
+//===--------------------------- End of the file --------------------------===//
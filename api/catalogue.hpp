@@ -0,0 +1,133 @@
+#ifndef CATALOGUE_HPP_
+#define CATALOGUE_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Catalogue
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Keeps the list of the repositories in git::RepositoriesPath(), with a
+// summary of each (its default branch and the commit at the head of it).
+//
+// The directory is only read the first time the list is asked for. After that
+// inotify tells it which repositories were added or removed and which had
+// their HEAD or default branch changed, so only those are looked at again.
+// The summaries that need to be worked out are done so in parallel on the
+// ThreadPool.
+//
+// Without inotify (other than on Linux) the directory is read each time and
+// a summary is only worked out again when the references of the repository
+// have changed, as given by Repository::ReferencesState(). The same is done
+// for a repository whose directories couldn't all be watched, such as when
+// the limit on the number of watches has been reached.
+//
+// Usage:
+// {
+//   git::Catalogue catalogue;
+//   ...
+//   const auto repositories = git::Catalogue::Current()->List();
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace git
+{
+  class Catalogue
+  {
+  public:
+    struct Summary
+    {
+      std::string name;
+
+      // The branch HEAD refers to (such as master), which is empty if HEAD
+      // is detached.
+      std::string defaultBranch;
+
+      // The commit HEAD resolves to and when it was committed (in seconds
+      // since the epoch). The sha is empty if there are no commits yet.
+      std::string sha;
+      std::int64_t time;
+    };
+
+    // Makes this the current instance until it is destroyed. Nothing is read
+    // until the list is first asked for.
+    Catalogue();
+    ~Catalogue();
+
+    // Returns the instance in use or null if there is none.
+    static Catalogue* Current();
+
+    // Returns the repositories ordered by name.
+    std::vector<Summary> List();
+
+  private:
+    Catalogue(const Catalogue&); /* = delete; */
+    Catalogue& operator =(const Catalogue&); /* = delete; */
+
+    struct Entry
+    {
+      Summary summary;
+
+      // The directory holding the repository itself (the .git directory of
+      // one with a working tree).
+      std::string gitDirectory;
+
+      bool isRepository;
+
+      // True if the summary needs to be worked out again.
+      bool isStale;
+
+      // The state of the references when the summary was worked out, which
+      // is used instead of inotify where it isn't available.
+      std::uint64_t state;
+
+      // The directories being watched for changes to the summary, and whether
+      // that is all of them so changes can't be missed.
+      std::vector<int> watches;
+      bool isWatched;
+    };
+
+    // Reads the directory, adding the entries for the directories which are
+    // new and removing those which are gone.
+    void Scan();
+
+    // Applies the changes inotify has reported since it was last called.
+    void ReadChanges();
+
+    // Works out the summary of the repository in the given directory from
+    // scratch, setting reference to the name of the reference HEAD refers to.
+    static void Summarise(const std::string& gitDirectory, Summary* summary,
+                          std::string* reference);
+
+    // Watches the directory of the entry, and if it is a repository the
+    // directories with the files its summary depends on.
+    void Watch(const std::string& name, Entry* entry,
+               const std::string& reference);
+    void Unwatch(Entry* entry);
+
+    std::string myDirectory;
+    std::map<std::string, Entry> myEntries;
+
+    // The inotify instance, the watch for the directory and the name of the
+    // entry for each of the other watches.
+    int myNotifier;
+    int myDirectoryWatch;
+    std::map<int, std::string> myWatches;
+
+    bool isScanNeeded;
+    std::mutex myMutex;
+
+    // The instance that was current when this one was created, if any.
+    Catalogue* myPrevious;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
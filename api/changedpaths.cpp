@@ -0,0 +1,548 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : ChangedPaths
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "changedpaths.hpp"
+
+#include "filecache.hpp"
+#include "repository.hpp"
+#include "request.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+// The file starts with a header, followed by a record for each commit of its
+// id, the number of bytes in its filter and then the filter.
+static const char fileMagic[4] = { 'G', 'J', 'C', 'P' };
+static const std::uint32_t fileVersion = 1;
+static const std::size_t headerSize = 8;
+static const std::size_t recordHeaderSize = GIT_OID_RAWSZ + 4;
+
+// The filters have ten bits for each path and set seven of them for each,
+// which gives about one false positive in a hundred. These are what git uses
+// for the filters in its commit-graph files.
+static const std::size_t bitsPerPath = 10;
+static const std::uint32_t hashCount = 7;
+static const std::uint32_t hashSeeds[2] = { 0x293ae76f, 0x7e646e2c };
+
+// A commit which changed more paths than this has no filter.
+static const std::size_t maximumChangedPaths = 512;
+
+// A filter larger than this must be from a corrupt file.
+static const std::uint32_t maximumFilterSize =
+  (maximumChangedPaths * 2 * bitsPerPath + 7) / 8;
+
+// The number of commits below which they are diffed on the calling thread.
+static const std::size_t minimumParallelCommits = 8;
+
+static git::ChangedPaths* currentChangedPaths = nullptr;
+
+static std::uint32_t read32(const unsigned char* data)
+{
+  return static_cast<std::uint32_t>(data[0]) << 24 |
+    static_cast<std::uint32_t>(data[1]) << 16 |
+    static_cast<std::uint32_t>(data[2]) << 8 |
+    static_cast<std::uint32_t>(data[3]);
+}
+
+static void write32(std::uint32_t value, std::vector<unsigned char>* data)
+{
+  data->push_back(static_cast<unsigned char>(value >> 24));
+  data->push_back(static_cast<unsigned char>(value >> 16));
+  data->push_back(static_cast<unsigned char>(value >> 8));
+  data->push_back(static_cast<unsigned char>(value));
+}
+
+// MurmurHash3 (x86, 32-bit) of the text.
+static std::uint32_t murmur3(std::uint32_t seed, const std::string& text)
+{
+  const std::uint32_t c1 = 0xcc9e2d51;
+  const std::uint32_t c2 = 0x1b873593;
+  const auto rotate = [](std::uint32_t value, int bits)
+  {
+    return (value << bits) | (value >> (32 - bits));
+  };
+
+  const unsigned char* const data =
+    reinterpret_cast<const unsigned char*>(text.data());
+  const std::size_t length = text.size();
+  std::uint32_t hash = seed;
+
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4)
+  {
+    std::uint32_t block = static_cast<std::uint32_t>(data[i]) |
+      static_cast<std::uint32_t>(data[i + 1]) << 8 |
+      static_cast<std::uint32_t>(data[i + 2]) << 16 |
+      static_cast<std::uint32_t>(data[i + 3]) << 24;
+    block = rotate(block * c1, 15) * c2;
+    hash = rotate(hash ^ block, 13) * 5 + 0xe6546b64;
+  }
+
+  std::uint32_t tail = 0;
+  switch (length & 3)
+  {
+  case 3:
+    tail ^= static_cast<std::uint32_t>(data[i + 2]) << 16;
+    // Falls through.
+  case 2:
+    tail ^= static_cast<std::uint32_t>(data[i + 1]) << 8;
+    // Falls through.
+  case 1:
+    tail ^= data[i];
+    hash ^= rotate(tail * c1, 15) * c2;
+  }
+
+  hash ^= static_cast<std::uint32_t>(length);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// Returns the index of the given bit of the path in a filter with bitCount
+// bits.
+static std::uint32_t bit_of(const std::uint32_t (&hashes)[2],
+                            std::uint32_t bit, std::uint32_t bitCount)
+{
+  return (hashes[0] + bit * hashes[1]) % bitCount;
+}
+
+// Finds the entry at the path in the tree of the commit, returning false if
+// there isn't one.
+static bool find_entry(const git_commit* commit, const std::string& path,
+                       git_oid* id)
+{
+  git_tree* tree = nullptr;
+  if (git_commit_tree(&tree, commit) != 0) return false;
+
+  git_tree_entry* entry = nullptr;
+  const bool isFound = git_tree_entry_bypath(&entry, tree, path.c_str()) == 0;
+  if (isFound) git_oid_cpy(id, git_tree_entry_id(entry));
+
+  git_tree_entry_free(entry);
+  git_tree_free(tree);
+  return isFound;
+}
+
+// Appends the record of the paths the commit changed compared to its first
+// parent to the records.
+//
+// Returns false if the commit or the trees can't be read.
+static bool add_record(git::Repository& repository, const git_oid& id,
+                       std::vector<unsigned char>* records)
+{
+  git_commit* commit = nullptr;
+  git_commit* parent = nullptr;
+  git_tree* tree = nullptr;
+  git_tree* parentTree = nullptr;
+  git_diff* diff = nullptr;
+  const bool isDiffed =
+    git_commit_lookup(&commit, repository, &id) == 0 &&
+    git_commit_tree(&tree, commit) == 0 &&
+    (git_commit_parentcount(commit) == 0 ||
+     (git_commit_parent(&parent, commit, 0) == 0 &&
+      git_commit_tree(&parentTree, parent) == 0)) &&
+    git_diff_tree_to_tree(&diff, repository, parentTree, tree, nullptr) == 0;
+
+  // Each path is added along with the directories it is in, so the history
+  // of a directory can be found as well.
+  std::unordered_set<std::string> paths;
+  bool hasFilter = isDiffed;
+  for (std::size_t i = 0, count = isDiffed ? git_diff_num_deltas(diff) : 0;
+       hasFilter && i < count; ++i)
+  {
+    const git_diff_delta* const delta = git_diff_get_delta(diff, i);
+    const char* const sides[] = { delta->old_file.path, delta->new_file.path };
+    for (std::size_t side = 0; side < 2 && hasFilter; ++side)
+    {
+      std::string path = sides[side];
+      while (!path.empty() && paths.insert(path).second)
+      {
+        const std::size_t slash = path.rfind('/');
+        path.resize(slash == std::string::npos ? 0 : slash);
+      }
+      hasFilter = paths.size() <= maximumChangedPaths;
+    }
+  }
+
+  git_diff_free(diff);
+  git_tree_free(parentTree);
+  git_tree_free(tree);
+  git_commit_free(parent);
+  git_commit_free(commit);
+  if (!isDiffed) return false;
+
+  records->insert(records->end(), id.id, id.id + GIT_OID_RAWSZ);
+  if (!hasFilter)
+  {
+    write32(0, records);
+    return true;
+  }
+
+  // A commit that changed nothing still has a filter, which has nothing in it.
+  const std::uint32_t size = static_cast<std::uint32_t>(
+    std::max<std::size_t>(1, (paths.size() * bitsPerPath + 7) / 8));
+  write32(size, records);
+  const std::size_t start = records->size();
+  records->resize(start + size, 0);
+  for (auto path = std::begin(paths); path != std::end(paths); ++path)
+  {
+    const std::uint32_t hashes[2] = {
+      murmur3(hashSeeds[0], *path), murmur3(hashSeeds[1], *path)
+    };
+    for (std::uint32_t i = 0; i < hashCount; ++i)
+    {
+      const std::uint32_t bit = bit_of(hashes, i, size * 8);
+      (*records)[start + bit / 8] |=
+        static_cast<unsigned char>(1u << (bit % 8));
+    }
+  }
+  return true;
+}
+
+git::ChangedPath::ChangedPath(const std::string& path)
+{
+  const std::size_t first = path.find_first_not_of('/');
+  const std::size_t last = path.find_last_not_of('/');
+  if (first != std::string::npos)
+  {
+    myPath = path.substr(first, last - first + 1);
+  }
+
+  myHashes[0] = murmur3(hashSeeds[0], myPath);
+  myHashes[1] = murmur3(hashSeeds[1], myPath);
+}
+
+bool git::IsPathChanged(Repository& repository, const git_commit* commit,
+                        const std::string& path, bool isFirstParentOnly)
+{
+  git_oid id;
+  const bool isFound = find_entry(commit, path, &id);
+
+  const unsigned int count = isFirstParentOnly ?
+    std::min(git_commit_parentcount(commit), 1u) :
+    git_commit_parentcount(commit);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    git_commit* parent = nullptr;
+    if (git_commit_lookup(&parent, repository,
+                          git_commit_parent_id(commit, i)) != 0)
+    {
+      throw git::Error("Could not read the parent of a commit.");
+    }
+
+    git_oid parentId;
+    const bool isInParent = find_entry(parent, path, &parentId);
+    git_commit_free(parent);
+    if (isFound == isInParent && (!isFound || git_oid_equal(&id, &parentId)))
+    {
+      return false;
+    }
+  }
+  return isFound || count > 0;
+}
+
+git::ChangedPathIndex::ChangedPathIndex(const std::string& path)
+: myPath(path),
+  myData(nullptr),
+  mySize(0),
+  myEnd(0)
+{
+#ifndef _WIN32
+  if (myPath.empty()) return;
+
+  const int descriptor = open(myPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (descriptor == -1) return;
+
+  // The lock keeps out any process appending to the file until it is mapped,
+  // so every record up to its end is complete.
+  struct stat status;
+  if (flock(descriptor, LOCK_SH) == 0 && fstat(descriptor, &status) == 0 &&
+      status.st_size > 0)
+  {
+    void* const data = mmap(nullptr, static_cast<std::size_t>(status.st_size),
+                            PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (data != MAP_FAILED)
+    {
+      myData = static_cast<const unsigned char*>(data);
+      mySize = static_cast<std::size_t>(status.st_size);
+    }
+  }
+  close(descriptor);
+
+  // A file that isn't understood is left alone, and the index is only kept
+  // in memory.
+  if (myData && (mySize < headerSize ||
+                 std::memcmp(myData, fileMagic, sizeof(fileMagic)) != 0 ||
+                 read32(myData + 4) != fileVersion))
+  {
+    myPath.clear();
+    return;
+  }
+
+  if (myData) myEnd = headerSize + Add(myData + headerSize, mySize - headerSize);
+#else
+  myPath.clear();
+#endif
+}
+
+git::ChangedPathIndex::~ChangedPathIndex()
+{
+#ifndef _WIN32
+  if (myData) munmap(const_cast<unsigned char*>(myData), mySize);
+#endif
+}
+
+std::size_t git::ChangedPathIndex::Add(const unsigned char* data,
+                                       std::size_t size)
+{
+  std::size_t offset = 0;
+  while (size - offset >= recordHeaderSize)
+  {
+    const unsigned char* const record = data + offset;
+    const std::uint32_t filterSize = read32(record + GIT_OID_RAWSZ);
+    if (filterSize > maximumFilterSize ||
+        size - offset - recordHeaderSize < filterSize)
+    {
+      break;
+    }
+
+    Key key;
+    std::memcpy(key.data(), record, key.size());
+    const Filter filter = { record + recordHeaderSize, filterSize };
+    myFilters.emplace(key, filter);
+    offset += recordHeaderSize + filterSize;
+  }
+  return offset;
+}
+
+void git::ChangedPathIndex::Append(const std::vector<unsigned char>& records)
+{
+#ifndef _WIN32
+  if (myPath.empty()) return;
+
+  const int descriptor =
+    open(myPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (descriptor == -1) return;
+
+  // The lock is held until the descriptor is closed.
+  struct stat status;
+  if (flock(descriptor, LOCK_EX) != 0 || fstat(descriptor, &status) != 0)
+  {
+    close(descriptor);
+    return;
+  }
+
+  std::size_t end = static_cast<std::size_t>(status.st_size);
+  if (end == 0)
+  {
+    std::vector<unsigned char> header(fileMagic,
+                                      fileMagic + sizeof(fileMagic));
+    write32(fileVersion, &header);
+    if (pwrite(descriptor, header.data(), header.size(), 0) !=
+        static_cast<ssize_t>(header.size()))
+    {
+      close(descriptor);
+      return;
+    }
+    end = myEnd = headerSize;
+  }
+  else if (myEnd == 0)
+  {
+    // The file was created by another process after this one looked for it.
+    unsigned char header[headerSize];
+    if (pread(descriptor, header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header)) ||
+        std::memcmp(header, fileMagic, sizeof(fileMagic)) != 0 ||
+        read32(header + 4) != fileVersion)
+    {
+      close(descriptor);
+      myPath.clear();
+      return;
+    }
+    myEnd = headerSize;
+  }
+
+  // The records other processes appended are added, and if the last is
+  // incomplete its writer must have died so it is removed.
+  if (end > myEnd)
+  {
+    std::vector<unsigned char> appended(end - myEnd);
+    if (pread(descriptor, appended.data(), appended.size(), myEnd) !=
+        static_cast<ssize_t>(appended.size()))
+    {
+      close(descriptor);
+      return;
+    }
+
+    myRecords.push_back(std::move(appended));
+    const std::vector<unsigned char>& added = myRecords.back();
+    const std::size_t complete = Add(added.data(), added.size());
+    if (complete != added.size() &&
+        ftruncate(descriptor, static_cast<off_t>(myEnd + complete)) != 0)
+    {
+      close(descriptor);
+      return;
+    }
+    end = myEnd + complete;
+  }
+
+  if (pwrite(descriptor, records.data(), records.size(),
+             static_cast<off_t>(end)) ==
+      static_cast<ssize_t>(records.size()))
+  {
+    myEnd = end + records.size();
+  }
+  else if (ftruncate(descriptor, static_cast<off_t>(end)) == 0)
+  {
+    myEnd = end;
+  }
+  close(descriptor);
+#else
+  (void)records;
+#endif
+}
+
+void git::ChangedPathIndex::Extend(Repository& repository,
+                                   const std::vector<git_oid>& commits)
+{
+  std::vector<git_oid> missing;
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    for (auto commit = std::begin(commits); commit != std::end(commits);
+         ++commit)
+    {
+      Key key;
+      std::memcpy(key.data(), commit->id, key.size());
+      if (myFilters.find(key) == myFilters.end()) missing.push_back(*commit);
+    }
+  }
+  if (missing.empty()) return;
+
+  StageTimer timer("index");
+  std::vector<std::vector<unsigned char>> records(missing.size());
+  ThreadPool* const pool = ThreadPool::Current();
+  if (!pool || missing.size() < minimumParallelCommits)
+  {
+    for (std::size_t i = 0; i < missing.size(); ++i)
+    {
+      add_record(repository, missing[i], &records[i]);
+    }
+  }
+  else
+  {
+    RepositoryHandles handles(repository);
+    std::atomic<std::size_t> remaining(missing.size());
+    for (std::size_t i = 0; i < missing.size(); ++i)
+    {
+      pool->Submit(
+        [&, i]
+        {
+          try
+          {
+            add_record(handles.Get(), missing[i], &records[i]);
+          }
+          catch (const git::Error& error)
+          {
+            // The commit is left out of the index, so it is always looked at.
+            fprintf(stderr, "Error: %s\n", error.what());
+          }
+          --remaining;
+        });
+    }
+    pool->RunUntil([&remaining]{ return remaining == 0; });
+  }
+
+  std::vector<unsigned char> all;
+  for (auto record = std::begin(records); record != std::end(records);
+       ++record)
+  {
+    all.insert(all.end(), record->begin(), record->end());
+  }
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  Append(all);
+  myRecords.push_back(std::move(all));
+  Add(myRecords.back().data(), myRecords.back().size());
+}
+
+bool git::ChangedPathIndex::MayHaveChanged(const git_oid& commit,
+                                           const ChangedPath& path)
+{
+  Key key;
+  std::memcpy(key.data(), commit.id, key.size());
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  const auto found = myFilters.find(key);
+  if (found == myFilters.end() || found->second.size == 0) return true;
+
+  const Filter& filter = found->second;
+  for (std::uint32_t i = 0; i < hashCount; ++i)
+  {
+    const std::uint32_t bit = bit_of(path.myHashes, i, filter.size * 8);
+    if (!(filter.bits[bit / 8] & (1u << (bit % 8)))) return false;
+  }
+  return true;
+}
+
+git::ChangedPaths::ChangedPaths(const std::string& directory)
+: myDirectory(directory),
+  myPrevious(currentChangedPaths)
+{
+  // The filters decide which commits are skipped, so only a directory nobody
+  // else can write to is used.
+  if (!FileCache::CreatePrivateDirectory(myDirectory)) myDirectory.clear();
+
+  currentChangedPaths = this;
+}
+
+git::ChangedPaths::~ChangedPaths()
+{
+  currentChangedPaths = myPrevious;
+}
+
+git::ChangedPaths* git::ChangedPaths::Current()
+{
+  return currentChangedPaths;
+}
+
+git::ChangedPathIndex& git::ChangedPaths::Index(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  std::unique_ptr<ChangedPathIndex>& index = myIndexes[name];
+  if (!index)
+  {
+    index.reset(new ChangedPathIndex(
+      myDirectory.empty() ? myDirectory : myDirectory + '/' + name));
+  }
+  return *index;
+}
+
+//===--------------------------- End of the file --------------------------===//
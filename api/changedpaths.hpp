@@ -0,0 +1,188 @@
+#ifndef CHANGED_PATHS_HPP_
+#define CHANGED_PATHS_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : ChangedPaths
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Keeps an index of the paths changed by each commit, so the history of a
+// path can be found without comparing the trees of every commit.
+//
+// For each commit the index has a Bloom filter of the paths it changed
+// compared to its first parent, including the directories they are in. A
+// filter can say a path was definitely not changed, in which case the commit
+// is skipped without being read, otherwise the trees are looked at to be
+// sure. A commit which changed more than a few hundred paths has no filter,
+// as it would rarely rule anything out.
+//
+// The filters are appended to a file for each repository, which is mapped
+// into memory when the index is first used. The commits that aren't in it
+// yet are diffed on the ThreadPool as a walk reaches them and added to the
+// end, so the file grows with the history. It is shared by every process
+// using the same directory, which lock it while they append.
+//
+// Usage:
+// {
+//   git::ChangedPaths changedPaths("/var/cache/gitjson/paths");
+//   ...
+//   git::ChangedPathIndex& index = changedPaths.Index("gitweb");
+//   const git::ChangedPath path("api/gitjson.cpp");
+//   index.Extend(repository, commits);
+//   if (index.MayHaveChanged(commits.front(), path) &&
+//       git::IsPathChanged(repository, commit, path.Path(), false))
+//   {
+//     ...
+//   }
+// }
+//
+// Known shortcomings:
+//   The file is only kept on POSIX systems, elsewhere the index is only kept
+//   in memory.
+//
+//===----------------------------------------------------------------------===//
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct git_commit;
+struct git_oid;
+
+namespace git
+{
+  class Repository;
+
+  // A path to look for in a ChangedPathIndex, which is hashed once for all the
+  // commits it is looked for in.
+  class ChangedPath
+  {
+  public:
+    // Leading and trailing slashes are ignored.
+    explicit ChangedPath(const std::string& path);
+
+    const std::string& Path() const { return myPath; }
+
+  private:
+    friend class ChangedPathIndex;
+
+    std::string myPath;
+    std::uint32_t myHashes[2];
+  };
+
+  // Returns true if the file or directory at the path in the commit differs
+  // from the one in each of its parents, or for a commit without parents, if
+  // there is one. With isFirstParentOnly only the first parent is compared,
+  // as for a history that only follows the first parents of merges.
+  //
+  // Throws git::Error if a parent can't be read.
+  bool IsPathChanged(Repository& repository, const git_commit* commit,
+                     const std::string& path, bool isFirstParentOnly);
+
+  class ChangedPathIndex
+  {
+  public:
+    // Maps the file at the given path, if there is one. With an empty path the
+    // index is only kept in memory.
+    ChangedPathIndex(const std::string& path);
+    ~ChangedPathIndex();
+
+    // Adds the commits that aren't in the index yet and appends them to the
+    // file. Commits which can't be read are left out.
+    void Extend(Repository& repository, const std::vector<git_oid>& commits);
+
+    // Returns false if the commit definitely didn't change the path compared
+    // to its first parent. Otherwise, or if the commit isn't in the index,
+    // returns true.
+    bool MayHaveChanged(const git_oid& commit, const ChangedPath& path);
+
+  private:
+    ChangedPathIndex(const ChangedPathIndex&); /* = delete; */
+    ChangedPathIndex& operator =(const ChangedPathIndex&); /* = delete; */
+
+    typedef std::array<unsigned char, 20> Key;
+
+    // The object ids are SHA-1 hashes so any part of them is a good hash.
+    struct Hash
+    {
+      std::size_t operator()(const Key& key) const
+      {
+        std::size_t hash;
+        std::memcpy(&hash, key.data() + 1, sizeof(hash));
+        return hash;
+      }
+    };
+
+    // The bits of a Bloom filter, which are in the mapped file or in
+    // myRecords. A filter without any bits may contain anything.
+    struct Filter
+    {
+      const unsigned char* bits;
+      std::uint32_t size;
+    };
+
+    // Adds the filters of the complete records at the start of the data,
+    // which must not move, returning the number of bytes they take up.
+    std::size_t Add(const unsigned char* data, std::size_t size);
+
+    // Appends the records to the file, first adding any that were appended
+    // by other processes since it was last read.
+    void Append(const std::vector<unsigned char>& records);
+
+    std::string myPath;
+
+    // The file as it was when the index was created.
+    const unsigned char* myData;
+    std::size_t mySize;
+
+    // The end of the records in the file which have been added.
+    std::size_t myEnd;
+
+    // The records added since the file was mapped.
+    std::deque<std::vector<unsigned char>> myRecords;
+
+    std::unordered_map<Key, Filter, Hash> myFilters;
+    std::mutex myMutex;
+  };
+
+  // Keeps the index of each repository, in a file named after it in a
+  // directory, while an instance exists.
+  class ChangedPaths
+  {
+  public:
+    // Makes this the current instance until it is destroyed. The directory is
+    // created as by FileCache::CreatePrivateDirectory(), and if it can't be
+    // used the indexes are only kept in memory.
+    ChangedPaths(const std::string& directory);
+    ~ChangedPaths();
+
+    // Returns the instance in use or null if there is none.
+    static ChangedPaths* Current();
+
+    // Returns the index for the repository with the given name.
+    ChangedPathIndex& Index(const std::string& name);
+
+  private:
+    ChangedPaths(const ChangedPaths&); /* = delete; */
+    ChangedPaths& operator =(const ChangedPaths&); /* = delete; */
+
+    std::string myDirectory;
+    std::map<std::string, std::unique_ptr<ChangedPathIndex>> myIndexes;
+    std::mutex myMutex;
+
+    // The instance that was current when this one was created, if any.
+    ChangedPaths* myPrevious;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,527 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : CommitGraph
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "commitgraph.hpp"
+
+#include "repository.hpp"
+#include "request.hpp"
+
+#include <algorithm>
+#include <queue>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+// The layout of the commit-graph file, see Documentation/technical/
+// commit-graph-format.txt in git.
+static const std::size_t headerSize = 8;
+static const std::size_t chunkEntrySize = 12;
+static const std::size_t commitDataSize = GIT_OID_RAWSZ + 16;
+static const std::uint32_t fanoutChunk = 0x4f494446;  // OIDF
+static const std::uint32_t idsChunk = 0x4f49444c;     // OIDL
+static const std::uint32_t commitsChunk = 0x43444154; // CDAT
+static const std::uint32_t edgesChunk = 0x45444745;   // EDGE
+static const std::uint32_t noParent = 0x70000000;
+static const std::uint32_t extraEdges = 0x80000000;
+static const std::uint32_t lastEdge = 0x80000000;
+
+// The number of commits whose generations were worked out that are kept, once
+// there would be more they are all forgotten. One walk can add more than
+// this, in which case those are kept until the next one.
+static const std::size_t computedCapacity = 1 << 18;
+
+static std::uint32_t read32(const unsigned char* data)
+{
+  return static_cast<std::uint32_t>(data[0]) << 24 |
+    static_cast<std::uint32_t>(data[1]) << 16 |
+    static_cast<std::uint32_t>(data[2]) << 8 |
+    static_cast<std::uint32_t>(data[3]);
+}
+
+static std::uint64_t read64(const unsigned char* data)
+{
+  return static_cast<std::uint64_t>(read32(data)) << 32 | read32(data + 4);
+}
+
+git::CommitGraph::CommitGraph()
+: myData(nullptr),
+  mySize(0),
+  myModified(0),
+  myFanout(nullptr),
+  myIds(nullptr),
+  myCommits(nullptr),
+  myEdges(nullptr),
+  myEdgeCount(0),
+  myCommitCount(0)
+{
+}
+
+git::CommitGraph::~CommitGraph()
+{
+  Unload();
+}
+
+git::CommitGraph::Key git::CommitGraph::KeyOf(const git_oid& id)
+{
+  Key key;
+  std::memcpy(key.data(), id.id, key.size());
+  return key;
+}
+
+void git::CommitGraph::Load(const std::string& path)
+{
+  const std::string file = path + "objects/info/commit-graph";
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  struct stat status;
+  if (stat(file.c_str(), &status) != 0)
+  {
+    Unload();
+    return;
+  }
+
+  const std::int64_t modified = static_cast<std::int64_t>(status.st_mtime);
+  const std::size_t size = static_cast<std::size_t>(status.st_size);
+  if (myData && modified == myModified && size == mySize) return;
+
+  Unload();
+  if (size < headerSize + chunkEntrySize) return;
+
+#ifndef _WIN32
+  const int descriptor = open(file.c_str(), O_RDONLY);
+  if (descriptor == -1) return;
+  void* const data =
+    mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  close(descriptor);
+  if (data == MAP_FAILED) return;
+  myData = static_cast<const unsigned char*>(data);
+#else
+  std::ifstream stream(file, std::ios::binary);
+  unsigned char* const data = new unsigned char[size];
+  if (!stream.read(reinterpret_cast<char*>(data), size))
+  {
+    delete[] data;
+    return;
+  }
+  myData = data;
+#endif
+  mySize = size;
+  myModified = modified;
+
+  // Only version 1 with SHA-1 is understood, and not a file that is part of
+  // a chain of them (which has base graphs).
+  const unsigned char* const header = myData;
+  const std::size_t chunkCount = header[6];
+  if (std::memcmp(header, "CGPH", 4) != 0 || header[4] != 1 ||
+      header[5] != 1 || header[7] != 0 ||
+      mySize < headerSize + (chunkCount + 1) * chunkEntrySize)
+  {
+    Unload();
+    return;
+  }
+
+  std::size_t idsSize = 0;
+  std::size_t commitsSize = 0;
+  for (std::size_t i = 0; i < chunkCount; ++i)
+  {
+    const unsigned char* const entry =
+      myData + headerSize + i * chunkEntrySize;
+    const std::uint64_t start = read64(entry + 4);
+    const std::uint64_t end = read64(entry + chunkEntrySize + 4);
+    if (start > end || end > mySize)
+    {
+      Unload();
+      return;
+    }
+
+    const unsigned char* const chunk = myData + start;
+    const std::size_t length = static_cast<std::size_t>(end - start);
+    switch (read32(entry))
+    {
+    case fanoutChunk:
+      if (length >= 256 * 4) myFanout = chunk;
+      break;
+    case idsChunk:
+      myIds = chunk;
+      idsSize = length;
+      break;
+    case commitsChunk:
+      myCommits = chunk;
+      commitsSize = length;
+      break;
+    case edgesChunk:
+      myEdges = chunk;
+      myEdgeCount = length / 4;
+      break;
+    }
+  }
+
+  if (!myFanout || !myIds || !myCommits)
+  {
+    Unload();
+    return;
+  }
+
+  // Files written before git had generation numbers have zero for all of
+  // them, so they can't be used.
+  myCommitCount = read32(myFanout + 255 * 4);
+  if (idsSize < std::size_t(myCommitCount) * GIT_OID_RAWSZ ||
+      commitsSize < std::size_t(myCommitCount) * commitDataSize ||
+      (myCommitCount > 0 && GenerationAt(0) == 0))
+  {
+    Unload();
+  }
+}
+
+void git::CommitGraph::Unload()
+{
+  if (myData)
+  {
+#ifndef _WIN32
+    munmap(const_cast<unsigned char*>(myData), mySize);
+#else
+    delete[] myData;
+#endif
+  }
+
+  myData = nullptr;
+  mySize = 0;
+  myModified = 0;
+  myFanout = nullptr;
+  myIds = nullptr;
+  myCommits = nullptr;
+  myEdges = nullptr;
+  myEdgeCount = 0;
+  myCommitCount = 0;
+}
+
+bool git::CommitGraph::PositionInFile(const git_oid& id,
+                                      std::uint32_t* position) const
+{
+  if (!myData) return false;
+
+  // The fan-out gives the number of ids whose first byte is at most each
+  // value, so the ids starting with the same byte as this one are between the
+  // previous count and this one.
+  const unsigned char first = id.id[0];
+  std::uint32_t low = first == 0 ? 0 : read32(myFanout + (first - 1) * 4);
+  std::uint32_t high = read32(myFanout + first * 4);
+  if (high > myCommitCount) return false;
+
+  while (low < high)
+  {
+    const std::uint32_t middle = low + (high - low) / 2;
+    const int order =
+      std::memcmp(myIds + std::size_t(middle) * GIT_OID_RAWSZ, id.id,
+                  GIT_OID_RAWSZ);
+    if (order == 0)
+    {
+      *position = middle;
+      return true;
+    }
+
+    if (order < 0) low = middle + 1;
+    else high = middle;
+  }
+  return false;
+}
+
+std::uint32_t git::CommitGraph::GenerationAt(std::uint32_t position) const
+{
+  // The generation is the top 30 bits, the rest is the commit time.
+  const unsigned char* const data =
+    myCommits + std::size_t(position) * commitDataSize;
+  return read32(data + GIT_OID_RAWSZ + 8) >> 2;
+}
+
+bool git::CommitGraph::ParentsAt(std::uint32_t position,
+                                 std::vector<git_oid>* parents) const
+{
+  const auto add = [this, parents](std::uint32_t parent)
+  {
+    if (parent >= myCommitCount) return false;
+
+    git_oid id;
+    git_oid_fromraw(&id, myIds + std::size_t(parent) * GIT_OID_RAWSZ);
+    parents->push_back(id);
+    return true;
+  };
+
+  const unsigned char* const data =
+    myCommits + std::size_t(position) * commitDataSize;
+  const std::uint32_t first = read32(data + GIT_OID_RAWSZ);
+  const std::uint32_t second = read32(data + GIT_OID_RAWSZ + 4);
+
+  parents->clear();
+  if (first == noParent) return true;
+  if (!add(first)) return false;
+  if (second == noParent) return true;
+  if (!(second & extraEdges)) return add(second);
+
+  // A merge of more than two has the rest of its parents in the edges, the
+  // last of which is marked.
+  for (std::size_t edge = second & ~extraEdges; edge < myEdgeCount; ++edge)
+  {
+    const std::uint32_t parent = read32(myEdges + edge * 4);
+    if (!add(parent & ~lastEdge)) return false;
+    if (parent & lastEdge) return true;
+  }
+  return false;
+}
+
+void git::CommitGraph::Find(git_repository* repository, const git_oid& id,
+                            GraphCommit* commit)
+{
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+
+    std::uint32_t position = 0;
+    if (PositionInFile(id, &position) &&
+        ParentsAt(position, &commit->parents))
+    {
+      commit->generation = GenerationAt(position);
+      return;
+    }
+
+    const auto computed = myComputed.find(KeyOf(id));
+    if (computed != myComputed.end())
+    {
+      *commit = computed->second;
+      return;
+    }
+  }
+
+  Commits computed;
+  Compute(repository, id, &computed);
+  *commit = computed[KeyOf(id)];
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  if (myComputed.size() + computed.size() > computedCapacity)
+  {
+    myComputed.clear();
+  }
+  for (auto entry = std::begin(computed); entry != std::end(computed);
+       ++entry)
+  {
+    myComputed.emplace(entry->first, std::move(entry->second));
+  }
+}
+
+bool git::CommitGraph::Known(const git_oid& id, std::uint32_t* generation)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+
+  std::uint32_t position = 0;
+  if (PositionInFile(id, &position))
+  {
+    *generation = GenerationAt(position);
+    return true;
+  }
+
+  const auto computed = myComputed.find(KeyOf(id));
+  if (computed == myComputed.end()) return false;
+  *generation = computed->second.generation;
+  return true;
+}
+
+void git::CommitGraph::Compute(git_repository* repository, const git_oid& id,
+                               Commits* commits)
+{
+  StageTimer timer("read");
+
+  // The commits are read depth first, and the generation of each is worked
+  // out once all of its parents have one. The parents are kept in the
+  // meantime so no commit is read twice. The commit asked for is always
+  // worked out, even if another thread has done so in the meantime.
+  std::unordered_map<Key, std::vector<git_oid>, Hash> pending;
+  std::vector<git_oid> stack(1, id);
+  while (!stack.empty())
+  {
+    const git_oid current = stack.back();
+    const Key key = KeyOf(current);
+    std::uint32_t known = 0;
+    if (commits->count(key) != 0 ||
+        (stack.size() > 1 && Known(current, &known)))
+    {
+      stack.pop_back();
+      continue;
+    }
+
+    auto parents = pending.find(key);
+    if (parents == pending.end())
+    {
+      git_commit* commit = nullptr;
+      if (git_commit_lookup(&commit, repository, &current) != 0)
+      {
+        char sha[GIT_OID_HEXSZ + 1];
+        throw git::Error(std::string("Could not read the commit ") +
+                         git_oid_tostr(sha, sizeof(sha), &current));
+      }
+
+      std::vector<git_oid> ids;
+      for (unsigned int i = 0, count = git_commit_parentcount(commit);
+           i < count; ++i)
+      {
+        ids.push_back(*git_commit_parent_id(commit, i));
+      }
+      git_commit_free(commit);
+      parents = pending.emplace(key, std::move(ids)).first;
+    }
+
+    std::uint32_t generation = 1;
+    bool isReady = true;
+    for (auto parent = std::begin(parents->second);
+         parent != std::end(parents->second); ++parent)
+    {
+      const auto computed = commits->find(KeyOf(*parent));
+      if (computed != commits->end())
+      {
+        generation = std::max(generation, computed->second.generation + 1);
+      }
+      else if (Known(*parent, &known))
+      {
+        generation = std::max(generation, known + 1);
+      }
+      else
+      {
+        stack.push_back(*parent);
+        isReady = false;
+      }
+    }
+
+    if (isReady)
+    {
+      GraphCommit& computed = (*commits)[key];
+      computed.generation = generation;
+      computed.parents = std::move(parents->second);
+      pending.erase(parents);
+      stack.pop_back();
+    }
+  }
+}
+
+git::Comparison git::CompareCommits(Repository& repository,
+                                    const git_oid& base,
+                                    const git_oid& head)
+{
+  // What is known about each commit that has been reached. A commit reached
+  // from both sides that isn't reachable from another such commit is a merge
+  // base, and everything it reaches is stale.
+  enum
+  {
+    FromBase = 1,
+    FromHead = 2,
+    Stale = 4,
+    Queued = 8
+  };
+
+  struct Entry
+  {
+    std::uint32_t generation;
+    git_oid id;
+
+    bool operator <(const Entry& other) const
+    {
+      return generation < other.generation;
+    }
+  };
+
+  CommitGraph& graph = repository.Graph();
+  StageTimer timer("walk");
+
+  Comparison comparison;
+  comparison.behindBy = 0;
+
+  std::unordered_map<CommitGraph::Key, unsigned char, CommitGraph::Hash>
+    flags;
+  std::priority_queue<Entry> queue;
+
+  // The number of queued commits that aren't stale, once there are none the
+  // rest of the history is reachable from both and a merge base.
+  std::size_t active = 0;
+
+  GraphCommit commit;
+  const auto reach = [&](const git_oid& id, unsigned char from)
+  {
+    unsigned char& flag = flags[CommitGraph::KeyOf(id)];
+    const unsigned char before = flag;
+    flag |= from;
+    if (before == 0)
+    {
+      GraphCommit reached;
+      graph.Find(repository, id, &reached);
+      queue.push(Entry{ reached.generation, id });
+      flag |= Queued;
+      if (!(flag & Stale)) ++active;
+    }
+    else if ((before & Queued) && !(before & Stale) && (flag & Stale))
+    {
+      --active;
+    }
+  };
+
+  reach(base, FromBase);
+  reach(head, FromHead);
+  while (active > 0)
+  {
+    const Entry entry = queue.top();
+    queue.pop();
+
+    unsigned char& flag = flags[CommitGraph::KeyOf(entry.id)];
+    flag &= ~Queued;
+    if (!(flag & Stale)) --active;
+
+    if ((flag & (FromBase | FromHead)) == (FromBase | FromHead))
+    {
+      if (!(flag & Stale))
+      {
+        comparison.mergeBases.push_back(entry.id);
+        flag |= Stale;
+      }
+    }
+    else if (flag & FromHead)
+    {
+      comparison.ahead.push_back(entry.id);
+    }
+    else
+    {
+      ++comparison.behindBy;
+    }
+
+    const unsigned char from = flag & (FromBase | FromHead | Stale);
+    graph.Find(repository, entry.id, &commit);
+    for (auto parent = std::begin(commit.parents);
+         parent != std::end(commit.parents); ++parent)
+    {
+      reach(*parent, from);
+    }
+  }
+
+  // The commits were reached from the highest generation down, so reversing
+  // them puts each parent before its children.
+  std::reverse(comparison.ahead.begin(), comparison.ahead.end());
+  return comparison;
+}
+
+//===--------------------------- End of the file --------------------------===//
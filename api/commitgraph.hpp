@@ -0,0 +1,168 @@
+#ifndef COMMIT_GRAPH_HPP_
+#define COMMIT_GRAPH_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : CommitGraph
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Gives the parents and generation number of the commits of a repository,
+// and uses them to compare two commits.
+//
+// The generation of a commit is one more than the largest generation of its
+// parents (a root commit is 1), so a commit can never be reached from one with
+// a lower generation. Walking the commits from the highest generation down
+// means each commit is only looked at once everything that can reach it has
+// been, so a comparison stops as soon as the commits left are reachable from
+// both sides, instead of going through the rest of the history.
+//
+// The generations are read from the commit-graph file that git writes (with
+// git commit-graph write or gc), which is mapped into memory, so the commits
+// in it aren't read at all. The generations of the other commits are worked
+// out from their history, without holding up the other threads using the
+// graph, and remembered as a commit never changes. Only so many of them are
+// remembered, beyond which they are forgotten and worked out again.
+//
+// Usage:
+// {
+//   git::Repository repository("gitweb");
+//   const git::Comparison comparison =
+//     git::CompareCommits(repository, base, head);
+//   printf("%zu ahead, %zu behind\n", comparison.ahead.size(),
+//          comparison.behindBy);
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct git_oid;
+struct git_repository;
+
+namespace git
+{
+  class Repository;
+
+  // What is known about a commit for walking the history.
+  struct GraphCommit
+  {
+    std::uint32_t generation;
+    std::vector<git_oid> parents;
+  };
+
+  class CommitGraph
+  {
+  public:
+    CommitGraph();
+    ~CommitGraph();
+
+    // Maps the commit-graph file of the repository at the given path (as
+    // given by git_repository_path) if it has changed since it was last
+    // mapped. Without the file all the generations are worked out.
+    void Load(const std::string& path);
+
+    // Sets the generation and parents of the commit.
+    //
+    // Throws git::Error if the commit, or one of its ancestors when its
+    // generation has to be worked out, can't be read.
+    void Find(git_repository* repository, const git_oid& id,
+              GraphCommit* commit);
+
+    // Identifies a commit in a hash table.
+    typedef std::array<unsigned char, 20> Key;
+
+    // The object ids are SHA-1 hashes so any part of them is a good hash.
+    struct Hash
+    {
+      std::size_t operator()(const Key& key) const
+      {
+        std::size_t hash;
+        std::memcpy(&hash, key.data() + 1, sizeof(hash));
+        return hash;
+      }
+    };
+
+    static Key KeyOf(const git_oid& id);
+
+  private:
+    CommitGraph(const CommitGraph&); /* = delete; */
+    CommitGraph& operator =(const CommitGraph&); /* = delete; */
+
+    // Unmaps the file, if there is one.
+    void Unload();
+
+    // Returns true if the commit is in the file, setting its position in it.
+    bool PositionInFile(const git_oid& id, std::uint32_t* position) const;
+
+    // Returns the generation of the commit at the position in the file.
+    std::uint32_t GenerationAt(std::uint32_t position) const;
+
+    // Returns false if the file refers to a commit that isn't in it.
+    bool ParentsAt(std::uint32_t position,
+                   std::vector<git_oid>* parents) const;
+
+    // Returns true if the generation of the commit is in the file or has been
+    // worked out, setting it.
+    bool Known(const git_oid& id, std::uint32_t* generation);
+
+    typedef std::unordered_map<Key, GraphCommit, Hash> Commits;
+
+    // Works out the generation of the commit and each of its ancestors that
+    // aren't known yet, adding them to the commits. This is done without
+    // holding myMutex.
+    void Compute(git_repository* repository, const git_oid& id,
+                 Commits* commits);
+
+    // The commit-graph file, and when it was last modified and its size so
+    // that a new one is noticed.
+    const unsigned char* myData;
+    std::size_t mySize;
+    std::int64_t myModified;
+
+    // The chunks of the file: the fan-out of the first byte of the ids, the
+    // ids in order, the data of each commit and the extra parents of merges
+    // with more than two.
+    const unsigned char* myFanout;
+    const unsigned char* myIds;
+    const unsigned char* myCommits;
+    const unsigned char* myEdges;
+    std::size_t myEdgeCount;
+    std::uint32_t myCommitCount;
+
+    // The commits that aren't in the file whose generations were worked out.
+    Commits myComputed;
+    std::mutex myMutex;
+  };
+
+  // The result of comparing a head commit against a base commit.
+  struct Comparison
+  {
+    // The commits reachable from the head but not the base, with the parents
+    // before their children.
+    std::vector<git_oid> ahead;
+
+    // The number of commits reachable from the base but not the head.
+    std::size_t behindBy;
+
+    // The best common ancestors, of which there is usually one. This is empty
+    // if the histories are unrelated.
+    std::vector<git_oid> mergeBases;
+  };
+
+  // Compares the commits using the generations of Repository::Graph().
+  //
+  // Throws git::Error if the commits can't be read.
+  Comparison CompareCommits(Repository& repository, const git_oid& base,
+                            const git_oid& head);
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,123 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : DeflateSink
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "deflatesink.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <zlib.h>
+
+// The size of the buffers for what is to be compressed and what has been.
+static const std::size_t bufferSize = 64 * 1024;
+
+struct DeflateSink::Stream
+{
+  z_stream stream;
+  char output[bufferSize];
+};
+
+DeflateSink::DeflateSink(OutputSink* output, Format format, int level)
+: myOutput(*output),
+  myStream(new Stream()),
+  myStorage(bufferSize),
+  isFinished(false)
+{
+  // Adding 16 to the window bits writes a gzip header and trailer rather
+  // than the zlib ones.
+  const int windowBits = format == Gzip ? 15 + 16 : 15;
+  if (deflateInit2(&myStream->stream, level, Z_DEFLATED, windowBits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    throw std::runtime_error("Could not start compressing.");
+  }
+
+  myBegin = myCursor = myStorage.data();
+  myEnd = myBegin + myStorage.size();
+}
+
+DeflateSink::~DeflateSink()
+{
+  deflateEnd(&myStream->stream);
+}
+
+void DeflateSink::Flush()
+{
+  if (isFinished) return;
+  Deflate(nullptr, 0, Z_SYNC_FLUSH);
+  myOutput.Flush();
+}
+
+void DeflateSink::Finish()
+{
+  if (isFinished) return;
+  Deflate(nullptr, 0, Z_FINISH);
+  isFinished = true;
+}
+
+void DeflateSink::Overflow(const char* data, std::size_t size)
+{
+  // Small writes are copied into the now empty buffer, where as large ones
+  // are compressed directly rather than copying them.
+  Deflate(nullptr, 0, Z_NO_FLUSH);
+  if (size < myStorage.size() / 2)
+  {
+    std::memcpy(myCursor, data, size);
+    myCursor += size;
+  }
+  else
+  {
+    Deflate(data, size, Z_NO_FLUSH);
+  }
+}
+
+void DeflateSink::Deflate(const char* data, std::size_t size, int flush)
+{
+  z_stream& stream = myStream->stream;
+
+  // The buffer goes first, then the data.
+  const struct { const char* data; std::size_t size; } parts[] = {
+    { myBegin, static_cast<std::size_t>(myCursor - myBegin) },
+    { data, size },
+  };
+  myCursor = myBegin;
+
+  for (int i = 0; i < 2; ++i)
+  {
+    const bool isLast = i == 1;
+    if (!isLast && parts[i].size == 0) continue;
+
+    // A uInt may be smaller than a std::size_t, so large data is compressed
+    // a piece at a time.
+    const char* cursor = parts[i].data;
+    std::size_t remaining = parts[i].size;
+    do
+    {
+      const uInt piece =
+        static_cast<uInt>(std::min<std::size_t>(remaining, 1u << 30));
+      stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(cursor));
+      stream.avail_in = piece;
+      cursor += piece;
+      remaining -= piece;
+
+      const int mode = isLast && remaining == 0 ? flush : Z_NO_FLUSH;
+      do
+      {
+        stream.next_out = reinterpret_cast<Bytef*>(myStream->output);
+        stream.avail_out = bufferSize;
+        deflate(&stream, mode);
+        myOutput.Write(myStream->output, bufferSize - stream.avail_out);
+      }
+      while (stream.avail_out == 0);
+    }
+    while (remaining > 0);
+  }
+}
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,68 @@
+#ifndef DEFLATE_SINK_HPP_
+#define DEFLATE_SINK_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : DeflateSink
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Compresses what is written to it with zlib and writes the result to
+// another sink, as it goes, in the gzip or zlib format (which are the gzip
+// and deflate content codings of HTTP).
+//
+// Usage:
+// {
+//   BufferSink body;
+//   DeflateSink compressed(&body, DeflateSink::Gzip);
+//   compressed.Write("{\"size\": 1024}\n");
+//   compressed.Finish();
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "sink.hpp"
+
+#include <memory>
+#include <vector>
+
+class DeflateSink : public OutputSink
+{
+public:
+  enum Format
+  {
+    Gzip,
+    Zlib,
+  };
+
+  // The level is from 1 (fastest) to 9 (smallest), or -1 for zlib's default.
+  DeflateSink(OutputSink* output, Format format, int level = -1);
+  ~DeflateSink();
+
+  // Compresses what has been written so far and passes it on, which makes
+  // the compression slightly worse so should only be used when the output
+  // can't wait.
+  void Flush() override;
+
+  // Compresses what is left and writes the end of the stream. Nothing can
+  // be written afterwards.
+  void Finish();
+
+protected:
+  void Overflow(const char* data, std::size_t size) override;
+
+private:
+  struct Stream;
+
+  // Compresses the buffer followed by the data with the given zlib flush
+  // mode.
+  void Deflate(const char* data, std::size_t size, int flush);
+
+  OutputSink& myOutput;
+  std::unique_ptr<Stream> myStream;
+  std::vector<char> myStorage;
+  bool isFinished;
+};
+
+//===--------------------------- End of the file --------------------------===//
+#endif
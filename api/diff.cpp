@@ -0,0 +1,369 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Diff
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "diff.hpp"
+
+#include "repository.hpp"
+#include "request.hpp"
+#include "threadpool.hpp"
+
+#include <atomic>
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+// The number of changed files below which the blobs are diffed on the calling
+// thread, as it isn't worth opening the repository on the other threads.
+static const std::size_t minimumParallelFiles = 8;
+
+// The largest patch of a file that is kept, and the most the patches of all
+// the files can add up to, beyond which the patches of the later files are
+// left out.
+static const std::size_t maximumPatchSize = 1024 * 1024;
+static const std::size_t maximumPatchesSize = 8 * 1024 * 1024;
+
+static git::DiffCache* currentCache = nullptr;
+
+static const char* status_of(git_delta_t status)
+{
+  switch (status)
+  {
+  case GIT_DELTA_ADDED:
+    return "added";
+  case GIT_DELTA_DELETED:
+    return "removed";
+  case GIT_DELTA_RENAMED:
+    return "renamed";
+  case GIT_DELTA_COPIED:
+    return "copied";
+  case GIT_DELTA_TYPECHANGE:
+    return "changed";
+  default:
+    return "modified";
+  }
+}
+
+namespace
+{
+  // The sides of a changed file, which are given to the thread that diffs
+  // it. An id is only set if that side is a blob.
+  struct Sides
+  {
+    git_oid oldId;
+    git_oid newId;
+    bool hasOld;
+    bool hasNew;
+    std::string oldPath;
+  };
+
+  // Appends the text to the patch of the file, unless it has gone over
+  // maximumPatchSize, in which case it has no patch.
+  void add_to_patch(git::Diff::File* file, const char* text,
+                    std::size_t length)
+  {
+    if (!file->hasPatch) return;
+    if (file->patch.size() + length > maximumPatchSize)
+    {
+      file->hasPatch = false;
+      std::string().swap(file->patch);
+      return;
+    }
+    file->patch.append(text, length);
+  }
+
+  int add_hunk(const git_diff_delta*, const git_diff_hunk* hunk,
+               void* payload)
+  {
+    add_to_patch(static_cast<git::Diff::File*>(payload), hunk->header,
+                 hunk->header_len);
+    return 0;
+  }
+
+  int add_line(const git_diff_delta*, const git_diff_hunk*,
+               const git_diff_line* line, void* payload)
+  {
+    git::Diff::File* const file = static_cast<git::Diff::File*>(payload);
+    const char origin = line->origin;
+    switch (origin)
+    {
+    case GIT_DIFF_LINE_ADDITION:
+      ++file->additions;
+      add_to_patch(file, &origin, 1);
+      break;
+    case GIT_DIFF_LINE_DELETION:
+      ++file->deletions;
+      add_to_patch(file, &origin, 1);
+      break;
+    case GIT_DIFF_LINE_CONTEXT:
+      add_to_patch(file, &origin, 1);
+      break;
+    default:
+      // The markers for a missing new line at the end of the file have it in
+      // their content.
+      break;
+    }
+    add_to_patch(file, line->content, line->content_len);
+    return 0;
+  }
+
+  // Returns roughly how many bytes the diff takes up in memory.
+  std::size_t size_of(const git::Diff& diff)
+  {
+    std::size_t size = sizeof(diff);
+    for (auto file = std::begin(diff.files); file != std::end(diff.files);
+         ++file)
+    {
+      size += sizeof(*file) + file->filename.capacity() +
+        file->previousFilename.capacity() + file->sha.capacity() +
+        file->patch.capacity();
+    }
+    return size;
+  }
+}
+
+// Diffs the blobs of the file, adding the lines added and removed to it, and
+// the patch if isWithPatches is true.
+//
+// Throws git::Error if either blob can't be read.
+static void diff_blobs(git::Repository& repository, const Sides& sides,
+                       bool isWithPatches, git::Diff::File* file)
+{
+  git_blob* oldBlob = nullptr;
+  git_blob* newBlob = nullptr;
+  if ((sides.hasOld &&
+       git_blob_lookup(&oldBlob, repository, &sides.oldId) != 0) ||
+      (sides.hasNew &&
+       git_blob_lookup(&newBlob, repository, &sides.newId) != 0))
+  {
+    git_blob_free(oldBlob);
+    throw git::Error("Could not read the blobs of " + file->filename);
+  }
+
+  file->isBinary = (oldBlob && git_blob_is_binary(oldBlob)) ||
+    (newBlob && git_blob_is_binary(newBlob));
+  file->hasPatch = isWithPatches && !file->isBinary;
+  int error = 0;
+  if (!file->isBinary)
+  {
+    git_diff_options options;
+    git_diff_init_options(&options, GIT_DIFF_OPTIONS_VERSION);
+    error = git_diff_blobs(oldBlob, sides.oldPath.c_str(),
+                           newBlob, file->filename.c_str(), &options,
+                           nullptr, nullptr,
+                           isWithPatches ? add_hunk : nullptr, add_line,
+                           file);
+  }
+  git_blob_free(newBlob);
+  git_blob_free(oldBlob);
+
+  if (error != 0)
+  {
+    throw git::Error("Could not diff " + file->filename);
+  }
+}
+
+std::shared_ptr<const git::Diff> git::DiffCommit(Repository& repository,
+                                                 const git_commit* commit)
+{
+  DiffCache* const cache = currentCache;
+  const std::string key =
+    repository.Name() + '\0' + git::HexOf(git_commit_id(commit));
+  if (cache)
+  {
+    if (auto diff = cache->Find(key)) return diff;
+  }
+
+  git_tree* tree = nullptr;
+  git_commit* parent = nullptr;
+  git_tree* parentTree = nullptr;
+  if (git_commit_tree(&tree, commit) != 0 ||
+      (git_commit_parentcount(commit) > 0 &&
+       (git_commit_parent(&parent, commit, 0) != 0 ||
+        git_commit_tree(&parentTree, parent) != 0)))
+  {
+    git_commit_free(parent);
+    git_tree_free(tree);
+    throw git::Error("Could not read the trees of the commit.");
+  }
+
+  std::shared_ptr<const Diff> diff;
+  try
+  {
+    diff = DiffTrees(repository, parentTree, tree, true);
+  }
+  catch (...)
+  {
+    git_tree_free(parentTree);
+    git_commit_free(parent);
+    git_tree_free(tree);
+    throw;
+  }
+  git_tree_free(parentTree);
+  git_commit_free(parent);
+  git_tree_free(tree);
+
+  if (cache) cache->Insert(key, diff);
+  return diff;
+}
+
+std::shared_ptr<const git::Diff> git::DiffTrees(Repository& repository,
+                                                const git_tree* from,
+                                                const git_tree* to,
+                                                bool isWithPatches)
+{
+  StageTimer timer("diff");
+
+  // Only the trees are read to find the changed files, so this is quick even
+  // when thousands of files changed.
+  git_diff* treeDiff = nullptr;
+  git_diff_find_options findOptions;
+  git_diff_find_init_options(&findOptions, GIT_DIFF_FIND_OPTIONS_VERSION);
+  findOptions.flags = GIT_DIFF_FIND_RENAMES;
+  if (git_diff_tree_to_tree(&treeDiff, repository,
+                            const_cast<git_tree*>(from),
+                            const_cast<git_tree*>(to), nullptr) != 0 ||
+      git_diff_find_similar(treeDiff, &findOptions) != 0)
+  {
+    git_diff_free(treeDiff);
+    throw git::Error("Could not compare the trees.");
+  }
+
+  auto result = std::make_shared<Diff>();
+  result->additions = 0;
+  result->deletions = 0;
+
+  const std::size_t count = git_diff_num_deltas(treeDiff);
+  std::vector<Sides> sides(count);
+  result->files.resize(count);
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    const git_diff_delta* const delta = git_diff_get_delta(treeDiff, i);
+    const bool isDeleted = delta->status == GIT_DELTA_DELETED;
+
+    Diff::File& file = result->files[i];
+    file.filename = isDeleted ? delta->old_file.path : delta->new_file.path;
+    if (delta->status == GIT_DELTA_RENAMED ||
+        delta->status == GIT_DELTA_COPIED)
+    {
+      file.previousFilename = delta->old_file.path;
+    }
+    file.status = status_of(delta->status);
+    file.sha = git::HexOf(isDeleted ? &delta->old_file.id : &delta->new_file.id);
+    file.additions = 0;
+    file.deletions = 0;
+    file.hasPatch = isWithPatches;
+    file.isBinary = false;
+
+    // Submodules have the id of a commit rather than a blob, so they are left
+    // out as are the sides that don't exist.
+    Sides& side = sides[i];
+    side.hasOld = delta->status != GIT_DELTA_ADDED &&
+      delta->old_file.mode != GIT_FILEMODE_COMMIT;
+    side.hasNew = !isDeleted && delta->new_file.mode != GIT_FILEMODE_COMMIT;
+    git_oid_cpy(&side.oldId, &delta->old_file.id);
+    git_oid_cpy(&side.newId, &delta->new_file.id);
+    side.oldPath = delta->old_file.path;
+  }
+  git_diff_free(treeDiff);
+
+  ThreadPool* const pool = ThreadPool::Current();
+  if (!pool || count < minimumParallelFiles)
+  {
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (sides[i].hasOld || sides[i].hasNew)
+      {
+        diff_blobs(repository, sides[i], isWithPatches, &result->files[i]);
+      }
+    }
+  }
+  else
+  {
+    RepositoryHandles handles(repository);
+    std::atomic<std::size_t> remaining(count);
+    std::mutex errorMutex;
+    std::string error;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      pool->Submit(
+        [&, i]
+        {
+          try
+          {
+            if (sides[i].hasOld || sides[i].hasNew)
+            {
+              diff_blobs(handles.Get(), sides[i], isWithPatches,
+                         &result->files[i]);
+            }
+          }
+          catch (const git::Error& exception)
+          {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error.empty()) error = exception.what();
+          }
+          --remaining;
+        });
+    }
+    pool->RunUntil([&remaining]{ return remaining == 0; });
+    if (!error.empty()) throw git::Error(error);
+  }
+
+  // The patches are left out in order of the files, rather than the order
+  // they were diffed in, so the same ones are always given.
+  std::size_t patchesSize = 0;
+  for (auto file = std::begin(result->files); file != std::end(result->files);
+       ++file)
+  {
+    result->additions += file->additions;
+    result->deletions += file->deletions;
+
+    patchesSize += file->patch.size();
+    if (patchesSize > maximumPatchesSize)
+    {
+      file->hasPatch = false;
+      std::string().swap(file->patch);
+    }
+  }
+  return result;
+}
+
+git::DiffCache::DiffCache(std::size_t capacity)
+: myDiffs(capacity),
+  myPrevious(currentCache)
+{
+  currentCache = this;
+}
+
+git::DiffCache::~DiffCache()
+{
+  currentCache = myPrevious;
+}
+
+git::DiffCache* git::DiffCache::Current()
+{
+  return currentCache;
+}
+
+std::shared_ptr<const git::Diff> git::DiffCache::Find(const std::string& key)
+{
+  return myDiffs.Find(key);
+}
+
+void git::DiffCache::Insert(const std::string& key,
+                            std::shared_ptr<const Diff> diff)
+{
+  const std::size_t size = size_of(*diff);
+  myDiffs.Insert(key, std::move(diff), size);
+}
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,129 @@
+#ifndef DIFF_HPP_
+#define DIFF_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Diff
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Works out the files changed between two trees, with the lines added and
+// removed from each and its patch, as given in the "files" and "stats" of a
+// commit by the GitHub API.
+//
+// The trees are compared on the calling thread, which only looks at the ids of
+// the entries, and then the blobs of the changed files are diffed by the
+// ThreadPool, each thread with its own handle to the repository. The diff of a
+// commit never changes, so the most recent ones are kept by a DiffCache.
+//
+// As on GitHub, the patch of a file is left out if it is too large, as are
+// the patches of the files after the first few megabytes of them, so a commit
+// that changed a great deal doesn't take up a great deal of memory.
+//
+// Usage:
+// {
+//   git::DiffCache cache(64 * 1024 * 1024);
+//   ...
+//   git::Repository repository("gitweb");
+//   const auto diff = git::DiffCommit(repository, commit);
+//   for (auto file = diff->files.begin(); ...)
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "lrucache.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct git_commit;
+struct git_tree;
+
+namespace git
+{
+  class Repository;
+
+  struct Diff
+  {
+    struct File
+    {
+      std::string filename;
+
+      // The name the file had before, if it was renamed or copied.
+      std::string previousFilename;
+
+      // One of added, removed, modified, renamed, copied or changed (when the
+      // type of the entry changed, such as from a file to a link).
+      const char* status;
+
+      // The blob of the file, or what it was if it was removed.
+      std::string sha;
+
+      std::size_t additions;
+      std::size_t deletions;
+
+      // The hunks of the diff without the header naming the files, which is
+      // empty if either side is a submodule. There is no patch (hasPatch is
+      // false) if either side is binary (isBinary) or it was too large.
+      std::string patch;
+      bool hasPatch;
+      bool isBinary;
+    };
+
+    std::vector<File> files;
+
+    // The totals over all the files.
+    std::size_t additions;
+    std::size_t deletions;
+  };
+
+  // Returns the diff of the commit against its first parent, or against an
+  // empty tree if it has none, from the DiffCache if it is there and adding it
+  // to the cache if there is one.
+  //
+  // Throws git::Error if the diff can't be worked out.
+  std::shared_ptr<const Diff> DiffCommit(Repository& repository,
+                                         const git_commit* commit);
+
+  // Returns the diff from one tree to the other, where either may be null for
+  // an empty tree. This isn't cached. Without isWithPatches only the lines
+  // added and removed are counted and none of the files have a patch.
+  //
+  // Throws git::Error if the diff can't be worked out.
+  std::shared_ptr<const Diff> DiffTrees(Repository& repository,
+                                        const git_tree* from,
+                                        const git_tree* to,
+                                        bool isWithPatches);
+
+  // Keeps the diffs that were most recently used.
+  class DiffCache
+  {
+  public:
+    // Makes this the current instance until it is destroyed. The capacity is
+    // the most bytes the diffs can take up.
+    DiffCache(std::size_t capacity);
+    ~DiffCache();
+
+    // Returns the instance in use or null if there is none.
+    static DiffCache* Current();
+
+    // Returns the diff with the given key or null if it isn't there.
+    std::shared_ptr<const Diff> Find(const std::string& key);
+
+    void Insert(const std::string& key, std::shared_ptr<const Diff> diff);
+
+  private:
+    DiffCache(const DiffCache&); /* = delete; */
+    DiffCache& operator =(const DiffCache&); /* = delete; */
+
+    LruCache<Diff> myDiffs;
+
+    // The instance that was current when this one was created, if any.
+    DiffCache* myPrevious;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,261 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : FileCache
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "filecache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+// How long a temporary file is left before it is assumed its writer has gone.
+static const std::time_t abandonedAfter = 60 * 60;
+
+FileCache::FileCache(const std::string& directory, std::uint64_t capacity)
+: myDirectory(directory),
+  myCapacity(capacity),
+  myTotal(0)
+{
+  // Without a directory nothing is ever found or added.
+  if (!CreatePrivateDirectory(myDirectory)) myDirectory.clear();
+  else Trim();
+}
+
+bool FileCache::CreatePrivateDirectory(const std::string& directory)
+{
+  // Creates each of the directories leading to it which are missing.
+  for (std::size_t slash = directory.find('/', 1);;
+       slash = directory.find('/', slash + 1))
+  {
+    mkdir(directory.substr(0, slash).c_str(), 0700);
+    if (slash == std::string::npos) break;
+  }
+
+  // A link could be replaced by whoever made it, so the directory itself has
+  // to be checked.
+  struct stat status;
+  if (lstat(directory.c_str(), &status) != 0)
+  {
+    fprintf(stderr, "Error: Could not create %s: %s\n", directory.c_str(),
+            std::strerror(errno));
+    return false;
+  }
+  if (!S_ISDIR(status.st_mode) || status.st_uid != geteuid() ||
+      (status.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+  {
+    fprintf(stderr, "Error: %s is not a directory only the current user can "
+            "write to, so it is not used.\n", directory.c_str());
+    return false;
+  }
+  return true;
+}
+
+int FileCache::Open(const std::string& name) const
+{
+  if (myDirectory.empty()) return -1;
+
+  const std::string path = myDirectory + "/" + name;
+  const int descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  // The modification time records when the file was last used.
+  if (descriptor != -1) futimens(descriptor, nullptr);
+  return descriptor;
+}
+
+FileCache::NewFile::NewFile(FileCache& cache, const std::string& name)
+: myCache(cache),
+  myPath(cache.myDirectory + "/" + name),
+  myTemporaryPath(myPath + ".XXXXXX"),
+  myDescriptor(-1),
+  mySize(0),
+  isFailed(false)
+{
+  if (!cache.myDirectory.empty()) myDescriptor = mkstemp(&myTemporaryPath[0]);
+}
+
+FileCache::NewFile::~NewFile()
+{
+  if (myDescriptor != -1)
+  {
+    close(myDescriptor);
+    unlink(myTemporaryPath.c_str());
+  }
+}
+
+bool FileCache::NewFile::Write(const char* data, std::size_t size)
+{
+  if (myDescriptor == -1 || isFailed) return false;
+
+  while (size > 0)
+  {
+    const ssize_t written = write(myDescriptor, data, size);
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+      isFailed = true;
+      return false;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+    mySize += static_cast<std::uint64_t>(written);
+  }
+  return true;
+}
+
+int FileCache::NewFile::Commit()
+{
+  if (myDescriptor == -1) return -1;
+
+  const bool isClosed = close(myDescriptor) == 0;
+  myDescriptor = -1;
+
+  // The file being replaced no longer counts.
+  struct stat status;
+  const std::uint64_t replaced = stat(myPath.c_str(), &status) == 0 ?
+    static_cast<std::uint64_t>(status.st_size) : 0;
+  if (!isClosed || isFailed ||
+      rename(myTemporaryPath.c_str(), myPath.c_str()) != 0)
+  {
+    unlink(myTemporaryPath.c_str());
+    return -1;
+  }
+
+  const int descriptor = open(myPath.c_str(), O_RDONLY | O_CLOEXEC);
+
+  // The files are only looked at when the total goes over the capacity, so
+  // adding a file doesn't take longer the more there are. A file that is
+  // smaller than the one it replaced is left to the next look to count.
+  if (mySize > replaced &&
+      (myCache.myTotal += mySize - replaced) > myCache.myCapacity)
+  {
+    myCache.Trim();
+  }
+  return descriptor;
+}
+
+void FileCache::Trim()
+{
+  struct File
+  {
+    std::string path;
+    std::time_t used;
+    std::uint64_t size;
+  };
+
+  std::unique_lock<std::mutex> lock(myTrimMutex, std::try_to_lock);
+  if (!lock) return;
+
+  DIR* directory = opendir(myDirectory.c_str());
+  if (!directory) return;
+
+  const std::time_t now = std::time(nullptr);
+  std::vector<File> files;
+  std::uint64_t total = 0;
+  while (const dirent* entry = readdir(directory))
+  {
+    if (entry->d_name[0] == '.') continue;
+
+    File file;
+    file.path = myDirectory + "/" + entry->d_name;
+
+    struct stat status;
+    if (stat(file.path.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+    {
+      continue;
+    }
+
+    // A temporary file is only removed once it has been left long enough
+    // that it can't still be being written.
+    if (std::strchr(entry->d_name, '.'))
+    {
+      if (now - status.st_mtime > abandonedAfter) unlink(file.path.c_str());
+      continue;
+    }
+
+    file.used = status.st_mtime;
+    file.size = static_cast<std::uint64_t>(status.st_size);
+    total += file.size;
+    files.push_back(std::move(file));
+  }
+  closedir(directory);
+
+  if (total > myCapacity)
+  {
+    const std::uint64_t lowWater = myCapacity - myCapacity / 8;
+    std::sort(files.begin(), files.end(),
+              [](const File& a, const File& b) { return a.used < b.used; });
+    for (auto file = files.begin(); file != files.end() && total > lowWater;
+         ++file)
+    {
+      if (unlink(file->path.c_str()) == 0) total -= file->size;
+    }
+  }
+  myTotal = total;
+}
+
+#else
+
+FileCache::FileCache(const std::string& directory, std::uint64_t capacity)
+: myDirectory(directory),
+  myCapacity(capacity),
+  myTotal(0)
+{
+}
+
+bool FileCache::CreatePrivateDirectory(const std::string&)
+{
+  return false;
+}
+
+int FileCache::Open(const std::string&) const
+{
+  return -1;
+}
+
+FileCache::NewFile::NewFile(FileCache& cache, const std::string&)
+: myCache(cache),
+  myDescriptor(-1),
+  mySize(0),
+  isFailed(true)
+{
+}
+
+FileCache::NewFile::~NewFile()
+{
+}
+
+bool FileCache::NewFile::Write(const char*, std::size_t)
+{
+  return false;
+}
+
+int FileCache::NewFile::Commit()
+{
+  return -1;
+}
+
+void FileCache::Trim()
+{
+}
+
+#endif
+
+//===--------------------------- End of the file --------------------------===//
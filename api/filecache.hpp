@@ -0,0 +1,127 @@
+#ifndef FILE_CACHE_HPP_
+#define FILE_CACHE_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : FileCache
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Keeps files in a directory which is shared by every process using it, up to
+// a capacity, after which the least recently used files are removed.
+//
+// A file is written to a temporary file and renamed into place once it is
+// complete, so a file is either complete or not there, and readers never need
+// to lock anything. The names of files must not contain a '.', as that is how
+// the temporary files are told apart.
+//
+// The files are trusted to be what their names say, so the directory must
+// only be writable by the current user. One which isn't, such as one another
+// user made first, is not used and the cache is always empty.
+//
+// Usage:
+// {
+//   FileCache cache("/var/cache/gitjson/responses", 1 << 28);
+//   int descriptor = cache.Open(name);
+//   if (descriptor == -1)
+//   {
+//     FileCache::NewFile file(cache, name);
+//     file.Write(data, size);
+//     descriptor = file.Commit();
+//   }
+//   ...
+//   close(descriptor);
+// }
+//
+// Known shortcomings:
+//   Only POSIX systems are supported, elsewhere the cache is always empty.
+//
+//===----------------------------------------------------------------------===//
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+class FileCache
+{
+public:
+  // The directory is created as by CreatePrivateDirectory().
+  FileCache(const std::string& directory, std::uint64_t capacity);
+
+  // Creates the directory, and any leading up to it, if it does not exist,
+  // giving only the current user access to those it creates.
+  //
+  // Returns false, after writing why to standard error, if the directory
+  // could not be created or is not owned by the current user or can be
+  // written by others.
+  static bool CreatePrivateDirectory(const std::string& directory);
+
+  // Returns a descriptor for reading the file with the given name and marks
+  // the file as the most recently used, or returns -1 if there is no such
+  // file. The caller needs to close the descriptor.
+  int Open(const std::string& name) const;
+
+  // A file being added to the cache, which is only visible once committed.
+  class NewFile
+  {
+  public:
+    NewFile(FileCache& cache, const std::string& name);
+
+    // Throws away the file if it was not committed.
+    ~NewFile();
+
+    // Returns false if the file could not be created.
+    bool IsOpen() const { return myDescriptor != -1; }
+
+    // The number of bytes written so far.
+    std::uint64_t Size() const { return mySize; }
+
+    // Returns false if the data could not be written, in which case the file
+    // can not be committed.
+    bool Write(const char* data, std::size_t size);
+
+    // Puts the file in the cache, replacing any file with the same name, and
+    // removes the least recently used files if that takes the cache over
+    // capacity.
+    //
+    // Returns a descriptor for reading the file or -1 if it could not be
+    // added. The caller needs to close the descriptor.
+    int Commit();
+
+  private:
+    NewFile(const NewFile&); /* = delete; */
+    NewFile& operator =(const NewFile&); /* = delete; */
+
+    FileCache& myCache;
+    std::string myPath;
+    std::string myTemporaryPath;
+    int myDescriptor;
+    std::uint64_t mySize;
+    bool isFailed;
+  };
+
+private:
+  FileCache(const FileCache&); /* = delete; */
+  FileCache& operator =(const FileCache&); /* = delete; */
+
+  // Looks at every file to find how much space they take up and if it is
+  // over the capacity, removes the least recently used until they are under
+  // seven eighths of it, so it isn't done again for a while.
+  void Trim();
+
+  std::string myDirectory;
+  std::uint64_t myCapacity;
+
+  // The size of the files when they were last looked at, plus those added
+  // since by this process. The files added by other processes are only
+  // counted the next time they are looked at.
+  std::atomic<std::uint64_t> myTotal;
+
+  // Held while trimming, so only one thread does it at a time.
+  std::mutex myTrimMutex;
+};
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -13,17 +13,45 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#include "base64.hpp"
+#include "blame.hpp"
+#include "blobfiles.hpp"
+#include "catalogue.hpp"
+#include "changedpaths.hpp"
+#include "commitgraph.hpp"
+#include "deflatesink.hpp"
+#include "diff.hpp"
+#include "http.hpp"
+#include "references.hpp"
 #include "repository.hpp"
+#include "request.hpp"
+#include "responsestore.hpp"
 #include "router.hpp"
+#include "statistics.hpp"
 #include "jsonwriter.hpp"
-
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <chrono>
 #include <iterator>
 
 #ifdef _MSC_VER
@@ -34,475 +62,652 @@
 #include <git2.h>
 #endif
 
-// TODO:
-// - Support configuring where the repositories are kept.
-
 #define VERSION "0.1.0"
 
-static const char* repositoriesPath = "D:/vcs";
+// The number of repositories kept open between requests when serving more
+// than one request.
+static const std::size_t repositoryCacheCapacity = 16;
 
-namespace util
-{
-  const static char Base64Lookup[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+// The number of commits listed by /commits when per_page is not given and the
+// most that can be asked for at once, which is enough for walking the whole
+// history of most repositories in one request.
+static const unsigned long defaultCommitsPerPage = 30;
+static const unsigned long maximumCommitsPerPage = 10000;
 
-  // Base64 encode the data from Content to Content + Size and insert new lines
-  // every 60 characters.
-  std::string
-  Base64Encode(const void * Content, git_off_t Size, bool NewLines);
-}
+// The commits for the history of a path are read from the walk in batches
+// which start small, so the first page comes back quickly, and double up to
+// the largest, so the index is extended for many commits at once.
+static const std::size_t firstPathBatch = 64;
+static const std::size_t maximumPathBatch = 4096;
 
-std::string util::Base64Encode(
-  const void * Content,
-  git_off_t Size,
-  bool NewLines)
-{
-  const char padCharacter('=');
+// The most entries listed by /trees/{sha} before the listing is marked as
+// truncated, which is the same as GitHub.
+static const std::size_t maximumTreeEntries = 100000;
+
+// Blobs of at least this size are sent by /file/ from a copy kept on disk,
+// smaller ones are read from the repository each time.
+static const std::size_t minimumBlobFileSize = 1024 * 1024;
+
+// The most space the copies of blobs can take up on disk.
+static const std::uint64_t blobFilesCapacity = 1024ull * 1024 * 1024;
+
+// The most space the responses that never change can take up on disk.
+static const std::uint64_t responseStoreCapacity = 256ull * 1024 * 1024;
 
-  // Determine how big the output string will need to be.
-  git_off_t encodedSize = ((Size / 3) + (Size % 3 > 0)) * 4;
-  if (NewLines) encodedSize += encodedSize / 60;
+// The most requests that can be made at once by /api/batch.
+static const std::size_t maximumBatchRequests = 100;
 
-  // Implementation taken from the C++ version from:
-  // http://en.wikibooks.org/wiki/Algorithm_Implementation/Miscellaneous/Base64
-  std::string encodedString;
-  encodedString.reserve(static_cast<std::size_t>(encodedSize));
+// The most commits listed by a comparison, as GitHub does.
+static const std::size_t maximumComparedCommits = 250;
+
+// The number of blames kept in memory, so the blame of a file at the next
+// commit can be worked out from the one before it.
+static const std::size_t blameCacheCapacity = 1024;
+
+// The most memory the diffs of commits kept in memory can take up.
+static const std::size_t diffCacheCapacity = 64 * 1024 * 1024;
+
+static const std::string& base_uri()
+{
+  static const char* env = std::getenv("BASE_URI");
+  static const std::string uri(env? env: "");
+  return uri;
+}
 
-  long temp;
-  const char* cursor = static_cast<const char*>(Content);
+// The URL of the API for a repository, which the URLs of the objects in it
+// start with. It is put together and escaped once for a response rather than
+// for each URL in it.
+class RepositoryUrl
+{
+  std::string myPrefix;
 
-  for (git_off_t idx = 0, rowCount = 4; idx < Size / 3; ++idx, rowCount += 4)
+public:
+  explicit RepositoryUrl(const std::string& repositoryName)
+  : myPrefix(JsonWriter::escape(
+      (base_uri() + "/api/repos/" + repositoryName).c_str()))
   {
-    temp  = (*cursor++) << 16; //Convert to big endian
-    temp += (*cursor++) << 8;
-    temp += (*cursor++);
-    encodedString.append(1, Base64Lookup[(temp & 0x00FC0000) >> 18]);
-    encodedString.append(1, Base64Lookup[(temp & 0x0003F000) >> 12]);
-    encodedString.append(1, Base64Lookup[(temp & 0x00000FC0) >> 6 ]);
-    encodedString.append(1, Base64Lookup[(temp & 0x0000003F)      ]);
+  }
 
-    if (NewLines && rowCount == 60)
+  // Returns a function for JsonWriterObject::stream() that writes the URL of
+  // the object in the collection, such as "/commits/".
+  auto Of(const char* collection, std::string_view sha) const
+  {
+    const std::string& prefix = myPrefix;
+    return [&prefix, collection, sha](OutputSink& output)
     {
-      encodedString.append("\\n");
-      rowCount = 0;
-    }
+      output.Write(prefix);
+      output.Write(collection);
+      output.Write(sha.data(), sha.size());
+    };
   }
+};
+
+// The keys of the objects written for commits and tree entries, of which
+// there may be a great many in a response.
+namespace keys
+{
+  constexpr JsonKey author("author");
+  constexpr JsonKey comitter("comitter");
+  constexpr JsonKey date("date");
+  constexpr JsonKey email("email");
+  constexpr JsonKey message("message");
+  constexpr JsonKey mode("mode");
+  constexpr JsonKey name("name");
+  constexpr JsonKey parents("parents");
+  constexpr JsonKey path("path");
+  constexpr JsonKey sha("sha");
+  constexpr JsonKey size("size");
+  constexpr JsonKey tree("tree");
+  constexpr JsonKey type("type");
+  constexpr JsonKey url("url");
+}
 
-  switch(Size % 3)
+// Returns the sink that the response to the current request is written to.
+static OutputSink* output()
+{
+  return &RequestContext::Current().Output();
+}
+
+// Returns how the JSON of the response to the request is laid out, which is
+// compact if it was asked for with ?compact=true or the header
+// X-JSON-Layout: compact, otherwise it is indented.
+static JsonWriter::Layout layout(const RequestContext& context)
+{
+  if (const std::string* value = context.Query("compact"))
   {
-  case 1:
-    temp  = (*cursor++) << 16; //Convert to big endian
-    encodedString.append(1, Base64Lookup[(temp & 0x00FC0000) >> 18]);
-    encodedString.append(1, Base64Lookup[(temp & 0x0003F000) >> 12]);
-    encodedString.append(2, padCharacter);
-    break;
-  case 2:
-    temp  = (*cursor++) << 16; //Convert to big endian
-    temp += (*cursor++) << 8;
-    encodedString.append(1, Base64Lookup[(temp & 0x00FC0000) >> 18]);
-    encodedString.append(1, Base64Lookup[(temp & 0x0003F000) >> 12]);
-    encodedString.append(1, Base64Lookup[(temp & 0x00000FC0) >> 6 ]);
-    encodedString.append(1, padCharacter);
-    break;
+    return (*value == "true" || *value == "1") ?
+      JsonWriter::Compact : JsonWriter::Indented;
   }
 
-  return encodedString;
+  const std::string* header = context.Header("X-JSON-Layout");
+  return header && *header == "compact" ?
+    JsonWriter::Compact : JsonWriter::Indented;
 }
 
-static int for_tags(
-  const char *name, git_oid *oid, void *payload)
+// Returns the layout of the response to the current request.
+static JsonWriter::Layout layout()
 {
-  std::vector<std::pair<std::string, git_oid>>* tags =
-    reinterpret_cast<std::vector<std::pair<std::string, git_oid>>*>(payload);
-  tags->push_back(std::make_pair(name, *oid));
-  return 0;
+  return layout(RequestContext::Current());
 }
 
-static const std::string& base_uri()
+// Records that the current request failed with the given HTTP status code.
+static void fail(int status, const std::string& message)
 {
-  static const char* env = std::getenv("BASE_URI");
-  static const std::string uri(env? env: "");
-  return uri;
+  RequestContext::Current().Error(status, message);
+}
+
+// Returns true if the query parameter with the given name is "true" or "1".
+static bool query_flag(const char* name)
+{
+  const std::string* value = RequestContext::Current().Query(name);
+  return value && (*value == "true" || *value == "1");
+}
+
+// Returns the text with everything but letters, digits and -._~ escaped as
+// %XX, so it can be put in a URL or a header whatever it contains.
+static std::string percent_encode(std::string_view text)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  std::string encoded;
+  encoded.reserve(text.size());
+  for (std::size_t i = 0; i < text.size(); ++i)
+  {
+    const unsigned char character = static_cast<unsigned char>(text[i]);
+    if (std::isalnum(character) || character == '-' || character == '.' ||
+        character == '_' || character == '~')
+    {
+      encoded += static_cast<char>(character);
+    }
+    else
+    {
+      encoded += '%';
+      encoded += digits[character >> 4];
+      encoded += digits[character & 15];
+    }
+  }
+  return encoded;
 }
 
+// Parses a date in the form YYYY-MM-DDTHH:MM:SSZ (ISO 8601 in UTC) as used by
+// the GitHub API, into the number of seconds since the epoch.
+//
+// Returns false if the text is not in that form.
+static bool parse_iso_date(const std::string& text, git_time_t* time)
+{
+  int year, month, day, hour, minute, second;
+  char zone = '\0';
+  if (std::sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%c", &year, &month,
+                  &day, &hour, &minute, &second, &zone) != 7 ||
+      zone != 'Z' || month < 1 || month > 12 || day < 1 || day > 31 ||
+      hour > 23 || minute > 59 || second > 60)
+  {
+    return false;
+  }
+
+  // The number of days since 1970-01-01 in the proleptic Gregorian calendar,
+  // counting years as starting in March so the leap day is at the end.
+  const int shiftedYear = month <= 2 ? year - 1 : year;
+  const int era = (shiftedYear >= 0 ? shiftedYear : shiftedYear - 399) / 400;
+  const int yearOfEra = shiftedYear - era * 400;
+  const int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 +
+    day - 1;
+  const int dayOfEra =
+    yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  const git_time_t days =
+    static_cast<git_time_t>(era) * 146097 + dayOfEra - 719468;
+
+  *time = days * 86400 + hour * 3600 + minute * 60 + second;
+  return true;
+}
+
+// The handlers which aren't for a repository are only routed to by main.
+#ifndef GITJSON_NO_MAIN
+
 static void api_information()
 {
   int major, minor, rev;
   git_libgit2_version(&major, &minor, &rev);
-  std::cout
-    << "{" << std::endl
-    << "   \"version\": \"" VERSION "\"," << std::endl
-    << "   \"libgit2\": { \"version\": \"" << major << '.' << minor << '.'
-                                    << rev << "\" }" << std::endl
-    << "}" << std::endl;
-}
 
-static void repositories_list()
-{
-   JsonWriter::array(&std::cout);
-   // TODO: Decide what to do here.
+  char libgit2Version[32];
+  snprintf(libgit2Version, sizeof(libgit2Version), "%d.%d.%d", major, minor,
+           rev);
+
+  auto object = JsonWriter::object(output(), layout());
+  object["version"] = VERSION;
+  {
+    auto libgit2Object = object["libgit2"].object();
+    libgit2Object["version"] = libgit2Version;
+  }
 }
 
-void branches(git_repository* repository,
-              const std::string& repositoryName,
-              JsonWriterArray* array)
+// Lists how long the requests for each route have taken since the process
+// started, as a histogram, and how much of that was spent in each stage.
+static void api_statistics()
 {
-  char shaString[GIT_OID_HEXSZ + 1];
-  git_branch_iterator* iterator = nullptr;
-  git_reference* reference = nullptr;
-  git_branch_t type;
-  git_branch_iterator_new(&iterator, repository, GIT_BRANCH_LOCAL);
+  const Statistics* statistics = Statistics::Current();
+  const std::vector<Statistics::Route> routes =
+    statistics ? statistics->Routes() : std::vector<Statistics::Route>();
+
+  auto object = JsonWriter::object(output(), layout());
+  object["uptime"] = static_cast<unsigned long long>(
+    statistics ? std::chrono::duration_cast<std::chrono::seconds>(
+                   statistics->Uptime()).count() : 0);
 
-  for (int ret = git_branch_next(&reference, &type, iterator);
-       ret != GIT_ITEROVER;
-       ret = git_branch_next(&reference, &type, iterator))
+  auto array = object["routes"].array();
+  for (auto route = std::begin(routes); route != std::end(routes); ++route)
   {
-    if (ret != 0)
+    auto routeObject = array.object();
+    routeObject["route"] = route->name;
+    routeObject["count"] = static_cast<unsigned long long>(route->count);
+    routeObject["total_us"] =
+      static_cast<unsigned long long>(route->totalMicroseconds);
+    routeObject["mean_us"] =
+      static_cast<unsigned long long>(route->totalMicroseconds / route->count);
+    routeObject["p50_us"] =
+      static_cast<unsigned long long>(route->Percentile(0.5));
+    routeObject["p90_us"] =
+      static_cast<unsigned long long>(route->Percentile(0.9));
+    routeObject["p99_us"] =
+      static_cast<unsigned long long>(route->Percentile(0.99));
+    routeObject["max_us"] =
+      static_cast<unsigned long long>(route->maximumMicroseconds);
+
+    // Each bucket counts the requests that took less than le_us, and at
+    // least the le_us of the bucket before it. The empty ones are left out.
+    {
+      auto histogram = routeObject["histogram"].array();
+      for (std::size_t i = 0; i < Statistics::bucketCount; ++i)
+      {
+        if (route->buckets[i] == 0) continue;
+        auto bucket = histogram.object();
+        bucket["le_us"] = static_cast<unsigned long long>(1ull << i);
+        bucket["count"] = static_cast<unsigned long long>(route->buckets[i]);
+      }
+    }
+
+    auto stages = routeObject["stages"].array();
+    for (auto stage = std::begin(route->stages);
+         stage != std::end(route->stages); ++stage)
     {
-      // an error occured.
-      std::exit(1);
+      auto stageObject = stages.object();
+      stageObject["name"] = stage->name;
+      stageObject["count"] = static_cast<unsigned long long>(stage->count);
+      stageObject["total_us"] =
+        static_cast<unsigned long long>(stage->totalMicroseconds);
     }
+  }
+}
+
+// Lists the repositories with the branch HEAD refers to and the commit at
+// the head of it.
+static void repositories_list()
+{
+  git::Catalogue* catalogue = git::Catalogue::Current();
+  const std::vector<git::Catalogue::Summary> repositories =
+    catalogue ? catalogue->List() : std::vector<git::Catalogue::Summary>();
+
+  auto array = JsonWriter::array(output(), layout());
+  for (auto repository = std::begin(repositories);
+       repository != std::end(repositories); ++repository)
+  {
+    const std::string url = base_uri() + "/api/repos/" + repository->name;
+
+    auto object = array.object();
+    object["name"] = repository->name;
+    object["url"] = url;
+    object["default_branch"] = repository->defaultBranch;
+    if (repository->sha.empty()) continue;
+
+    char isoDateString[sizeof "2011-10-08T07:07:09Z"];
+    const std::time_t time = static_cast<std::time_t>(repository->time);
+    std::strftime(isoDateString, sizeof(isoDateString), "%Y-%m-%dT%H:%M:%SZ",
+                  std::gmtime(&time));
+    object["updated_at"] = isoDateString;
+
+    auto commitObject = object["commit"].object();
+    commitObject["sha"] = repository->sha;
+    commitObject["url"] = url + "/commits/" + repository->sha;
+  }
+}
 
-    const char* name = nullptr;
-    git_branch_name(&name, reference);
-    git_oid_tostr(shaString, sizeof(shaString),
-                  git_reference_target(reference));
+#endif
 
+void branches(const git::References& references,
+              const std::string& repositoryName,
+              JsonWriterArray* array)
+{
+  static const std::string prefix = "refs/heads/";
+  const auto range = references.Prefixed(prefix);
+  for (auto reference = range.first; reference != range.second; ++reference)
+  {
     auto branchObject = array->object();
-    branchObject["name"] = name;
+    branchObject["name"] = reference->name.substr(prefix.size());
     {
       auto commitObject = branchObject["commit"].object();
-      commitObject["sha"] = shaString;
+      commitObject["sha"] = reference->target;
       commitObject["url"] = base_uri() + "/api/repos/" + repositoryName +
-        "/commits/" + shaString;
+        "/commits/" + reference->target;
     }
   }
-  git_branch_iterator_free(iterator);
 }
 
 void commit(
   const git_commit* const commit,
-  const std::string& repositoryName,
+  const RepositoryUrl& url,
   JsonWriterObject* object)
 {
   char shaString[GIT_OID_HEXSZ + 1];
-  char isoDateString[sizeof "2011-10-08T07:07:09Z"];
+  char isoDateString[JsonWriter::timeLength];
+  const std::string_view isoDate(isoDateString, sizeof(isoDateString));
   const git_signature * author = git_commit_author(commit);
   const git_signature * comitter = git_commit_committer(commit);
   const git_oid* treeOid = git_commit_tree_id(commit);
 
   {
-    const time_t commitTime = git_commit_time(commit);
-    const tm* time = std::gmtime(&commitTime);
-    std::strftime(isoDateString, sizeof(isoDateString),
-                  "%Y-%m-%dT%H:%M:%SZ", time);
+    JsonWriter::format_time(git_commit_time(commit), isoDateString);
 
-    auto authorObject = (*object)["author"].object();
-    authorObject["date"] = isoDateString;
-    authorObject["email"] = author->email;
-    authorObject["name"] = author->name;
+    auto authorObject = (*object)[keys::author].object();
+    authorObject[keys::date] = isoDate;
+    authorObject[keys::email] = author->email;
+    authorObject[keys::name] = author->name;
   }
 
   {
-    const time_t commitTime = comitter->when.time;
-    const tm* time = std::gmtime(&commitTime);
-    std::strftime(isoDateString, sizeof(isoDateString),
-                  "%Y-%m-%dT%H:%M:%SZ", time);
+    JsonWriter::format_time(comitter->when.time, isoDateString);
 
-    auto authorObject = (*object)["comitter"].object();
-    authorObject["date"] = isoDateString;
-    authorObject["email"] = comitter->email;
-    authorObject["name"] = comitter->name;
+    auto authorObject = (*object)[keys::comitter].object();
+    authorObject[keys::date] = isoDate;
+    authorObject[keys::email] = comitter->email;
+    authorObject[keys::name] = comitter->name;
   }
 
-  (*object)["message"] = JsonWriter::escape(git_commit_message(commit));
+  (*object)[keys::message] = git_commit_message(commit);
 
   {
     git_oid_tostr(shaString, sizeof(shaString), treeOid);
+    const std::string_view sha(shaString, GIT_OID_HEXSZ);
 
-    auto treeObject = (*object)["tree"].object();
-    treeObject["sha"] = shaString;
-    treeObject["url"] = base_uri() + "/api/repos/" + repositoryName +
-      "/trees/" + shaString;
+    auto treeObject = (*object)[keys::tree].object();
+    treeObject[keys::sha] = sha;
+    treeObject[keys::url].stream(url.Of("/trees/", sha));
   }
 }
 
-void repository_information(const std::vector<std::string>& arguments)
+// Writes the commit along with its parents, SHA and URL.
+void commit_with_parents(
+  const git_commit* const commit,
+  const RepositoryUrl& url,
+  JsonWriterObject* object)
 {
-  const std::string& repositoryName = arguments.front();
-  git::Repository repo(repositoryName);
+  char commitHash[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(commitHash, sizeof(commitHash), git_commit_id(commit));
+  const std::string_view sha(commitHash, GIT_OID_HEXSZ);
+
+  ::commit(commit, url, object);
+
+  {
+    auto parentsArray = (*object)[keys::parents].array();
+    for (unsigned int i = 0, count = git_commit_parentcount(commit);
+         i < count; ++i)
+    {
+      char parentShaString[GIT_OID_HEXSZ + 1];
+      git_oid_tostr(parentShaString, sizeof(parentShaString),
+                    git_commit_parent_id(commit, i));
+      const std::string_view parentSha(parentShaString, GIT_OID_HEXSZ);
+
+      auto parentObject = parentsArray.object();
+      parentObject[keys::sha] = parentSha;
+      parentObject[keys::url].stream(url.Of("/commits/", parentSha));
+    }
+  }
+  (*object)[keys::sha] = sha;
+  (*object)[keys::url].stream(url.Of("/commits/", sha));
+}
+
+// Writes the stats and files of the diff, in the form the GitHub API gives
+// them for a commit, with the patch of each file if isWithPatches is true.
+static void write_diff(const git::Diff& diff, bool isWithPatches,
+                       JsonWriterObject* object)
+{
+  {
+    auto statsObject = (*object)["stats"].object();
+    statsObject["total"] = static_cast<unsigned long long>(
+      diff.additions + diff.deletions);
+    statsObject["additions"] = static_cast<unsigned long long>(
+      diff.additions);
+    statsObject["deletions"] = static_cast<unsigned long long>(
+      diff.deletions);
+  }
+
+  auto filesArray = (*object)["files"].array();
+  for (auto file = std::begin(diff.files); file != std::end(diff.files);
+       ++file)
+  {
+    auto fileObject = filesArray.object();
+    fileObject[keys::sha] = file->sha;
+    fileObject["filename"] = file->filename;
+    fileObject["status"] = file->status;
+    fileObject["additions"] = static_cast<unsigned long long>(
+      file->additions);
+    fileObject["deletions"] = static_cast<unsigned long long>(
+      file->deletions);
+    fileObject["changes"] = static_cast<unsigned long long>(
+      file->additions + file->deletions);
+    if (isWithPatches && file->hasPatch) fileObject["patch"] = file->patch;
+    if (!file->previousFilename.empty())
+    {
+      fileObject["previous_filename"] = file->previousFilename;
+    }
+  }
+}
 
-  std::vector<std::pair<std::string, git_oid>> tags;
-  git_tag_foreach(repo, for_tags, &tags);
+void repository_information(const Router::Arguments& arguments)
+{
+  const std::string repositoryName(arguments.front());
+  git::Repository repo(repositoryName);
+  const auto references = repo.Refs();
 
   {
-    char commitHash[64] = {0};
-    auto object = JsonWriter::object(&std::cout);
+    auto object = JsonWriter::object(output(), layout());
     object["repository"] = repositoryName;
     {
       auto branches = object["branches"].array();
-      ::branches(repo, repositoryName, &branches);
+      ::branches(*references, repositoryName, &branches);
     }
 
     {
       auto aw = object["tags"].array();
-      for (auto tag = std::begin(tags); tag != std::end(tags); ++tag)
+      const auto tags = references->Prefixed("refs/tags/");
+      for (auto tag = tags.first; tag != tags.second; ++tag)
       {
-        git_oid_fmt(commitHash, &tag->second);
-
         auto tagObject = aw.object();
-        tagObject["name"] = tag->first;
-        tagObject["hash"] = commitHash;
+        tagObject["name"] = tag->name;
+        tagObject["hash"] = tag->target;
         tagObject["url"] = base_uri() + "/api/repos/" + repositoryName + '/' +
-          tag->first;
+          tag->name;
       }
     }
   }
 }
 
 // Populate the object property of a reference.
-void populate_reference_object(git_reference* reference,
+void populate_reference_object(const git::References::Reference& reference,
                                const std::string& repositoryName,
-                               JsonWriterObject& object,
-                               char* commitHash = nullptr)
+                               JsonWriterObject& object)
 {
-  char commitHashStorage[64] = { 0 };
-  if (!commitHash) commitHash = commitHashStorage;
-
-  const git_ref_t type = git_reference_type(reference);
-  if (type == GIT_REF_OID)
+  const std::string type(reference.type);
+  if (type == "symbolic")
   {
-    git_oid_fmt(commitHash, git_reference_target(reference));
-    object["sha"] = commitHash;
+    object["target"] = reference.symbolicTarget;
+    object["type"] = type;
+    return;
+  }
 
-    const git_oid* const peeled = git_reference_target_peel(reference);
-    if (peeled)
-    {
-      object["type"] = "tag";
-      object["url"] = base_uri() + "/api/repos/" + repositoryName +
-        "/tags/" + commitHash;
+  object["sha"] = reference.target;
+  object["type"] = type;
 
-      // This is not part of the GitHub API, but is provided as it didn't
-      // require any additional cost to look-up.
-      git_oid_fmt(commitHash, peeled);
-      object["target_sha"] = commitHash;
-    }
-    else
-    {
-      git_reference* resolvedReference = nullptr;
-      if (git_reference_resolve(&resolvedReference, reference) == 0)
-      {
-        object["type"] = "tag";
-        object["url"] = base_uri() + "/api/repos/" + repositoryName +
-          "/tags/" + commitHash;
-        git_reference_free(resolvedReference);
-      }
-      else
-      {
-        object["type"] = "commit";
-        object["url"] = base_uri() + "/api/repos/" + repositoryName +
-          "/commits/" + commitHash;
-      }
-    }
-  }
-  else if (type == GIT_REF_SYMBOLIC)
-  {
-    object["target"] = git_reference_symbolic_target(reference);
-    object["type"] = "symbolic";
-  }
+  const char* const collection =
+    type == "tag" ? "/tags/" : type == "tree" ? "/trees/" :
+    type == "blob" ? "/blobs/" : "/commits/";
+  object["url"] = base_uri() + "/api/repos/" + repositoryName + collection +
+    reference.target;
+
+  // This is not part of the GitHub API, but is provided as it didn't require
+  // any additional cost to look-up.
+  if (!reference.peeled.empty()) object["target_sha"] = reference.peeled;
 }
 
-void repository_refs(const std::vector<std::string>& arguments)
+void repository_refs(const Router::Arguments& arguments)
 {
   // This function has been developed to output it in the following format:
   // https://developer.github.com/v3/git/refs/
   //
   // Example: https://api.github.com/repos/git/git/git/refs
-  const std::string& repositoryName = arguments.front();
-  const auto path = repositoriesPath + ("/" + repositoryName);
-
-  git_repository* repository;
-  int error = git_repository_open(&repository, path.c_str());
-
-  if (error != 0) return;
+  const std::string repositoryName(arguments.front());
+  git::Repository repository(repositoryName);
+  const auto references = repository.Refs();
 
   {
-    auto aw = JsonWriter::array(&std::cout);
-
-    git_reference* reference = nullptr;
-    git_reference_iterator* iterator = nullptr;
-    git_reference_iterator_new(&iterator, repository);
-
-    for (int ret = git_reference_next(&reference, iterator);
-         ret != GIT_ITEROVER;
-         ret = git_reference_next(&reference, iterator))
+    auto aw = JsonWriter::array(output(), layout());
+    for (auto reference = references->begin(); reference != references->end();
+         ++reference)
     {
-      if (ret != 0)
-      {
-        // an error occured.
-        std::exit(1);
-      }
-
       auto tagObject = aw.object();
-      tagObject["ref"] = git_reference_name(reference);
+      tagObject["ref"] = reference->name;
       tagObject["url"] = base_uri() + "/api/repos/" + repositoryName + '/' +
-        git_reference_name(reference);
+        reference->name;
 
       auto objectObject = tagObject["object"].object();
-      populate_reference_object(reference, repositoryName, objectObject);
+      populate_reference_object(*reference, repositoryName, objectObject);
     }
-    git_reference_iterator_free(iterator);
   }
-
-  git_repository_free(repository);
 }
 
-void repository_ref(const std::vector<std::string>& arguments)
+void repository_ref(const Router::Arguments& arguments)
 {
   // This function has been developed to output it in the following format:
   // https://developer.github.com/v3/git/refs/
   //
   // Example: https://api.github.com/repos/git/git/git/refs/heads/master
 
-  const std::string& repositoryName = arguments.front();
-
-  const auto path = repositoriesPath + ("/" + repositoryName);
+  const std::string repositoryName(arguments.front());
 
   // The long name for the reference (e.g. HEAD, refs/heads/master, refs/tags/v0.1.0)
   std::stringstream referenceName;
   referenceName << "refs/";
   std::copy(std::begin(arguments) + 1, std::end(arguments) - 1,
-            std::ostream_iterator<std::string>(referenceName, "/"));
+            std::ostream_iterator<std::string_view>(referenceName, "/"));
   referenceName << arguments.back();
 
-  git_repository* repo = nullptr;
-  int error = git_repository_open(&repo, path.c_str());
-  if (error != 0) return;
-
-  git_reference* reference = nullptr;
-  error = git_reference_lookup(&reference, repo, referenceName.str().c_str());
-  if (error == GIT_ENOTFOUND)
+  if (!git_reference_is_valid_name(referenceName.str().c_str()))
   {
-    std::cerr << "Couldn't find the reference" << std::endl;
+    fail(422, "Invalid reference spec");
     return;
   }
-  else if (error == GIT_EINVALIDSPEC)
+
+  git::Repository repo(repositoryName);
+  const auto references = repo.Refs();
+
+  const git::References::Reference* const reference =
+    references->Find(referenceName.str());
+  if (!reference)
   {
-    std::cerr << "Invalid reference spec" << std::endl;
+    fail(404, "Couldn't find the reference");
     return;
   }
-  else if (error != 0) return;
 
   {
-    auto object = JsonWriter::object(&std::cout);
+    auto object = JsonWriter::object(output(), layout());
     object["ref"] = referenceName.str();
     object["url"] = base_uri() + "/api/repos/" + repositoryName + '/' +
       referenceName.str();
 
     {
       auto objectObject = object["object"].object();
-      populate_reference_object(reference, repositoryName, objectObject);
+      populate_reference_object(*reference, repositoryName, objectObject);
     }
   }
 }
 
-void repository_tags(const std::vector<std::string>& arguments)
+void repository_tags(const Router::Arguments& arguments)
 {
-  const std::string& repositoryName = arguments.front();
-  const auto path = repositoriesPath + ("/" + repositoryName);
-
-  git_repository* repo;
-  int error = git_repository_open(&repo, path.c_str());
-
-  if (error != 0) return;
-
-  std::vector<std::pair<std::string, git_oid>> tags;
-  error = git_tag_foreach(repo, for_tags, &tags);
+  const std::string repositoryName(arguments.front());
+  git::Repository repo(repositoryName);
+  const auto references = repo.Refs();
   {
-    char commitHash[64] = {0};
-    auto object = JsonWriter::object(&std::cout);
+    auto object = JsonWriter::object(output(), layout());
     object["repository"] = repositoryName;
     {
       auto aw = object["tags"].array();
-      for (auto tag = std::begin(tags); tag != std::end(tags); ++tag)
+      const auto tags = references->Prefixed("refs/tags/");
+      for (auto tag = tags.first; tag != tags.second; ++tag)
       {
-        git_oid_fmt(commitHash, &tag->second);
-
         auto tagObject = aw.object();
-        tagObject["name"] = tag->first;
-        tagObject["hash"] = commitHash;
+        tagObject["name"] = tag->name;
+        tagObject["hash"] = tag->target;
         tagObject["url"] = base_uri() + "/api/repos/" + repositoryName +
-          "/tags/" + tag->first;
+          "/tags/" + tag->name;
       }
     }
   }
-
-  git_repository_free(repo);
 }
 
-void repository_branches(const std::vector<std::string>& arguments)
+void repository_branches(const Router::Arguments& arguments)
 {
   // Implements: https://developer.github.com/v3/repos/#list-branches
-  const std::string& repositoryName = arguments.front();
-
-  const auto path = repositoriesPath + ("/" + repositoryName);
-
-  git_repository* repository;
-  int error = git_repository_open(&repository, path.c_str());
-
-  if (error != 0) return;
+  const std::string repositoryName(arguments.front());
+  git::Repository repository(repositoryName);
+  const auto references = repository.Refs();
 
   {
-    auto array = JsonWriter::array(&std::cout);
-    branches(repository, repositoryName, &array);
+    auto array = JsonWriter::array(output(), layout());
+    branches(*references, repositoryName, &array);
   }
 }
 
-void repository_branch(const std::vector<std::string>& arguments)
+void repository_branch(const Router::Arguments& arguments)
 {
   // Implements: https://developer.github.com/v3/repos/#get-branch
   // Excludes specifics for links back to GitHub users, comments etc.
-  const std::string& repositoryName = arguments.front();
-  const auto path = repositoriesPath + ("/" + repositoryName);
-
-  git_repository* repository;
-  int error = git_repository_open(&repository, path.c_str());
-
-  if (error != 0) return;
+  const std::string repositoryName(arguments.front());
+  const std::string branchName(arguments[1]);
+  git::Repository repository(repositoryName);
 
   git_object* object = nullptr;
-  error = git_revparse_single(&object, repository, arguments[1].c_str());
+  const int error = git_revparse_single(&object, repository,
+                                        branchName.c_str());
   if (error)
   {
-    fprintf(stderr, "The given reference was bad.");
+    fail(404, "The given reference was bad.");
     return;
   }
   else if (git_object_type(object) != GIT_OBJ_COMMIT)
   {
-    fprintf(stderr, "The given reference is not to a branch.");
+    fail(422, "The given reference is not to a branch.");
   }
   else
   {
     char shaString[GIT_OID_HEXSZ + 1];
     git_oid_tostr(shaString, sizeof(shaString), git_object_id(object));
 
-    auto branchObject = JsonWriter::object(&std::cout);
-    branchObject["name"] = arguments[1];
+    auto branchObject = JsonWriter::object(output(), layout());
+    branchObject["name"] = branchName;
     {
       auto commitObject = branchObject["commit"].object();
       commitObject["sha"] = shaString;
       const git_commit* const commit = (git_commit*)object;
-      ::commit(commit, repositoryName, &commitObject);
+      ::commit(commit, RepositoryUrl(repositoryName), &commitObject);
     }
   }
 
   git_object_free(object);
 }
 
-void repository_tag(const std::vector<std::string>& arguments)
+void repository_tag(const Router::Arguments& arguments)
 {
   // Implements: https://developer.github.com/v3/git/tags/#get-a-tag
-  const std::string& repositoryName = arguments.front();
+  const std::string repositoryName(arguments.front());
+  const std::string sha(arguments[1]);
   git::Repository repository(repositoryName);
 
   if (!repository.IsOpen()) return;
@@ -510,26 +715,31 @@ void repository_tag(const std::vector<std::string>& arguments)
   // The argument has to be the SHA.
   // TODO: Add validation to ensure it is the correct length/valid etc.
   git_oid objectId;
-  int error = git_oid_fromstr(&objectId, arguments[1].c_str());
+  int error = git_oid_fromstr(&objectId, sha.c_str());
   if (error)
   {
-    // TODO: Handle errors better.
-    std::exit(1);
+    fail(422, "The given tag was not a SHA: " + sha);
+    return;
   }
 
   git_tag *tag = nullptr;
-  error = git_tag_lookup(&tag, repository, &objectId);
+  {
+    StageTimer timer("read");
+    error = git_tag_lookup(&tag, repository, &objectId);
+  }
   if (error != 0 || !tag)
   {
-    // TODO: Handle errors better.
-    std::exit(2);
+    fail(404, "Could not find the tag: " + sha);
+    return;
   }
 
   const git_otype type = git_tag_target_type(tag);
   if (type != GIT_OBJ_COMMIT)
   {
-    // TODO: Handle errors better.
-    std::exit(3);
+    // TODO: Support tags of objects other than commits.
+    git_tag_free(tag);
+    fail(422, "The given tag does not reference a commit.");
+    return;
   }
 
   char isoDateString[sizeof "2011-10-08T07:07:09Z"];
@@ -539,13 +749,13 @@ void repository_tag(const std::vector<std::string>& arguments)
   std::strftime(isoDateString, sizeof(isoDateString), "%Y-%m-%dT%H:%M:%SZ",
                 time);
   {
-    auto object = JsonWriter::object(&std::cout);
+    auto object = JsonWriter::object(output(), layout());
 
     object["tag"] = git_tag_name(tag);
-    object["sha"] = arguments[1];
+    object["sha"] = sha;
     object["url"] = base_uri() + "/api/repos/" + repositoryName +
-      "/tags/" + arguments[1];
-    object["message"] = JsonWriter::escape(git_tag_message(tag));
+      "/tags/" + sha;
+    object["message"] = git_tag_message(tag);
     {
       auto taggerObject = object["tagger"].object();
       taggerObject["name"] = tagger->name;
@@ -567,271 +777,1931 @@ void repository_tag(const std::vector<std::string>& arguments)
     }
   }
 
+  git_tag_free(tag);
 }
 
-void repository_commit(const std::vector<std::string>& arguments)
+void repository_commit(const Router::Arguments& arguments)
 {
-  const std::string& repositoryName = arguments.front();
+  const std::string repositoryName(arguments.front());
   git::Repository repository(repositoryName);
 
   if (!repository.IsOpen()) return;
 
-  const std::string& specification = arguments[1];
+  const std::string specification(arguments[1]);
 
   git_object* gitObject = repository.Parse(specification);
-  if (!gitObject) return;
+  if (!gitObject)
+  {
+    fail(404, "No commit found for '" + specification + "'");
+    return;
+  }
 
   // TODO: Handle indirection through an annoated tag.
   switch (git_object_type(gitObject))
   {
   default:
-    fprintf(stderr, "'%s' does not reference a commit.\n",
-	    specification.c_str());
+    git_object_free(gitObject);
+    fail(422, "'" + specification + "' does not reference a commit.");
     return;
   case GIT_OBJ_COMMIT:
     break;
   }
 
-  const git_oid* oid = git_object_id(gitObject);
-  const git_commit* commit = (const git_commit*)gitObject;
-
-  char commitHash[41];
-  commitHash[40] = '\0';
-  git_oid_fmt(commitHash, oid);
-
+  // The files changed by the commit are only given when asked for with
+  // ?files=true, as they take far longer to work out than the rest.
+  std::shared_ptr<const git::Diff> diff;
+  if (query_flag("files"))
   {
-    auto object = JsonWriter::object(&std::cout);
-    ::commit(commit, repositoryName, &object);
-
+    try
     {
-      auto parentsArray = object["parents"].array();
-      for (unsigned int i = 0, count = git_commit_parentcount(commit);
-           i < count; ++i)
-      {
-        char parentShaString[GIT_OID_HEXSZ + 1];
-        git_oid_tostr(parentShaString, sizeof(parentShaString),
-                      git_commit_parent_id(commit, i));
-
-        auto parentObject = parentsArray.object();
-        parentObject["sha"] = parentShaString;
-        parentObject["url"] = base_uri() + "/api/repos/" + repositoryName +
-           "/commits/" + parentShaString;
-      }
+      diff = git::DiffCommit(repository, (const git_commit*)gitObject);
     }
-    object["sha"] = commitHash;
-    object["url"] = base_uri() + "/api/repos/" + repositoryName + "/commits/" +
-      commitHash;
+    catch (...)
+    {
+      git_object_free(gitObject);
+      throw;
+    }
+  }
+
+  {
+    auto object = JsonWriter::object(output(), layout());
+    commit_with_parents((const git_commit*)gitObject,
+                        RepositoryUrl(repositoryName), &object);
+    if (diff) write_diff(*diff, true, &object);
   }
 
   git_object_free(gitObject);
 }
 
-void repository_tree(const std::vector<std::string>& arguments)
+void repository_commits(const Router::Arguments& arguments)
 {
-  // Implements: https://developer.github.com/v3/git/trees/#get-a-tree
-  // Example:
-  //   https://api.github.com/repos/git/git/git/trees/
-  //     7f4837766f5bf8bd1d008ac38470a53f34b4f910
-  const std::string& repositoryName = arguments.front();
-  git::Repository repository(repositoryName);
-
-  if (!repository.IsOpen()) return;
-
-  git_oid objectId;
-  int error = git_oid_fromstr(&objectId, arguments[1].c_str());
-  if (error)
+  // Implements: https://developer.github.com/v3/repos/commits/
+  //   #list-commits-on-a-repository
+  //
+  // The parameters are:
+  //   sha - The commit to start from (default: HEAD).
+  //   per_page - The most commits to return (default: 30, maximum: 10000).
+  //   path - Only commits that changed the file or directory at this path.
+  //   since, until - Only commits committed at or after/before this time,
+  //                  given as YYYY-MM-DDTHH:MM:SSZ.
+  //
+  // Rather than numbered pages, the next page is found by the "after"
+  // parameter which is the SHA of the last commit on the previous page. The
+  // URL of the next page is given by the Link header, as GitHub does. The
+  // walk to find the cursor goes through the previous pages again, without
+  // reading them, so the later pages of a long history take longer. Hiding
+  // the cursor instead would hide its ancestors, which are yet to be listed.
+  //
+  // The following are not part of the GitHub API:
+  //   first_parent - If true only the first parent of merges is followed.
+  //   order - "topo" to never list a parent before its children, otherwise
+  //           the commits are listed newest first.
+  //
+  // A commit changed the path if what is at it differs from what is at it in
+  // each of its parents, so merges that took it from one side are left out.
+  // With first_parent only the first parent is compared, so a merge which
+  // brought in a change is listed, as by git log --first-parent. Renames
+  // aren't followed.
+  const std::string repositoryName(arguments.front());
+  RequestContext& context = RequestContext::Current();
+
+  unsigned long perPage = defaultCommitsPerPage;
+  if (const std::string* value = context.Query("per_page"))
   {
-    // TODO: Handle errors better.
-    std::exit(1);
+    char* end = nullptr;
+    perPage = std::strtoul(value->c_str(), &end, 10);
+    if (value->empty() || *end != '\0' || perPage == 0 ||
+        perPage > maximumCommitsPerPage)
+    {
+      fail(422, "per_page must be between 1 and " +
+           std::to_string(maximumCommitsPerPage) + '.');
+      return;
+    }
   }
 
-  git_tree* tree = nullptr;
-  error = git_tree_lookup(&tree, repository, &objectId);
-  if (error)
+  git_time_t since = std::numeric_limits<git_time_t>::min();
+  git_time_t until = std::numeric_limits<git_time_t>::max();
+  const std::string* sinceText = context.Query("since");
+  const std::string* untilText = context.Query("until");
+  if ((sinceText && !parse_iso_date(*sinceText, &since)) ||
+      (untilText && !parse_iso_date(*untilText, &until)))
   {
-    // TODO: Handle errors better.
-    std::exit(1);
+    fail(422, "The dates must be in the form YYYY-MM-DDTHH:MM:SSZ.");
+    return;
   }
 
+  git_oid after;
+  const std::string* afterText = context.Query("after");
+  if (afterText && git_oid_fromstr(&after, afterText->c_str()) != 0)
   {
-    char shaString[GIT_OID_HEXSZ + 1];
+    fail(422, "The given cursor was not a SHA: " + *afterText);
+    return;
+  }
 
-    auto object = JsonWriter::object(&std::cout);
-    object["sha"] = arguments[1];
-    object["url"] = base_uri() + "/api/repos/" + repositoryName + "/trees/" +
-      arguments[1];
+  const std::string* pathText = context.Query("path");
+  std::unique_ptr<const git::ChangedPath> path;
+  if (pathText)
+  {
+    path.reset(new git::ChangedPath(*pathText));
+    if (path->Path().empty())
     {
-      auto treeArray = object["tree"].array();
-
-      const size_t entryCount = git_tree_entrycount(tree);
-      for (size_t i = 0; i < entryCount; ++i)
-      {
-        const git_tree_entry* entry = git_tree_entry_byindex(tree, i);
-        git_oid_tostr(shaString, sizeof(shaString), git_tree_entry_id(entry));
-
-        // Convert the "mode" parameter to base8 number to be the same as the
-        // "mode" parameter here, http://developer.github.com/v3/git/trees/
-        std::stringstream ss;
-        ss << std::oct << git_tree_entry_filemode(entry);
-
-        auto tagObject = treeArray.object();
-        tagObject["path"] = git_tree_entry_name(entry);
-        tagObject["mode"] = ss.str();
-        tagObject["sha"] = shaString;
-
-        // Tree objects in git do not store the size of the blobs, so additional
-        // look-ups are required for that.
-        //
-        // First determine if the item is an blob or a tree.
-        if (git_tree_entry_type(entry) == GIT_OBJ_BLOB)
-        {
-          const git_oid* oid = git_tree_entry_id(entry);
-          git_blob* blob = nullptr;
-          git_blob_lookup(&blob, repository, oid);
-          tagObject["type"] = "blob";
-          tagObject["size"] = git_blob_rawsize(blob);
-          tagObject["url"] = base_uri() + "/api/repos/" + repositoryName +
-            "/blobs/" + shaString;
-        }
-        else if(git_tree_entry_type(entry) == GIT_OBJ_TREE)
-        {
-          tagObject["type"] = "tree";
-          tagObject["url"] = base_uri() + "/api/repos/" + repositoryName +
-            "/trees/" + shaString;
-        }
-      }
+      fail(422, "The path must name a file or directory.");
+      return;
     }
   }
-  git_tree_free(tree);
-}
 
+  const bool isFirstParent = query_flag("first_parent");
+  const std::string* order = context.Query("order");
+  const bool isTopological = order && *order == "topo";
 
-void repository_blob(const std::vector<std::string>& arguments)
-{
-  // Implements: https://developer.github.com/v3/git/blobs/#get-a-blob
-  //
-  // Example:
-  //   https://api.github.com/repos/git/git/git/blobs/
-  //     5e98806c6cc246acef5f539ae191710a0c06ad3f
-  //
-  // NOTE: GitHub's API only supports up to 100 megabytes.
-  //
-  // The API is suppose to support both applicaiton/json or 'raw' at the moment
-  // this is only the "json" one (see /file/ for details on the raw option).
-  const std::string& repositoryName = arguments.front();
   git::Repository repository(repositoryName);
 
-  if (!repository.IsOpen()) return;
-
-  git_oid objectId;
-  const int error = git_oid_fromstr(&objectId, arguments[1].c_str());
-  if (error)
+  const std::string* sha = context.Query("sha");
+  const std::string specification = sha ? *sha : "HEAD";
+  git_object* object = repository.Parse(specification);
+  if (!object)
   {
-    fprintf(stderr, "The given reference was bad.");
+    fail(404, "No commit found for '" + specification + "'");
     return;
   }
 
-  git_blob* blob = nullptr;
-  git_blob_lookup(&blob, repository, &objectId);
+  git_object* start = nullptr;
+  const int error = git_object_peel(&start, object, GIT_OBJ_COMMIT);
+  git_object_free(object);
+  if (error != 0)
+  {
+    fail(422, "'" + specification + "' does not reference a commit.");
+    return;
+  }
 
-  // TODO: Determine if it needs to be base64 encoded.
-  const bool base64Encoded = true;
+  char startHash[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(startHash, sizeof(startHash), git_object_id(start));
 
+  git_revwalk* walk = nullptr;
+  if (git_revwalk_new(&walk, repository) != 0 ||
+      git_revwalk_push(walk, git_object_id(start)) != 0)
+  {
+    git_revwalk_free(walk);
+    git_object_free(start);
+    throw git::Error("Could not walk the commits.");
+  }
+  git_object_free(start);
+
+  // Sorting by time alone is done incrementally so the first commits are
+  // written out without waiting for the whole history to be walked, where as
+  // the topological order needs all of it.
+  git_revwalk_sorting(walk, isTopological ?
+                      GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME : GIT_SORT_TIME);
+  if (isFirstParent) git_revwalk_simplify_first_parent(walk);
+
+  git_oid oid;
+  int ret = 0;
+
+  // Skip over the commits up to and including the cursor. This is far cheaper
+  // than listing them and unlike starting the walk from the cursor it gives
+  // the same order as the previous pages, but it is still proportional to the
+  // number of commits on them.
+  if (afterText)
   {
-    auto object = JsonWriter::object(&std::cout);
+    StageTimer timer("walk");
+    while ((ret = git_revwalk_next(&oid, walk)) == 0 &&
+           !git_oid_equal(&oid, &after))
+    {
+    }
 
-    // TODO: Instead of creating a temporary string for the base64, the output
-    // could be written directly to the stream.
-    object["content"] = util::Base64Encode(git_blob_rawcontent(blob),
-                                           git_blob_rawsize(blob),
-                                           true);
-     object["encoding"] = (base64Encoded ? "base64" : "utf-8");
-    object["sha"] = arguments[1];
-    object["url"] = base_uri() + "/api/repos/" + repositoryName +
-      "/blobs/" + arguments[1];
-    object["size"] = git_blob_rawsize(blob);
+    if (ret == GIT_ITEROVER)
+    {
+      git_revwalk_free(walk);
+      fail(422, "The cursor is not reachable from '" + specification + "'");
+      return;
+    }
   }
-}
 
-void repository_file(const std::vector<std::string>& arguments)
-{
-  // Writes out a given file from the repository, as-is, with no additional
-  // metadata.
-  const std::string& repositoryName = arguments.front();
-  git::Repository repository(repositoryName);
+  // For the history of a path the commits are indexed by the paths they
+  // changed, so most of them are passed over without being read. They are
+  // taken from the walk in batches so the commits missing from the index are
+  // added to it together.
+  git::ChangedPaths* const changedPaths = git::ChangedPaths::Current();
+  git::ChangedPathIndex* const index =
+    path && changedPaths ? &changedPaths->Index(repositoryName) : nullptr;
+  std::vector<git_oid> batch;
+  std::size_t batchPosition = 0;
+  std::size_t batchSize = firstPathBatch;
+  const auto nextCommit = [&](git_oid* id)
+  {
+    if (!index)
+    {
+      StageTimer timer("walk");
+      return git_revwalk_next(id, walk);
+    }
 
-  if (!repository.IsOpen()) return;
+    if (batchPosition == batch.size())
+    {
+      batch.clear();
+      batchPosition = 0;
+      int result = 0;
+      {
+        StageTimer timer("walk");
+        git_oid walked;
+        while (batch.size() < batchSize &&
+               (result = git_revwalk_next(&walked, walk)) == 0)
+        {
+          batch.push_back(walked);
+        }
+      }
+      if (batch.empty()) return result == 0 ? GIT_ITEROVER : result;
 
-  const std::string& specification = arguments[1];
+      index->Extend(repository, batch);
+      batchSize = std::min(batchSize * 2, maximumPathBatch);
+    }
+    git_oid_cpy(id, &batch[batchPosition++]);
+    return 0;
+  };
 
+  char lastHash[GIT_OID_HEXSZ + 1] = { 0 };
+  bool hasMore = false;
+  const RepositoryUrl url(repositoryName);
+  {
+    auto array = JsonWriter::array(output(), layout());
+    unsigned long count = 0;
+    while (ret == 0)
+    {
+      ret = nextCommit(&oid);
+      if (ret != 0) break;
+
+      if (index && !index->MayHaveChanged(oid, *path)) continue;
+
+      git_commit* commit = nullptr;
+      {
+        StageTimer timer("read");
+        ret = git_commit_lookup(&commit, repository, &oid);
+      }
+      if (ret != 0)
+      {
+        ret = -1;
+        break;
+      }
+
+      // When sorted by time alone the rest of the commits are older, so the
+      // walk stops at the first one before since. In topological order an
+      // older commit may come before a newer one, so they are all looked at.
+      const git_time_t time = git_commit_time(commit);
+      if (time < since && !isTopological)
+      {
+        git_commit_free(commit);
+        break;
+      }
+      if (time < since || time > until)
+      {
+        git_commit_free(commit);
+        continue;
+      }
+
+      if (path)
+      {
+        bool isChanged = false;
+        {
+          StageTimer timer("read");
+          isChanged = git::IsPathChanged(repository, commit, path->Path(),
+                                         isFirstParent);
+        }
+        if (!isChanged)
+        {
+          git_commit_free(commit);
+          continue;
+        }
+      }
+
+      if (count == perPage)
+      {
+        hasMore = true;
+        git_commit_free(commit);
+        break;
+      }
+
+      {
+        auto object = array.object();
+        commit_with_parents(commit, url, &object);
+      }
+      git_oid_tostr(lastHash, sizeof(lastHash), &oid);
+      ++count;
+      git_commit_free(commit);
+    }
+  }
+  git_revwalk_free(walk);
+
+  if (ret != 0 && ret != GIT_ITEROVER)
+  {
+    throw git::Error("Could not walk the commits.");
+  }
+
+  if (hasMore)
+  {
+    // The next page starts from the commit this one started from rather than
+    // the given one, so the pages stay consistent if a branch moves.
+    std::string next = base_uri() + "/api/repos/" + repositoryName +
+      "/commits?sha=" + startHash + "&per_page=" + std::to_string(perPage) +
+      "&after=" + lastHash;
+    if (pathText) next += "&path=" + percent_encode(*pathText);
+    if (sinceText) next += "&since=" + percent_encode(*sinceText);
+    if (untilText) next += "&until=" + percent_encode(*untilText);
+    if (isFirstParent) next += "&first_parent=true";
+    if (isTopological) next += "&order=topo";
+    context.AddResponseHeader("Link", '<' + next + ">; rel=\"next\"");
+  }
+}
+
+namespace
+{
+  // A tree being listed by /trees/{sha}, along with what is looked up for its
+  // entries.
+  struct TreeNode
+  {
+    enum State { Pending, Reading, Ready };
+
+    TreeNode(const git_oid& id, const std::string& path)
+    : oid(id), path(path), state(Pending), tree(nullptr) {}
+    ~TreeNode() { git_tree_free(tree); }
+
+    git_oid oid;
+
+    // The path of the tree from the root of the listing, which ends with a
+    // slash unless it is the root.
+    std::string path;
+
+    std::atomic<int> state;
+    git_tree* tree;
+
+    // The size of the entry with the same index if it is a blob, otherwise
+    // -1.
+    std::vector<std::int64_t> sizes;
+
+    // The trees within this one, in the order their entries appear. This is
+    // only filled in for recursive listings.
+    std::vector<std::unique_ptr<TreeNode>> subtrees;
+
+    // Why the tree could not be read, if it couldn't.
+    std::string error;
+  };
+
+  // Reads the trees of a listing.
+  //
+  // For a recursive listing, reading a tree schedules its subtrees to be read
+  // on the thread pool, so the whole hierarchy is read in parallel while the
+  // entries are being written out in order. libgit2 repositories must not be
+  // used by more than one thread at once, so each thread reads the trees with
+  // its own handle to the repository.
+  class TreeReader
+  {
+  public:
+    // The tree is the root of the listing, which is freed by the reader.
+    TreeReader(git::Repository& repository, git_tree* tree, bool isRecursive);
+
+    // Waits for the trees which are still being read.
+    ~TreeReader();
+
+    bool IsRecursive() const { return isRecursive; }
+
+    TreeNode& Root() { return myRoot; }
+
+    // Returns once the tree has been read, reading it on the calling thread
+    // if no other thread has started on it.
+    //
+    // Throws git::Error if the tree could not be read.
+    void Wait(TreeNode& node);
+
+    // Stops reading the trees that have not been started, as the listing is
+    // complete.
+    void Stop() { isStopping = true; }
+
+  private:
+    TreeReader(const TreeReader&); /* = delete; */
+    TreeReader& operator =(const TreeReader&); /* = delete; */
+
+    // Reads the tree with the given repository if nothing else has started
+    // reading it.
+    void Read(TreeNode& node, git::Repository& repository);
+
+    // Queues the subtrees of the node to be read by the thread pool.
+    void Schedule(TreeNode& node);
+
+    git::Repository& myRepository;
+    ThreadPool* const myPool;
+    const bool isRecursive;
+
+    std::atomic<bool> isStopping;
+
+    // The number of entries that have been read, which stops the subtrees
+    // from being read ahead once the listing will be truncated.
+    std::atomic<std::size_t> myEntryCount;
+
+    // The number of tasks that have been queued and not yet finished.
+    std::atomic<std::size_t> myOutstanding;
+
+    git::RepositoryHandles myHandles;
+
+    // This is after the handles so the trees are freed before the handles
+    // are closed.
+    TreeNode myRoot;
+  };
+}
+
+TreeReader::TreeReader(git::Repository& repository,
+                       git_tree* tree,
+                       bool isRecursive)
+: myRepository(repository),
+  myPool(ThreadPool::Current()),
+  isRecursive(isRecursive),
+  isStopping(false),
+  myEntryCount(0),
+  myOutstanding(0),
+  myHandles(repository),
+  myRoot(*git_tree_id(tree), "")
+{
+  myRoot.tree = tree;
+}
+
+TreeReader::~TreeReader()
+{
+  isStopping = true;
+  if (myPool)
+  {
+    myPool->RunUntil([this]{ return myOutstanding == 0; });
+  }
+}
+
+void TreeReader::Wait(TreeNode& node)
+{
+  Read(node, myRepository);
+  if (node.state != TreeNode::Ready)
+  {
+    myPool->RunUntil([&node]{ return node.state == TreeNode::Ready; });
+  }
+
+  if (!node.error.empty()) throw git::Error(node.error);
+}
+
+void TreeReader::Read(TreeNode& node, git::Repository& repository)
+{
+  int expected = TreeNode::Pending;
+  if (!node.state.compare_exchange_strong(expected, TreeNode::Reading))
+  {
+    return;
+  }
+
+  char shaString[GIT_OID_HEXSZ + 1];
+  int error = 0;
+  if (!node.tree)
+  {
+    StageTimer timer("read");
+    error = git_tree_lookup(&node.tree, repository, &node.oid);
+  }
+  if (error != 0)
+  {
+    git_oid_tostr(shaString, sizeof(shaString), &node.oid);
+    node.error = std::string("Could not find the tree: ") + shaString;
+    node.state = TreeNode::Ready;
+    return;
+  }
+
+  const size_t entryCount = git_tree_entrycount(node.tree);
+  node.sizes.assign(entryCount, -1);
+  for (size_t i = 0; i < entryCount; ++i)
+  {
+    const git_tree_entry* entry = git_tree_entry_byindex(node.tree, i);
+
+    // Tree objects in git do not store the size of the blobs, so additional
+    // look-ups are required for that. Only the header of the blob is read,
+    // so this costs the same no matter how big the blob is.
+    if (git_tree_entry_type(entry) == GIT_OBJ_BLOB)
+    {
+      node.sizes[i] = repository.ObjectSize(*git_tree_entry_id(entry));
+    }
+    else if (isRecursive && git_tree_entry_type(entry) == GIT_OBJ_TREE)
+    {
+      node.subtrees.emplace_back(
+        new TreeNode(*git_tree_entry_id(entry),
+                     node.path + git_tree_entry_name(entry) + '/'));
+    }
+  }
+
+  myEntryCount += entryCount;
+  node.state = TreeNode::Ready;
+
+  Schedule(node);
+}
+
+void TreeReader::Schedule(TreeNode& node)
+{
+  if (!myPool || isStopping || myEntryCount >= maximumTreeEntries) return;
+
+  for (auto subtree = std::begin(node.subtrees);
+       subtree != std::end(node.subtrees); ++subtree)
+  {
+    TreeNode& child = **subtree;
+    ++myOutstanding;
+    myPool->Submit(
+      [this, &child]
+      {
+        if (!isStopping)
+        {
+          try
+          {
+            Read(child, myHandles.Get());
+          }
+          catch (const git::Error& error)
+          {
+            // The tree is left to be read by Wait() which will report the
+            // error.
+            fprintf(stderr, "Error: %s\n", error.what());
+          }
+        }
+        --myOutstanding;
+      });
+  }
+}
+
+// Writes the entries of the tree to the array. In a recursive listing the
+// entries of each subtree follow the entry for the subtree, so the order is
+// the same no matter which threads read which trees.
+//
+// Returns false if it stopped because the limit on the number of entries was
+// reached.
+static bool write_tree_entries(TreeReader& reader,
+                               TreeNode& node,
+                               const RepositoryUrl& url,
+                               JsonWriterArray* array,
+                               std::size_t* remaining)
+{
+  reader.Wait(node);
+
+  char shaString[GIT_OID_HEXSZ + 1];
+  const std::string_view sha(shaString, GIT_OID_HEXSZ);
+  auto subtree = std::begin(node.subtrees);
+
+  const size_t entryCount = git_tree_entrycount(node.tree);
+  for (size_t i = 0; i < entryCount; ++i)
+  {
+    if (*remaining == 0) return false;
+    --*remaining;
+
+    const git_tree_entry* entry = git_tree_entry_byindex(node.tree, i);
+    git_oid_tostr(shaString, sizeof(shaString), git_tree_entry_id(entry));
+
+    // Convert the "mode" parameter to base8 number to be the same as the
+    // "mode" parameter here, http://developer.github.com/v3/git/trees/
+    char mode[11];
+    const std::size_t modeLength =
+      JsonWriter::format_octal(git_tree_entry_filemode(entry), mode);
+
+    {
+      auto tagObject = array->object();
+      tagObject[keys::path].stream([&node, entry](OutputSink& output)
+      {
+        const char* const name = git_tree_entry_name(entry);
+        JsonWriter::escape(node.path.data(), node.path.size(), &output);
+        JsonWriter::escape(name, std::strlen(name), &output);
+      });
+      tagObject[keys::mode] = std::string_view(mode, modeLength);
+      tagObject[keys::sha] = sha;
+
+      // First determine if the item is an blob or a tree.
+      if (git_tree_entry_type(entry) == GIT_OBJ_BLOB)
+      {
+        tagObject[keys::type] = "blob";
+        if (node.sizes[i] >= 0) tagObject[keys::size] = node.sizes[i];
+        tagObject[keys::url].stream(url.Of("/blobs/", sha));
+      }
+      else if(git_tree_entry_type(entry) == GIT_OBJ_TREE)
+      {
+        tagObject[keys::type] = "tree";
+        tagObject[keys::url].stream(url.Of("/trees/", sha));
+      }
+    }
+
+    if (reader.IsRecursive() && git_tree_entry_type(entry) == GIT_OBJ_TREE)
+    {
+      if (!write_tree_entries(reader, **subtree++, url, array, remaining))
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void repository_tree(const Router::Arguments& arguments)
+{
+  // Implements: https://developer.github.com/v3/git/trees/#get-a-tree
+  // Example:
+  //   https://api.github.com/repos/git/git/git/trees/
+  //     7f4837766f5bf8bd1d008ac38470a53f34b4f910
+  //
+  // With ?recursive=1 the entries of all the trees within the tree are
+  // listed as well, with their path from the tree. Once there are more than
+  // maximumTreeEntries the listing is cut short and "truncated" is true.
+  const std::string repositoryName(arguments.front());
+  const std::string sha(arguments[1]);
+  git::Repository repository(repositoryName);
+
+  if (!repository.IsOpen()) return;
+
+  git_oid objectId;
+  int error = git_oid_fromstr(&objectId, sha.c_str());
+  if (error)
+  {
+    fail(422, "The given tree was not a SHA: " + sha);
+    return;
+  }
+
+  git_tree* tree = nullptr;
+  {
+    StageTimer timer("read");
+    error = git_tree_lookup(&tree, repository, &objectId);
+  }
+  if (error)
+  {
+    fail(404, "Could not find the tree: " + sha);
+    return;
+  }
+
+  TreeReader reader(repository, tree, query_flag("recursive"));
+
+  {
+    auto object = JsonWriter::object(output(), layout());
+    object["sha"] = sha;
+    object["url"] = base_uri() + "/api/repos/" + repositoryName + "/trees/" +
+      sha;
+
+    bool isTruncated = false;
+    {
+      auto treeArray = object["tree"].array();
+      std::size_t remaining = maximumTreeEntries;
+      isTruncated = !write_tree_entries(reader, reader.Root(),
+                                        RepositoryUrl(repositoryName),
+                                        &treeArray, &remaining);
+      reader.Stop();
+    }
+    object["truncated"] = isTruncated;
+  }
+}
+
+void repository_blob(const Router::Arguments& arguments)
+{
+  // Implements: https://developer.github.com/v3/git/blobs/#get-a-blob
+  //
+  // Example:
+  //   https://api.github.com/repos/git/git/git/blobs/
+  //     5e98806c6cc246acef5f539ae191710a0c06ad3f
+  //
+  // NOTE: GitHub's API only supports up to 100 megabytes.
+  //
+  // The API is suppose to support both applicaiton/json or 'raw' at the moment
+  // this is only the "json" one (see /file/ for details on the raw option).
+  const std::string repositoryName(arguments.front());
+  const std::string sha(arguments[1]);
+  git::Repository repository(repositoryName);
+
+  if (!repository.IsOpen()) return;
+
+  git_oid objectId;
+  const int error = git_oid_fromstr(&objectId, sha.c_str());
+  if (error)
+  {
+    fail(422, "The given reference was bad.");
+    return;
+  }
+
+  git_blob* blob = nullptr;
+  bool isFound = false;
+  {
+    StageTimer timer("read");
+    isFound = git_blob_lookup(&blob, repository, &objectId) == 0;
+  }
+  if (!isFound)
+  {
+    fail(404, "Could not find the blob: " + sha);
+    return;
+  }
+
+  // TODO: Determine if it needs to be base64 encoded.
+  const bool base64Encoded = true;
+
+  {
+    auto object = JsonWriter::object(output(), layout());
+
+    // The encoded content is written straight to the output a chunk at a
+    // time rather than building it up in memory first.
+    object["content"].stream(
+      [blob](OutputSink& output)
+      {
+        util::Base64Encode(git_blob_rawcontent(blob),
+                           static_cast<std::size_t>(git_blob_rawsize(blob)),
+                           true,
+                           output);
+      });
+     object["encoding"] = (base64Encoded ? "base64" : "utf-8");
+    object["sha"] = sha;
+    object["url"] = base_uri() + "/api/repos/" + repositoryName +
+      "/blobs/" + sha;
+    object["size"] = git_blob_rawsize(blob);
+  }
+
+  git_blob_free(blob);
+}
+
+void repository_file(const Router::Arguments& arguments)
+{
+  // Writes out a given file from the repository, as-is, with no additional
+  // metadata.
+  const std::string repositoryName(arguments.front());
+  git::Repository repository(repositoryName);
+
+  if (!repository.IsOpen()) return;
+
+  const std::string specification(arguments[1]);
+
+  // Only the header of the object is read here, the content is streamed to
+  // the output rather than being read into memory all at once.
+  git_oid id;
+  size_t size = 0;
+  git_otype type = GIT_OBJ_BAD;
+  git_odb* objects = repository.Objects();
+  if (!repository.Resolve(specification, &id) || !objects ||
+      git_odb_read_header(&size, &type, objects, &id) != 0)
+  {
+    fail(404, "No file found for '" + specification + "'");
+    return;
+  }
+
+  // TODO: Handle other types better.
+  if (type != GIT_OBJ_BLOB)
+  {
+    fail(422, "The given reference is not a file.");
+    return;
+  }
+
+  // A filename which can't be quoted as it is, such as one which isn't
+  // ASCII, is given percent-encoded as UTF-8 (RFC 6266). Control characters
+  // aren't allowed in either form.
+  RequestContext& context = RequestContext::Current();
+  const std::string* filename = context.Query("filename");
+  if (filename)
+  {
+    const auto is_control = [](char character)
+    {
+      const unsigned char code = static_cast<unsigned char>(character);
+      return code < 0x20 || code == 0x7F;
+    };
+    const auto is_quotable = [](char character)
+    {
+      const unsigned char code = static_cast<unsigned char>(character);
+      return code < 0x80 && character != '"' && character != '\\';
+    };
+    if (std::any_of(filename->begin(), filename->end(), is_control))
+    {
+      fail(422, "The filename can't contain control characters.");
+      return;
+    }
+
+    context.AddResponseHeader(
+      "Content-Disposition",
+      std::all_of(filename->begin(), filename->end(), is_quotable) ?
+        "attachment;filename=\"" + *filename + '"' :
+        "attachment;filename*=UTF-8''" + percent_encode(*filename));
+  }
+  context.ContentType("application/octet-stream");
+
+  git::BlobFiles* files = git::BlobFiles::Current();
+  if (files && size >= minimumBlobFileSize &&
+      files->Write(repository, id, size, output()))
+  {
+    return;
+  }
+
+  if (!git::BlobFiles::Stream(repository, id, output()))
+  {
+    fail(500, "The file could not be read.");
+  }
+}
+
+void repository_blame(const Router::Arguments& arguments)
+{
+  // Gives the commit which last changed each line of a file, as given by
+  // git blame, in hunks of consecutive lines from the same commit.
+  //
+  // Example: /api/repos/gitweb/blame/master/api/gitjson.cpp
+  const std::string repositoryName(arguments.front());
+  const std::string specification(arguments[1]);
+
+  std::stringstream pathStream;
+  std::copy(std::begin(arguments) + 2, std::end(arguments) - 1,
+            std::ostream_iterator<std::string_view>(pathStream, "/"));
+  pathStream << arguments.back();
+  const std::string path = pathStream.str();
+
+  git::Repository repository(repositoryName);
+  if (!repository.IsOpen()) return;
+
+  git_object* gitObject = repository.Parse(specification);
+  if (!gitObject)
+  {
+    fail(404, "No commit found for '" + specification + "'");
+    return;
+  }
+
+  if (git_object_type(gitObject) != GIT_OBJ_COMMIT)
+  {
+    git_object_free(gitObject);
+    fail(422, "'" + specification + "' does not reference a commit.");
+    return;
+  }
+
+  const git_commit* const commit = (const git_commit*)gitObject;
+  std::shared_ptr<const git::Blame> blame;
+  try
+  {
+    blame = git::BlameFile(repository, commit, path);
+  }
+  catch (...)
+  {
+    git_object_free(gitObject);
+    throw;
+  }
+
+  if (!blame)
+  {
+    git_object_free(gitObject);
+    fail(404, "No file found for '" + path + "'");
+    return;
+  }
+
+  char commitHash[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(commitHash, sizeof(commitHash), git_commit_id(commit));
+  git_object_free(gitObject);
+
+  {
+    const RepositoryUrl url(repositoryName);
+    char isoDateString[JsonWriter::timeLength];
+    const std::string_view isoDate(isoDateString, sizeof(isoDateString));
+
+    auto object = JsonWriter::object(output(), layout());
+    object[keys::sha] = std::string_view(commitHash, GIT_OID_HEXSZ);
+    object[keys::path] = path;
+
+    auto hunksArray = object["hunks"].array();
+    for (auto hunk = std::begin(blame->hunks); hunk != std::end(blame->hunks);
+         ++hunk)
+    {
+      auto hunkObject = hunksArray.object();
+      hunkObject["start_line"] = static_cast<unsigned long long>(
+        hunk->startLine);
+      hunkObject["lines"] = static_cast<unsigned long long>(hunk->lineCount);
+
+      {
+        auto commitObject = hunkObject["commit"].object();
+        commitObject[keys::sha] = hunk->sha;
+        commitObject[keys::url].stream(url.Of("/commits/", hunk->sha));
+      }
+
+      {
+        JsonWriter::format_time(hunk->authorTime, isoDateString);
+
+        auto authorObject = hunkObject[keys::author].object();
+        authorObject[keys::name] = hunk->authorName;
+        authorObject[keys::email] = hunk->authorEmail;
+        authorObject[keys::date] = isoDate;
+      }
+
+      hunkObject["original_path"] = hunk->originalPath;
+      hunkObject["original_start_line"] = static_cast<unsigned long long>(
+        hunk->originalStartLine);
+    }
+  }
+}
+
+// Finds the commit with the given specification, failing the request if
+// there isn't one.
+//
+// Returns null if it failed.
+static git_commit* find_commit(git::Repository& repository,
+                               const std::string& specification)
+{
   git_object* object = repository.Parse(specification);
-  if (!object) return;
+  if (!object)
+  {
+    fail(404, "No commit found for '" + specification + "'");
+    return nullptr;
+  }
+
+  git_object* commit = nullptr;
+  const int error = git_object_peel(&commit, object, GIT_OBJ_COMMIT);
+  git_object_free(object);
+  if (error != 0)
+  {
+    fail(422, "'" + specification + "' does not reference a commit.");
+    return nullptr;
+  }
+  return (git_commit*)commit;
+}
+
+void repository_compare(const Router::Arguments& arguments)
+{
+  // Implements: https://developer.github.com/v3/repos/commits/
+  //   #compare-two-commits
+  //
+  // The commits listed are those reachable from the head but not the base,
+  // the oldest first, and the files are those changed from the merge base to
+  // the head, without their patches.
+  //
+  // Example: /api/repos/gitweb/compare/v0.1.0...master
+  const std::string repositoryName(arguments.front());
+
+  std::stringstream specificationStream;
+  std::copy(std::begin(arguments) + 1, std::end(arguments) - 1,
+            std::ostream_iterator<std::string_view>(specificationStream, "/"));
+  specificationStream << arguments.back();
+  const std::string specification = specificationStream.str();
+
+  const std::size_t separator = specification.find("...");
+  if (separator == std::string::npos || separator == 0 ||
+      separator + 3 == specification.size())
+  {
+    fail(422, "The comparison must be given as {base}...{head}.");
+    return;
+  }
+  const std::string baseName = specification.substr(0, separator);
+  const std::string headName = specification.substr(separator + 3);
+
+  git::Repository repository(repositoryName);
+  if (!repository.IsOpen()) return;
+
+  git_commit* base = find_commit(repository, baseName);
+  if (!base) return;
+  git_commit* head = find_commit(repository, headName);
+  if (!head)
+  {
+    git_commit_free(base);
+    return;
+  }
+
+  git::Comparison comparison;
+  std::vector<git_commit*> commits;
+  git_commit* mergeBase = nullptr;
+  std::shared_ptr<const git::Diff> diff;
+  const auto free_commits = [&]
+  {
+    for (auto commit = std::begin(commits); commit != std::end(commits);
+         ++commit)
+    {
+      git_commit_free(*commit);
+    }
+    git_commit_free(mergeBase);
+    git_commit_free(head);
+    git_commit_free(base);
+  };
+
+  try
+  {
+    comparison = git::CompareCommits(repository, *git_commit_id(base),
+                                     *git_commit_id(head));
+    if (comparison.mergeBases.empty())
+    {
+      free_commits();
+      fail(404, "There is no common ancestor of '" + baseName + "' and '" +
+           headName + "'.");
+      return;
+    }
+
+    StageTimer timer("read");
+    if (git_commit_lookup(&mergeBase, repository,
+                          &comparison.mergeBases.front()) != 0)
+    {
+      mergeBase = nullptr;
+      throw git::Error("Could not read the merge base.");
+    }
+
+    const std::size_t count =
+      std::min(comparison.ahead.size(), maximumComparedCommits);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      git_commit* commit = nullptr;
+      if (git_commit_lookup(&commit, repository, &comparison.ahead[i]) != 0)
+      {
+        throw git::Error("Could not read the commits.");
+      }
+      commits.push_back(commit);
+    }
+  }
+  catch (...)
+  {
+    free_commits();
+    throw;
+  }
+
+  // The files changed from the merge base to the head never change, so they
+  // are kept with the diffs of the commits. Only their stats are given, so
+  // their patches aren't worked out.
+  char mergeBaseHash[GIT_OID_HEXSZ + 1];
+  char headHash[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(mergeBaseHash, sizeof(mergeBaseHash),
+                git_commit_id(mergeBase));
+  git_oid_tostr(headHash, sizeof(headHash), git_commit_id(head));
+
+  git::DiffCache* const diffs = git::DiffCache::Current();
+  const std::string key = repositoryName + '\0' + mergeBaseHash + "..." +
+    headHash;
+  if (diffs) diff = diffs->Find(key);
+  if (!diff)
+  {
+    git_tree* mergeBaseTree = nullptr;
+    git_tree* headTree = nullptr;
+    try
+    {
+      if (git_commit_tree(&mergeBaseTree, mergeBase) != 0 ||
+          git_commit_tree(&headTree, head) != 0)
+      {
+        throw git::Error("Could not read the trees of the commits.");
+      }
+      diff = git::DiffTrees(repository, mergeBaseTree, headTree, false);
+    }
+    catch (...)
+    {
+      git_tree_free(headTree);
+      git_tree_free(mergeBaseTree);
+      free_commits();
+      throw;
+    }
+    git_tree_free(headTree);
+    git_tree_free(mergeBaseTree);
+    if (diffs) diffs->Insert(key, diff);
+  }
+
+  {
+    const std::size_t aheadBy = comparison.ahead.size();
+    const std::size_t behindBy = comparison.behindBy;
+    const RepositoryUrl url(repositoryName);
+
+    auto object = JsonWriter::object(output(), layout());
+    object[keys::url] = base_uri() + "/api/repos/" + repositoryName +
+      "/compare/" + specification;
+    object["status"] =
+      aheadBy == 0 && behindBy == 0 ? "identical" :
+      behindBy == 0 ? "ahead" :
+      aheadBy == 0 ? "behind" : "diverged";
+    object["ahead_by"] = static_cast<unsigned long long>(aheadBy);
+    object["behind_by"] = static_cast<unsigned long long>(behindBy);
+    object["total_commits"] = static_cast<unsigned long long>(aheadBy);
+
+    {
+      auto baseObject = object["base_commit"].object();
+      commit_with_parents(base, url, &baseObject);
+    }
+
+    {
+      auto mergeBaseObject = object["merge_base_commit"].object();
+      commit_with_parents(mergeBase, url, &mergeBaseObject);
+    }
+
+    {
+      auto commitsArray = object["commits"].array();
+      for (auto commit = std::begin(commits); commit != std::end(commits);
+           ++commit)
+      {
+        auto commitObject = commitsArray.object();
+        commit_with_parents(*commit, url, &commitObject);
+      }
+    }
+
+    write_diff(*diff, false, &object);
+  }
+
+  free_commits();
+}
+
+void repository_next_command(const Router::Arguments& arguments)
+{
+  const std::string repositoryName(arguments.front());
+
+  // The goal of the following is to implement "ls-tree" that outputs to JSON.
+  {
+    git::Repository repository(repositoryName);
+
+    git_object* object = nullptr;
+    int error = git_revparse_single(&object, repository, "master");
+    if (error)
+    {
+      fail(404, "The given reference was bad.");
+      return;
+    }
+
+    git_object_free(object);
+  }
+}
+
+// The benchmarks (bench.cpp) are linked with the handlers from this file and
+// have their own main, so they go without the rest, which serves them.
+#ifndef GITJSON_NO_MAIN
+
+// Splits a path of the form /api/repos/{name}/{kind}/{specification} into
+// its parts, where the kind and specification may be empty.
+//
+// Returns false if the path is not for a repository.
+static bool split_repository_path(std::string_view path,
+                                  std::string_view* name,
+                                  std::string_view* kind,
+                                  std::string_view* specification)
+{
+  const std::string_view prefix = "/api/repos/";
+  if (path.substr(0, prefix.size()) != prefix) return false;
+
+  const std::string_view rest = path.substr(prefix.size());
+  const std::size_t nameEnd = rest.find('/');
+  *name = rest.substr(0, nameEnd);
+  *kind = std::string_view();
+  *specification = std::string_view();
+  if (nameEnd != std::string_view::npos)
+  {
+    *kind = rest.substr(nameEnd + 1);
+    const std::size_t kindEnd = kind->find('/');
+    if (kindEnd != std::string_view::npos)
+    {
+      *specification = kind->substr(kindEnd + 1);
+      *kind = kind->substr(0, kindEnd);
+    }
+  }
+  return !name->empty();
+}
+
+// Returns true if the request is for a raw file, which is sent as it is.
+static bool is_raw_file(const RequestContext& context)
+{
+  std::string_view name, kind, specification;
+  return split_repository_path(context.Path(), &name, &kind, &specification) &&
+    kind == "file";
+}
+
+// Returns what identifies the response to the request, which is a hash of
+// everything it depends on (including its content encoding), or an empty
+// string if it can't be identified without generating it.
+//
+// When a path refers to an object by its SHA the response can never change,
+// as the SHA identifies the content, and isImmutable is set to true.
+// Otherwise the response can change when the references of the repository
+// do. Either way this is worked out without opening the repository.
+static std::string response_identity(const RequestContext& context,
+                                     bool* isImmutable)
+{
+  const std::string_view path = context.Path();
+  std::string_view name, kind, specification;
+  if (!split_repository_path(path, &name, &kind, &specification))
+  {
+    return std::string();
+  }
+
+  // A blame is of a path at the commit, which comes first, and a comparison
+  // is of two commits.
+  const auto is_sha = [](std::string_view text)
+  {
+    return text.size() == GIT_OID_HEXSZ &&
+      text.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+  };
+  const std::string_view object = kind == "blame" ?
+    specification.substr(0, specification.find('/')) : specification;
+  *isImmutable =
+    ((kind == "commits" || kind == "trees" || kind == "blobs" ||
+      kind == "tags" || kind == "file" || kind == "blame") &&
+     is_sha(object)) ||
+    (kind == "compare" && object.size() == 2 * GIT_OID_HEXSZ + 3 &&
+     is_sha(object.substr(0, GIT_OID_HEXSZ)) &&
+     object.substr(GIT_OID_HEXSZ, 3) == "..." &&
+     is_sha(object.substr(GIT_OID_HEXSZ + 3)));
+
+  std::uint64_t state = 0;
+  if (!*isImmutable &&
+      !git::Repository::ReferencesState(std::string(name), &state))
+  {
+    return std::string();
+  }
+
+  // FNV-1a of everything the response depends on.
+  std::uint64_t hash = 14695981039346656037ull;
+  const auto add = [&hash](std::string_view text)
+  {
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+      hash = (hash ^ static_cast<unsigned char>(text[i])) * 1099511628211ull;
+    }
+    hash = (hash ^ 0xFF) * 1099511628211ull;
+  };
+
+  add(VERSION);
+  add(base_uri());
+  add(path);
+  add(context.ContentEncoding());
+  add(layout(context) == JsonWriter::Compact ? "compact" : "indented");
+  const RequestContext::Fields& query = context.QueryParameters();
+  for (auto parameter = std::begin(query); parameter != std::end(query);
+       ++parameter)
+  {
+    add(parameter->first);
+    add(parameter->second);
+  }
+  add(std::string_view(reinterpret_cast<const char*>(&state), sizeof(state)));
+
+  char identity[GIT_OID_HEXSZ + 18];
+  if (*isImmutable)
+  {
+    std::snprintf(identity, sizeof(identity), "%.*s-%016llx", GIT_OID_HEXSZ,
+                  object.data(), static_cast<unsigned long long>(hash));
+  }
+  else
+  {
+    std::snprintf(identity, sizeof(identity), "%016llx",
+                  static_cast<unsigned long long>(hash));
+  }
+  return identity;
+}
+
+// Returns the entity tag of the response to the request, quoted as it is in
+// the ETag header, or an empty string if there isn't one.
+static std::string entity_tag(const RequestContext& context)
+{
+  bool isImmutable = false;
+  const std::string identity = response_identity(context, &isImmutable);
+  return identity.empty() ? identity : '"' + identity + '"';
+}
+
+// Runs the handler for the request.
+//
+// Returns false if there is no handler for the request.
+static bool dispatch(const Router& router, RequestContext& context)
+{
+  const auto start = std::chrono::steady_clock::now();
+  const std::chrono::nanoseconds timedBefore = context.TimedTotal();
+
+  bool isRouted = true;
+  try
+  {
+    isRouted = router(context.Path(), '/');
+  }
+  catch (const git::NotFound& error)
+  {
+    context.Error(404, std::string("Error: ") + error.what());
+  }
+  catch (const git::Error& error)
+  {
+    context.Error(500, std::string("Error: ") + error.what());
+  }
+
+  if (!isRouted)
+  {
+    context.Error(404, "Unknown resource: " + context.Path());
+    return false;
+  }
+
+  // The time the handler spent outside of the stages it timed went on
+  // writing the response.
+  context.AddTiming("json", std::chrono::steady_clock::now() - start -
+                    (context.TimedTotal() - timedBefore));
+  return true;
+}
+
+// Routes the given request to its handler, which writes the response to the
+// output of the request, compressed if the request has a content encoding.
+//
+// A response that never changes is written from the ResponseStore if it is
+// there, otherwise it is added to it. Raw files are left to the BlobFiles.
+//
+// Returns false if there is no handler for the request.
+static bool route(const Router& router, RequestContext& context)
+{
+  ResponseStore* store = ResponseStore::Current();
+  std::string key;
+  if (store && !is_raw_file(context))
+  {
+    bool isImmutable = false;
+    key = response_identity(context, &isImmutable);
+    if (!isImmutable) key.clear();
+  }
+
+  OutputSink& output = context.Output();
+  if (!key.empty())
+  {
+    StageTimer timer("store");
+    if (store->Write(key, &output)) return true;
+  }
+
+  std::optional<ResponseStore::Recorder> recorder;
+  if (!key.empty()) recorder.emplace(*store, key, &output);
+  OutputSink* destination = recorder ? &*recorder : &output;
+
+  // A response which is kept is only compressed once, so it is worth taking
+  // the time to make it as small as possible.
+  std::optional<DeflateSink> compressed;
+  const std::string& encoding = context.ContentEncoding();
+  if (!encoding.empty())
+  {
+    compressed.emplace(destination,
+                       encoding == "gzip" ? DeflateSink::Gzip :
+                                            DeflateSink::Zlib,
+                       recorder ? 9 : -1);
+    destination = &*compressed;
+  }
 
-  // TODO: Handle other types better.
-  if (git_object_type(object) != GIT_OBJ_BLOB)
+  context.Output(destination);
+  const bool isRouted = dispatch(router, context);
+  context.Output(&output);
+
+  if (compressed) compressed->Finish();
+  if (recorder)
+  {
+    if (isRouted && context.Status() == 200) recorder->Commit();
+    else recorder->Flush();
+  }
+  return isRouted;
+}
+
+// Returns the route the request was for, with the names given in the path
+// replaced by placeholders (as in /api/repos/{repo}/commits/{sha}), which the
+// time taken by the request is recorded against.
+static std::string route_name(const RequestContext& context, bool isRouted)
+{
+  if (context.Status() == 304) return "not modified";
+  if (!isRouted) return "unknown";
+
+  const std::string& path = context.Path();
+  std::string_view name, kind, specification;
+  if (!split_repository_path(path, &name, &kind, &specification)) return path;
+
+  std::string route = "/api/repos/{repo}";
+  if (!kind.empty()) route += '/' + std::string(kind);
+  if (!specification.empty())
+  {
+    route += kind == "refs" ? "/{ref}" :
+      kind == "blame" ? "/{ref}/{path}" :
+      kind == "compare" ? "/{base}...{head}" :
+      (kind == "branches" || kind == "tags") ? "/{name}" : "/{sha}";
+  }
+  return route;
+}
+
+// Returns the value of the Server-Timing header for the response, which gives
+// the milliseconds spent in each stage of handling the request and in total.
+static std::string server_timing(const RequestContext& context,
+                                 std::chrono::nanoseconds elapsed)
+{
+  const auto milliseconds = [](std::chrono::nanoseconds duration)
+  {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+
+  std::string value;
+  char metric[64];
+  const RequestContext::Timings& timings = context.StageTimings();
+  for (auto timing = std::begin(timings); timing != std::end(timings);
+       ++timing)
+  {
+    std::snprintf(metric, sizeof(metric), "%s;dur=%.3f, ", timing->first,
+                  milliseconds(timing->second));
+    value += metric;
+  }
+  std::snprintf(metric, sizeof(metric), "total;dur=%.3f",
+                milliseconds(elapsed));
+  return value + metric;
+}
+
+// Records how long the request took in the Statistics, if there are any.
+static void record_request(const RequestContext& context, bool isRouted,
+                           std::chrono::nanoseconds elapsed)
+{
+  if (Statistics* statistics = Statistics::Current())
+  {
+    statistics->Record(route_name(context, isRouted), elapsed,
+                       context.StageTimings());
+  }
+}
+
+// The router the requests given to /api/batch are routed through, which
+// routes raw files and other batches to not_batchable.
+static const Router* batchRouter = nullptr;
+
+// Stands in for the handlers of the requests that can't be batched, as their
+// responses aren't JSON or would run more batches.
+static void not_batchable()
+{
+  fail(422, "Only JSON responses can be batched: " +
+       RequestContext::Current().Path());
+}
+
+static void not_batchable_with_arguments(const Router::Arguments&)
+{
+  not_batchable();
+}
+
+// Runs the requests given by the path parameters of the query, such as
+// /api/batch?path=/api/repos/gitweb/refs&path=/api/repos/gitweb/branches,
+// and responds with an array of their results in the same order. Each has
+// the path, the status and the body of the response to it.
+//
+// The requests are run in parallel on the ThreadPool and share the
+// repositories they open through the RepositoryCache, which is created for
+// them if there isn't one already. Raw files can't be included, as they
+// aren't JSON, nor can other batches. A response which isn't JSON is
+// replaced by an error rather than being put in the array.
+static void batch_requests()
+{
+  RequestContext& context = RequestContext::Current();
+
+  std::vector<std::string> paths;
+  const RequestContext::Fields& query = context.QueryParameters();
+  for (auto parameter = std::begin(query); parameter != std::end(query);
+       ++parameter)
+  {
+    if (parameter->first == "path") paths.push_back(parameter->second);
+  }
+
+  if (paths.empty() || paths.size() > maximumBatchRequests)
   {
-    fprintf(stderr, "The given reference is not a file.");
+    fail(422, "Between 1 and " + std::to_string(maximumBatchRequests) +
+         " paths must be given.");
     return;
   }
 
-  const git_blob* blob = (const git_blob *)object;
+  struct Result
+  {
+    std::string path;
+    int status;
+    BufferSink body;
+  };
+  std::vector<Result> results(paths.size());
+
+  const JsonWriter::Layout layout = ::layout(context);
+  const auto run = [layout](Result* result)
+  {
+    RequestContext request(result->path, &result->body);
+    if (layout == JsonWriter::Compact)
+    {
+      request.AddHeader("X-JSON-Layout", "compact");
+    }
+
+    const bool isRouted = route(*batchRouter, request);
+    if (request.Status() < 400 &&
+        !JsonWriter::is_valid(std::string_view(result->body.Data(),
+                                               result->body.Size())))
+    {
+      request.Error(500, "The response was not JSON: " + result->path);
+    }
+
+    result->status = request.Status();
+    if (result->status >= 400)
+    {
+      result->body.Clear();
+      auto object = JsonWriter::object(&result->body, layout);
+      object["message"] = request.ErrorMessage();
+    }
+    record_request(request, isRouted, request.Elapsed());
+  };
 
-  fwrite(git_blob_rawcontent(blob),
-         static_cast<size_t>(git_blob_rawsize(blob)),
-         1,
-         stdout);
+  std::optional<git::RepositoryCache> cache;
+  if (!git::RepositoryCache::Current()) cache.emplace(paths.size());
 
-  git_object_free(object);
+  ThreadPool* pool = ThreadPool::Current();
+  std::atomic<std::size_t> remaining(results.size());
+  for (std::size_t i = 0; i < results.size(); ++i)
+  {
+    Result* result = &results[i];
+    result->path = paths[i];
+    if (!pool)
+    {
+      run(result);
+      continue;
+    }
+
+    pool->Submit([&run, &remaining, result]
+                 {
+                   run(result);
+                   --remaining;
+                 });
+  }
+  if (pool) pool->RunUntil([&remaining] { return remaining == 0; });
+
+  auto array = JsonWriter::array(output(), layout);
+  for (auto result = std::begin(results); result != std::end(results);
+       ++result)
+  {
+    // The body is written as it is, without the new line at the end.
+    std::string_view body(result->body.Data(), result->body.Size());
+    while (!body.empty() && body.back() == '\n') body.remove_suffix(1);
+
+    auto object = array.object();
+    object["path"] = result->path;
+    object["status"] = static_cast<std::int64_t>(result->status);
+    object["body"].json(body);
+  }
 }
 
-void repository_next_command(const std::vector<std::string>& arguments)
+// Returns the content coding to use for a response given the value of the
+// Accept-Encoding header of the request, which is gzip or deflate, or an
+// empty string if the response should not be compressed.
+static std::string choose_encoding(const std::string* accepted)
 {
-  const std::string& repositoryName = arguments.front();
+  if (!accepted) return std::string();
+
+  // The weight given to each coding, or -1 if it isn't named. A coding that
+  // isn't named has the weight of *, if that is.
+  double gzipWeight = -1;
+  double deflateWeight = -1;
+  double anyWeight = -1;
+  std::size_t start = 0;
+  while (start < accepted->size())
+  {
+    std::size_t end = accepted->find(',', start);
+    if (end == std::string::npos) end = accepted->size();
+
+    // Each is a coding optionally followed by a weight (gzip;q=0.5), where a
+    // weight of 0 means it is not acceptable.
+    std::string coding = accepted->substr(start, end - start);
+    const std::size_t semicolon = coding.find(';');
+    double weight = 1;
+    if (semicolon != std::string::npos)
+    {
+      const std::size_t q = coding.find("q=", semicolon);
+      if (q != std::string::npos)
+      {
+        weight = std::strtod(coding.c_str() + q + 2, nullptr);
+      }
+      coding.resize(semicolon);
+    }
+    coding.erase(std::remove(coding.begin(), coding.end(), ' '),
+                 coding.end());
+    std::transform(coding.begin(), coding.end(), coding.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
 
-  // The goal of the following is to implement "ls-tree" that outputs to JSON.
+    if (coding == "gzip" || coding == "x-gzip") gzipWeight = weight;
+    else if (coding == "deflate") deflateWeight = weight;
+    else if (coding == "*") anyWeight = weight;
+
+    start = end + 1;
+  }
+
+  if (gzipWeight < 0) gzipWeight = anyWeight;
+  if (deflateWeight < 0) deflateWeight = anyWeight;
+
+  // gzip is preferred when they are given the same weight.
+  if (gzipWeight > 0 && gzipWeight >= deflateWeight) return "gzip";
+  if (deflateWeight > 0) return "deflate";
+  return std::string();
+}
+
+// Returns true if the value of an If-None-Match header matches the entity
+// tag, in which case the client already has the response. The tag "*" only
+// matches "*", which matches any response there is.
+static bool is_matching_tag(const std::string& tags, const std::string& tag)
+{
+  std::size_t start = 0;
+  while (start < tags.size())
   {
-    git::Repository repository(repositoryName);
+    std::size_t end = tags.find(',', start);
+    if (end == std::string::npos) end = tags.size();
 
-    git_object* object = nullptr;
-    int error = git_revparse_single(&object, repository, "master");
-    if (error)
+    std::string_view candidate(tags.data() + start, end - start);
+    while (!candidate.empty() && candidate.front() == ' ')
     {
-      fprintf(stderr, "The given reference was bad.");
-      return;
+      candidate.remove_prefix(1);
+    }
+    while (!candidate.empty() && candidate.back() == ' ')
+    {
+      candidate.remove_suffix(1);
     }
 
-    git_object_free(object);
+    // The comparison is weak, so a weak tag matches too.
+    if (candidate.substr(0, 2) == "W/") candidate.remove_prefix(2);
+    if (candidate == tag) return true;
+
+    start = end + 1;
   }
+  return false;
 }
 
-int main(int argc, char* argv[])
+// Passes files written to the output on to the response, so they are sent
+// with sendfile() rather than being copied into the body.
+class ResponseSink : public BufferSink
 {
-  // Command line parser.
-  //
-  // examples:
-  // /api/repos/<repo-name>/tags
-  if (argc != 2)
+public:
+  ResponseSink(http::Response& response) : myResponse(response) {}
+
+  void WriteFile(int descriptor, std::uint64_t offset,
+                 std::uint64_t size) override
   {
-    fprintf(stderr, "usage: %s <uri>\n", argv[0]);
-    fprintf(stderr, "       %s -\n", argv[0]);
-    return 1;
+    myResponse.body.append(Data(), Size());
+    Clear();
+    if (!myResponse.AttachFile(descriptor, offset, size))
+    {
+      BufferSink::WriteFile(descriptor, offset, size);
+    }
   }
 
-  const std::string uri(argv[1]);
+private:
+  http::Response& myResponse;
+};
 
-  // Check if it starts with /api/
-  if (uri.find("/api/", 0, 5) == std::string::npos &&
-      uri != "-")
+// Handles the request, filling in the response with everything except for
+// the Content-Length.
+static void respond(const Router& router, const http::Request& request,
+                    http::Response& response)
+{
+  ResponseSink body(response);
+  RequestContext context(request.target, &body);
+  for (auto header = std::begin(request.headers);
+       header != std::end(request.headers); ++header)
   {
-    fprintf(stderr, "The URI didn't start with /api/");
-    return 1;
+    context.AddHeader(header->first, header->second);
   }
 
-  git_libgit2_init();
+  bool isRouted = false;
+  if (request.method != "GET" && request.method != "HEAD")
+  {
+    context.Error(405, "Only GET and HEAD are supported.");
+    response.headers.emplace_back("Allow", "GET, HEAD");
+  }
+  else
+  {
+    // Raw files are sent as they are, as they may already be compressed
+    // and are sent straight from the file.
+    if (!is_raw_file(context))
+    {
+      context.ContentEncoding(
+        choose_encoding(context.Header("Accept-Encoding")));
+      context.AddResponseHeader("Vary", "Accept-Encoding, X-JSON-Layout");
+    }
 
-  Router router;
+    // A client that already has the response is told so before the
+    // repository is opened.
+    const std::string tag = entity_tag(context);
+    const std::string* tags = context.Header("If-None-Match");
+    if (!tag.empty()) context.AddResponseHeader("ETag", tag);
+
+    if (!tag.empty() && tags && is_matching_tag(*tags, tag))
+    {
+      context.Status(304);
+    }
+    else
+    {
+      isRouted = route(router, context);
+
+      // Whether there is a response for "*" to match isn't known until the
+      // handler has looked for it, so a missing object is still a 404.
+      if (tags && context.Status() == 200 && is_matching_tag(*tags, "*"))
+      {
+        context.Status(304);
+      }
+    }
+  }
+
+  response.status = context.Status();
+  if (response.status == 304)
+  {
+    body.Clear();
+    response.body.clear();
+    response.DetachFile();
+    response.headers = context.ResponseHeaders();
+  }
+  else if (response.status >= 400)
+  {
+    // Anything written before the error is discarded.
+    body.Clear();
+    response.body.clear();
+    response.DetachFile();
+    {
+      auto object = JsonWriter::object(&body, layout(context));
+      object["message"] = context.ErrorMessage();
+    }
+    response.body = body.Take();
+    response.headers.emplace_back("Content-Type",
+                                  "application/json; charset=utf-8");
+  }
+  else
+  {
+    response.body += body.Take();
+    response.headers.emplace_back("Content-Type", context.ContentType());
+    if (!context.ContentEncoding().empty())
+    {
+      response.headers.emplace_back("Content-Encoding",
+                                    context.ContentEncoding());
+    }
+    response.headers.insert(std::end(response.headers),
+                            std::begin(context.ResponseHeaders()),
+                            std::end(context.ResponseHeaders()));
+  }
+
+  const std::chrono::nanoseconds elapsed = context.Elapsed();
+  response.headers.emplace_back("Server-Timing",
+                                server_timing(context, elapsed));
+  record_request(context, isRouted, elapsed);
+}
+
+// Serves the API over HTTP on the given address (host:port) until an error
+// occurs.
+//
+// As with serve_frames(), the requests are handled on threads of the server's
+// own, as many as the ThreadPool has, rather than on the pool.
+static void serve(const Router& router, const std::string& address)
+{
+  http::Server server(
+    [&router](const http::Request& request, http::Response& response)
+    {
+      respond(router, request, response);
+    },
+    ThreadPool::Current()->Size());
+
+  server.Listen(address);
+  fprintf(stderr, "Serving HTTP on %s ...\n", address.c_str());
+  server.Run();
+}
+
+// Writes the response to the output, framed as described by serve_frames().
+static void write_frame(const std::string& id, http::Response& response,
+                        OutputSink* output)
+{
+  output->Write(id);
+  output->Put(' ');
+  output->WriteInteger(static_cast<std::int64_t>(response.status));
+  output->Put(' ');
+  const bool hasFile = response.file != -1;
+  output->WriteInteger(static_cast<std::uint64_t>(response.body.size()) +
+                       (hasFile ? response.fileSize : 0));
+  output->Put('\n');
+
+  for (auto header = std::begin(response.headers);
+       header != std::end(response.headers); ++header)
+  {
+    output->Write(header->first);
+    output->Write(": ", 2);
+    output->Write(header->second);
+    output->Put('\n');
+  }
+  output->Put('\n');
+
+  if (hasFile)
+  {
+    output->Write(response.body.data(), response.filePosition);
+    output->WriteFile(response.file, response.fileOffset, response.fileSize);
+    output->Write(response.body.data() + response.filePosition,
+                  response.body.size() - response.filePosition);
+  }
+  else
+  {
+    output->Write(response.body);
+  }
+  output->Flush();
+}
+
+// Serves requests read from standard input until it ends or a line with just
+// "\4" is read. Each request is a line with an id, chosen by the client, and
+// the target separated by a space:
+//   <id> <uri>
+//
+// The requests are handled in parallel and each response is written to
+// standard output as soon as it is complete, so they may be in a different
+// order to the requests. A response is framed by a line with the id of the
+// request, the status and the length of the body, followed by the headers, a
+// blank line and the body:
+//   <id> <status> <length>
+//   <name>: <value>
+//   ...
+//
+//   <body>
+//
+// The requests have threads of their own, as many as the ThreadPool has,
+// rather than being run on the pool. The handlers split their work into tasks
+// on the pool and help with it while they wait, which would otherwise mean
+// running whole requests in the middle of another.
+static void serve_frames(const Router& router)
+{
+  const std::size_t threadCount = ThreadPool::Current()->Size();
+
+  // The most requests waiting for a thread, beyond which no more are read
+  // until one is taken.
+  const std::size_t maximumQueued = threadCount * 4;
+
+  struct Frame
+  {
+    std::string id;
+    std::string target;
+  };
+  std::deque<Frame> queue;
+  bool isEnded = false;
+  std::mutex queueMutex;
+  std::condition_variable queueChanged;
+
+  DescriptorSink output(1);
+  std::mutex outputMutex;
+
+  const auto handle_requests = [&]
+  {
+    for (;;)
+    {
+      Frame frame;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [&] { return isEnded || !queue.empty(); });
+        if (queue.empty()) return;
+        frame = std::move(queue.front());
+        queue.pop_front();
+      }
+      queueChanged.notify_all();
+
+      http::Request request;
+      request.method = "GET";
+      request.target = frame.target;
+      request.version = 1;
+
+      http::Response response;
+      try
+      {
+        respond(router, request, response);
+      }
+      catch (const std::exception& error)
+      {
+        response = http::Response();
+        response.status = 500;
+        response.headers.emplace_back("Content-Type",
+                                      "text/plain; charset=utf-8");
+        response.body = std::string("Error: ") + error.what();
+      }
+
+      std::lock_guard<std::mutex> lock(outputMutex);
+      write_frame(frame.id, response, &output);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < threadCount; ++i)
+  {
+    threads.emplace_back(handle_requests);
+  }
+
+  std::string line;
+  while (std::getline(std::cin, line) && line != "\4")
+  {
+    const std::size_t space = line.find(' ');
+    if (space == std::string::npos || space == 0)
+    {
+      fprintf(stderr, "Expected \"<id> <uri>\" but got: %s\n", line.c_str());
+      continue;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueChanged.wait(lock, [&] { return queue.size() < maximumQueued; });
+      queue.push_back(Frame{ line.substr(0, space), line.substr(space + 1) });
+    }
+    queueChanged.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    isEnded = true;
+  }
+  queueChanged.notify_all();
+  for (auto thread = std::begin(threads); thread != std::end(threads);
+       ++thread)
+  {
+    thread->join();
+  }
+}
+
+// Returns the directory the caches shared between processes are kept in,
+// which is $GITJSON_CACHE, or else gitjson in the cache directory of the user
+// ($XDG_CACHE_HOME or ~/.cache). The caches are only used by the user they
+// belong to, so they are never put in a directory anyone can write to, such as
+// /tmp. An empty string is returned if there is nowhere to put them.
+static std::string cache_directory()
+{
+  if (const char* directory = std::getenv("GITJSON_CACHE")) return directory;
+  if (const char* directory = std::getenv("XDG_CACHE_HOME"))
+  {
+    if (*directory == '/') return std::string(directory) + "/gitjson";
+  }
+  if (const char* home = std::getenv("HOME"))
+  {
+    if (*home == '/') return std::string(home) + "/.cache/gitjson";
+  }
+  return std::string();
+}
+
+// Adds the routes of the API to the router and compiles it. The router for
+// the requests in a batch has the same routes, except those which can't be
+// batched.
+static void add_routes(Router* routes, bool isForBatches)
+{
+  Router& router = *routes;
   router["api"] = api_information;
   router["api"]["repos"] = repositories_list;
+  router["api"]["batch"] = isForBatches ? not_batchable : batch_requests;
+  router["api"]["stats"] = api_statistics;
   router["api"]["repos"][Router::placeholder] = repository_information;
   router["api"]["repos"][Router::placeholder]["refs"] = repository_refs;
   router["api"]["repos"][Router::placeholder]["refs"][
@@ -842,21 +2712,69 @@ int main(int argc, char* argv[])
   router["api"]["repos"][Router::placeholder]["tags"] = repository_tags;
   router["api"]["repos"][Router::placeholder]["tags"][Router::placeholder] =
     repository_tag;
+  router["api"]["repos"][Router::placeholder]["commits"] = repository_commits;
   router["api"]["repos"][Router::placeholder]["commits"][Router::placeholder] =
     repository_commit;
   router["api"]["repos"][Router::placeholder]["trees"][Router::placeholder] =
     repository_tree;
   router["api"]["repos"][Router::placeholder]["blobs"][Router::placeholder] =
     repository_blob;
+  router["api"]["repos"][Router::placeholder]["blame"][Router::placeholder][
+    Router::placeholder_remaining] = repository_blame;
+  router["api"]["repos"][Router::placeholder]["compare"][
+    Router::placeholder_remaining] = repository_compare;
 
   // Output the file with no manipulation (i.e it won't be put into JSON, etc.
   // TODO: Add support for "raw" and change this to use "raw".
   router["api"]["repos"][Router::placeholder]["file"][Router::placeholder] =
-    repository_file;
+    isForBatches ? not_batchable_with_arguments : repository_file;
 
   // A work in progress.
   router["api"]["repos"][Router::placeholder]["next"] = repository_next_command;
 
+  router.Compile();
+}
+
+int main(int argc, char* argv[])
+{
+  // Command line parser.
+  //
+  // examples:
+  // /api/repos/<repo-name>/tags
+  const bool isListening =
+    argc == 3 && std::string(argv[1]) == "--listen";
+  if (argc != 2 && !isListening)
+  {
+    fprintf(stderr, "usage: %s <uri>\n", argv[0]);
+    fprintf(stderr, "       %s -\n", argv[0]);
+    fprintf(stderr, "       %s --framed\n", argv[0]);
+    fprintf(stderr, "       %s --listen [host]:port\n", argv[0]);
+    return 1;
+  }
+
+  const std::string uri(argv[1]);
+
+  // Check if it starts with /api/
+  if (uri.find("/api/", 0, 5) == std::string::npos &&
+      uri != "-" && uri != "--framed" && !isListening)
+  {
+    fprintf(stderr, "The URI didn't start with /api/");
+    return 1;
+  }
+
+  git_libgit2_init();
+
+  if (const char* repositories = std::getenv("GITJSON_REPOSITORIES"))
+  {
+    git::RepositoriesPath(repositories);
+  }
+
+  Router router;
+  Router routerForBatches;
+  add_routes(&router, false);
+  add_routes(&routerForBatches, true);
+  batchRouter = &routerForBatches;
+
   struct ShutdownGit
   {
     ~ShutdownGit()
@@ -868,42 +2786,97 @@ int main(int argc, char* argv[])
     }
   } shutdownOnScopeExit;
 
-  if (uri == "-")
+  // Used for reading the trees of a recursive listing in parallel. The
+  // threads are only started when they are first needed.
+  ThreadPool threadPool;
+
+  // Large files are sent from copies kept on disk, which are shared with any
+  // other instances using the same directory, as are the stored responses.
+  const std::string cachePath = cache_directory();
+  std::optional<git::BlobFiles> blobFiles;
+  if (!cachePath.empty())
+  {
+    blobFiles.emplace(cachePath + "/blobs", blobFilesCapacity);
+  }
+
+  // The responses for objects given by their SHA never change, so they are
+  // kept on disk for the next request for them.
+  std::optional<ResponseStore> responseStore;
+  if (!cachePath.empty())
   {
+    responseStore.emplace(cachePath + "/responses", responseStoreCapacity);
+  }
+
+  // How long the requests take, which is given by /api/stats.
+  Statistics statistics;
+
+  // The repositories listed by /api/repos, which are only found the first
+  // time they are asked for and then kept up to date.
+  git::Catalogue catalogue;
+
+  // The blames of files, which are slow to work out from the history.
+  git::BlameCache blameCache(blameCacheCapacity);
+
+  // The files changed by commits, which are worked out in parallel.
+  git::DiffCache diffCache(diffCacheCapacity);
+
+  // The paths changed by each commit, for the history of a path, which are
+  // kept on disk and added to as the histories are walked.
+  std::optional<git::ChangedPaths> changedPaths;
+  if (!cachePath.empty()) changedPaths.emplace(cachePath + "/paths");
+
+  if (isListening)
+  {
+    git::RepositoryCache cache(repositoryCacheCapacity);
+    try
+    {
+      serve(router, argv[2]);
+    }
+    catch (const http::Error& error)
+    {
+      fprintf(stderr, "Error: %s\n", error.what());
+      return 2;
+    }
+  }
+  else if (uri == "--framed")
+  {
+    git::RepositoryCache cache(repositoryCacheCapacity);
+    serve_frames(router);
+  }
+  else if (uri == "-")
+  {
+    git::RepositoryCache cache(repositoryCacheCapacity);
+    DescriptorSink output(1);
+
     // Read the URI from standard in.
     std::string uriFromStandardIn;
     while (!std::getline(std::cin, uriFromStandardIn).eof() &&
            uriFromStandardIn != "\4")
     {
       // Perform the route.
-      // TODO: Add exception handling.
-      if (!router(uriFromStandardIn.c_str(), '/'))
       {
-        fprintf(stderr, "Unknown resource: %s\n", uri.c_str());
-        return 1;
+        RequestContext context(uriFromStandardIn, &output);
+        const bool isRouted = route(router, context);
+        record_request(context, isRouted, context.Elapsed());
       }
-      std::cout << "\04\n";
+
+      // The response is only passed on once it is complete.
+      output.Write("\04\n", 2);
+      output.Flush();
     }
   }
   else
   {
     // Perform the route.
-    try
-    {
-      if (!router(argv[1], '/'))
-      {
-        fprintf(stderr, "Unknown resource: %s\n", uri.c_str());
-        return 1;
-      }
-    }
-    catch (const git::Error& error)
-    {
-      fprintf(stderr, "Error: %s\n", error.what());
-      return 2;
-    }
+    DescriptorSink output(1);
+    RequestContext context(uri, &output);
+    if (!route(router, context)) return 1;
+    if (context.Status() >= 500) return 2;
   }
 
   return 0;
 }
 
+#endif
+
 //===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,1072 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : http
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "http.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  // The largest request head (request line and headers) that is accepted.
+  const std::size_t maximumHeadSize = 64 * 1024;
+
+  // The largest request body that is accepted.
+  const std::size_t maximumBodySize = 8 * 1024 * 1024;
+
+  // Once this many bytes of responses are waiting to be sent on a connection
+  // no more of its pipelined requests are handled until they are sent. The
+  // files in responses are not counted as they are not held in memory.
+  const std::size_t maximumPendingOutput = 4 * 1024 * 1024;
+
+  // The most that is sent from a file at a time, so one large file doesn't
+  // hold up the other connections.
+  const std::size_t fileChunkSize = 1024 * 1024;
+
+  // The most pipelined requests on a connection that are handled at once,
+  // beyond which the rest wait until the first of them are complete.
+  const std::size_t maximumPipelined = 16;
+
+  // How long a connection can go without a complete request, while none of
+  // its requests are being handled, or without taking any of its response,
+  // before it is closed.
+  const std::chrono::seconds idleTimeout(30);
+
+  // How often the connections are checked for having been idle for too long.
+  const int expiryInterval = 1000;
+
+  bool equal_ignoring_case(const std::string& a, const char* b)
+  {
+    std::size_t i = 0;
+    for (; i < a.size() && b[i] != '\0'; ++i)
+    {
+      const char x = (a[i] >= 'A' && a[i] <= 'Z') ? a[i] - 'A' + 'a' : a[i];
+      const char y = (b[i] >= 'A' && b[i] <= 'Z') ? b[i] - 'A' + 'a' : b[i];
+      if (x != y) return false;
+    }
+    return i == a.size() && b[i] == '\0';
+  }
+
+  // Returns true if the comma separated list of tokens in value contains
+  // token, for example the Connection header.
+  bool contains_token(const std::string* value, const char* token)
+  {
+    if (!value) return false;
+
+    std::size_t start = 0;
+    while (start < value->size())
+    {
+      std::size_t end = value->find(',', start);
+      if (end == std::string::npos) end = value->size();
+
+      std::size_t first = start;
+      std::size_t last = end;
+      while (first < last && (*value)[first] == ' ') ++first;
+      while (last > first && (*value)[last - 1] == ' ') --last;
+      if (equal_ignoring_case(value->substr(first, last - first), token))
+      {
+        return true;
+      }
+      start = end + 1;
+    }
+    return false;
+  }
+
+  // Parses the request line and headers in [head, head + size) into request.
+  //
+  // Returns false if the request is malformed.
+  bool parse_head(const char* head, std::size_t size, http::Request* request)
+  {
+    const char* const end = head + size;
+    const char* lineEnd =
+      static_cast<const char*>(std::memchr(head, '\n', size));
+    if (!lineEnd) return false;
+
+    // The request line, for example: GET /api/repos HTTP/1.1
+    {
+      std::string line(head, lineEnd);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+
+      const std::size_t methodEnd = line.find(' ');
+      const std::size_t targetEnd = line.rfind(' ');
+      if (methodEnd == std::string::npos || targetEnd == methodEnd)
+      {
+        return false;
+      }
+
+      request->method = line.substr(0, methodEnd);
+      request->target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+
+      const std::string version = line.substr(targetEnd + 1);
+      if (version == "HTTP/1.1") request->version = 1;
+      else if (version == "HTTP/1.0") request->version = 0;
+      else return false;
+    }
+
+    for (const char* cursor = lineEnd + 1; cursor < end; cursor = lineEnd + 1)
+    {
+      lineEnd = static_cast<const char*>(std::memchr(cursor, '\n',
+                                                     end - cursor));
+      if (!lineEnd) lineEnd = end;
+
+      std::string line(cursor, lineEnd);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (line.empty()) break;
+
+      const std::size_t colon = line.find(':');
+      if (colon == std::string::npos || colon == 0) return false;
+
+      std::size_t valueStart = colon + 1;
+      while (valueStart < line.size() &&
+             (line[valueStart] == ' ' || line[valueStart] == '\t'))
+      {
+        ++valueStart;
+      }
+      std::size_t valueEnd = line.size();
+      while (valueEnd > valueStart &&
+             (line[valueEnd - 1] == ' ' || line[valueEnd - 1] == '\t'))
+      {
+        --valueEnd;
+      }
+
+      request->headers.emplace_back(
+        line.substr(0, colon), line.substr(valueStart, valueEnd - valueStart));
+    }
+
+    return true;
+  }
+
+  // Returns false for the responses which never have a body.
+  bool has_body(int status)
+  {
+    return status >= 200 && status != 204 && status != 304;
+  }
+
+  // Formats the status line and headers of the response.
+  //
+  // A header whose name or value contains a line break is left out, as it
+  // would add headers of its own or end the head early.
+  std::string format_head(const http::Response& response,
+                          std::size_t contentLength,
+                          bool keepAlive)
+  {
+    char statusLine[64];
+    std::snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %d %s\r\n",
+                  response.status, http::ReasonPhrase(response.status));
+
+    std::string head(statusLine);
+    for (auto header = std::begin(response.headers);
+         header != std::end(response.headers); ++header)
+    {
+      if (header->first.find_first_of("\r\n") != std::string::npos ||
+          header->second.find_first_of("\r\n") != std::string::npos)
+      {
+        fprintf(stderr, "Error: The %s header contains a line break.\n",
+                header->first.c_str());
+        continue;
+      }
+
+      head += header->first;
+      head += ": ";
+      head += header->second;
+      head += "\r\n";
+    }
+    if (has_body(response.status))
+    {
+      head += "Content-Length: ";
+      head += std::to_string(contentLength);
+      head += "\r\n";
+    }
+    head += keepAlive ? "\r\n" : "Connection: close\r\n\r\n";
+    return head;
+  }
+}
+
+http::Response::Response()
+: status(200),
+  file(-1),
+  fileOffset(0),
+  fileSize(0),
+  filePosition(0)
+{
+}
+
+http::Response::Response(Response&& other)
+: status(other.status),
+  headers(std::move(other.headers)),
+  body(std::move(other.body)),
+  file(other.file),
+  fileOffset(other.fileOffset),
+  fileSize(other.fileSize),
+  filePosition(other.filePosition)
+{
+  other.file = -1;
+}
+
+http::Response& http::Response::operator =(Response&& other)
+{
+  if (this != &other)
+  {
+    DetachFile();
+    status = other.status;
+    headers = std::move(other.headers);
+    body = std::move(other.body);
+    file = other.file;
+    fileOffset = other.fileOffset;
+    fileSize = other.fileSize;
+    filePosition = other.filePosition;
+    other.file = -1;
+  }
+  return *this;
+}
+
+http::Response::~Response()
+{
+  DetachFile();
+}
+
+const std::string* http::Request::Header(const char* name) const
+{
+  for (auto header = std::begin(headers); header != std::end(headers);
+       ++header)
+  {
+    if (equal_ignoring_case(header->first, name)) return &header->second;
+  }
+  return nullptr;
+}
+
+const char* http::ReasonPhrase(int status)
+{
+  switch (status)
+  {
+  case 200: return "OK";
+  case 204: return "No Content";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 413: return "Payload Too Large";
+  case 422: return "Unprocessable Entity";
+  case 431: return "Request Header Fields Too Large";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  case 503: return "Service Unavailable";
+  default: return "Unknown";
+  }
+}
+
+// A request that has been read and its response, which is filled in by one of
+// the threads unless it could be answered straight away.
+struct http::Server::Job
+{
+  Job(int descriptor, std::uint64_t connection)
+  : descriptor(descriptor), connection(connection), keepAlive(false),
+    isDone(false)
+  {
+  }
+
+  // The connection the request came from, whose descriptor may have been
+  // reused for another connection by the time the response is complete.
+  int descriptor;
+  std::uint64_t connection;
+
+  Request request;
+  Response response;
+  bool keepAlive;
+  std::atomic<bool> isDone;
+};
+
+struct http::Server::Connection
+{
+  // Part of a response, which is either data or part of a file.
+  struct Chunk
+  {
+    Chunk(std::string data) : data(std::move(data)), file(-1), offset(0) {}
+    Chunk(int file, std::uint64_t offset, std::uint64_t size)
+    : file(file), offset(offset), size(size) {}
+
+    std::uint64_t Size() const { return file == -1 ? data.size() : size; }
+
+    std::string data;
+
+    // The file is owned by the connection and closed once it is sent.
+    int file;
+    std::uint64_t offset;
+    std::uint64_t size;
+  };
+
+  Connection(int descriptor, std::uint64_t id)
+  : descriptor(descriptor), id(id), outputOffset(0), pendingOutput(0),
+    idleSince(std::chrono::steady_clock::now()), isClosing(false),
+    isWatchingOutput(false)
+  {
+  }
+
+  ~Connection();
+
+  int descriptor;
+  std::uint64_t id;
+
+  // The bytes received that are yet to be handled.
+  std::string input;
+
+  // The requests being handled, in the order they were received, which
+  // their responses are sent in.
+  std::deque<std::shared_ptr<Job>> jobs;
+
+  // The responses waiting to be sent, outputOffset is how much of the front
+  // one has been sent already.
+  std::deque<Chunk> output;
+  std::uint64_t outputOffset;
+  std::size_t pendingOutput;
+
+  // When the last complete request was read or anything was last sent.
+  std::chrono::steady_clock::time_point idleSince;
+
+  // True if the connection should be closed once the output is sent.
+  bool isClosing;
+  bool isWatchingOutput;
+};
+
+http::Server::Server(Handler handler, std::size_t threadCount)
+: myHandler(handler),
+  myThreadCount(std::max<std::size_t>(threadCount, 1)),
+  myListener(-1),
+  isListening(false),
+  myPoll(-1),
+  myWakeup(-1),
+  myNextConnection(0),
+  isStopping(false)
+{
+}
+
+#ifdef __linux__
+
+bool http::Response::AttachFile(int descriptor, std::uint64_t offset,
+                                std::uint64_t size)
+{
+  if (file != -1) return false;
+
+  file = fcntl(descriptor, F_DUPFD_CLOEXEC, 0);
+  if (file == -1) return false;
+
+  fileOffset = offset;
+  fileSize = size;
+  filePosition = body.size();
+  return true;
+}
+
+void http::Response::DetachFile()
+{
+  if (file != -1) close(file);
+  file = -1;
+}
+
+http::Server::Connection::~Connection()
+{
+  for (auto chunk = std::begin(output); chunk != std::end(output); ++chunk)
+  {
+    if (chunk->file != -1) close(chunk->file);
+  }
+}
+
+http::Server::~Server()
+{
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    isStopping = true;
+  }
+  myJobsChanged.notify_all();
+  for (auto thread = std::begin(myThreads); thread != std::end(myThreads);
+       ++thread)
+  {
+    thread->join();
+  }
+
+  for (auto connection = std::begin(myConnections);
+       connection != std::end(myConnections); ++connection)
+  {
+    close(connection->first);
+  }
+  if (myListener != -1) close(myListener);
+  if (myWakeup != -1) close(myWakeup);
+  if (myPoll != -1) close(myPoll);
+}
+
+void http::Server::Listen(const std::string& address)
+{
+  // Split host:port, where the host may be [::1] for IPv6.
+  std::string host;
+  std::string port = address;
+  const std::size_t colon = address.rfind(':');
+  if (colon != std::string::npos)
+  {
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+    {
+      host = host.substr(1, host.size() - 2);
+    }
+  }
+
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo* addresses = nullptr;
+  const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                                port.c_str(), &hints, &addresses);
+  if (error != 0)
+  {
+    throw http::Error("Could not resolve " + address + ": " +
+                      gai_strerror(error));
+  }
+
+  for (addrinfo* candidate = addresses; candidate;
+       candidate = candidate->ai_next)
+  {
+    const int descriptor = socket(candidate->ai_family,
+                                  candidate->ai_socktype | SOCK_NONBLOCK |
+                                  SOCK_CLOEXEC,
+                                  candidate->ai_protocol);
+    if (descriptor == -1) continue;
+
+    const int enable = 1;
+    setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (bind(descriptor, candidate->ai_addr, candidate->ai_addrlen) == 0 &&
+        listen(descriptor, SOMAXCONN) == 0)
+    {
+      myListener = descriptor;
+      break;
+    }
+    close(descriptor);
+  }
+  freeaddrinfo(addresses);
+
+  if (myListener == -1)
+  {
+    throw http::Error("Could not listen on " + address + ": " +
+                      std::strerror(errno));
+  }
+
+  myPoll = epoll_create1(EPOLL_CLOEXEC);
+  if (myPoll == -1)
+  {
+    throw http::Error(std::string("Could not create epoll instance: ") +
+                      std::strerror(errno));
+  }
+
+  myWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (myWakeup == -1)
+  {
+    throw http::Error(std::string("Could not create eventfd: ") +
+                      std::strerror(errno));
+  }
+
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = myWakeup;
+  epoll_ctl(myPoll, EPOLL_CTL_ADD, myWakeup, &event);
+
+  Resume();
+}
+
+void http::Server::Run()
+{
+  if (myPoll == -1) throw http::Error("The server is not listening.");
+
+  while (myThreads.size() < myThreadCount)
+  {
+    myThreads.emplace_back([this] { Work(); });
+  }
+
+  auto lastExpired = std::chrono::steady_clock::now();
+  epoll_event events[64];
+  for (;;)
+  {
+    const int count = epoll_wait(myPoll, events, 64, expiryInterval);
+    if (count == -1 && errno != EINTR)
+    {
+      throw http::Error(std::string("Waiting for connections failed: ") +
+                        std::strerror(errno));
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+      const int descriptor = events[i].data.fd;
+      if (descriptor == myListener)
+      {
+        Accept();
+        continue;
+      }
+
+      if (descriptor == myWakeup)
+      {
+        Complete();
+        continue;
+      }
+
+      auto connection = myConnections.find(descriptor);
+      if (connection == myConnections.end()) continue;
+
+      if (events[i].events & (EPOLLERR | EPOLLHUP))
+      {
+        Close(descriptor);
+        continue;
+      }
+
+      if (events[i].events & EPOLLIN) Read(*connection->second);
+
+      // Reading may have closed the connection.
+      connection = myConnections.find(descriptor);
+      if (connection == myConnections.end()) continue;
+
+      if (events[i].events & EPOLLOUT) Write(*connection->second);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - lastExpired >= std::chrono::milliseconds(expiryInterval))
+    {
+      Expire();
+      lastExpired = now;
+    }
+  }
+}
+
+void http::Server::Accept()
+{
+  for (;;)
+  {
+    const int descriptor = accept4(myListener, nullptr, nullptr,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (descriptor == -1)
+    {
+      // These are specific to the connection that was dropped.
+      if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+      {
+        continue;
+      }
+
+      // The connection stays waiting while there are no descriptors or
+      // memory for it, which would keep the listener readable, so it isn't
+      // watched until a connection is closed.
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM)
+      {
+        fprintf(stderr, "Could not accept a connection: %s\n",
+                std::strerror(errno));
+        Pause();
+      }
+
+      // Otherwise it is EAGAIN as there are no more connections waiting.
+      return;
+    }
+
+    const int enable = 1;
+    setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = descriptor;
+    if (epoll_ctl(myPoll, EPOLL_CTL_ADD, descriptor, &event) != 0)
+    {
+      close(descriptor);
+      continue;
+    }
+
+    myConnections[descriptor].reset(
+      new Connection(descriptor, myNextConnection++));
+  }
+}
+
+void http::Server::Pause()
+{
+  if (!isListening) return;
+  epoll_ctl(myPoll, EPOLL_CTL_DEL, myListener, nullptr);
+  isListening = false;
+}
+
+void http::Server::Resume()
+{
+  if (isListening) return;
+
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = myListener;
+  isListening = epoll_ctl(myPoll, EPOLL_CTL_ADD, myListener, &event) == 0;
+}
+
+void http::Server::Expire()
+{
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<int> expired;
+  for (auto connection = std::begin(myConnections);
+       connection != std::end(myConnections); ++connection)
+  {
+    if (connection->second->jobs.empty() &&
+        now - connection->second->idleSince > idleTimeout)
+    {
+      expired.push_back(connection->first);
+    }
+  }
+
+  for (auto descriptor = std::begin(expired); descriptor != std::end(expired);
+       ++descriptor)
+  {
+    Close(*descriptor);
+  }
+
+  // The descriptors may have been freed by something other than a connection
+  // closing.
+  Resume();
+}
+
+void http::Server::Work()
+{
+  for (;;)
+  {
+    std::shared_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(myMutex);
+      myJobsChanged.wait(lock, [this] { return isStopping || !myJobs.empty(); });
+      if (isStopping) return;
+      job = std::move(myJobs.front());
+      myJobs.pop_front();
+    }
+
+    try
+    {
+      myHandler(job->request, job->response);
+    }
+    catch (const std::exception& error)
+    {
+      fprintf(stderr, "Error: %s\n", error.what());
+      job->response = Response();
+      job->response.status = 500;
+    }
+    job->isDone = true;
+
+    {
+      std::lock_guard<std::mutex> lock(myMutex);
+      myCompleted.push_back(std::move(job));
+    }
+    const std::uint64_t one = 1;
+    const ssize_t written = write(myWakeup, &one, sizeof(one));
+    (void)written;
+  }
+}
+
+void http::Server::Complete()
+{
+  std::uint64_t count = 0;
+  const ssize_t length = read(myWakeup, &count, sizeof(count));
+  (void)length;
+
+  std::vector<std::shared_ptr<Job>> completed;
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    completed.swap(myCompleted);
+  }
+
+  // The connection may have been closed while its request was handled.
+  for (auto job = std::begin(completed); job != std::end(completed); ++job)
+  {
+    const auto connection = myConnections.find((*job)->descriptor);
+    if (connection == myConnections.end() ||
+        connection->second->id != (*job)->connection)
+    {
+      continue;
+    }
+
+    Collect(*connection->second);
+    Write(*connection->second);
+  }
+}
+
+void http::Server::Read(Connection& connection)
+{
+  char buffer[16 * 1024];
+  bool hasPeerClosed = false;
+  for (;;)
+  {
+    const ssize_t count = recv(connection.descriptor, buffer, sizeof(buffer),
+                               0);
+    if (count > 0)
+    {
+      connection.input.append(buffer, static_cast<std::size_t>(count));
+      continue;
+    }
+
+    if (count == 0) hasPeerClosed = true;
+    else if (errno == EINTR) continue;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      Close(connection.descriptor);
+      return;
+    }
+    break;
+  }
+
+  Process(connection);
+
+  if (hasPeerClosed)
+  {
+    // Finish sending the responses to the requests that were complete, the
+    // client may have only shut down its side.
+    connection.isClosing = true;
+    connection.input.clear();
+  }
+
+  Write(connection);
+}
+
+void http::Server::Process(Connection& connection)
+{
+  std::size_t consumed = 0;
+  while (!connection.isClosing &&
+         connection.pendingOutput < maximumPendingOutput &&
+         connection.jobs.size() < maximumPipelined)
+  {
+    const std::string& input = connection.input;
+    auto job = std::make_shared<Job>(connection.descriptor, connection.id);
+    std::size_t headEnd = input.find("\r\n\r\n", consumed);
+    if (headEnd == std::string::npos)
+    {
+      if (input.size() - consumed <= maximumHeadSize) break;
+
+      job->response.status = 431;
+      job->isDone = true;
+      connection.jobs.push_back(std::move(job));
+      connection.isClosing = true;
+      break;
+    }
+    headEnd += 4;
+
+    Request& request = job->request;
+    Response& response = job->response;
+    std::size_t requestEnd = headEnd;
+
+    if (!parse_head(input.data() + consumed, headEnd - consumed, &request))
+    {
+      response.status = 400;
+    }
+    else if (request.Header("Transfer-Encoding"))
+    {
+      response.status = 501;
+    }
+    else
+    {
+      const std::string* contentLength = request.Header("Content-Length");
+      const std::size_t bodySize =
+        contentLength ? std::strtoul(contentLength->c_str(), nullptr, 10) : 0;
+      if (bodySize > maximumBodySize)
+      {
+        response.status = 413;
+      }
+      else
+      {
+        // Wait for the rest of the body.
+        if (input.size() - headEnd < bodySize) break;
+
+        request.body = input.substr(headEnd, bodySize);
+        requestEnd = headEnd + bodySize;
+
+        const std::string* connectionHeader = request.Header("Connection");
+        job->keepAlive = request.version == 1 ?
+          !contains_token(connectionHeader, "close") :
+          contains_token(connectionHeader, "keep-alive");
+      }
+    }
+
+    // The rest of the input can't be trusted if the request was malformed,
+    // otherwise the request is given to one of the threads.
+    if (response.status == 400 || response.status == 413 ||
+        response.status == 501)
+    {
+      job->isDone = true;
+    }
+    else
+    {
+      {
+        std::lock_guard<std::mutex> lock(myMutex);
+        myJobs.push_back(job);
+      }
+      myJobsChanged.notify_one();
+    }
+
+    consumed = requestEnd;
+    connection.idleSince = std::chrono::steady_clock::now();
+    if (!job->keepAlive) connection.isClosing = true;
+    connection.jobs.push_back(std::move(job));
+  }
+
+  connection.input.erase(0, consumed);
+  Collect(connection);
+}
+
+void http::Server::Collect(Connection& connection)
+{
+  while (!connection.jobs.empty() && connection.jobs.front()->isDone)
+  {
+    const std::shared_ptr<Job> job = std::move(connection.jobs.front());
+    connection.jobs.pop_front();
+
+    Response& response = job->response;
+    const bool isBodySent =
+      job->request.method != "HEAD" && has_body(response.status);
+    const bool hasFile = response.file != -1;
+    std::string head = format_head(
+      response, response.body.size() + (hasFile ? response.fileSize : 0),
+      job->keepAlive);
+    connection.pendingOutput += head.size();
+    connection.output.emplace_back(std::move(head));
+    if (isBodySent)
+    {
+      // The body up to the file, the file and then the rest of the body.
+      std::string rest;
+      if (hasFile)
+      {
+        rest = response.body.substr(response.filePosition);
+        response.body.resize(response.filePosition);
+      }
+
+      if (!response.body.empty())
+      {
+        connection.pendingOutput += response.body.size();
+        connection.output.emplace_back(std::move(response.body));
+      }
+
+      if (hasFile)
+      {
+        connection.output.emplace_back(response.file, response.fileOffset,
+                                       response.fileSize);
+        response.file = -1;
+      }
+
+      if (!rest.empty())
+      {
+        connection.pendingOutput += rest.size();
+        connection.output.emplace_back(std::move(rest));
+      }
+    }
+  }
+}
+
+void http::Server::Write(Connection& connection)
+{
+  while (!connection.output.empty())
+  {
+    Connection::Chunk& front = connection.output.front();
+    if (front.file != -1)
+    {
+      off_t position =
+        static_cast<off_t>(front.offset + connection.outputOffset);
+      const std::size_t wanted = static_cast<std::size_t>(
+        std::min<std::uint64_t>(front.size - connection.outputOffset,
+                                fileChunkSize));
+      const ssize_t sent = sendfile(connection.descriptor, front.file,
+                                    &position, wanted);
+      if (sent == -1 && errno == EINTR) continue;
+      if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      if (sent <= 0)
+      {
+        // The file is shorter than it was said to be, so the response can't
+        // be completed.
+        Close(connection.descriptor);
+        return;
+      }
+      connection.idleSince = std::chrono::steady_clock::now();
+
+      connection.outputOffset += static_cast<std::uint64_t>(sent);
+      if (connection.outputOffset == front.size)
+      {
+        close(front.file);
+        connection.output.pop_front();
+        connection.outputOffset = 0;
+      }
+    }
+    else
+    {
+      // Send as many of the chunks up to the next file as possible at once.
+      iovec vectors[64];
+      int vectorCount = 0;
+      for (auto chunk = std::begin(connection.output);
+           chunk != std::end(connection.output) && chunk->file == -1 &&
+           vectorCount < 64;
+           ++chunk, ++vectorCount)
+      {
+        const std::size_t offset = vectorCount == 0 ?
+          static_cast<std::size_t>(connection.outputOffset) : 0;
+        vectors[vectorCount].iov_base =
+          const_cast<char*>(chunk->data.data()) + offset;
+        vectors[vectorCount].iov_len = chunk->data.size() - offset;
+      }
+
+      msghdr message;
+      std::memset(&message, 0, sizeof(message));
+      message.msg_iov = vectors;
+      message.msg_iovlen = vectorCount;
+
+      const ssize_t sent = sendmsg(connection.descriptor, &message,
+                                   MSG_NOSIGNAL);
+      if (sent == -1)
+      {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        Close(connection.descriptor);
+        return;
+      }
+
+      // Drop the chunks that have been completely sent.
+      connection.idleSince = std::chrono::steady_clock::now();
+      std::size_t remaining = static_cast<std::size_t>(sent);
+      connection.pendingOutput -= remaining;
+      while (remaining > 0)
+      {
+        const std::size_t left = connection.output.front().data.size() -
+          static_cast<std::size_t>(connection.outputOffset);
+        if (remaining < left)
+        {
+          connection.outputOffset += remaining;
+          break;
+        }
+        remaining -= left;
+        connection.output.pop_front();
+        connection.outputOffset = 0;
+      }
+    }
+
+    // Handle the pipelined requests that were held back while waiting for
+    // the output to drain.
+    if (connection.output.empty() && !connection.input.empty())
+    {
+      Process(connection);
+    }
+  }
+
+  if (connection.output.empty() && connection.jobs.empty() &&
+      connection.isClosing)
+  {
+    Close(connection.descriptor);
+    return;
+  }
+
+  Watch(connection);
+}
+
+void http::Server::Watch(Connection& connection)
+{
+  const bool needsOutput = !connection.output.empty();
+  if (needsOutput == connection.isWatchingOutput) return;
+
+  epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLRDHUP;
+  if (needsOutput) event.events |= EPOLLOUT;
+  event.data.fd = connection.descriptor;
+  epoll_ctl(myPoll, EPOLL_CTL_MOD, connection.descriptor, &event);
+  connection.isWatchingOutput = needsOutput;
+}
+
+void http::Server::Close(int descriptor)
+{
+  epoll_ctl(myPoll, EPOLL_CTL_DEL, descriptor, nullptr);
+  close(descriptor);
+  myConnections.erase(descriptor);
+
+  // There is now a descriptor free to accept another connection with.
+  Resume();
+}
+
+#else
+
+bool http::Response::AttachFile(int, std::uint64_t, std::uint64_t)
+{
+  return false;
+}
+
+void http::Response::DetachFile()
+{
+}
+
+http::Server::Connection::~Connection()
+{
+}
+
+http::Server::~Server()
+{
+}
+
+void http::Server::Listen(const std::string&)
+{
+  throw http::Error("The built-in HTTP server is only supported on Linux.");
+}
+
+void http::Server::Run()
+{
+  throw http::Error("The built-in HTTP server is only supported on Linux.");
+}
+
+#endif
+
+#ifdef HTTP_ENABLE_TESTING
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// Serves the file given as the second argument at /file, with a line before
+// and after it.
+int main(int argc, char* argv[])
+{
+  const int file = argc > 2 ? open(argv[2], O_RDONLY) : -1;
+  http::Server server(
+    [file](const http::Request& request, http::Response& response)
+    {
+      response.headers.emplace_back("Content-Type", "text/plain");
+      response.body = request.method + " " + request.target + "\n";
+      struct stat status;
+      if (request.target == "/file" && fstat(file, &status) == 0)
+      {
+        response.AttachFile(file, 0,
+                            static_cast<std::uint64_t>(status.st_size));
+        response.body += "end\n";
+      }
+    },
+    4);
+  server.Listen(argc > 1 ? argv[1] : "localhost:7723");
+  server.Run();
+  return 0;
+}
+#endif
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,206 @@
+#ifndef HTTP_HPP_
+#define HTTP_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : http
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// A small HTTP/1.1 server that serves many connections from a single thread
+// using epoll. Persistent connections (keep-alive) and pipelining are
+// supported, the responses on a connection are sent in the order the
+// requests were received.
+//
+// The requests are handled on threads of the server's own, so a slow request
+// doesn't hold up the other connections, and the responses are handed back
+// to the thread serving the connections (through an eventfd) to be sent.
+//
+// The body of a response may include part of a file, which is sent straight
+// from the file to the socket by the kernel.
+//
+// A connection which goes too long without sending a complete request, or
+// without taking any of its response, is closed. When there are no more
+// descriptors to accept connections with, no more are accepted until one is
+// closed.
+//
+// Usage:
+//   http::Server server(
+//     [](const http::Request& request, http::Response& response)
+//     {
+//       response.body = "Hello world";
+//     },
+//     4);
+//   server.Listen("localhost:7723");
+//   server.Run();
+//
+// Known shortcomings:
+//   Only Linux is supported, on other platforms Listen() throws.
+//
+//   Request bodies sent with the chunked transfer-encoding are not supported.
+//
+//===----------------------------------------------------------------------===//
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace http
+{
+  class Error : public std::runtime_error
+  {
+  public:
+    Error(const std::string& message) : std::runtime_error(message) {}
+  };
+
+  struct Request
+  {
+    std::string method;
+    std::string target;
+
+    // The minor version of HTTP/1.x.
+    int version;
+
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    // Returns the value of the header with the given name or null if there
+    // was no such header. The names are not case-sensitive.
+    const std::string* Header(const char* name) const;
+  };
+
+  struct Response
+  {
+    Response();
+    Response(Response&& other);
+    Response& operator =(Response&& other);
+    ~Response();
+
+    int status;
+
+    // The headers to send, the Content-Length is added by the server.
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    // Part of a file which is sent as part of the body with sendfile(), so it
+    // is never read into memory. It is sent after the first filePosition
+    // bytes of the body. The descriptor is -1 if there is no file.
+    int file;
+    std::uint64_t fileOffset;
+    std::uint64_t fileSize;
+    std::size_t filePosition;
+
+    // Sends size bytes of the file from offset after what is in the body so
+    // far. The response keeps a duplicate of the descriptor, so the caller
+    // still needs to close theirs.
+    //
+    // Returns false if the response already has a file, in which case the
+    // caller needs to put the content in the body instead.
+    bool AttachFile(int descriptor, std::uint64_t offset, std::uint64_t size);
+
+    // Drops the file, if there is one.
+    void DetachFile();
+
+  private:
+    Response(const Response&); /* = delete; */
+    Response& operator =(const Response&); /* = delete; */
+  };
+
+  typedef std::function<void(const Request&, Response&)> Handler;
+
+  // Returns the reason phrase for the given status code, for example
+  // "Not Found" for 404.
+  const char* ReasonPhrase(int status);
+
+  class Server
+  {
+  public:
+    // The handler is called on threadCount threads (at least one), so it may
+    // be handling several requests at once.
+    Server(Handler handler, std::size_t threadCount);
+
+    // Waits for the requests being handled to finish.
+    ~Server();
+
+    // Starts listening on the given address which is in the form host:port,
+    // where the host is optional (in which case it listens on all
+    // interfaces).
+    //
+    // Throws http::Error if it can not listen on the address.
+    void Listen(const std::string& address);
+
+    // Accepts connections and serves requests until an error occurs.
+    void Run();
+
+  private:
+    Server(const Server&); /* = delete; */
+    Server& operator =(const Server&); /* = delete; */
+
+    struct Connection;
+    struct Job;
+
+    void Accept();
+    void Read(Connection& connection);
+    void Write(Connection& connection);
+    void Close(int descriptor);
+
+    // Starts handling the complete requests that have been read so far.
+    void Process(Connection& connection);
+
+    // Moves the responses at the front of the connection that are complete
+    // to its output.
+    void Collect(Connection& connection);
+
+    // Takes the responses that the threads have completed.
+    void Complete();
+
+    // Closes the connections that have been idle for too long, and accepts
+    // connections again if that had been stopped.
+    void Expire();
+
+    // Stops and starts watching for connections to accept.
+    void Pause();
+    void Resume();
+
+    // Handles the requests given to the threads until the server is
+    // destroyed.
+    void Work();
+
+    // Updates the events epoll waits for based on if there is output pending.
+    void Watch(Connection& connection);
+
+    Handler myHandler;
+    std::size_t myThreadCount;
+    int myListener;
+    bool isListening;
+    int myPoll;
+
+    // Written to by the threads when they have completed a response.
+    int myWakeup;
+
+    std::map<int, std::unique_ptr<Connection>> myConnections;
+    std::uint64_t myNextConnection;
+
+    // The requests waiting for a thread and the responses the threads have
+    // completed that haven't been taken yet.
+    std::vector<std::thread> myThreads;
+    std::deque<std::shared_ptr<Job>> myJobs;
+    std::vector<std::shared_ptr<Job>> myCompleted;
+    bool isStopping;
+    std::mutex myMutex;
+    std::condition_variable myJobsChanged;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -7,69 +7,429 @@
 //===----------------------------------------------------------------------===//
 
 #include "jsonwriter.hpp"
+#include "simd.hpp"
 
 #include <algorithm>
-#include <iomanip>
-#include <sstream>
+#include <cctype>
+#include <cstring>
+#include <type_traits>
 
-JsonWriterObject JsonWriter::object(std::ostream* output)
+JsonWriterObject JsonWriter::object(OutputSink* output, Layout layout)
 {
-  return JsonWriterObject(output);
+  return JsonWriterObject(output, layout);
 }
 
-JsonWriterArray JsonWriter::array(std::ostream* output)
+JsonWriterArray JsonWriter::array(OutputSink* output, Layout layout)
 {
-  return JsonWriterArray(output);
+  return JsonWriterArray(output, layout);
 }
 
-std::string JsonWriter::escape(const char* string)
+namespace
 {
-  std::ostringstream ss;
-  for (const char* c = string; *c != '\0'; ++c)
+  // Returns the number of characters at the start of [string, string + length)
+  // which can be written as they are, which is length if none of them need
+  // to be escaped.
+  typedef std::size_t (*ScanFunction)(const char* string, std::size_t length);
+
+  inline bool needs_escaping(unsigned char character)
+  {
+    return character < 0x20 || character == '"' || character == '\\';
+  }
+
+  std::size_t scan_scalar(const char* string, std::size_t length)
+  {
+    std::size_t index = 0;
+    while (index < length &&
+           !needs_escaping(static_cast<unsigned char>(string[index])))
+    {
+      ++index;
+    }
+    return index;
+  }
+
+#ifdef SIMD_X86
+
+  // The vectorised versions compare a block of characters against the double
+  // quote and backslash at once and find the control codes with an unsigned
+  // minimum, as min(c, 0x1F) is c only when c <= 0x1F. The common case of a
+  // string with nothing to escape is then a handful of instructions per block.
+
+  SIMD_TARGET("sse2")
+  std::size_t scan_sse2(const char* string, std::size_t length)
+  {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    std::size_t index = 0;
+    for (; index + 16 <= length; index += 16)
+    {
+      const __m128i block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(string + index));
+      const __m128i matches = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                     _mm_cmpeq_epi8(block, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(block, control), block));
+      const unsigned int mask =
+        static_cast<unsigned int>(_mm_movemask_epi8(matches));
+      if (mask != 0) return index + simd::LowestSetBit(mask);
+    }
+    return index + scan_scalar(string + index, length - index);
+  }
+
+  SIMD_TARGET("avx2")
+  std::size_t scan_avx2(const char* string, std::size_t length)
+  {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+
+    std::size_t index = 0;
+    for (; index + 32 <= length; index += 32)
+    {
+      const __m256i block = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(string + index));
+      const __m256i matches = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, quote),
+                        _mm256_cmpeq_epi8(block, backslash)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(block, control), block));
+      const unsigned int mask =
+        static_cast<unsigned int>(_mm256_movemask_epi8(matches));
+      if (mask != 0) return index + simd::LowestSetBit(mask);
+    }
+    return index + scan_sse2(string + index, length - index);
+  }
+
+#endif
+
+  ScanFunction choose_scanner()
+  {
+#ifdef SIMD_X86
+    if (simd::HasAvx2()) return scan_avx2;
+    if (simd::HasSse2()) return scan_sse2;
+#endif
+    return scan_scalar;
+  }
+
+  // Writes the escape sequence for a character that needs_escaping().
+  void write_escape(OutputSink& output, unsigned char character)
   {
-    // Escape the following charachters.
-    switch (*c)
+    switch (character)
     {
-    case '"': ss << "\\\""; break;
-    case '\\': ss << "\\\\"; break;
-    case '\b': ss << "\\b"; break;
-    case '\f': ss << "\\f"; break;
-    case '\n': ss << "\\n"; break;
-    case '\r': ss << "\\r"; break;
-    case '\t': ss << "\\t"; break;
+    case '"': output.Write("\\\"", 2); break;
+    case '\\': output.Write("\\\\", 2); break;
+    case '\b': output.Write("\\b", 2); break;
+    case '\f': output.Write("\\f", 2); break;
+    case '\n': output.Write("\\n", 2); break;
+    case '\r': output.Write("\\r", 2); break;
+    case '\t': output.Write("\\t", 2); break;
     default:
-      if (*c < 20)
+    {
+      // Escape the other control codes by using 4 hex digits.
+      static const char digits[] = "0123456789abcdef";
+      const char escaped[] = {
+        '\\', 'u', '0', '0', digits[character >> 4], digits[character & 0xF]
+      };
+      output.Write(escaped, sizeof(escaped));
+      break;
+    }
+    }
+  }
+
+  // Writes the string surrounded by double quotes.
+  void write_string(OutputSink& output, const char* value)
+  {
+    output.Put('"');
+    JsonWriter::escape(value, std::strlen(value), &output);
+    output.Put('"');
+  }
+}
+
+void JsonWriter::escape(const char* string, std::size_t length,
+                        OutputSink* output)
+{
+  static const ScanFunction scan = choose_scanner();
+
+  const char* const end = string + length;
+  while (string != end)
+  {
+    const std::size_t clean =
+      scan(string, static_cast<std::size_t>(end - string));
+    output->Write(string, clean);
+    string += clean;
+    if (string == end) break;
+
+    write_escape(*output, static_cast<unsigned char>(*string));
+    ++string;
+  }
+}
+
+std::string JsonWriter::escape(const char* string)
+{
+  BufferSink output;
+  escape(string, std::strlen(string), &output);
+  return output.Take();
+}
+
+void JsonWriter::format_time(std::int64_t time, char* buffer)
+{
+  // The days since the epoch are converted to a date in the proleptic
+  // Gregorian calendar, by counting from 0000-03-01 so the leap day is at
+  // the end of the year. See http://howardhinnant.github.io/date_algorithms.html
+  std::int64_t days = time / 86400;
+  std::int64_t seconds = time % 86400;
+  if (seconds < 0)
+  {
+    seconds += 86400;
+    --days;
+  }
+
+  days += 719468;
+  const std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const std::int64_t dayOfEra = days - era * 146097;
+  const std::int64_t yearOfEra =
+    (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  const std::int64_t dayOfYear =
+    dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  const std::int64_t monthFromMarch = (5 * dayOfYear + 2) / 153;
+  const std::int64_t day = dayOfYear - (153 * monthFromMarch + 2) / 5 + 1;
+  const std::int64_t month =
+    monthFromMarch < 10 ? monthFromMarch + 3 : monthFromMarch - 9;
+  const std::int64_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+
+  const auto put = [](char* cursor, std::int64_t value, int digits)
+  {
+    for (int i = digits - 1; i >= 0; --i)
+    {
+      cursor[i] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    }
+  };
+
+  put(buffer, year, 4);
+  buffer[4] = '-';
+  put(buffer + 5, month, 2);
+  buffer[7] = '-';
+  put(buffer + 8, day, 2);
+  buffer[10] = 'T';
+  put(buffer + 11, seconds / 3600, 2);
+  buffer[13] = ':';
+  put(buffer + 14, seconds / 60 % 60, 2);
+  buffer[16] = ':';
+  put(buffer + 17, seconds % 60, 2);
+  buffer[19] = 'Z';
+}
+
+std::size_t JsonWriter::format_octal(std::uint32_t value, char (&buffer)[11])
+{
+  std::size_t length = 0;
+  do
+  {
+    buffer[length++] = static_cast<char>('0' + (value & 7));
+    value >>= 3;
+  }
+  while (value != 0);
+  std::reverse(buffer, buffer + length);
+  return length;
+}
+
+namespace
+{
+  // The most arrays and objects a value checked by is_valid() can be nested
+  // in, so the recursion is bounded.
+  const unsigned int maximumValidDepth = 256;
+
+  // Checks JSON as given by RFC 8259, advancing the position past what has
+  // been checked.
+  class Validator
+  {
+  public:
+    Validator(std::string_view text) : myText(text), myPosition(0) {}
+
+    bool Document()
+    {
+      return Value(0) && (SkipWhitespace(), myPosition == myText.size());
+    }
+
+  private:
+    void SkipWhitespace()
+    {
+      while (myPosition < myText.size() &&
+             (myText[myPosition] == ' ' || myText[myPosition] == '\t' ||
+              myText[myPosition] == '\n' || myText[myPosition] == '\r'))
       {
-        // Escape the other control codes by using 4 hex digits.
-        ss << "\\u"  << std::setfill('0') << std::setw(4)
-           << std::hex << *c << std::dec;
+        ++myPosition;
       }
-      else
+    }
+
+    bool Take(char character)
+    {
+      if (myPosition == myText.size() || myText[myPosition] != character)
       {
-        ss << *c;
+        return false;
       }
-      break;
+      ++myPosition;
+      return true;
+    }
+
+    bool Literal(std::string_view literal)
+    {
+      if (myText.substr(myPosition, literal.size()) != literal) return false;
+      myPosition += literal.size();
+      return true;
+    }
+
+    bool Digits()
+    {
+      const std::size_t start = myPosition;
+      while (myPosition < myText.size() && myText[myPosition] >= '0' &&
+             myText[myPosition] <= '9')
+      {
+        ++myPosition;
+      }
+      return myPosition > start;
+    }
+
+    bool Number()
+    {
+      Take('-');
+      if (!Take('0') && !Digits()) return false;
+      if (Take('.') && !Digits()) return false;
+      if (Take('e') || Take('E'))
+      {
+        if (!Take('+')) Take('-');
+        if (!Digits()) return false;
+      }
+      return true;
+    }
+
+    bool String()
+    {
+      if (!Take('"')) return false;
+      while (myPosition < myText.size())
+      {
+        const unsigned char character =
+          static_cast<unsigned char>(myText[myPosition++]);
+        if (character == '"') return true;
+        if (character < 0x20) return false;
+        if (character != '\\') continue;
+
+        if (myPosition == myText.size()) return false;
+        const char escaped = myText[myPosition++];
+        if (escaped == 'u')
+        {
+          for (int i = 0; i < 4; ++i, ++myPosition)
+          {
+            if (myPosition == myText.size() ||
+                !std::isxdigit(static_cast<unsigned char>(myText[myPosition])))
+            {
+              return false;
+            }
+          }
+        }
+        else if (!std::strchr("\"\\/bfnrt", escaped) || escaped == '\0')
+        {
+          return false;
+        }
+      }
+      return false;
     }
+
+    // Checks the members of an object or the elements of an array, after
+    // the opening bracket.
+    bool Members(char close, bool isObject, unsigned int depth)
+    {
+      SkipWhitespace();
+      if (Take(close)) return true;
+      do
+      {
+        if (isObject)
+        {
+          SkipWhitespace();
+          if (!String()) return false;
+          SkipWhitespace();
+          if (!Take(':')) return false;
+        }
+        if (!Value(depth + 1)) return false;
+        SkipWhitespace();
+      }
+      while (Take(','));
+      return Take(close);
+    }
+
+    bool Value(unsigned int depth)
+    {
+      SkipWhitespace();
+      if (myPosition == myText.size()) return false;
+
+      switch (myText[myPosition])
+      {
+      case '{':
+        ++myPosition;
+        return depth < maximumValidDepth && Members('}', true, depth);
+      case '[':
+        ++myPosition;
+        return depth < maximumValidDepth && Members(']', false, depth);
+      case '"':
+        return String();
+      case 't':
+        return Literal("true");
+      case 'f':
+        return Literal("false");
+      case 'n':
+        return Literal("null");
+      default:
+        return Number();
+      }
+    }
+
+    std::string_view myText;
+    std::size_t myPosition;
+  };
+}
+
+bool JsonWriter::is_valid(std::string_view text)
+{
+  return Validator(text).Document();
+}
+
+// Starts a new line indented by two spaces for each level of depth.
+static void new_line(OutputSink& output, unsigned int depth)
+{
+  static const char spaces[] = "\n                                ";
+  const std::size_t most = sizeof(spaces) - 2;
+
+  std::size_t remaining = 2 * static_cast<std::size_t>(depth);
+  std::size_t count = std::min(remaining, most);
+  output.Write(spaces, count + 1);
+  for (remaining -= count; remaining != 0; remaining -= count)
+  {
+    count = std::min(remaining, most);
+    output.Write(spaces + 1, count);
   }
-  return ss.str();
 }
 
+JsonWriterObject::JsonWriterObject(OutputSink* output,
+                                   JsonWriter::Layout layout)
+: JsonWriterObject(output, layout == JsonWriter::Indented, 0)
+{
+}
 
-JsonWriterObject::JsonWriterObject(std::ostream* output, std::string indentation)
+JsonWriterObject::JsonWriterObject(OutputSink* output, bool isIndenting,
+                                   unsigned int depth)
 : myOutput(*output),
   myState(WaitingForKey),
-  isIndenting(true),
-  myIndentation(indentation)
+  isIndenting(isIndenting),
+  myDepth(depth)
 {
-  myOutput << "{";
-  if (isIndenting) myOutput << '\n';
+  myOutput.Put('{');
 }
 
 JsonWriterObject::JsonWriterObject(JsonWriterObject&& writer)
 : myOutput(writer.myOutput),
-  myState(WaitingForKey),
+  myState(writer.myState),
   isIndenting(writer.isIndenting),
-  myIndentation(writer.myIndentation)
+  myDepth(writer.myDepth)
 {
   writer.myState = Moved;
 }
@@ -78,58 +438,65 @@ JsonWriterObject::~JsonWriterObject()
 {
   if (myState == Moved) return;
 
-  if (isIndenting)
+  if (isIndenting && myState != WaitingForKey)
   {
-    myOutput << std::endl << myIndentation << '}';
-
-    // No indentation means it is the top level so it can decide where to
-    // put the new line.
-    if (myIndentation.empty()) myOutput << std::endl;
+    new_line(myOutput, myDepth);
+    myOutput.Put('}');
   }
   else
   {
-    myOutput << '}' << std::endl;
+    myOutput.Put('}');
   }
+
+  // The top level decides where to put the new line.
+  if (myDepth == 0) myOutput.Put('\n');
+}
+
+void JsonWriterObject::Separate()
+{
+  if (myState == WaitingForAnotherKey) myOutput.Put(',');
+  if (isIndenting) new_line(myOutput, myDepth + 1);
+}
+
+void JsonWriterObject::Colon()
+{
+  if (isIndenting) myOutput.Write(": ", 2);
+  else myOutput.Put(':');
 }
 
 JsonWriterObject& JsonWriterObject::operator <<(const char* value)
 {
   if (value == nullptr) value = "";
 
-  if (isIndenting)
+  if (myState == WaitingForValue)
   {
-    if (myState == WaitingForAnotherKey)
-    {
-      myOutput << ',' << std::endl;
-    }
-
-    if (myState == WaitingForValue)
-    {
-      myOutput << ": \"" << value << '"';
-      myState = WaitingForAnotherKey;
-    }
-    else
-    {
-      myOutput << myIndentation << "  \""      << value << '"';
-      myState = WaitingForValue;
-    }
+    Colon();
+    write_string(myOutput, value);
+    myState = WaitingForAnotherKey;
   }
   else
   {
-    if (myState == WaitingForValue)
-    {
-      myOutput << ':' << '"' << value << '"';
-      myState = WaitingForAnotherKey;
-    }
-    else
-    {
-      myOutput << '"' << value << '"';
-      myState = WaitingForValue;
-    }
+    Separate();
+    write_string(myOutput, value);
+    myState = WaitingForValue;
   }
   return *this;
 }
 
+// Writes the integer to the output without going through iostreams.
+template<typename T>
+static void write_integer(OutputSink& output, T value)
+{
+  if (std::is_signed<T>::value)
+  {
+    output.WriteInteger(static_cast<std::int64_t>(value));
+  }
+  else
+  {
+    output.WriteInteger(static_cast<std::uint64_t>(value));
+  }
+}
+
 template<typename T>
 JsonWriterObject& JsonWriterObject::operator <<(T value)
 {
@@ -138,36 +505,17 @@ JsonWriterObject& JsonWriterObject::operator <<(T value)
   // If value is a string it needs to be quoted and this function is not
   // suitable for that.
 
-  if (isIndenting)
+  if (myState == WaitingForValue)
   {
-    if (myState == WaitingForAnotherKey)
-    {
-      myOutput << ',' << std::endl;
-    }
-
-    if (myState == WaitingForValue)
-    {
-      myOutput << ": " << value;
-      myState = WaitingForAnotherKey;
-    }
-    else
-    {
-      myOutput << myIndentation << " " << value;
-      myState = WaitingForValue;
-    }
+    Colon();
+    write_integer(myOutput, value);
+    myState = WaitingForAnotherKey;
   }
   else
   {
-    if (myState == WaitingForValue)
-    {
-      myOutput << ':' << value;
-      myState = WaitingForAnotherKey;
-    }
-    else
-    {
-      myOutput << value;
-      myState = WaitingForValue;
-    }
+    Separate();
+    write_integer(myOutput, value);
+    myState = WaitingForValue;
   }
   return *this;
 }
@@ -185,11 +533,25 @@ JsonWriterObject& JsonWriterObject::operator [](const char* key)
   return *this;
 }
 
+JsonWriterObject& JsonWriterObject::Key(const char* quoted, std::size_t size)
+{
+  if (myState != WaitingForKey && myState != WaitingForAnotherKey)
+  {
+    return *this;
+  }
+
+  Separate();
+  myOutput.Write(quoted, size);
+  myState = WaitingForValue;
+  return *this;
+}
+
 JsonWriterObject& JsonWriterObject::operator =(bool value)
 {
   if (myState == WaitingForValue)
   {
-      myOutput << ": " << (value ? "true" : "false");
+      Colon();
+      myOutput.Write(value ? "true" : "false");
       myState = WaitingForAnotherKey;
   }
   else
@@ -221,6 +583,32 @@ JsonWriterObject& JsonWriterObject::operator =(const char* value)
   return *this;
 }
 
+JsonWriterObject& JsonWriterObject::operator =(std::string_view value)
+{
+  if (myState == WaitingForValue)
+  {
+    Colon();
+    myOutput.Put('"');
+    JsonWriter::escape(value.data(), value.size(), &myOutput);
+    myOutput.Put('"');
+    myState = WaitingForAnotherKey;
+  }
+
+  return *this;
+}
+
+JsonWriterObject& JsonWriterObject::json(std::string_view value)
+{
+  if (myState == WaitingForValue)
+  {
+    Colon();
+    myOutput.Write(value.data(), value.size());
+    myState = WaitingForAnotherKey;
+  }
+
+  return *this;
+}
+
 JsonWriterObject& JsonWriterObject::operator =(const unsigned int value)
 {
   if (myState == WaitingForValue)
@@ -255,8 +643,8 @@ JsonWriterObject& JsonWriterObject::operator =(const JsonWriterArray&)
 {
   if (myState == WaitingForAnotherKey)
   {
-    if (isIndenting) myOutput << ',' << std::endl;
-    else myOutput << ',';
+    if (isIndenting) myOutput.Write(",\n", 2);
+    else myOutput.Put(',');
   }
 
   return *this;
@@ -264,43 +652,41 @@ JsonWriterObject& JsonWriterObject::operator =(const JsonWriterArray&)
 
 JsonWriterArray JsonWriterObject::array()
 {
-  myOutput << ": ";
+  Colon();
   myState = WaitingForAnotherKey;
-  return JsonWriterArray(&myOutput, myIndentation + "  ");
+  return JsonWriterArray(&myOutput, isIndenting, myDepth + 1);
 }
 
 JsonWriterObject JsonWriterObject::object()
 {
-  myOutput << ": ";
+  Colon();
   myState = WaitingForAnotherKey;
-  return JsonWriterObject(&myOutput, myIndentation + "  ");
+  return JsonWriterObject(&myOutput, isIndenting, myDepth + 1);
 }
 
+JsonWriterArray::JsonWriterArray(OutputSink* output,
+                                 JsonWriter::Layout layout)
+: JsonWriterArray(output, layout == JsonWriter::Indented, 0)
+{
+}
 
-JsonWriterArray::JsonWriterArray(
-  std::ostream* output, std::string indentation)
+JsonWriterArray::JsonWriterArray(OutputSink* output, bool isIndenting,
+                                 unsigned int depth)
 : myOutput(*output),
   hasAnElement(false),
-  isIndenting(true),
-  myIndentation(indentation),
-  hasBeenMoved(false)
+  hasBeenMoved(false),
+  isIndenting(isIndenting),
+  myDepth(depth)
 {
-  if (isIndenting)
-  {
-    myOutput << "[" << std::endl;
-  }
-  else
-  {
-    myOutput << "[";
-  }
+  myOutput.Put('[');
 }
 
 JsonWriterArray::JsonWriterArray(JsonWriterArray&& writer)
 : myOutput(writer.myOutput),
   hasAnElement(writer.hasAnElement),
+  hasBeenMoved(false),
   isIndenting(writer.isIndenting),
-  myIndentation(writer.myIndentation),
-  hasBeenMoved(false)
+  myDepth(writer.myDepth)
 {
   writer.hasBeenMoved = true;
 }
@@ -309,51 +695,26 @@ JsonWriterArray::~JsonWriterArray()
 {
   if (hasBeenMoved) return;
 
-  if (isIndenting)
-  {
-    if (hasAnElement)
-    {
-      myOutput << std::endl << myIndentation << ']';
-    }
-    else
-    {
-      myOutput << myIndentation << ']';
-    }
+  if (isIndenting && hasAnElement) new_line(myOutput, myDepth);
+  myOutput.Put(']');
 
-    // No indentation means it is the top level so it can decide where to
-    // put the new line.
-    if (myIndentation.empty()) myOutput << std::endl;
-  }
-  else
-  {
-    myOutput << ']';
-  }
+  // The top level decides where to put the new line.
+  if (myDepth == 0) myOutput.Put('\n');
+}
+
+void JsonWriterArray::Separate()
+{
+  if (hasAnElement) myOutput.Put(',');
+  if (isIndenting) new_line(myOutput, myDepth + 1);
+  hasAnElement = true;
 }
 
 JsonWriterArray& JsonWriterArray::operator <<(const char* value)
 {
-  if (isIndenting)
-  {
-    if (hasAnElement)
-    {
-      myOutput << ',' << std::endl;
-    }
+  if (value == nullptr) value = "";
 
-    myOutput << myIndentation << "  \""      << value << '"';
-    hasAnElement = true;
-  }
-  else
-  {
-    if (hasAnElement)
-    {
-      myOutput << ",\"" << value << '"';
-    }
-    else
-    {
-      myOutput << '"' << value << '"';
-      hasAnElement = true;
-    }
-  }
+  Separate();
+  write_string(myOutput, value);
   return *this;
 }
 
@@ -372,35 +733,18 @@ JsonWriterArray& JsonWriterArray::operator <<(
 
 JsonWriterObject JsonWriterArray::object()
 {
-  if (hasAnElement)
-  {
-    if (isIndenting)
-    {
-      myOutput << ',' << std::endl << myIndentation << "  ";
-    }
-    else
-    {
-      myOutput << ',';
-    }
-  }
-  else if (isIndenting)
-  {
-    myOutput << myIndentation << "  ";
-  }
-
-  hasAnElement = true;
-  return JsonWriterObject(&myOutput, myIndentation + "  ");
+  Separate();
+  return JsonWriterObject(&myOutput, isIndenting, myDepth + 1);
 }
 
 #ifdef JSONWRITER_ENABLE_TESTING
 
-#include <iostream>
-
 int main()
 {
+  DescriptorSink output(1);
 
   {
-    JsonWriterObject objectWriter(&std::cout);
+    JsonWriterObject objectWriter(&output);
 
     // Best style.
     objectWriter["hello"] = "value";
@@ -410,7 +754,7 @@ int main()
   }
 
   {
-    JsonWriterArray arrayWriter(&std::cout);
+    JsonWriterArray arrayWriter(&output);
 
     arrayWriter << "apple" << "pear" << "carrot" << "grape";
   }
@@ -419,7 +763,7 @@ int main()
   // object.
 
   {
-    JsonWriterObject objectWriter(&std::cout);
+    JsonWriterObject objectWriter(&output);
 
     objectWriter["hello"] = "value";
     objectWriter["second"].array() << "apple" << "pear" << "carrot" << "grape";
@@ -433,7 +777,7 @@ int main()
 
   {
     // Test the example that is in the header.
-    JsonWriterObject objectWriter(&std::cout);
+    JsonWriterObject objectWriter(&output);
     objectWriter["name"] = "Bill Gates";
     objectWriter["likes"].array() << "software" << "money" << "helping";
     {
@@ -446,18 +790,80 @@ int main()
 
   {
     // Test one of the known shortcomings.
-    JsonWriterObject ow(&std::cout);
+    JsonWriterObject ow(&output);
     ow = "hello";
   }
 
   {
     // Use the convicence functions
-    auto o = JsonWriter::object(&std::cout);
+    auto o = JsonWriter::object(&output);
     o["city"] = "Medina";
     o["state"] = "Washington";
     o["country"] = "United States";
   }
 
+  {
+    // Strings are escaped as they are written, whatever their length.
+    auto o = JsonWriter::object(&output);
+    o["quote \"key\""] = "tab\there, a \"quote\" and C:\\path\x01\x1f";
+    o["long"] = std::string(40, 'a') + "\n" + std::string(40, 'b') + "\\";
+    o["utf-8"] = "caf\xc3\xa9 \xe2\x82\xac";
+    o["array"].array() << "a\rb";
+  }
+
+  if (JsonWriter::escape("\x7f\b\f\x10\xff") != "\x7f\\b\\f\\u0010\xff")
+  {
+    return 1;
+  }
+
+  {
+    // Keys declared once are written the same as any other.
+    static constexpr JsonKey shaKey("sha");
+    auto o = JsonWriter::object(&output);
+    o[shaKey] = std::string_view("0123456789abcdef", 7);
+    o["after"] = "a key that isn't a JsonKey";
+  }
+
+  {
+    // The compact layout has no whitespace at all, other than the new line
+    // at the end.
+    BufferSink compact;
+    {
+      auto o = JsonWriter::object(&compact, JsonWriter::Compact);
+      o["name"] = "Bill Gates";
+      o["likes"].array() << "software" << "money";
+      {
+        auto address = o["address"].object();
+        address["city"] = "Medina";
+        address["state"] = "Washington";
+      }
+      o["empty"].array();
+      o["age"] = static_cast<std::int64_t>(57);
+      o["retired"] = false;
+      o["raw"].json("{\"already\":\"JSON\"}");
+    }
+    if (compact.Take() !=
+        "{\"name\":\"Bill Gates\",\"likes\":[\"software\",\"money\"],"
+        "\"address\":{\"city\":\"Medina\",\"state\":\"Washington\"},"
+        "\"empty\":[],\"age\":57,\"retired\":false,"
+        "\"raw\":{\"already\":\"JSON\"}}\n")
+    {
+      return 1;
+    }
+  }
+
+  char time[JsonWriter::timeLength];
+  JsonWriter::format_time(1318057629, time);
+  if (std::string(time, sizeof(time)) != "2011-10-08T07:07:09Z") return 1;
+  JsonWriter::format_time(951782400, time);
+  if (std::string(time, sizeof(time)) != "2000-02-29T00:00:00Z") return 1;
+
+  char mode[11];
+  if (std::string(mode, JsonWriter::format_octal(0100644, mode)) != "100644")
+  {
+    return 1;
+  }
+
   return 0;
 }
 #endif
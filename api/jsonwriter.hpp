@@ -7,12 +7,13 @@
 // LICENSE      : The MIT License (see LICENSE.txt for details)
 // DESCRIPTION  :
 //
-// Provides an easy way for outputting JSON to a character stream
-// (std::ostream), without first storing all the data and then serialising it.
+// Provides an easy way for outputting JSON to an OutputSink, without first
+// storing all the data and then serialising it.
 //
 // Usage:
 // {
-//   JsonWriterObject objectWriter(&std::cout);
+//   DescriptorSink output(1);
+//   JsonWriterObject objectWriter(&output);
 //   objectWriter["name"] = "Bill Gates";
 //   objectWriter["likes"].array() << "software" << "money" << "helping;
 //   {
@@ -50,18 +51,30 @@
 //
 //   The following will compile but will do nothing.
 //   {
-//     JsonWriterObject ow(&std::cout);
+//     JsonWriterObject ow(&output);
 //     ow = "hello";
 //   }
 //
 //   There is currently no support for anything other than array, objects and
 //   strings.
 //
+// Responses written often, such as commits and tree entries, declare their
+// keys once as JsonKey constants. Those are quoted at compile time so writing
+// one is a single copy, and their values are formatted into buffers on the
+// stack with format_time() and format_octal(), so no field allocates.
+//
+//   static constexpr JsonKey shaKey("sha");
+//   char sha[GIT_OID_HEXSZ + 1];
+//   object[shaKey] = std::string_view(sha, GIT_OID_HEXSZ);
+//
 //===----------------------------------------------------------------------===//
 
+#include "sink.hpp"
+
+#include <cstddef>
 #include <cstdint>
-#include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class JsonWriterObject;
@@ -69,32 +82,95 @@ class JsonWriterArray;
 
 namespace JsonWriter
 {
-  JsonWriterObject object(std::ostream* output);
-  JsonWriterArray array(std::ostream* output);
+  // How the JSON is laid out. Indented puts each member and element on a line
+  // of its own, indented by two spaces for each level, while Compact leaves
+  // out all the whitespace for clients that don't need it.
+  enum Layout { Indented, Compact };
+
+  JsonWriterObject object(OutputSink* output, Layout layout = Indented);
+  JsonWriterArray array(OutputSink* output, Layout layout = Indented);
 
   // Escapes double quotes, backslash, whitespace (backspace, form-feed, line
-  // feed, carriage-return and tab) and all control codes less than 20.
+  // feed, carriage-return and tab) and all other control codes less than 0x20.
+  // Everything else, including UTF-8 sequences, is left as it is.
   std::string escape(const char* string);
+
+  // Writes the escaped form of [string, string + length) to the output.
+  //
+  // The strings written by JsonWriterObject and JsonWriterArray go through
+  // this, so they should not be escaped beforehand.
+  void escape(const char* string, std::size_t length, OutputSink* output);
+
+  // The number of characters format_time() writes.
+  const std::size_t timeLength = sizeof "2011-10-08T07:07:09Z" - 1;
+
+  // Writes the time, given in seconds since the epoch, as UTC in the form
+  // YYYY-MM-DDTHH:MM:SSZ to the first timeLength characters of buffer.
+  void format_time(std::int64_t time, char* buffer);
+
+  // Writes the value in octal to the buffer, returning the number of
+  // characters written. It is not terminated.
+  std::size_t format_octal(std::uint32_t value, char (&buffer)[11]);
+
+  // Returns true if the text is a single JSON value, with only whitespace
+  // around it, such as a response to be written with json(). Values nested
+  // more than a few hundred deep aren't accepted.
+  bool is_valid(std::string_view text);
 }
 
+// The key of a member of an object, which is put in quotes at compile time.
+// The key can't contain anything that would need to be escaped.
+template<std::size_t N>
+class JsonKey
+{
+  char myText[N + 1];
+
+public:
+  constexpr JsonKey(const char (&key)[N])
+  : myText()
+  {
+    myText[0] = '"';
+    for (std::size_t i = 0; i + 1 < N; ++i)
+    {
+      if (key[i] == '"' || key[i] == '\\' ||
+          static_cast<unsigned char>(key[i]) < 0x20)
+      {
+        throw "A JsonKey can't contain anything that needs escaping.";
+      }
+      myText[i + 1] = key[i];
+    }
+    myText[N] = '"';
+  }
+
+  // The key in quotes, which isn't terminated.
+  const char* data() const { return myText; }
+  static constexpr std::size_t size() { return N + 1; }
+};
+
 class JsonWriterObject
 {
   enum State { WaitingForKey, WaitingForValue, WaitingForAnotherKey, Moved };
 
-  std::ostream& myOutput;
+  OutputSink& myOutput;
   State myState;
   bool isIndenting;
-  std::string myIndentation;
+
+  // The number of objects and arrays this one is within.
+  unsigned int myDepth;
 
   // This is a helper function used internally to write an integer to the
-  // output stream (myOutput) based on the state (myState).
+  // output (myOutput) based on the state (myState).
   template<typename T>
   JsonWriterObject& operator <<(T value);
 
   JsonWriterObject(const JsonWriterObject&); /* = delete; */
   JsonWriterObject& operator =(const JsonWriterObject&); /* = default; */
+
+  friend class JsonWriterArray;
+  JsonWriterObject(OutputSink* output, bool isIndenting, unsigned int depth);
 public:
-  JsonWriterObject(std::ostream* output, std::string indentation = "");
+  JsonWriterObject(OutputSink* output,
+                   JsonWriter::Layout layout = JsonWriter::Indented);
   JsonWriterObject(JsonWriterObject&& writer);
   ~JsonWriterObject();
 
@@ -103,34 +179,71 @@ public:
 
   JsonWriterObject& operator [](const char* key);
 
+  template<std::size_t N>
+  JsonWriterObject& operator [](const JsonKey<N>& key)
+  {
+    return Key(key.data(), key.size());
+  }
+
   JsonWriterObject& operator =(bool value);
   JsonWriterObject& operator =(const std::string& value);
   JsonWriterObject& operator =(const char* value);
+  JsonWriterObject& operator =(std::string_view value);
   JsonWriterObject& operator =(const unsigned int value);
   JsonWriterObject& operator =(const unsigned long long value);
   JsonWriterObject& operator =(const std::int64_t value);
   JsonWriterObject& operator =(const JsonWriterArray& value);
 
+  // Writes a string value whose content is written to the output by the
+  // given function, for values too large to hold in memory. The content must
+  // already be escaped.
+  template<typename Function>
+  JsonWriterObject& stream(Function write);
+
+  // Writes a value which is already JSON, such as another response.
+  JsonWriterObject& json(std::string_view value);
+
   // These should really only be on the class returned by operator [].
   JsonWriterArray array();
   JsonWriterObject object();
+
+private:
+  // Writes a key that is already in quotes.
+  JsonWriterObject& Key(const char* quoted, std::size_t size);
+
+  // Writes what comes before a key, which is a comma if it isn't the first
+  // and a new line if it is indenting.
+  void Separate();
+
+  // Writes what comes between a key and its value.
+  void Colon();
 };
 
 class JsonWriterArray
 {
-  std::ostream& myOutput;
+  OutputSink& myOutput;
   bool hasAnElement;
   bool hasBeenMoved;
   bool isIndenting;
-  std::string myIndentation;
+
+  // The number of objects and arrays this one is within.
+  unsigned int myDepth;
 
   JsonWriterArray();
 
   JsonWriterArray(const JsonWriterArray&); /* = delete; */
   JsonWriterArray& operator =(const JsonWriterArray&); /* = default; */
+
+  friend class JsonWriterObject;
+  JsonWriterArray(OutputSink* output, bool isIndenting, unsigned int depth);
+
+  // Writes what comes before an element, which is a comma if it isn't the
+  // first and a new line if it is indenting.
+  void Separate();
 public:
 
-  JsonWriterArray(std::ostream* output, std::string indentation = "");
+  JsonWriterArray(OutputSink* output,
+                  JsonWriter::Layout layout = JsonWriter::Indented);
   JsonWriterArray(JsonWriterArray&& writer);
 
   ~JsonWriterArray();
@@ -144,5 +257,19 @@ public:
   // TODO: Support putting an array in an array.
 };
 
+template<typename Function>
+JsonWriterObject& JsonWriterObject::stream(Function write)
+{
+  if (myState == WaitingForValue)
+  {
+    myOutput.Write(isIndenting ? ": \"" : ":\"");
+    write(myOutput);
+    myOutput.Put('"');
+    myState = WaitingForAnotherKey;
+  }
+
+  return *this;
+}
+
 //===--------------------------- End of the file --------------------------===//
 #endif
@@ -0,0 +1,115 @@
+#ifndef LRU_CACHE_HPP_
+#define LRU_CACHE_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : LruCache
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Keeps the values that were most recently used, up to a capacity, for the
+// caches of things that never change such as blames and diffs. Each value is
+// given a cost when it is added, which may be one to limit the number of
+// values or their size in bytes, and the least recently used are removed once
+// the total goes over the capacity.
+//
+// The values are shared, so one that is removed stays alive while it is still
+// being used. The cache can be used from any thread.
+//
+// Usage:
+// {
+//   LruCache<Blame> cache(1024);
+//   std::shared_ptr<const Blame> blame = cache.Find(key);
+//   if (!blame)
+//   {
+//     blame = work_out_blame();
+//     cache.Insert(key, blame, 1);
+//   }
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+template<typename Value>
+class LruCache
+{
+public:
+  // The capacity is in the units of the costs given to Insert().
+  LruCache(std::size_t capacity) : myCapacity(capacity), myTotal(0) {}
+
+  // Returns the value with the given key, marking it as the most recently
+  // used, or null if it isn't there.
+  std::shared_ptr<const Value> Find(const std::string& key);
+
+  // Adds the value as the most recently used, replacing any with the same key,
+  // and removes the least recently used until the total cost is within the
+  // capacity. A value which costs more than the capacity isn't kept.
+  void Insert(const std::string& key, std::shared_ptr<const Value> value,
+              std::size_t cost);
+
+private:
+  LruCache(const LruCache&); /* = delete; */
+  LruCache& operator =(const LruCache&); /* = delete; */
+
+  struct Entry
+  {
+    std::string key;
+    std::shared_ptr<const Value> value;
+    std::size_t cost;
+  };
+  typedef std::list<Entry> Entries;
+
+  std::size_t myCapacity;
+  std::size_t myTotal;
+
+  // The most recently used is first.
+  Entries myEntries;
+  std::map<std::string, typename Entries::iterator> myIndex;
+  std::mutex myMutex;
+};
+
+template<typename Value>
+std::shared_ptr<const Value> LruCache<Value>::Find(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  const auto index = myIndex.find(key);
+  if (index == myIndex.end()) return nullptr;
+
+  myEntries.splice(myEntries.begin(), myEntries, index->second);
+  return index->second->value;
+}
+
+template<typename Value>
+void LruCache<Value>::Insert(const std::string& key,
+                             std::shared_ptr<const Value> value,
+                             std::size_t cost)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  const auto index = myIndex.find(key);
+  if (index != myIndex.end())
+  {
+    myTotal -= index->second->cost;
+    myEntries.erase(index->second);
+    myIndex.erase(index);
+  }
+  if (cost > myCapacity) return;
+
+  myEntries.push_front(Entry{ key, std::move(value), cost });
+  myIndex[key] = myEntries.begin();
+  myTotal += cost;
+  while (myTotal > myCapacity)
+  {
+    myTotal -= myEntries.back().cost;
+    myIndex.erase(myEntries.back().key);
+    myEntries.pop_back();
+  }
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,156 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : References
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "references.hpp"
+
+#include "repository.hpp"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#pragma warning(disable : 4510 4512 4610)
+#include <git2.h>
+#pragma warning(4 : 4510 4512 4610)
+#else
+#include <git2.h>
+#endif
+
+// Sets the type of the reference and, if it is an annotated tag, what it
+// peels to.
+static void peel(git_repository* repository, git_odb* objects,
+                 const git_oid* id, const git_oid* peeled,
+                 git::References::Reference* reference)
+{
+  // The packed-refs file records what its tags peel to, so they don't need to
+  // be read.
+  if (peeled)
+  {
+    reference->type = "tag";
+    reference->peeled = git::HexOf(peeled);
+    return;
+  }
+
+  size_t length = 0;
+  git_otype type = GIT_OBJ_BAD;
+  if (!objects || git_odb_read_header(&length, &type, objects, id) != 0)
+  {
+    reference->type = "commit";
+    return;
+  }
+  reference->type = git_object_type2string(type);
+  if (type != GIT_OBJ_TAG) return;
+
+  // A tag may be of another tag, so it is peeled until it is something else.
+  git_object* tag = nullptr;
+  git_object* target = nullptr;
+  if (git_object_lookup(&tag, repository, id, GIT_OBJ_TAG) == 0 &&
+      git_object_peel(&target, tag, GIT_OBJ_ANY) == 0)
+  {
+    reference->peeled = git::HexOf(git_object_id(target));
+  }
+  git_object_free(target);
+  git_object_free(tag);
+}
+
+git::References::References(git_repository* repository)
+{
+  git_odb* objects = nullptr;
+  if (git_repository_odb(&objects, repository) != 0) objects = nullptr;
+
+  git_reference_iterator* iterator = nullptr;
+  if (git_reference_iterator_new(&iterator, repository) != 0)
+  {
+    git_odb_free(objects);
+    throw git::Error("Could not iterate over the references.");
+  }
+
+  git_reference* reference = nullptr;
+  for (int ret = git_reference_next(&reference, iterator);
+       ret != GIT_ITEROVER;
+       ret = git_reference_next(&reference, iterator))
+  {
+    if (ret != 0)
+    {
+      git_reference_iterator_free(iterator);
+      git_odb_free(objects);
+      throw git::Error("Could not iterate over the references.");
+    }
+
+    Reference entry;
+    entry.name = git_reference_name(reference);
+    if (git_reference_type(reference) == GIT_REF_SYMBOLIC)
+    {
+      entry.type = "symbolic";
+      entry.symbolicTarget = git_reference_symbolic_target(reference);
+
+      git_reference* resolved = nullptr;
+      if (git_reference_resolve(&resolved, reference) == 0)
+      {
+        entry.target = git::HexOf(git_reference_target(resolved));
+        git_reference_free(resolved);
+      }
+    }
+    else
+    {
+      const git_oid* const target = git_reference_target(reference);
+      entry.target = git::HexOf(target);
+      peel(repository, objects, target, git_reference_target_peel(reference),
+           &entry);
+    }
+
+    myReferences.push_back(std::move(entry));
+    git_reference_free(reference);
+  }
+  git_reference_iterator_free(iterator);
+  git_odb_free(objects);
+
+  std::sort(myReferences.begin(), myReferences.end(),
+            [](const Reference& left, const Reference& right)
+            {
+              return left.name < right.name;
+            });
+}
+
+const git::References::Reference* git::References::Find(
+  const std::string& name) const
+{
+  const auto reference = std::lower_bound(
+    myReferences.begin(), myReferences.end(), name,
+    [](const Reference& left, const std::string& right)
+    {
+      return left.name < right;
+    });
+  if (reference == myReferences.end() || reference->name != name)
+  {
+    return nullptr;
+  }
+  return &*reference;
+}
+
+std::pair<git::References::const_iterator, git::References::const_iterator>
+git::References::Prefixed(const std::string& prefix) const
+{
+  const auto first = std::lower_bound(
+    myReferences.begin(), myReferences.end(), prefix,
+    [](const Reference& left, const std::string& right)
+    {
+      return left.name < right;
+    });
+
+  // The names starting with the prefix are all together, from the first, so
+  // the end of them is found by a binary search as well.
+  const auto last = std::partition_point(
+    first, myReferences.end(),
+    [&prefix](const Reference& reference)
+    {
+      return reference.name.compare(0, prefix.size(), prefix) == 0;
+    });
+  return std::make_pair(first, last);
+}
+
+//===--------------------------- End of the file --------------------------===//
@@ -0,0 +1,82 @@
+#ifndef REFERENCES_HPP_
+#define REFERENCES_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : References
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// A snapshot of the references in a repository, ordered by name, with what
+// each of them resolves to and, for an annotated tag, what it peels to.
+//
+// The snapshot never changes once it has been read, so it can be shared by
+// the requests for the repository until its references change on disk.
+// Repository::Refs() takes care of that.
+//
+// Usage:
+// {
+//   git::Repository repository("gitweb");
+//   const auto references = repository.Refs();
+//   const auto tags = references->Prefixed("refs/tags/");
+//   for (auto tag = tags.first; tag != tags.second; ++tag) ...
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include <string>
+#include <utility>
+#include <vector>
+
+struct git_repository;
+
+namespace git
+{
+  class References
+  {
+  public:
+    struct Reference
+    {
+      // The full name, such as refs/heads/master.
+      std::string name;
+
+      // The type of the object the reference resolves to (commit, tag, tree
+      // or blob) or "symbolic" if it refers to another reference.
+      const char* type;
+
+      // The name of the reference a symbolic reference refers to.
+      std::string symbolicTarget;
+
+      // The SHA of the object the reference resolves to, which is empty for
+      // a symbolic reference that doesn't resolve.
+      std::string target;
+
+      // The SHA of the object an annotated tag peels to, otherwise empty.
+      std::string peeled;
+    };
+
+    typedef std::vector<Reference>::const_iterator const_iterator;
+
+    // Reads the references of the repository, throwing git::Error if they
+    // can't be read.
+    explicit References(git_repository* repository);
+
+    const_iterator begin() const { return myReferences.begin(); }
+    const_iterator end() const { return myReferences.end(); }
+    std::size_t size() const { return myReferences.size(); }
+
+    // Returns the reference with the given full name or null if there isn't
+    // one.
+    const Reference* Find(const std::string& name) const;
+
+    // Returns the range of references whose names start with the prefix.
+    std::pair<const_iterator, const_iterator> Prefixed(
+      const std::string& prefix) const;
+
+  private:
+    std::vector<Reference> myReferences;
+  };
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif
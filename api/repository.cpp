@@ -8,6 +8,20 @@
 
 #include "repository.hpp"
 
+#include "commitgraph.hpp"
+#include "references.hpp"
+#include "request.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
 #ifdef _MSC_VER
 #pragma warning(disable : 4510 4512 4610)
 #include <git2.h>
@@ -16,37 +30,101 @@
 #include <git2.h>
 #endif
 
-static const char* repositoriesPath = "D:/vcs";
+static std::string repositoriesPath = "D:/vcs";
 
-git::Repository::Repository(const std::string& name)
-: myPath(repositoriesPath + ("/" + name)),
-  myRepository(nullptr)
+static git::RepositoryCache* currentCache = nullptr;
+
+// The most object sizes remembered for each repository.
+static const std::size_t objectSizeCapacity = 1 << 18;
+
+static std::string path_of(const std::string& name)
+{
+  return repositoriesPath + ("/" + name);
+}
+
+// Returns the path to the git directory of the repository with the given name,
+// which is the .git directory within it unless it is a bare repository.
+static std::string git_directory_of(const std::string& name)
+{
+  const std::string path = path_of(name);
+  struct stat status;
+  if (stat((path + "/.git").c_str(), &status) == 0 &&
+      (status.st_mode & S_IFMT) == S_IFDIR)
+  {
+    return path + "/.git";
+  }
+  return path;
+}
+
+const std::string& git::RepositoriesPath()
+{
+  return repositoriesPath;
+}
+
+void git::RepositoriesPath(const std::string& path)
+{
+  repositoriesPath = path;
+}
+
+std::string git::HexOf(const git_oid* id)
+{
+  char sha[GIT_OID_HEXSZ + 1];
+  return git_oid_tostr(sha, sizeof(sha), id);
+}
+
+// Opens the repository with the given name.
+//
+// Throws git::NotFound if the repository can not be found and git::Error if it
+// can't be opened.
+static git_repository* open(const std::string& name)
 {
-  const int error = git_repository_open(&myRepository, myPath.c_str());
+  git_repository* repository = nullptr;
+  StageTimer timer("open");
+  const int error = git_repository_open(&repository, path_of(name).c_str());
   if (error != 0)
   {
     const git_error* lastError = giterr_last();
-    if (lastError && lastError->message)
-    {
-      throw git::Error(std::string("Could not open repository: ") +
-                       lastError->message);
-    }
-    else
+    const std::string cause = (lastError && lastError->message) ?
+      lastError->message : "cause unknown.";
+    if (error == GIT_ENOTFOUND)
     {
-      throw git::Error("Could not open repository: cause unknown.");
+      throw git::NotFound("Could not open repository: " + cause);
     }
+    throw git::Error("Could not open repository: " + cause);
   }
+  return repository;
+}
+
+git::Repository::Repository(const std::string& name)
+: myName(name),
+  myRepository(nullptr),
+  isCached(currentCache != nullptr),
+  myObjects(nullptr)
+{
+  myRepository = isCached ? currentCache->Acquire(name) : open(name);
+  if (isCached) mySizes = currentCache->Sizes(name);
 }
 
 git::Repository::~Repository()
 {
-  git_repository_free(myRepository);
+  git_odb_free(myObjects);
+  myObjects = nullptr;
+
+  if (isCached && currentCache)
+  {
+    currentCache->Release(myName, myRepository);
+  }
+  else
+  {
+    git_repository_free(myRepository);
+  }
   myRepository = nullptr;
 }
 
 git_object* git::Repository::Parse(const std::string& specification)
 {
   git_object* object = nullptr;
+  StageTimer timer("revparse");
   int error = git_revparse_single(&object, myRepository, specification.c_str());
   if (error != 0)
   {
@@ -64,4 +142,420 @@ git_object* git::Repository::Parse(const std::string& specification)
   return object;
 }
 
+bool git::Repository::Resolve(const std::string& specification, git_oid* id)
+{
+  if (specification.size() == GIT_OID_HEXSZ &&
+      git_oid_fromstr(id, specification.c_str()) == 0)
+  {
+    return true;
+  }
+
+  // A path within a commit or tree, such as HEAD:README.md. A colon at the
+  // start has other meanings (such as :/message) which are left to Parse().
+  const std::size_t colon = specification.find(':');
+  if (colon != std::string::npos && colon > 0)
+  {
+    git_object* tree = Parse(specification.substr(0, colon));
+    if (!tree) return false;
+
+    StageTimer timer("revparse");
+    git_object* peeled = nullptr;
+    git_tree_entry* entry = nullptr;
+    const bool isFound =
+      git_object_peel(&peeled, tree, GIT_OBJ_TREE) == 0 &&
+      git_tree_entry_bypath(&entry, reinterpret_cast<git_tree*>(peeled),
+                            specification.c_str() + colon + 1) == 0;
+    if (isFound) git_oid_cpy(id, git_tree_entry_id(entry));
+
+    git_tree_entry_free(entry);
+    git_object_free(peeled);
+    git_object_free(tree);
+    return isFound;
+  }
+
+  git_object* object = Parse(specification);
+  if (!object) return false;
+  git_oid_cpy(id, git_object_id(object));
+  git_object_free(object);
+  return true;
+}
+
+git_odb* git::Repository::Objects()
+{
+  if (!myObjects && git_repository_odb(&myObjects, myRepository) != 0)
+  {
+    myObjects = nullptr;
+  }
+  return myObjects;
+}
+
+std::int64_t git::Repository::ObjectSize(const git_oid& id)
+{
+  std::int64_t size;
+  if (mySizes && mySizes->Find(id, &size)) return size;
+
+  git_odb* objects = Objects();
+  if (!objects) return -1;
+
+  // For an object in a pack this only inflates the start of it, or of the
+  // delta for it, where the size is recorded.
+  size_t length = 0;
+  git_otype type;
+  {
+    StageTimer timer("read");
+    if (git_odb_read_header(&length, &type, objects, &id) != 0) return -1;
+  }
+
+  size = static_cast<std::int64_t>(length);
+  if (mySizes) mySizes->Insert(id, size);
+  return size;
+}
+
+std::shared_ptr<const git::References> git::Repository::Refs()
+{
+  std::uint64_t state = 0;
+  const bool isKept = isCached && currentCache &&
+    ReferencesState(myName, &state);
+  if (isKept)
+  {
+    auto references = currentCache->FindReferences(myName, state);
+    if (references) return references;
+  }
+
+  std::shared_ptr<const References> references;
+  {
+    StageTimer timer("read");
+    references = std::make_shared<const References>(myRepository);
+  }
+  if (isKept) currentCache->InsertReferences(myName, state, references);
+  return references;
+}
+
+git::RepositoryHandles::RepositoryHandles(Repository& repository)
+: myRepository(repository),
+  myThread(std::this_thread::get_id())
+{
+}
+
+git::Repository& git::RepositoryHandles::Get()
+{
+  if (std::this_thread::get_id() == myThread) return myRepository;
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  std::unique_ptr<Repository>& handle = myHandles[std::this_thread::get_id()];
+  if (!handle) handle.reset(new Repository(myRepository.Name()));
+  return *handle;
+}
+
+git::CommitGraph& git::Repository::Graph()
+{
+  if (!myGraph)
+  {
+    if (isCached && currentCache)
+    {
+      myGraph = currentCache->Graph(myName);
+    }
+    else
+    {
+      myGraph = std::make_shared<CommitGraph>();
+    }
+  }
+
+  myGraph->Load(git_repository_path(myRepository));
+  return *myGraph;
+}
+
+#ifndef _WIN32
+
+// Adds the status of the file or directory to the hash, returning false if
+// it doesn't exist.
+static bool hash_status(const std::string& path, std::uint64_t* hash,
+                        struct stat* status)
+{
+  if (stat(path.c_str(), status) != 0) return false;
+
+  const std::int64_t values[] = {
+    static_cast<std::int64_t>(status->st_ino),
+    static_cast<std::int64_t>(status->st_size),
+    static_cast<std::int64_t>(status->st_mtime),
+#ifdef __linux__
+    static_cast<std::int64_t>(status->st_mtim.tv_nsec),
+#endif
+  };
+
+  // FNV-1a.
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+  for (std::size_t i = 0; i < sizeof(values); ++i)
+  {
+    *hash = (*hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return true;
+}
+
+// Adds the directory and the directories within it to the hash. A loose
+// reference is updated by renaming a lock file over it, which modifies the
+// directory it is in.
+static void hash_directories(const std::string& path, std::uint64_t* hash)
+{
+  struct stat status;
+  if (!hash_status(path, hash, &status) || !S_ISDIR(status.st_mode)) return;
+
+  DIR* directory = opendir(path.c_str());
+  if (!directory) return;
+
+  std::vector<std::string> names;
+  while (const dirent* entry = readdir(directory))
+  {
+    if (entry->d_name[0] == '.') continue;
+    if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) continue;
+    names.push_back(entry->d_name);
+  }
+  closedir(directory);
+
+  // The order the entries are read in is not stable.
+  std::sort(names.begin(), names.end());
+  for (auto name = std::begin(names); name != std::end(names); ++name)
+  {
+    hash_directories(path + "/" + *name, hash);
+  }
+}
+
+bool git::Repository::ReferencesState(const std::string& name,
+                                      std::uint64_t* state)
+{
+  const std::string path = git_directory_of(name);
+  struct stat status;
+
+  std::uint64_t hash = 14695981039346656037ull;
+  if (!hash_status(path + "/HEAD", &hash, &status)) return false;
+
+  // The packed-refs file is optional, its absence is hashed as well.
+  if (!hash_status(path + "/packed-refs", &hash, &status)) hash ^= 1;
+
+  hash_directories(path + "/refs", &hash);
+  *state = hash;
+  return true;
+}
+
+#else
+
+bool git::Repository::ReferencesState(const std::string&, std::uint64_t*)
+{
+  return false;
+}
+
+#endif
+
+git::ObjectSizes::ObjectSizes(std::size_t capacity)
+: myShardCapacity(capacity / shardCount + 1)
+{
+}
+
+git::ObjectSizes::Key git::ObjectSizes::KeyOf(const git_oid& id)
+{
+  Key key;
+  std::memcpy(key.data(), id.id, key.size());
+  return key;
+}
+
+bool git::ObjectSizes::Find(const git_oid& id, std::int64_t* size)
+{
+  Shard& shard = myShards[id.id[0] % shardCount];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto entry = shard.sizes.find(KeyOf(id));
+  if (entry == shard.sizes.end()) return false;
+  *size = entry->second;
+  return true;
+}
+
+void git::ObjectSizes::Insert(const git_oid& id, std::int64_t size)
+{
+  Shard& shard = myShards[id.id[0] % shardCount];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.sizes.size() >= myShardCapacity) shard.sizes.clear();
+  shard.sizes[KeyOf(id)] = size;
+}
+
+bool git::RepositoryCache::State::operator ==(const State& other) const
+{
+  return packsModified == other.packsModified &&
+    packedRefsModified == other.packedRefsModified &&
+    packedRefsSize == other.packedRefsSize;
+}
+
+git::RepositoryCache::RepositoryCache(std::size_t capacity)
+: myCapacity(capacity)
+{
+  currentCache = this;
+}
+
+git::RepositoryCache::~RepositoryCache()
+{
+  for (auto slot = std::begin(mySlots); slot != std::end(mySlots); ++slot)
+  {
+    git_repository_free(slot->repository);
+  }
+  currentCache = nullptr;
+}
+
+git::RepositoryCache* git::RepositoryCache::Current()
+{
+  return currentCache;
+}
+
+git::RepositoryCache::State git::RepositoryCache::Inspect(
+  const std::string& path)
+{
+  const auto modified = [](const struct stat& status) -> std::int64_t
+  {
+#ifdef __linux__
+    return static_cast<std::int64_t>(status.st_mtim.tv_sec) * 1000000000 +
+      status.st_mtim.tv_nsec;
+#else
+    return static_cast<std::int64_t>(status.st_mtime);
+#endif
+  };
+
+  State state = { 0, 0, 0 };
+  struct stat status;
+
+  // Adding or removing a pack (fetch, push, gc or repack) modifies the
+  // directory the packs are in. Loose objects are found by libgit2 without
+  // any help as it looks for them on disk whenever they are not in a pack.
+  const std::string packs = path + "/objects/pack";
+  if (stat(packs.c_str(), &status) == 0) state.packsModified = modified(status);
+
+  const std::string packedRefs = path + "/packed-refs";
+  if (stat(packedRefs.c_str(), &status) == 0)
+  {
+    state.packedRefsModified = modified(status);
+    state.packedRefsSize = static_cast<std::int64_t>(status.st_size);
+  }
+
+  return state;
+}
+
+git_repository* git::RepositoryCache::Acquire(const std::string& name)
+{
+  const State state = Inspect(git_directory_of(name));
+
+  git_repository* repository = nullptr;
+  State cachedState;
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    auto index = myIndex.find(name);
+    if (index != myIndex.end())
+    {
+      const auto slot = index->second.back();
+      index->second.pop_back();
+      if (index->second.empty()) myIndex.erase(index);
+
+      repository = slot->repository;
+      cachedState = slot->state;
+      mySlots.erase(slot);
+    }
+  }
+
+  if (!repository)
+  {
+    repository = open(name);
+  }
+  else if (!(cachedState == state))
+  {
+    // The packs in the repository have changed since it was last used so
+    // bring the object database up to date with them. The loose references
+    // are always read from disk and libgit2 reloads packed-refs when its
+    // timestamp changes, so the reference database looks after itself.
+    git_odb* odb = nullptr;
+    if (git_repository_odb(&odb, repository) == 0)
+    {
+      git_odb_refresh(odb);
+      git_odb_free(odb);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  myInUse[repository] = state;
+  return repository;
+}
+
+void git::RepositoryCache::Release(
+  const std::string& name, git_repository* repository)
+{
+  std::vector<git_repository*> evicted;
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    const auto inUse = myInUse.find(repository);
+    const State state = inUse->second;
+    myInUse.erase(inUse);
+
+    const Slot slot = { name, repository, state };
+    mySlots.push_front(slot);
+    myIndex[name].push_back(mySlots.begin());
+
+    while (mySlots.size() > myCapacity)
+    {
+      auto& siblings = myIndex[mySlots.back().name];
+      siblings.erase(std::find(std::begin(siblings), std::end(siblings),
+                               std::prev(mySlots.end())));
+      if (siblings.empty())
+      {
+        myIndex.erase(mySlots.back().name);
+        myReferences.erase(mySlots.back().name);
+        mySizes.erase(mySlots.back().name);
+        myGraphs.erase(mySlots.back().name);
+      }
+
+      evicted.push_back(mySlots.back().repository);
+      mySlots.pop_back();
+    }
+  }
+
+  // Close them outside of the lock, as this may unmap a lot of memory.
+  for (auto victim = std::begin(evicted); victim != std::end(evicted);
+       ++victim)
+  {
+    git_repository_free(*victim);
+  }
+}
+
+std::shared_ptr<git::ObjectSizes> git::RepositoryCache::Sizes(
+  const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  std::shared_ptr<ObjectSizes>& sizes = mySizes[name];
+  if (!sizes) sizes = std::make_shared<ObjectSizes>(objectSizeCapacity);
+  return sizes;
+}
+
+std::shared_ptr<git::CommitGraph> git::RepositoryCache::Graph(
+  const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  std::shared_ptr<CommitGraph>& graph = myGraphs[name];
+  if (!graph) graph = std::make_shared<CommitGraph>();
+  return graph;
+}
+
+std::shared_ptr<const git::References> git::RepositoryCache::FindReferences(
+  const std::string& name, std::uint64_t state)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  const auto snapshot = myReferences.find(name);
+  if (snapshot == myReferences.end() || snapshot->second.state != state)
+  {
+    return nullptr;
+  }
+  return snapshot->second.references;
+}
+
+void git::RepositoryCache::InsertReferences(
+  const std::string& name, std::uint64_t state,
+  const std::shared_ptr<const References>& references)
+{
+  std::lock_guard<std::mutex> lock(myMutex);
+  const ReferencesSnapshot snapshot = { state, references };
+  myReferences[name] = snapshot;
+}
+
 //===--------------------------- End of the file --------------------------===//
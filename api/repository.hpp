@@ -9,11 +9,23 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 struct git_repository;
 struct git_object;
+struct git_odb;
+struct git_oid;
 
 namespace git
 {
@@ -23,15 +35,53 @@ namespace git
     Error(const std::string& message) : std::runtime_error(message) {}
   };
 
+  // Thrown when the repository that was asked for does not exist.
+  class NotFound : public Error
+  {
+  public:
+    NotFound(const std::string& message) : Error(message) {}
+  };
+
+  class CommitGraph;
+  class ObjectSizes;
+  class References;
+
+  // The directory the repositories are in, where each is found by its name.
+  // It should only be changed before any repositories are opened.
+  const std::string& RepositoriesPath();
+  void RepositoriesPath(const std::string& path);
+
+  // Returns the id as the 40 hexadecimal digits of the SHA.
+  std::string HexOf(const git_oid* id);
+
   class Repository
   {
-    std::string myPath;
+    std::string myName;
     git_repository* myRepository;
 
+    // True if the repository came from the RepositoryCache and should be
+    // returned to it rather than closed.
+    bool isCached;
+
+    // The object database, which is opened when it is first needed.
+    git_odb* myObjects;
+
+    // The sizes of the objects in the repository that have been looked up
+    // before, which is shared with the RepositoryCache while it keeps the
+    // repository. This is null if there is no cache.
+    std::shared_ptr<ObjectSizes> mySizes;
+
+    // The generations of the commits, which is shared with the
+    // RepositoryCache while it keeps the repository, if there is one.
+    std::shared_ptr<CommitGraph> myGraph;
+
+    Repository(const Repository&); /* = delete; */
+    Repository& operator =(const Repository&); /* = delete; */
   public:
-    //  Opens the repository with the given name in repositoriesPath..
+    //  Opens the repository with the given name in RepositoriesPath().
     Repository(const std::string& name);
-    // Throws git::Error if the repository can not be found.
+    // Throws git::NotFound if the repository can not be found and git::Error
+    // if it can't be opened.
 
     // Closes the repository. Everything opened from the repository should be
     // closed (freed) before this occurs.
@@ -44,6 +94,9 @@ namespace git
     // Determines if the repository is opened.
     bool IsOpen() const { return myRepository != nullptr; }
 
+    // The name the repository was opened with.
+    const std::string& Name() const { return myName; }
+
     // Finds an object with the given "specification" which may be the hex-hash
     // or a named reference (tag).
     //
@@ -52,6 +105,212 @@ namespace git
     //
     // Returns null if it can't open the object.
     git_object* Parse(const std::string& specification);
+
+    // Finds the id of the object with the given specification, like Parse()
+    // but without reading the object itself. A blob given by a path (as in
+    // master:README.md) is found through the trees, so a large blob is not
+    // inflated just to find its id.
+    //
+    // Returns false if there is no such object.
+    bool Resolve(const std::string& specification, git_oid* id);
+
+    // Returns the object database of the repository, or null if it can't be
+    // opened. It belongs to the repository.
+    git_odb* Objects();
+
+    // Returns the size of the object with the given id in bytes, or -1 if
+    // there is no such object.
+    //
+    // Only the header of the object is read, so the content is not inflated,
+    // and the size is remembered for the next time it is asked for.
+    std::int64_t ObjectSize(const git_oid& id);
+
+    // Returns a snapshot of the references of the repository.
+    //
+    // With a RepositoryCache the snapshot is kept and shared until
+    // ReferencesState() changes, so they are only read again after a
+    // reference has been added, changed or removed.
+    std::shared_ptr<const References> Refs();
+
+    // Returns the generations and parents of the commits, for walking the
+    // history without reading the commits. The commit-graph file is mapped
+    // again if it has been rewritten since it was last used.
+    CommitGraph& Graph();
+
+    // Sets state to a hash of what is on disk for the references of the
+    // repository with the given name, which changes whenever a reference
+    // (including HEAD) is added, changed or removed. Only the files are
+    // looked at, the repository is not opened.
+    //
+    // Returns false if the repository doesn't exist or its state can't be
+    // found, such as on Windows.
+    static bool ReferencesState(const std::string& name,
+                                std::uint64_t* state);
+  };
+
+  // Gives each thread its own handle to a repository, as a repository can't be
+  // used by more than one thread at a time. The thread that created this uses
+  // the repository it was given.
+  class RepositoryHandles
+  {
+  public:
+    RepositoryHandles(Repository& repository);
+
+    // Returns the handle for the calling thread, opening it if need be.
+    Repository& Get();
+
+  private:
+    RepositoryHandles(const RepositoryHandles&); /* = delete; */
+    RepositoryHandles& operator =(const RepositoryHandles&); /* = delete; */
+
+    Repository& myRepository;
+    const std::thread::id myThread;
+    std::mutex myMutex;
+    std::map<std::thread::id, std::unique_ptr<Repository>> myHandles;
+  };
+
+  // Remembers the sizes of the objects in a repository. As an object is
+  // identified by its content its size never changes, so nothing needs to be
+  // invalidated.
+  //
+  // The sizes are split between shards, each with their own lock, so the
+  // threads of a recursive tree listing rarely wait for each other. When a
+  // shard is full it is emptied.
+  class ObjectSizes
+  {
+  public:
+    ObjectSizes(std::size_t capacity);
+
+    // Returns true if the size of the object is known.
+    bool Find(const git_oid& id, std::int64_t* size);
+
+    void Insert(const git_oid& id, std::int64_t size);
+
+  private:
+    ObjectSizes(const ObjectSizes&); /* = delete; */
+    ObjectSizes& operator =(const ObjectSizes&); /* = delete; */
+
+    typedef std::array<unsigned char, 20> Key;
+
+    // The object ids are SHA-1 hashes so any part of them is a good hash.
+    struct Hash
+    {
+      std::size_t operator()(const Key& key) const
+      {
+        std::size_t hash;
+        std::memcpy(&hash, key.data() + 1, sizeof(hash));
+        return hash;
+      }
+    };
+
+    struct Shard
+    {
+      std::mutex mutex;
+      std::unordered_map<Key, std::int64_t, Hash> sizes;
+    };
+
+    static const std::size_t shardCount = 16;
+
+    static Key KeyOf(const git_oid& id);
+
+    std::size_t myShardCapacity;
+    Shard myShards[shardCount];
+  };
+
+  // Keeps repositories open after they have been used so the next request for
+  // the same repository can reuse it along with everything libgit2 has cached
+  // for it, such as parsed objects, pack indexes and mapped pack windows.
+  //
+  // While an instance exists, git::Repository takes its repositories from it
+  // and gives them back when it is destroyed. The least recently used
+  // repositories are closed once there are more than the capacity.
+  //
+  // A repository is only ever given to one git::Repository at a time, if the
+  // same repository is used concurrently then another handle to it is opened.
+  class RepositoryCache
+  {
+  public:
+    RepositoryCache(std::size_t capacity);
+    ~RepositoryCache();
+
+    // Returns the cache in use or null if there is none.
+    static RepositoryCache* Current();
+
+  private:
+    friend class Repository;
+
+    RepositoryCache(const RepositoryCache&); /* = delete; */
+    RepositoryCache& operator =(const RepositoryCache&); /* = delete; */
+
+    // What was on disk when the repository was last used, this is used to
+    // detect when packs have been added or removed.
+    struct State
+    {
+      std::int64_t packsModified;
+      std::int64_t packedRefsModified;
+      std::int64_t packedRefsSize;
+
+      bool operator ==(const State& other) const;
+    };
+
+    struct Slot
+    {
+      std::string name;
+      git_repository* repository;
+      State state;
+    };
+
+    // Returns the state of the git directory (not the working tree) at the
+    // given path.
+    static State Inspect(const std::string& path);
+
+    // Returns an open repository with the given name, either one that was
+    // released earlier or a newly opened one.
+    git_repository* Acquire(const std::string& name);
+
+    // Returns the repository to the cache.
+    void Release(const std::string& name, git_repository* repository);
+
+    // Returns the sizes of the objects in the repository with the given name,
+    // which are kept until the repository is closed.
+    std::shared_ptr<ObjectSizes> Sizes(const std::string& name);
+
+    // Returns the generations of the commits of the repository with the given
+    // name, which are kept until the repository is closed.
+    std::shared_ptr<CommitGraph> Graph(const std::string& name);
+
+    // Returns the snapshot of the references of the repository taken when
+    // they were in the given state, or null if there isn't one.
+    std::shared_ptr<const References> FindReferences(const std::string& name,
+                                                     std::uint64_t state);
+    void InsertReferences(const std::string& name, std::uint64_t state,
+                          const std::shared_ptr<const References>& references);
+
+    std::size_t myCapacity;
+
+    // The repositories that are not in use, the most recently used is first.
+    std::list<Slot> mySlots;
+    std::map<std::string, std::vector<std::list<Slot>::iterator>> myIndex;
+
+    // The state of the repositories that are in use.
+    std::map<git_repository*, State> myInUse;
+
+    // The sizes of the objects and the generations of the commits, which are
+    // only kept while the repository is, as there is one of each for every
+    // repository that has been used and without a commit-graph file the
+    // generations may be worked out for the whole history.
+    std::map<std::string, std::shared_ptr<ObjectSizes>> mySizes;
+    std::map<std::string, std::shared_ptr<CommitGraph>> myGraphs;
+
+    // The snapshots of the references, which are only kept while the
+    // repository is, as there may be a lot of them.
+    struct ReferencesSnapshot
+    {
+      std::uint64_t state;
+      std::shared_ptr<const References> references;
+    };
+    std::map<std::string, ReferencesSnapshot> myReferences;
+    std::mutex myMutex;
   };
 }
 
@@ -0,0 +1,209 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : RequestContext
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "request.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static thread_local RequestContext* currentRequest = nullptr;
+
+// Decodes the %XX escapes in the given text and if isQuery is true also turns
+// '+' into spaces.
+static std::string decode(const std::string& text, bool isQuery)
+{
+  const auto hex = [](char c) -> int
+  {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+
+  std::string decoded;
+  decoded.reserve(text.size());
+  for (std::size_t i = 0; i < text.size(); ++i)
+  {
+    if (text[i] == '%' && i + 2 < text.size() &&
+        hex(text[i + 1]) >= 0 && hex(text[i + 2]) >= 0)
+    {
+      decoded.push_back(static_cast<char>(hex(text[i + 1]) * 16 +
+                                          hex(text[i + 2])));
+      i += 2;
+    }
+    else if (isQuery && text[i] == '+')
+    {
+      decoded.push_back(' ');
+    }
+    else
+    {
+      decoded.push_back(text[i]);
+    }
+  }
+  return decoded;
+}
+
+static bool equal_ignoring_case(const std::string& a, const char* b)
+{
+  std::size_t i = 0;
+  for (; i < a.size() && b[i] != '\0'; ++i)
+  {
+    const char x = (a[i] >= 'A' && a[i] <= 'Z') ? a[i] - 'A' + 'a' : a[i];
+    const char y = (b[i] >= 'A' && b[i] <= 'Z') ? b[i] - 'A' + 'a' : b[i];
+    if (x != y) return false;
+  }
+  return i == a.size() && b[i] == '\0';
+}
+
+RequestContext::RequestContext(const std::string& target, OutputSink* output)
+: myOutput(output),
+  myStatus(200),
+  myContentType("application/json; charset=utf-8"),
+  myStart(std::chrono::steady_clock::now()),
+  myPrevious(currentRequest)
+{
+  const std::size_t queryStart = target.find('?');
+  const std::string path = decode(target.substr(0, queryStart), false);
+  for (std::size_t start = 0; start < path.size();)
+  {
+    std::size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    if (end > start)
+    {
+      myPath += '/';
+      myPath.append(path, start, end - start);
+    }
+    start = end + 1;
+  }
+
+  if (queryStart != std::string::npos)
+  {
+    // Split the query string (a=1&b=2) into its name and value pairs.
+    std::size_t start = queryStart + 1;
+    while (start <= target.size())
+    {
+      std::size_t end = target.find('&', start);
+      if (end == std::string::npos) end = target.size();
+
+      const std::string parameter = target.substr(start, end - start);
+      if (!parameter.empty())
+      {
+        const std::size_t equals = parameter.find('=');
+        if (equals == std::string::npos)
+        {
+          myQuery.emplace_back(decode(parameter, true), std::string());
+        }
+        else
+        {
+          myQuery.emplace_back(decode(parameter.substr(0, equals), true),
+                               decode(parameter.substr(equals + 1), true));
+        }
+      }
+      start = end + 1;
+    }
+  }
+
+  currentRequest = this;
+}
+
+RequestContext::~RequestContext()
+{
+  currentRequest = myPrevious;
+}
+
+RequestContext& RequestContext::Current()
+{
+  if (!currentRequest)
+  {
+    throw std::logic_error("There is no request being handled.");
+  }
+  return *currentRequest;
+}
+
+const std::string* RequestContext::Query(const char* name) const
+{
+  for (auto parameter = std::begin(myQuery); parameter != std::end(myQuery);
+       ++parameter)
+  {
+    if (parameter->first == name) return &parameter->second;
+  }
+  return nullptr;
+}
+
+const std::string* RequestContext::Header(const char* name) const
+{
+  for (auto header = std::begin(myHeaders); header != std::end(myHeaders);
+       ++header)
+  {
+    if (equal_ignoring_case(header->first, name)) return &header->second;
+  }
+  return nullptr;
+}
+
+void RequestContext::AddHeader(
+  const std::string& name, const std::string& value)
+{
+  myHeaders.emplace_back(name, value);
+}
+
+void RequestContext::Error(int status, const std::string& message)
+{
+  fprintf(stderr, "%s\n", message.c_str());
+  myStatus = status;
+  myErrorMessage = message;
+}
+
+void RequestContext::AddResponseHeader(
+  const std::string& name, const std::string& value)
+{
+  myResponseHeaders.emplace_back(name, value);
+}
+
+void RequestContext::AddTiming(const char* stage,
+                               std::chrono::nanoseconds duration)
+{
+  for (auto timing = std::begin(myTimings); timing != std::end(myTimings);
+       ++timing)
+  {
+    if (timing->first == stage || std::strcmp(timing->first, stage) == 0)
+    {
+      timing->second += duration;
+      return;
+    }
+  }
+  myTimings.emplace_back(stage, duration);
+}
+
+std::chrono::nanoseconds RequestContext::TimedTotal() const
+{
+  std::chrono::nanoseconds total(0);
+  for (auto timing = std::begin(myTimings); timing != std::end(myTimings);
+       ++timing)
+  {
+    total += timing->second;
+  }
+  return total;
+}
+
+StageTimer::StageTimer(const char* stage)
+: myRequest(currentRequest),
+  myStage(stage)
+{
+  if (myRequest) myStart = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer()
+{
+  if (myRequest)
+  {
+    myRequest->AddTiming(myStage, std::chrono::steady_clock::now() - myStart);
+  }
+}
+
+//===--------------------------- End of the file --------------------------===//
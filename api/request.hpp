@@ -0,0 +1,167 @@
+#ifndef REQUEST_HPP_
+#define REQUEST_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : RequestContext
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Holds the state of the request currently being handled, such as the query
+// parameters and where the response should be written to.
+//
+// The handlers are invoked by the Router with only the placeholders from the
+// path, so the rest of the request is made available to them through
+// RequestContext::Current().
+//
+// The time taken by the stages of handling a request, such as opening the
+// repository, is added to it by a StageTimer around each of them.
+//
+// Usage:
+// {
+//   DescriptorSink output(1);
+//   RequestContext context("/api/repos/gitweb/file/README.md?filename=a.md",
+//                          &output);
+//   router(context.Path(), '/');
+//   if (context.Status() != 200) ...
+// }
+//
+// {
+//   StageTimer timer("open");
+//   git_repository_open(&repository, path);
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "sink.hpp"
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+class RequestContext
+{
+public:
+  typedef std::vector<std::pair<std::string, std::string>> Fields;
+  typedef std::vector<std::pair<const char*, std::chrono::nanoseconds>>
+    Timings;
+
+  // Makes this the current request of the calling thread until it is
+  // destroyed. The target is the path and optionally a query string.
+  RequestContext(const std::string& target, OutputSink* output);
+  ~RequestContext();
+
+  // Returns the request that is being handled by the calling thread.
+  static RequestContext& Current();
+
+  // The path of the target with the query string removed and the escaped
+  // characters decoded. Empty segments are removed, as the Router skips them,
+  // so the path is the same however many slashes separate the segments.
+  const std::string& Path() const { return myPath; }
+
+  // Returns the value of the query parameter with the given name or null if
+  // there was no such parameter.
+  const std::string* Query(const char* name) const;
+
+  // The names and values of all the query parameters, in the order given.
+  const Fields& QueryParameters() const { return myQuery; }
+
+  // Returns the value of the request header with the given name or null if
+  // there was no such header. The names are not case-sensitive.
+  const std::string* Header(const char* name) const;
+  void AddHeader(const std::string& name, const std::string& value);
+
+  // Where the response body should be written to.
+  OutputSink& Output() const { return *myOutput; }
+
+  // Changes where the rest of the response body is written to.
+  void Output(OutputSink* output) { myOutput = output; }
+
+  // The HTTP status code of the response, which is 200 unless Error() has
+  // been called.
+  int Status() const { return myStatus; }
+
+  // Sets the status for a response which is not an error, such as 304 when
+  // the client already has the response.
+  void Status(int status) { myStatus = status; }
+
+  // Records that the request failed with the given HTTP status code. The
+  // message is written to standard error.
+  void Error(int status, const std::string& message);
+  const std::string& ErrorMessage() const { return myErrorMessage; }
+
+  // The media type of the response body.
+  const std::string& ContentType() const { return myContentType; }
+  void ContentType(const std::string& type) { myContentType = type; }
+
+  // The content coding the response body is compressed with, such as gzip,
+  // or an empty string if it is not compressed.
+  const std::string& ContentEncoding() const { return myContentEncoding; }
+  void ContentEncoding(const std::string& encoding)
+  {
+    myContentEncoding = encoding;
+  }
+
+  // Headers to add to the response, in addition to the Content-Type.
+  const Fields& ResponseHeaders() const { return myResponseHeaders; }
+  void AddResponseHeader(const std::string& name, const std::string& value);
+
+  // The time spent in each stage of handling the request, in the order they
+  // were first timed. A stage timed more than once has the total.
+  const Timings& StageTimings() const { return myTimings; }
+
+  // Adds the duration to the stage with the given name, which must be a
+  // string literal as it is kept without being copied.
+  void AddTiming(const char* stage, std::chrono::nanoseconds duration);
+
+  // The time spent in all the stages so far.
+  std::chrono::nanoseconds TimedTotal() const;
+
+  // The time since the request was created.
+  std::chrono::nanoseconds Elapsed() const
+  {
+    return std::chrono::steady_clock::now() - myStart;
+  }
+
+private:
+  RequestContext(const RequestContext&); /* = delete; */
+  RequestContext& operator =(const RequestContext&); /* = delete; */
+
+  std::string myPath;
+  Fields myQuery;
+  Fields myHeaders;
+  OutputSink* myOutput;
+  int myStatus;
+  std::string myErrorMessage;
+  std::string myContentType;
+  std::string myContentEncoding;
+  Fields myResponseHeaders;
+  Timings myTimings;
+  std::chrono::steady_clock::time_point myStart;
+
+  // The request that was current when this one was created, if any.
+  RequestContext* myPrevious;
+};
+
+// Adds the time from when it is created to when it is destroyed to a stage of
+// the current request. Nothing is recorded when there isn't a request, such
+// as on the threads of the ThreadPool.
+class StageTimer
+{
+public:
+  // The stage must be a string literal.
+  explicit StageTimer(const char* stage);
+  ~StageTimer();
+
+private:
+  StageTimer(const StageTimer&); /* = delete; */
+  StageTimer& operator =(const StageTimer&); /* = delete; */
+
+  RequestContext* myRequest;
+  const char* myStage;
+  std::chrono::steady_clock::time_point myStart;
+};
+
+//===--------------------------- End of the file --------------------------===//
+#endif
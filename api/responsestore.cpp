@@ -0,0 +1,118 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : ResponseStore
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "responsestore.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+static ResponseStore* currentStore = nullptr;
+
+ResponseStore::ResponseStore(const std::string& directory,
+                             std::uint64_t capacity)
+: myResponses(directory, capacity),
+  myCapacity(capacity),
+  myPrevious(currentStore)
+{
+  currentStore = this;
+}
+
+ResponseStore::~ResponseStore()
+{
+  currentStore = myPrevious;
+}
+
+ResponseStore* ResponseStore::Current()
+{
+  return currentStore;
+}
+
+bool ResponseStore::Write(const std::string& key, OutputSink* output)
+{
+  const int descriptor = myResponses.Open(key);
+  if (descriptor == -1) return false;
+
+#ifndef _WIN32
+  struct stat status;
+  const bool isFound = fstat(descriptor, &status) == 0;
+  if (isFound)
+  {
+    output->WriteFile(descriptor, 0,
+                      static_cast<std::uint64_t>(status.st_size));
+  }
+  close(descriptor);
+  return isFound;
+#else
+  _close(descriptor);
+  return false;
+#endif
+}
+
+ResponseStore::Recorder::Recorder(ResponseStore& store,
+                                  const std::string& key,
+                                  OutputSink* output)
+: myOutput(*output),
+  myCopy(store.myResponses, key),
+  myLimit(store.myCapacity / 16),
+  isCopying(myCopy.IsOpen()),
+  myStorage(64 * 1024)
+{
+  myBegin = myCursor = myStorage.data();
+  myEnd = myBegin + myStorage.size();
+}
+
+void ResponseStore::Recorder::Flush()
+{
+  Drain(nullptr, 0);
+  myOutput.Flush();
+}
+
+void ResponseStore::Recorder::Commit()
+{
+  Flush();
+  if (!isCopying) return;
+
+  const int descriptor = myCopy.Commit();
+#ifdef _WIN32
+  if (descriptor != -1) _close(descriptor);
+#else
+  if (descriptor != -1) close(descriptor);
+#endif
+}
+
+void ResponseStore::Recorder::Overflow(const char* data, std::size_t size)
+{
+  Drain(data, size);
+}
+
+void ResponseStore::Recorder::Drain(const char* data, std::size_t size)
+{
+  const std::size_t bufferedSize = static_cast<std::size_t>(myCursor - myBegin);
+  myCursor = myBegin;
+
+  myOutput.Write(myBegin, bufferedSize);
+  if (size > 0) myOutput.Write(data, size);
+
+  if (isCopying && myCopy.Size() + bufferedSize + size > myLimit)
+  {
+    isCopying = false;
+  }
+
+  if (isCopying)
+  {
+    isCopying = myCopy.Write(myBegin, bufferedSize) &&
+      (size == 0 || myCopy.Write(data, size));
+  }
+}
+
+//===--------------------------- End of the file --------------------------===//
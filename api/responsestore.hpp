@@ -0,0 +1,95 @@
+#ifndef RESPONSE_STORE_HPP_
+#define RESPONSE_STORE_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : ResponseStore
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Keeps the responses which can never change, such as those for an object
+// given by its SHA, in a FileCache so the next request for them can be served
+// from the file rather than reading the objects and generating the JSON
+// again.
+//
+// The files are shared by every gitjson process using the same directory, so
+// this also helps when a process is started for each request.
+//
+// Usage:
+// {
+//   ResponseStore store("/var/cache/gitjson/responses", 1 << 28);
+//   ...
+//   if (!store.Write(key, &output))
+//   {
+//     ResponseStore::Recorder recorder(store, key, &output);
+//     generate_response(&recorder);
+//     recorder.Commit();
+//   }
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "filecache.hpp"
+#include "sink.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ResponseStore
+{
+public:
+  // Makes this the current instance until it is destroyed.
+  ResponseStore(const std::string& directory, std::uint64_t capacity);
+  ~ResponseStore();
+
+  // Returns the instance in use or null if there is none.
+  static ResponseStore* Current();
+
+  // Writes the stored response with the given key to the output.
+  //
+  // Returns false if there is no such response.
+  bool Write(const std::string& key, OutputSink* output);
+
+  // Passes what is written to it on to the output, keeping a copy which is
+  // stored as the response with the given key when it is committed.
+  //
+  // Responses larger than a sixteenth of the capacity are not kept.
+  class Recorder : public OutputSink
+  {
+  public:
+    Recorder(ResponseStore& store, const std::string& key,
+             OutputSink* output);
+
+    void Flush() override;
+
+    // Passes on what has been written and stores the response.
+    void Commit();
+
+  protected:
+    void Overflow(const char* data, std::size_t size) override;
+
+  private:
+    // Writes out the buffer followed by the given data.
+    void Drain(const char* data, std::size_t size);
+
+    OutputSink& myOutput;
+    FileCache::NewFile myCopy;
+    std::uint64_t myLimit;
+    bool isCopying;
+    std::vector<char> myStorage;
+  };
+
+private:
+  ResponseStore(const ResponseStore&); /* = delete; */
+  ResponseStore& operator =(const ResponseStore&); /* = delete; */
+
+  FileCache myResponses;
+  std::uint64_t myCapacity;
+
+  // The instance that was current when this one was created, if any.
+  ResponseStore* myPrevious;
+};
+
+//===--------------------------- End of the file --------------------------===//
+#endif
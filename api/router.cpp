@@ -8,9 +8,9 @@
 
 #include "router.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
-#include <sstream>
 #include <map>
 #include <vector>
 
@@ -22,56 +22,130 @@ Router & Router::operator [](const char* term)
   return route.first->second;
 }
 
-bool Router::operator()(const char* path, char token) const
+void Router::Compile()
 {
-  std::vector<std::string> terms;
+  myTable = Table();
+  myTable.nodes.emplace_back();
+  Compile(&myTable, 0);
+}
+
+void Router::Compile(Table* table, std::size_t index) const
+{
+  // The nodes are added as the routes are visited, so the node is only
+  // referred to by its index.
+  table->nodes[index].function =
+    isSelfTakingArguments ? nullptr : mySelfFunction;
+  table->nodes[index].selfPlaceholderFunction =
+    isSelfTakingArguments ? myPlaceholderSelfFunction : nullptr;
+  table->nodes[index].placeholderFunction = myPlaceholderFunction;
+  table->nodes[index].isSunkingUpAllRemainingTerms =
+    isSunkingUpAllRemainingTerms;
+
+  // The edges of a node are kept together, so they are all added before any
+  // of the routes after them. They are already sorted as they come from a
+  // map.
+  const std::size_t firstEdge = table->edges.size();
+  table->nodes[index].firstEdge = static_cast<std::uint32_t>(firstEdge);
+  table->nodes[index].edgeCount = static_cast<std::uint32_t>(myRoutes.size());
+  table->edges.resize(firstEdge + myRoutes.size());
+
+  std::size_t edge = firstEdge;
+  for (auto route = std::begin(myRoutes); route != std::end(myRoutes);
+       ++route, ++edge)
   {
-    std::istringstream iss(path);
-    std::string term;
-    while (std::getline(iss, term, token))
+    table->edges[edge].termOffset =
+      static_cast<std::uint32_t>(table->terms.size());
+    table->edges[edge].termLength =
+      static_cast<std::uint32_t>(route->first.size());
+    table->edges[edge].node = static_cast<std::uint32_t>(table->nodes.size());
+    table->terms += route->first;
+
+    table->nodes.emplace_back();
+    route->second.Compile(table, table->edges[edge].node);
+  }
+}
+
+bool Router::operator()(std::string_view path, char token) const
+{
+  std::string_view terms[maximumTerms];
+  std::size_t count = 0;
+
+  for (std::size_t start = 0; start < path.size();)
+  {
+    std::size_t end = path.find(token, start);
+    if (end == std::string_view::npos) end = path.size();
+
+    if (end > start)
     {
-      if (term.empty()) continue;
-      terms.push_back(term);
+      if (count == maximumTerms) return false;
+      terms[count++] = path.substr(start, end - start);
     }
+    start = end + 1;
   }
 
-  return (*this)(terms);
+  return (*this)(terms, count);
 }
 
-bool Router::operator()(const std::vector<std::string>& terms) const
+bool Router::operator()(const std::string_view* terms, std::size_t count) const
 {
-  std::vector<std::string> placeholders;
+  if (!myTable.nodes.empty()) return Route(myTable, terms, count);
+
+  Table table;
+  table.nodes.emplace_back();
+  Compile(&table, 0);
+  return Route(table, terms, count);
+}
+
+bool Router::Route(const Table& table, const std::string_view* terms,
+                   std::size_t count)
+{
+  std::string_view placeholders[maximumTerms];
+  std::size_t placeholderCount = 0;
 
   // True if the last term is a place holder.
   bool lastTermIsPlaceholder = false;
-  const Router* router = this;
-  for (auto term = std::begin(terms); term != std::end(terms); ++term)
+  const Node* node = &table.nodes.front();
+  for (std::size_t term = 0; term < count; ++term)
   {
-    // The current router takes an place-holder, so the "term" could be
+    // The current node takes an place-holder, so the "term" could be
     // anything.
-    if (router->myPlaceholderFunction)
+    if (node->placeholderFunction)
     {
-      placeholders.push_back(*term);
+      placeholders[placeholderCount++] = terms[term];
       ++term;
 
       // The last term was just a place-holder so stop.
-      if (term == std::end(terms))
+      if (term == count)
       {
         lastTermIsPlaceholder = true;
         break;
       }
-      else if (router->isSunkingUpAllRemainingTerms)
+      else if (node->isSunkingUpAllRemainingTerms)
       {
-        placeholders.insert(placeholders.end(), term, std::end(terms));
+        std::copy(terms + term, terms + count,
+                  placeholders + placeholderCount);
+        placeholderCount += count - term;
         lastTermIsPlaceholder = true;
         break;
       }
 
-      // Fall through, as the term shold be looked up in myRoutes now.
+      // Fall through, as the term shold be looked up in the edges now.
     }
 
-    const auto result = router->myRoutes.find(*term);
-    if (result == router->myRoutes.end())
+    const Edge* first = table.edges.data() + node->firstEdge;
+    const Edge* last = first + node->edgeCount;
+    const std::string_view name = terms[term];
+    const Edge* edge = std::lower_bound(
+      first, last, name,
+      [&table](const Edge& edge, const std::string_view& name)
+      {
+        return std::string_view(table.terms.data() + edge.termOffset,
+                                edge.termLength) < name;
+      });
+
+    if (edge == last ||
+        std::string_view(table.terms.data() + edge->termOffset,
+                         edge->termLength) != name)
     {
       // This probably needs to test if its another place-holder in support of
       // allowing two of them in a row.
@@ -79,25 +153,24 @@ bool Router::operator()(const std::vector<std::string>& terms) const
       // TODO: Throw an "unknown_route_exception".
       return false;
     }
-    else
-    {
-      router = &result->second;
-    }
+
+    node = &table.nodes[edge->node];
   }
 
-  if (placeholders.empty() && router->mySelfFunction)
+  const Arguments arguments(placeholders, placeholderCount);
+  if (lastTermIsPlaceholder)
   {
-    router->mySelfFunction();
+    node->placeholderFunction(arguments);
     return true;
   }
-  else if (lastTermIsPlaceholder && router->myPlaceholderFunction)
+  else if (placeholderCount == 0 && node->function)
   {
-    router->myPlaceholderFunction(placeholders);
+    node->function();
     return true;
   }
-  else if (router->myPlaceholderSelfFunction)
+  else if (node->selfPlaceholderFunction)
   {
-    router->myPlaceholderSelfFunction(placeholders);
+    node->selfPlaceholderFunction(arguments);
     return true;
   }
   else
@@ -121,6 +194,7 @@ RouterWithPlaceholder Router::operator [](placeholder_remaining_t)
 Router & Router::operator =(CallFunction function)
 {
   mySelfFunction = function;
+  isSelfTakingArguments = false;
   return *this;
 }
 
@@ -134,6 +208,7 @@ RouterWithPlaceholder::operator =(Router::CallPlaceholderFunction function)
   else
   {
     myRouter.myPlaceholderSelfFunction = function;
+    myRouter.isSelfTakingArguments = true;
   }
 
   myRouter.isSunkingUpAllRemainingTerms = isSunkingUpAllRemainingPlaceholders;
@@ -143,26 +218,117 @@ RouterWithPlaceholder::operator =(Router::CallPlaceholderFunction function)
 
 #ifdef ROUTER_ENABLE_TESTING
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef _MSC_VER
+#define __FUNCSIG__ __PRETTY_FUNCTION__
+#endif
+
+// Counts the allocations made, to check that routing doesn't make any.
+static std::atomic<std::size_t> allocationCount(0);
+
+void* operator new(std::size_t size)
+{
+  ++allocationCount;
+  if (void* memory = std::malloc(size ? size : 1)) return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+  std::free(memory);
+}
+
 void api_information() { puts(__FUNCSIG__); }
 void repositories_list() { puts(__FUNCSIG__); }
-void repository_information(const std::vector<std::string>& arguments)
+void repository_information(const Router::Arguments& arguments)
 {
   std::cout << "repository_information for \""  << arguments[0] << '"'
             << std::endl;
 }
 
-void repository_tags(const std::vector<std::string>& arguments)
+void repository_tags(const Router::Arguments& arguments)
 { puts(__FUNCSIG__); }
 
-void repository_branches(const std::vector<std::string>& arguments)
+void repository_branches(const Router::Arguments& arguments)
 { puts(__FUNCSIG__); }
 
-void repository_tag(const std::vector<std::string>& arguments)
+void repository_tag(const Router::Arguments& arguments)
 {
   std::cout << "tag \"" << arguments[1] << "\" for \""  << arguments[0] << '"'
             << std::endl;
 }
 
+static std::size_t benchmarkCalls = 0;
+static void count_call() { ++benchmarkCalls; }
+static void count_call_with(const Router::Arguments& arguments)
+{
+  benchmarkCalls += arguments.size();
+}
+
+// Measures how long it takes to route the paths of a typical set of
+// requests, which is reported per path routed.
+static void benchmark()
+{
+  Router router;
+  router["api"] = count_call;
+  router["api"]["repos"] = count_call;
+  router["api"]["repos"][Router::placeholder] = count_call_with;
+  router["api"]["repos"][Router::placeholder]["refs"] = count_call_with;
+  router["api"]["repos"][Router::placeholder]["refs"][
+    Router::placeholder_remaining] = count_call_with;
+  router["api"]["repos"][Router::placeholder]["branches"] = count_call_with;
+  router["api"]["repos"][Router::placeholder]["branches"][Router::placeholder] =
+    count_call_with;
+  router["api"]["repos"][Router::placeholder]["tags"] = count_call_with;
+  router["api"]["repos"][Router::placeholder]["tags"][Router::placeholder] =
+    count_call_with;
+  router["api"]["repos"][Router::placeholder]["commits"] = count_call_with;
+  router["api"]["repos"][Router::placeholder]["commits"][Router::placeholder] =
+    count_call_with;
+  router["api"]["repos"][Router::placeholder]["trees"][Router::placeholder] =
+    count_call_with;
+  router["api"]["repos"][Router::placeholder]["file"][Router::placeholder] =
+    count_call_with;
+  router.Compile();
+
+  const char* paths[] = {
+    "/api/repos",
+    "/api/repos/gitweb",
+    "/api/repos/gitweb/refs/heads/master",
+    "/api/repos/gitweb/branches/master",
+    "/api/repos/gitweb/commits",
+    "/api/repos/gitweb/commits/7f4837766f5bf8bd1d008ac38470a53f34b4f910",
+    "/api/repos/gitweb/trees/7f4837766f5bf8bd1d008ac38470a53f34b4f910",
+    "/api/repos/gitweb/unknown/path",
+  };
+  const std::size_t pathCount = sizeof(paths) / sizeof(paths[0]);
+  const std::size_t iterations = 1000000;
+
+  const std::size_t allocationsBefore = allocationCount;
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    router(paths[i % pathCount]);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  const std::size_t allocations = allocationCount - allocationsBefore;
+
+  std::printf(
+    "route: %.1f ns/op, %.3f allocs/op (%zu calls)\n",
+    std::chrono::duration<double, std::nano>(elapsed).count() / iterations,
+    static_cast<double>(allocations) / iterations, benchmarkCalls);
+}
+
 int main()
 {
   Router router;
@@ -178,18 +344,18 @@ int main()
   // TODO: Support setting up an alias.
   // router["api"]["repositories"] = router["api"]["repos"];
 
+  router.Compile();
+
   // This needs working...
   router("api");
 
   // TODO: varadic arguments would be nice to support router("api", "repos")
-  std::vector<std::string> arguments;
-  arguments.push_back("api");
-  arguments.push_back("repos");
-  arguments.push_back("anything");
-  arguments.push_back("tags");
-  arguments.push_back("something");
-  router(arguments);
+  const std::string_view arguments[] = {
+    "api", "repos", "anything", "tags", "something"
+  };
+  router(arguments, 5);
 
+  benchmark();
   return 0;
 }
 #endif
@@ -18,6 +18,7 @@
 //   Router router;
 //   router["api"]["books"] = list_books
 //   router["api"]["books"][Router::placeholder] = about_book
+//   router.Compile();
 //
 // Concepts:
 //   The placeholder is used where you want to allow any string to be used and
@@ -25,23 +26,60 @@
 //
 //   In the example above, "placeholder" would be the name of the book.
 //
-//   Once a placeholder is used, the callback function accepts a std::vector of
-//   std::string.
+//   Once a placeholder is used, the callback function accepts the
+//   Router::Arguments, which are views of the placeholders in the path.
+//
+//   Once all the routes are added, Compile() flattens them into a table that
+//   paths are looked up in without allocating any memory. The views passed to
+//   the functions refer to the path, so are only valid during the call.
 //
 //===----------------------------------------------------------------------===//
 
-#include <string>
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <string>
+#include <string_view>
 #include <vector>
 
 class RouterWithPlaceholder;
 class Router
 {
 public:
+  // The placeholders from the path.
+  class Arguments
+  {
+  public:
+    Arguments(const std::string_view* terms, std::size_t count)
+      : myTerms(terms), myCount(count) {}
+
+    std::size_t size() const { return myCount; }
+    bool empty() const { return myCount == 0; }
+
+    const std::string_view& operator [](std::size_t index) const
+    {
+      return myTerms[index];
+    }
+    const std::string_view& front() const { return myTerms[0]; }
+    const std::string_view& back() const { return myTerms[myCount - 1]; }
+
+    const std::string_view* begin() const { return myTerms; }
+    const std::string_view* end() const { return myTerms + myCount; }
+
+  private:
+    const std::string_view* myTerms;
+    std::size_t myCount;
+  };
+
   typedef void (* CallFunction)(void);
-  typedef void (* CallPlaceholderFunction)(const std::vector<std::string>&);
+  typedef void (* CallPlaceholderFunction)(const Arguments&);
+
+  // The most terms in a path which can be routed, longer paths are never
+  // matched.
+  static const std::size_t maximumTerms = 32;
 
   Router() : mySelfFunction(nullptr), myPlaceholderFunction(nullptr),
+             isSelfTakingArguments(false),
              isSunkingUpAllRemainingTerms(false) {}
 
   // Used to indicate that this route takes a placeholder and passes it to the
@@ -60,16 +98,60 @@ public:
   RouterWithPlaceholder operator [](placeholder_t);
   RouterWithPlaceholder operator [](placeholder_remaining_t);
 
+  // Builds the table used for routing from the routes added so far. The
+  // routes must not be changed afterwards without compiling them again.
+  //
+  // Routing is still possible without this, but the table is then built for
+  // each path.
+  void Compile();
+
   // Methods for invoking the functions. Returns false is no route is present.
   //
   // The first will tokenise the given path into terms.
   // The second asumes it has already been broken up into terms.
-  bool operator()(const char* path, char token = '/') const;
-  bool operator()(const std::vector<std::string>& terms) const;
+  bool operator()(std::string_view path, char token = '/') const;
+  bool operator()(const std::string_view* terms, std::size_t count) const;
 
 private:
   friend class RouterWithPlaceholder;
 
+  struct Node
+  {
+    CallFunction function;
+    CallPlaceholderFunction selfPlaceholderFunction;
+    CallPlaceholderFunction placeholderFunction;
+    bool isSunkingUpAllRemainingTerms;
+
+    // The range of myEdges for the terms that follow this one.
+    std::uint32_t firstEdge;
+    std::uint32_t edgeCount;
+  };
+
+  struct Edge
+  {
+    // Where the term is in myTerms.
+    std::uint32_t termOffset;
+    std::uint32_t termLength;
+
+    std::uint32_t node;
+  };
+
+  // The compiled routes. The edges of each node are sorted by their term, so
+  // they can be binary searched.
+  struct Table
+  {
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+    std::string terms;
+  };
+
+  // Adds the routes from this router to the table as the node with the given
+  // index, which has already been added.
+  void Compile(Table* table, std::size_t index) const;
+
+  static bool Route(const Table& table, const std::string_view* terms,
+                    std::size_t count);
+
   // The function to call
   union
   {
@@ -81,9 +163,14 @@ private:
   // anything) value.
   CallPlaceholderFunction myPlaceholderFunction;
 
+  // True if the function to call is myPlaceholderSelfFunction.
+  bool isSelfTakingArguments;
+
   bool isSunkingUpAllRemainingTerms;
 
   std::map<std::string, Router> myRoutes;
+
+  Table myTable;
 };
 
 class RouterWithPlaceholder
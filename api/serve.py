@@ -14,12 +14,21 @@ import os
 import subprocess
 import sys
 import tempfile
+import threading
+import time
 try:
   from BaseHTTPServer import HTTPServer
   from SimpleHTTPServer import SimpleHTTPRequestHandler
+  from SocketServer import ThreadingMixIn
 except ModuleNotFoundError:
   from http.server import BaseHTTPRequestHandler as SimpleHTTPRequestHandler
   from http.server import HTTPServer
+  from socketserver import ThreadingMixIn
+
+
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+  """Handles each request on its own thread."""
+  daemon_threads = True
 
 
 class Forwarder(SimpleHTTPRequestHandler):
@@ -41,7 +50,10 @@ class Forwarder(SimpleHTTPRequestHandler):
       else:
         queries = {}
 
+    started = time.time()
+    self.serverTiming = ''
     stdout, stderr = self.execute(self.path)
+    elapsed = (time.time() - started) * 1000
     response = stderr if stderr else stdout
 
     if isinstance(response, tuple):
@@ -62,6 +74,14 @@ class Forwarder(SimpleHTTPRequestHandler):
       self.send_header("Content-type", "application/json; charset=utf-8")
 
     self.send_header("Content-length", contentLength)
+
+    # The stages timed by gitjson, when it gives them, and the time taken to
+    # get the response from it (forward), which includes the pipe and the
+    # starting of the process, if it is started for each request.
+    timing = 'forward;dur=%.3f' % elapsed
+    if self.serverTiming:
+      timing = self.serverTiming + ', ' + timing
+    self.send_header("Server-Timing", timing)
     self.end_headers()
     if isinstance(response, list):
       for element in response:
@@ -75,31 +95,113 @@ class GitRunner(Forwarder):
 
   The intention is to elimiate the overhead of having to start a process and
   set-up gitjson each time a request is made.
+
+  The requests are tagged with an id and sent to the process as they arrive,
+  which handles them in parallel and answers each one, by its id, when it is
+  done, so a slow request doesn't hold up the ones after it.
   """
 
   gitjsonexe = r'build\Release_x64\gitjson.exe'
 
   gitjsonprocess = None
 
+  lock = threading.Lock()
+  nextId = 0
+
+  # The requests waiting for a response, by id, each with an event to signal
+  # when the response has been read and where to put it.
+  pending = {}
+
+  # How long to wait for a response, in seconds, before giving up on it.
+  timeout = 300
+
   def execute(self, path):
     """Executes the git json executable and returns the results."""
 
-    # Spawn the process if it wasn't started already.
-    process = self.process()
+    waiting = [threading.Event(), None]
+    with GitRunner.lock:
+      # Spawn the process if it wasn't started already.
+      process = self.process()
+      if not process:
+        return '', 'Error: gitjson could not be started.'
 
-    # Send the command
-    process.stdin.write(path + '\n')
+      GitRunner.nextId += 1
+      requestId = str(GitRunner.nextId)
+      GitRunner.pending[requestId] = waiting
 
-    # Read the output
-    length = 0
-    lines = []
-    line = process.stdout.readline()
-    while line and not line.startswith(chr(4)):
-      lines.append(line)
-      length += len(line)
-      line = process.stdout.readline()
+      # Send the command
+      try:
+        process.stdin.write(('%s %s\n' % (requestId, path)).encode('utf-8'))
+        process.stdin.flush()
+      except EnvironmentError:
+        # The process has exited, which the reader will notice and answer
+        # every request waiting on it, including this one.
+        pass
+
+    if not waiting[0].wait(GitRunner.timeout):
+      with GitRunner.lock:
+        GitRunner.pending.pop(requestId, None)
+      return '', 'Error: gitjson did not respond in time.'
+
+    status, body, self.serverTiming = waiting[1]
+    if status >= 400:
+      return '', body.decode('utf-8', 'replace')
+    return ([body], len(body)), ''
+
+  @staticmethod
+  def read_responses(process):
+    """Reads the responses and hands each one to the request waiting for it.
+
+    Each is a line with the id, status and length of the body, then the
+    headers, a blank line and the body.
+
+    When the process exits, every request still waiting is answered with an
+    error and the next request starts a new process.
+    """
+    stdout = process.stdout
+    while True:
+      line = stdout.readline()
+      if not line:
+        break
 
-    return (lines, length), ''
+      try:
+        requestId, status, length = line.decode('utf-8').split()
+        status, length = int(status), int(length)
+      except ValueError:
+        print('error: unexpected output from gitjson: ', line)
+        break
+
+      timing = ''
+      header = stdout.readline().strip()
+      while header:
+        name, _, value = header.decode('utf-8').partition(':')
+        if name.lower() == 'server-timing':
+          timing = value.strip()
+        header = stdout.readline().strip()
+      body = stdout.read(length)
+      if len(body) < length:
+        break
+
+      with GitRunner.lock:
+        waiting = GitRunner.pending.pop(requestId, None)
+      if waiting:
+        waiting[1] = (status, body, timing)
+        waiting[0].set()
+
+    # Nothing more can be read from it, so it is stopped if it is still going.
+    try:
+      process.kill()
+    except EnvironmentError:
+      pass
+
+    with GitRunner.lock:
+      if GitRunner.gitjsonprocess is process:
+        GitRunner.gitjsonprocess = None
+      abandoned = list(GitRunner.pending.values())
+      GitRunner.pending.clear()
+    for waiting in abandoned:
+      waiting[1] = (500, b'Error: gitjson exited.', '')
+      waiting[0].set()
 
   def process(self):
     """
@@ -116,7 +218,7 @@ class GitRunner(Forwarder):
       stderr = tempfile.TemporaryFile(mode="w+t")
       try:
         GitRunner.gitjsonprocess = subprocess.Popen(
-          args=[self.gitjsonexe, '-'],
+          args=[self.gitjsonexe, '--framed'],
           executable=self.gitjsonexe,
           env=env,
           stdin=subprocess.PIPE,
@@ -128,6 +230,11 @@ class GitRunner(Forwarder):
         print('error: invoking process: ', e)
         return None
 
+      reader = threading.Thread(target=GitRunner.read_responses,
+                                args=(GitRunner.gitjsonprocess,))
+      reader.daemon = True
+      reader.start()
+
     return GitRunner.gitjsonprocess
 
 class GitForwarder(Forwarder):
@@ -177,13 +284,14 @@ if __name__ == '__main__':
       port = 7723
   server_address = ('', port)
 
-  # At the moment there is very little benefit of reusing the process as all
-  # it saves is the process creation and setting up of routes. The git repo
-  # is closed after it response to each request so its in-memory caches etc
-  # are cleared.
+  # Reusing the process saves the process creation and setting up of routes,
+  # and gitjson keeps the most recently used repositories open between
+  # requests so their in-memory caches (objects, pack indexes etc) stay warm.
+  # The requests are handled on their own threads so they can be passed on to
+  # it while others are still being answered.
   reuseProcess = False
   if reuseProcess:
-    httpd = HTTPServer(server_address, GitRunner)
+    httpd = ThreadingHTTPServer(server_address, GitRunner)
   else:
     httpd = HTTPServer(server_address, GitForwarder)
 
@@ -0,0 +1,133 @@
+#ifndef SIMD_HPP_
+#define SIMD_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : simd
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Detects which vector instructions the processor supports, so the fastest
+// version of a function can be chosen when the program is run rather than
+// when it is compiled.
+//
+// Usage:
+//   SIMD_TARGET("avx2") void encode_avx2(...);
+//   if (simd::HasAvx2()) encode_avx2(...); else encode(...);
+//
+// SIMD_X86 is defined when compiling for x86 or x86-64, otherwise only the
+// scalar versions are available and the functions below return false.
+//
+//===----------------------------------------------------------------------===//
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#define SIMD_TARGET(name) __attribute__((target(name)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SIMD_X86 1
+#define SIMD_TARGET(name)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace simd
+{
+  // Returns true if the processor supports SSE2.
+  bool HasSse2();
+
+  // Returns true if the processor supports SSSE3 (pshufb).
+  bool HasSsse3();
+
+  // Returns true if the processor and operating system support AVX2.
+  bool HasAvx2();
+}
+
+#ifdef SIMD_X86
+
+inline bool simd::HasSse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  // It is part of the x86-64 instruction set.
+  return true;
+#elif defined(__GNUC__)
+  static const bool isSupported = __builtin_cpu_supports("sse2");
+  return isSupported;
+#else
+  static const bool isSupported = []
+  {
+    int registers[4];
+    __cpuid(registers, 1);
+    return (registers[3] & (1 << 26)) != 0;
+  }();
+  return isSupported;
+#endif
+}
+
+namespace simd
+{
+  // Returns the index of the lowest bit that is set in the mask, which must
+  // not be zero. This is for finding the first match in the result of a
+  // movemask.
+  unsigned int LowestSetBit(unsigned int mask);
+}
+
+inline unsigned int simd::LowestSetBit(unsigned int mask)
+{
+#if defined(__GNUC__)
+  return static_cast<unsigned int>(__builtin_ctz(mask));
+#else
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned int>(index);
+#endif
+}
+
+inline bool simd::HasSsse3()
+{
+#if defined(__GNUC__)
+  static const bool isSupported = __builtin_cpu_supports("ssse3");
+#else
+  static const bool isSupported = []
+  {
+    int registers[4];
+    __cpuid(registers, 1);
+    return (registers[2] & (1 << 9)) != 0;
+  }();
+#endif
+  return isSupported;
+}
+
+inline bool simd::HasAvx2()
+{
+#if defined(__GNUC__)
+  static const bool isSupported = __builtin_cpu_supports("avx2");
+#else
+  static const bool isSupported = []
+  {
+    int registers[4];
+    __cpuid(registers, 1);
+    const bool hasOsxsave = (registers[2] & (1 << 27)) != 0;
+    const bool hasAvx = (registers[2] & (1 << 28)) != 0;
+    if (!hasOsxsave || !hasAvx) return false;
+
+    // The operating system must save the YMM registers.
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(registers, 7, 0);
+    return (registers[1] & (1 << 5)) != 0;
+  }();
+#endif
+  return isSupported;
+}
+
+#else
+
+inline bool simd::HasSse2() { return false; }
+inline bool simd::HasSsse3() { return false; }
+inline bool simd::HasAvx2() { return false; }
+
+#endif
+
+//===--------------------------- End of the file --------------------------===//
+#endif
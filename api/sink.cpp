@@ -0,0 +1,278 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : OutputSink
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "sink.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+void OutputSink::WriteInteger(std::uint64_t value)
+{
+  char digits[20];
+  char* first = digits + sizeof(digits);
+  do
+  {
+    *--first = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }
+  while (value != 0);
+
+  Write(first, static_cast<std::size_t>(digits + sizeof(digits) - first));
+}
+
+void OutputSink::WriteInteger(std::int64_t value)
+{
+  if (value < 0)
+  {
+    Put('-');
+    // Negate as unsigned so the most negative value doesn't overflow.
+    WriteInteger(~static_cast<std::uint64_t>(value) + 1);
+  }
+  else
+  {
+    WriteInteger(static_cast<std::uint64_t>(value));
+  }
+}
+
+void OutputSink::WriteFile(int descriptor, std::uint64_t offset,
+                           std::uint64_t size)
+{
+  char chunk[64 * 1024];
+  while (size > 0)
+  {
+    const std::size_t wanted = static_cast<std::size_t>(
+      std::min<std::uint64_t>(size, sizeof(chunk)));
+#ifdef _WIN32
+    if (_lseeki64(descriptor, static_cast<__int64>(offset), SEEK_SET) == -1)
+    {
+      return;
+    }
+    const int count = _read(descriptor, chunk,
+                            static_cast<unsigned int>(wanted));
+#else
+    const ssize_t count = pread(descriptor, chunk, wanted,
+                                static_cast<off_t>(offset));
+    if (count < 0 && errno == EINTR) continue;
+#endif
+    if (count <= 0) return;
+
+    Write(chunk, static_cast<std::size_t>(count));
+    offset += static_cast<std::uint64_t>(count);
+    size -= static_cast<std::uint64_t>(count);
+  }
+}
+
+BufferSink::BufferSink()
+{
+  myStorage.resize(4096);
+  myBegin = myCursor = &myStorage[0];
+  myEnd = myBegin + myStorage.size();
+}
+
+std::string BufferSink::Take()
+{
+  myStorage.resize(Size());
+  std::string contents;
+  contents.swap(myStorage);
+
+  myStorage.resize(4096);
+  myBegin = myCursor = &myStorage[0];
+  myEnd = myBegin + myStorage.size();
+  return contents;
+}
+
+void BufferSink::Overflow(const char* data, std::size_t size)
+{
+  const std::size_t used = Size();
+  std::size_t capacity = myStorage.size() * 2;
+  while (capacity < used + size) capacity *= 2;
+
+  myStorage.resize(capacity);
+  myBegin = &myStorage[0];
+  myCursor = myBegin + used;
+  myEnd = myBegin + capacity;
+
+  std::memcpy(myCursor, data, size);
+  myCursor += size;
+}
+
+DescriptorSink::DescriptorSink(int descriptor, std::size_t highWaterMark)
+: myDescriptor(descriptor),
+  myStorage(new char[highWaterMark])
+{
+  myBegin = myCursor = myStorage;
+  myEnd = myStorage + highWaterMark;
+}
+
+DescriptorSink::~DescriptorSink()
+{
+  Flush();
+  delete [] myStorage;
+}
+
+void DescriptorSink::Flush()
+{
+  Drain(nullptr, 0);
+}
+
+void DescriptorSink::WriteFile(int descriptor, std::uint64_t offset,
+                               std::uint64_t size)
+{
+#ifdef __linux__
+  // What has been written so far must come first.
+  Flush();
+
+  bool isFirst = true;
+  while (size > 0)
+  {
+    off_t position = static_cast<off_t>(offset);
+    const std::size_t wanted = static_cast<std::size_t>(
+      std::min<std::uint64_t>(size, 1 << 30));
+    const ssize_t sent = sendfile(myDescriptor, descriptor, &position,
+                                  wanted);
+    if (sent < 0)
+    {
+      if (errno == EINTR) continue;
+
+      // Older kernels can only send to a socket.
+      if (isFirst && (errno == EINVAL || errno == ENOSYS)) break;
+
+      // The other end has gone away, so there is no one to report it to.
+      return;
+    }
+    if (sent == 0) return;
+
+    isFirst = false;
+    offset += static_cast<std::uint64_t>(sent);
+    size -= static_cast<std::uint64_t>(sent);
+  }
+#endif
+
+  OutputSink::WriteFile(descriptor, offset, size);
+}
+
+void DescriptorSink::Overflow(const char* data, std::size_t size)
+{
+  // Small writes are copied into the now empty buffer, where as large ones
+  // are written out directly rather than copying them.
+  if (size < static_cast<std::size_t>(myEnd - myBegin) / 2)
+  {
+    Drain(nullptr, 0);
+    std::memcpy(myCursor, data, size);
+    myCursor += size;
+  }
+  else
+  {
+    Drain(data, size);
+  }
+}
+
+void DescriptorSink::Drain(const char* data, std::size_t size)
+{
+  const char* buffered = myBegin;
+  std::size_t bufferedSize = static_cast<std::size_t>(myCursor - myBegin);
+  myCursor = myBegin;
+
+#ifdef _WIN32
+  const struct { const char* data; std::size_t size; } parts[] =
+    { { buffered, bufferedSize }, { data, size } };
+  for (int i = 0; i < 2; ++i)
+  {
+    const char* cursor = parts[i].data;
+    std::size_t remaining = parts[i].size;
+    while (remaining > 0)
+    {
+      const int written = _write(myDescriptor, cursor,
+                                 static_cast<unsigned int>(remaining));
+      if (written <= 0) return;
+      cursor += written;
+      remaining -= static_cast<std::size_t>(written);
+    }
+  }
+#else
+  // Write the buffer and the data with a single system call.
+  iovec vectors[2] = {
+    { const_cast<char*>(buffered), bufferedSize },
+    { const_cast<char*>(data), size },
+  };
+  int first = 0;
+  while (first < 2)
+  {
+    if (vectors[first].iov_len == 0)
+    {
+      ++first;
+      continue;
+    }
+
+    const ssize_t written = writev(myDescriptor, vectors + first, 2 - first);
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+
+      // The other end has gone away, so there is no one to report it to.
+      return;
+    }
+
+    std::size_t remaining = static_cast<std::size_t>(written);
+    while (first < 2 && remaining >= vectors[first].iov_len)
+    {
+      remaining -= vectors[first].iov_len;
+      vectors[first].iov_len = 0;
+      ++first;
+    }
+    if (first < 2)
+    {
+      vectors[first].iov_base =
+        static_cast<char*>(vectors[first].iov_base) + remaining;
+      vectors[first].iov_len -= remaining;
+    }
+  }
+#endif
+}
+
+StreamSink::StreamSink(std::ostream* output, std::size_t highWaterMark)
+: myOutput(*output),
+  myStorage(new char[highWaterMark])
+{
+  myBegin = myCursor = myStorage;
+  myEnd = myStorage + highWaterMark;
+}
+
+StreamSink::~StreamSink()
+{
+  Flush();
+  delete [] myStorage;
+}
+
+void StreamSink::Flush()
+{
+  myOutput.write(myBegin, myCursor - myBegin);
+  myOutput.flush();
+  myCursor = myBegin;
+}
+
+void StreamSink::Overflow(const char* data, std::size_t size)
+{
+  myOutput.write(myBegin, myCursor - myBegin);
+  myOutput.write(data, static_cast<std::streamsize>(size));
+  myCursor = myBegin;
+}
+
+//===--------------------------- End of the file --------------------------===//
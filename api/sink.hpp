@@ -0,0 +1,166 @@
+#ifndef SINK_HPP_
+#define SINK_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : OutputSink
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Provides somewhere to write the bytes of a response to, which collects them
+// in a buffer and only passes them on when the buffer fills up (the
+// high-water mark) or when Flush() is called at the end of the response.
+//
+// There are sinks for:
+// - BufferSink - A growable contiguous buffer, which is never passed on.
+// - DescriptorSink - A file descriptor such as standard output, a pipe or a
+//                    socket. Files written to it are copied with sendfile()
+//                    rather than being read into memory.
+// - StreamSink - A std::ostream.
+//
+// Usage:
+// {
+//   DescriptorSink output(1);
+//   output.Write("{\"size\": ");
+//   output.WriteInteger(1024);
+//   output.Write("}\n");
+//   output.Flush();
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+class OutputSink
+{
+public:
+  virtual ~OutputSink() {}
+
+  void Write(const char* data, std::size_t size)
+  {
+    if (size <= static_cast<std::size_t>(myEnd - myCursor))
+    {
+      std::memcpy(myCursor, data, size);
+      myCursor += size;
+    }
+    else
+    {
+      Overflow(data, size);
+    }
+  }
+
+  void Write(const char* text) { Write(text, std::strlen(text)); }
+  void Write(const std::string& text) { Write(text.data(), text.size()); }
+
+  void Put(char character)
+  {
+    if (myCursor == myEnd) Overflow(&character, 1);
+    else *myCursor++ = character;
+  }
+
+  // Writes the value in decimal.
+  void WriteInteger(std::int64_t value);
+  void WriteInteger(std::uint64_t value);
+
+  // Writes size bytes of the file open as descriptor, starting at offset.
+  // This copies the file through the buffer a chunk at a time, sinks which
+  // can do better (such as sending it with sendfile()) override it. The
+  // descriptor is not closed.
+  virtual void WriteFile(int descriptor, std::uint64_t offset,
+                         std::uint64_t size);
+
+  // Passes everything written so far on to the destination.
+  virtual void Flush() = 0;
+
+protected:
+  OutputSink() : myBegin(nullptr), myCursor(nullptr), myEnd(nullptr) {}
+
+  // Called by Write() when there is not enough room left in the buffer for
+  // the data. It must either make room for the data and copy it to the buffer
+  // or pass on both the buffer and the data.
+  virtual void Overflow(const char* data, std::size_t size) = 0;
+
+  // The buffer is [myBegin, myEnd) of which [myBegin, myCursor) is in use.
+  char* myBegin;
+  char* myCursor;
+  char* myEnd;
+
+private:
+  OutputSink(const OutputSink&); /* = delete; */
+  OutputSink& operator =(const OutputSink&); /* = delete; */
+};
+
+// Keeps everything written to it in memory.
+class BufferSink : public OutputSink
+{
+public:
+  BufferSink();
+
+  const char* Data() const { return myBegin; }
+  std::size_t Size() const
+  {
+    return static_cast<std::size_t>(myCursor - myBegin);
+  }
+
+  // Returns what has been written and empties the buffer.
+  std::string Take();
+
+  // Throws away what has been written.
+  void Clear() { myCursor = myBegin; }
+
+  void Flush() override {}
+
+protected:
+  void Overflow(const char* data, std::size_t size) override;
+
+private:
+  std::string myStorage;
+};
+
+// Writes to a file descriptor, which may be a file, pipe or socket.
+class DescriptorSink : public OutputSink
+{
+public:
+  DescriptorSink(int descriptor, std::size_t highWaterMark = 64 * 1024);
+  ~DescriptorSink();
+
+  void Flush() override;
+
+  // Copies the file to the descriptor within the kernel, where possible.
+  void WriteFile(int descriptor, std::uint64_t offset,
+                 std::uint64_t size) override;
+
+protected:
+  void Overflow(const char* data, std::size_t size) override;
+
+private:
+  // Writes out the buffer followed by the given data.
+  void Drain(const char* data, std::size_t size);
+
+  int myDescriptor;
+  char* myStorage;
+};
+
+// Writes to a std::ostream.
+class StreamSink : public OutputSink
+{
+public:
+  StreamSink(std::ostream* output, std::size_t highWaterMark = 64 * 1024);
+  ~StreamSink();
+
+  void Flush() override;
+
+protected:
+  void Overflow(const char* data, std::size_t size) override;
+
+private:
+  std::ostream& myOutput;
+  char* myStorage;
+};
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,112 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Statistics
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "statistics.hpp"
+
+#include <cstring>
+
+static Statistics* currentStatistics = nullptr;
+
+static std::uint64_t microseconds(std::chrono::nanoseconds duration)
+{
+  return static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+std::uint64_t Statistics::Route::Percentile(double fraction) const
+{
+  const double wanted = fraction * static_cast<double>(count);
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < bucketCount; ++i)
+  {
+    seen += buckets[i];
+    if (buckets[i] > 0 && static_cast<double>(seen) >= wanted)
+    {
+      // None of them took longer than the slowest one.
+      const std::uint64_t bound = std::uint64_t(1) << i;
+      return i + 1 < bucketCount && bound < maximumMicroseconds ?
+        bound : maximumMicroseconds;
+    }
+  }
+  return maximumMicroseconds;
+}
+
+Statistics::Statistics()
+: myStart(std::chrono::steady_clock::now()),
+  myPrevious(currentStatistics)
+{
+  currentStatistics = this;
+}
+
+Statistics::~Statistics()
+{
+  currentStatistics = myPrevious;
+}
+
+Statistics* Statistics::Current()
+{
+  return currentStatistics;
+}
+
+void Statistics::Record(const std::string& name,
+                        std::chrono::nanoseconds duration,
+                        const RequestContext::Timings& stages)
+{
+  const std::uint64_t elapsed = microseconds(duration);
+  std::size_t bucket = 0;
+  while (bucket + 1 < bucketCount && elapsed >= std::uint64_t(1) << bucket)
+  {
+    ++bucket;
+  }
+
+  std::lock_guard<std::mutex> lock(myMutex);
+  auto found = myRoutes.find(name);
+  if (found == myRoutes.end())
+  {
+    Route route = {};
+    route.name = name;
+    found = myRoutes.emplace(name, std::move(route)).first;
+  }
+
+  Route& route = found->second;
+  ++route.count;
+  route.totalMicroseconds += elapsed;
+  if (elapsed > route.maximumMicroseconds) route.maximumMicroseconds = elapsed;
+  ++route.buckets[bucket];
+
+  for (auto timing = std::begin(stages); timing != std::end(stages); ++timing)
+  {
+    auto stage = std::begin(route.stages);
+    while (stage != std::end(route.stages) &&
+           std::strcmp(stage->name, timing->first) != 0)
+    {
+      ++stage;
+    }
+    if (stage == std::end(route.stages))
+    {
+      const Stage added = { timing->first, 0, 0 };
+      stage = route.stages.insert(stage, added);
+    }
+    ++stage->count;
+    stage->totalMicroseconds += microseconds(timing->second);
+  }
+}
+
+std::vector<Statistics::Route> Statistics::Routes() const
+{
+  std::vector<Route> routes;
+  std::lock_guard<std::mutex> lock(myMutex);
+  routes.reserve(myRoutes.size());
+  for (auto route = std::begin(myRoutes); route != std::end(myRoutes); ++route)
+  {
+    routes.push_back(route->second);
+  }
+  return routes;
+}
+
+//===--------------------------- End of the file --------------------------===//
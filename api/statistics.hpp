@@ -0,0 +1,102 @@
+#ifndef STATISTICS_HPP_
+#define STATISTICS_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : Statistics
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Collects how long the requests for each route took, as a histogram, along
+// with the total time spent in each stage of them, for as long as the
+// process runs.
+//
+// The histogram has a bucket for each power of two microseconds, so it is the
+// same size whatever the number of requests.
+//
+// Usage:
+// {
+//   Statistics statistics;
+//   ...
+//   Statistics::Current()->Record("/api/repos/{repo}", context.Elapsed(),
+//                                 context.StageTimings());
+//   ...
+//   std::vector<Statistics::Route> routes = statistics.Routes();
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include "request.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Statistics
+{
+public:
+  // The requests which took less than 2^i microseconds, and not less than
+  // 2^(i-1), are counted by bucket i. The last bucket has the rest.
+  static const std::size_t bucketCount = 32;
+
+  struct Stage
+  {
+    const char* name;
+    std::uint64_t count;
+    std::uint64_t totalMicroseconds;
+  };
+
+  struct Route
+  {
+    std::string name;
+    std::uint64_t count;
+    std::uint64_t totalMicroseconds;
+    std::uint64_t maximumMicroseconds;
+    std::uint64_t buckets[bucketCount];
+    std::vector<Stage> stages;
+
+    // Returns the upper bound, in microseconds, of the bucket which holds the
+    // request that took longer than the given fraction (0 to 1) of them, or
+    // the longest time taken if that is less.
+    std::uint64_t Percentile(double fraction) const;
+  };
+
+  // Makes this the current instance until it is destroyed.
+  Statistics();
+  ~Statistics();
+
+  // Returns the instance in use or null if there is none.
+  static Statistics* Current();
+
+  // Adds a request for the route which took the given duration, with the time
+  // taken by each of its stages.
+  void Record(const std::string& route, std::chrono::nanoseconds duration,
+              const RequestContext::Timings& stages);
+
+  // Returns a copy of the statistics of each route, ordered by name.
+  std::vector<Route> Routes() const;
+
+  // The time since this was created.
+  std::chrono::steady_clock::duration Uptime() const
+  {
+    return std::chrono::steady_clock::now() - myStart;
+  }
+
+private:
+  Statistics(const Statistics&); /* = delete; */
+  Statistics& operator =(const Statistics&); /* = delete; */
+
+  mutable std::mutex myMutex;
+  std::map<std::string, Route> myRoutes;
+  std::chrono::steady_clock::time_point myStart;
+
+  // The instance that was current when this one was created, if any.
+  Statistics* myPrevious;
+};
+
+//===--------------------------- End of the file --------------------------===//
+#endif
@@ -0,0 +1,192 @@
+//===----------------------------------------------------------------------===//
+//
+// NAME         : ThreadPool
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+//
+//===----------------------------------------------------------------------===//
+
+#include "threadpool.hpp"
+
+#include <chrono>
+
+static ThreadPool* currentPool = nullptr;
+
+// The pool the calling thread belongs to and its index within it, if any.
+static thread_local ThreadPool* workerPool = nullptr;
+static thread_local std::size_t workerIndex = 0;
+
+ThreadPool::ThreadPool(std::size_t threads)
+: myThreadCount(threads),
+  myQueued(0),
+  myCompleted(0),
+  myWaiting(0),
+  isStopping(false),
+  myPrevious(currentPool)
+{
+  if (myThreadCount == 0)
+  {
+    myThreadCount = std::thread::hardware_concurrency();
+    if (myThreadCount == 0) myThreadCount = 1;
+  }
+
+  for (std::size_t i = 0; i < myThreadCount; ++i)
+  {
+    myWorkers.emplace_back(new Worker);
+  }
+
+  currentPool = this;
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    isStopping = true;
+  }
+  myWakeUp.notify_all();
+
+  for (auto worker = std::begin(myWorkers); worker != std::end(myWorkers);
+       ++worker)
+  {
+    if ((*worker)->thread.joinable()) (*worker)->thread.join();
+  }
+
+  currentPool = myPrevious;
+}
+
+ThreadPool* ThreadPool::Current()
+{
+  return currentPool;
+}
+
+void ThreadPool::Start()
+{
+  for (std::size_t i = 0; i < myThreadCount; ++i)
+  {
+    myWorkers[i]->thread = std::thread(&ThreadPool::Work, this, i);
+  }
+}
+
+void ThreadPool::Submit(Task task)
+{
+  std::call_once(myStarted, &ThreadPool::Start, this);
+
+  if (workerPool == this)
+  {
+    Worker& worker = *myWorkers[workerIndex];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+  else
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    myQueue.push_back(std::move(task));
+  }
+
+  ++myQueued;
+
+  // Taking the lock means a worker is either yet to check for tasks or is
+  // already waiting, so the notification can't be missed.
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+  }
+  myWakeUp.notify_one();
+}
+
+bool ThreadPool::RunOne()
+{
+  Task task;
+  if (!Take(workerPool == this ? workerIndex : myThreadCount, &task))
+  {
+    return false;
+  }
+
+  task();
+
+  ++myCompleted;
+  if (myWaiting > 0)
+  {
+    {
+      std::lock_guard<std::mutex> lock(myMutex);
+    }
+    myProgress.notify_all();
+  }
+  return true;
+}
+
+bool ThreadPool::Take(std::size_t index, Task* task)
+{
+  if (myQueued == 0) return false;
+
+  // The most recently submitted task of its own.
+  if (index < myThreadCount)
+  {
+    Worker& worker = *myWorkers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty())
+    {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      --myQueued;
+      return true;
+    }
+  }
+
+  // The oldest task submitted from outside of the pool.
+  {
+    std::lock_guard<std::mutex> lock(myMutex);
+    if (!myQueue.empty())
+    {
+      *task = std::move(myQueue.front());
+      myQueue.pop_front();
+      --myQueued;
+      return true;
+    }
+  }
+
+  // The oldest task of another worker.
+  for (std::size_t i = 1; i <= myThreadCount; ++i)
+  {
+    Worker& victim = *myWorkers[(index + i) % myThreadCount];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty())
+    {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --myQueued;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::Work(std::size_t index)
+{
+  workerPool = this;
+  workerIndex = index;
+
+  for (;;)
+  {
+    if (RunOne()) continue;
+
+    std::unique_lock<std::mutex> lock(myMutex);
+    myWakeUp.wait(lock, [this]{ return isStopping || myQueued > 0; });
+    if (isStopping && myQueued == 0) return;
+  }
+}
+
+void ThreadPool::WaitForProgress(std::size_t completed)
+{
+  std::unique_lock<std::mutex> lock(myMutex);
+  ++myWaiting;
+
+  // The timeout covers a task that is submitted to another worker while
+  // waiting, which does not count as progress but could be run here.
+  myProgress.wait_for(lock, std::chrono::milliseconds(1),
+                      [this, completed]{ return myCompleted != completed; });
+  --myWaiting;
+}
+
+//===--------------------------- End of the file --------------------------===//
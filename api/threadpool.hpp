@@ -0,0 +1,133 @@
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+//===----------------------------------------------------------------------===//
+//
+// NAME         : ThreadPool
+// COPYRIGHT    : (c) 2013 Sean Donnellan. All Rights Reserved.
+// LICENSE      : The MIT License (see LICENSE.txt for details)
+// DESCRIPTION  :
+//
+// Runs tasks on a fixed set of threads.
+//
+// Each thread has its own queue of tasks. A task submitted by a task goes on
+// the queue of the thread running it and is taken from the back, so the work
+// stays depth-first and local to that thread. A thread that runs out of tasks
+// steals them from the front of the other queues, which is where the larger
+// pieces of work (those submitted first) are.
+//
+// The threads are only started when the first task is submitted, so a pool
+// which is never used costs nothing.
+//
+// Usage:
+// {
+//   ThreadPool pool(4);
+//   std::atomic<int> remaining(2);
+//   pool.Submit([&remaining]{ ...; --remaining; });
+//   pool.Submit([&remaining]{ ...; --remaining; });
+//
+//   // The calling thread helps with the tasks while it waits.
+//   pool.RunUntil([&remaining]{ return remaining == 0; });
+// }
+//
+//===----------------------------------------------------------------------===//
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  typedef std::function<void()> Task;
+
+  // Makes this the current pool until it is destroyed. If threads is zero
+  // then there is a thread for each processor.
+  ThreadPool(std::size_t threads = 0);
+
+  // Waits for the tasks that have been submitted to finish.
+  ~ThreadPool();
+
+  // Returns the pool in use or null if there is none.
+  static ThreadPool* Current();
+
+  // The number of threads in the pool.
+  std::size_t Size() const { return myThreadCount; }
+
+  // Queues the task to be run on one of the threads. The task must not throw
+  // an exception.
+  void Submit(Task task);
+
+  // Runs one of the queued tasks on the calling thread.
+  //
+  // Returns false if there were no tasks queued.
+  bool RunOne();
+
+  // Runs queued tasks on the calling thread until isDone() returns true,
+  // waiting for the other threads to make progress when there are none.
+  template<typename Predicate>
+  void RunUntil(Predicate isDone);
+
+private:
+  ThreadPool(const ThreadPool&); /* = delete; */
+  ThreadPool& operator =(const ThreadPool&); /* = delete; */
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  void Start();
+  void Work(std::size_t index);
+
+  // Takes the next task for the worker with the given index, which is the
+  // number of workers for threads outside of the pool.
+  bool Take(std::size_t index, Task* task);
+
+  // Waits until a task has finished since completed was read.
+  void WaitForProgress(std::size_t completed);
+
+  std::size_t myThreadCount;
+  std::vector<std::unique_ptr<Worker>> myWorkers;
+  std::once_flag myStarted;
+
+  // Tasks submitted from threads that are not part of the pool.
+  std::deque<Task> myQueue;
+
+  // The number of tasks that are queued but not yet taken.
+  std::atomic<std::size_t> myQueued;
+
+  // The number of tasks that have finished and the number of threads which
+  // are waiting for that to change.
+  std::atomic<std::size_t> myCompleted;
+  std::atomic<std::size_t> myWaiting;
+
+  bool isStopping;
+  std::mutex myMutex;
+  std::condition_variable myWakeUp;
+  std::condition_variable myProgress;
+
+  // The pool that was current when this one was created, if any.
+  ThreadPool* myPrevious;
+};
+
+template<typename Predicate>
+void ThreadPool::RunUntil(Predicate isDone)
+{
+  for (;;)
+  {
+    const std::size_t completed = myCompleted;
+    if (isDone()) return;
+    if (!RunOne()) WaitForProgress(completed);
+  }
+}
+
+//===--------------------------- End of the file --------------------------===//
+#endif